@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define ARENA_MIN_CHUNK (64 * 1024)
+#define ARENA_MAX_CHUNK (4 * 1024 * 1024) // chunks stop doubling here
+#define ARENA_ALIGN 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size; // usable bytes in data
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[]; // the header alone would leave it 8-byte aligned
+} ArenaChunk;
+
+// Bump allocator for everything that lives exactly as long as one parse.
+// Allocations never move; arena_reset() rewinds to the first chunk and keeps
+// every chunk for reuse, so a warmed-up arena stops calling malloc.
+typedef struct {
+    ArenaChunk* first;
+    ArenaChunk* current;
+} Arena;
+
+void init_arena(Arena*);
+void* arena_alloc(Arena*, size_t);
+void* arena_calloc(Arena*, size_t, size_t);
+char* arena_strdup(Arena*, const char*);
+void arena_reset(Arena*);
+void free_arena(Arena*);
+
+#endif
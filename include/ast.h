@@ -0,0 +1,81 @@
+#ifndef AST_H
+#define AST_H
+
+#include "atom.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+struct Parser;
+
+typedef uint32_t AstNode; // index into the node arrays
+#define AST_NONE 0 // no node; index 0 of the arrays is unused
+#define AST_WIDE 0x80000000u // AST_CONSTANT payload flag: the rest indexes ast.wide
+
+typedef enum {
+    AST_BLOCK,     // children: the declarations and statements of begin..end
+    AST_VARIABLE,  // payload: declared name
+    AST_FUNCTION,  // payload: name; children: optional AST_PARAMETER, AST_BLOCK
+    AST_PARAMETER, // payload: name
+    AST_READ,      // payload: variable
+    AST_WRITE,     // payload: variable
+    AST_ASSIGN,    // payload: target; child: the expression
+    AST_IF,        // children: AST_COMPARE, AST_SEQUENCE, optional else AST_SEQUENCE
+    AST_SEQUENCE,  // children: the statements of a then or else branch
+    AST_COMPARE,   // payload: TokenType of the operator; children: two expressions
+    AST_SUBTRACT,  // children: two expressions
+    AST_MULTIPLY,  // children: two expressions
+    AST_REFERENCE, // payload: variable
+    AST_CONSTANT,  // payload: value, see ast_constant_value()
+    AST_CALL,      // payload: function; child: the argument
+} AstKind;
+
+typedef struct {
+    uint32_t depth; // pending nodes below the open node's children
+    uint32_t payload;
+} AstMark;
+
+// Syntax tree of the last parse, kept when ast.enabled is set before program().
+// Nodes are stored as parallel arrays in the parser arena and live until the
+// next parser_reset(). Children come before their parent, so the tree is laid
+// out in post-order with root last.
+typedef struct {
+    bool enabled;
+    AstNode root; // outermost block, AST_NONE if not built or the input had errors
+
+    uint8_t* kind; // AstKind
+    uint32_t* payload; // atom, constant or operator, see AstKind
+    AstNode* first_child;
+    AstNode* next_sibling;
+    size_t count; // nodes + 1, for the unused index 0
+    size_t capacity;
+
+    uint64_t* wide; // constants too large for a payload
+    size_t wide_count;
+    size_t wide_capacity;
+
+    AstNode* pending; // finished nodes not attached to a parent yet
+    size_t pending_count;
+    size_t pending_capacity;
+    AstMark* marks; // nodes whose children are being parsed, innermost last
+    size_t mark_count;
+    size_t mark_capacity;
+} Ast;
+
+// Builder calls made by both parser engines; they do nothing unless the tree
+// is enabled and the input has been error-free so far.
+bool start_ast(struct Parser*);
+void ast_leaf(struct Parser*, AstKind, uint32_t);
+void ast_constant(struct Parser*, Atom);
+void ast_open(struct Parser*, uint32_t);
+void ast_close(struct Parser*, AstKind);
+void ast_binary(struct Parser*, AstKind, uint32_t);
+void finish_ast(struct Parser*);
+void reset_ast(Ast*);
+uint64_t ast_constant_value(const Ast*, AstNode);
+
+const char* ast_kind_name(AstKind);
+bool print_ast(struct Parser*, FILE*);
+
+#endif
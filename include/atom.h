@@ -0,0 +1,35 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint32_t Atom; // interned identifier or constant, compared as an integer
+
+#define ATOM_NONE 0 // tokens without a value (keywords, operators, EOLN)
+
+typedef struct {
+    char* pool; // NUL-terminated names stored back to back
+    size_t pool_len;
+    size_t pool_capacity;
+
+    size_t* offsets; // atom -> offset of its name in pool
+    uint32_t* lengths; // atom -> length of its name
+    uint32_t* hashes; // atom -> hash of its name, kept for rehashing
+    uint32_t count;
+    uint32_t capacity;
+
+    uint32_t* index; // open-addressing hash of names -> atom, 0 marks an empty slot
+    size_t index_size;
+} AtomTable;
+
+bool init_atom_table(AtomTable*);
+void free_atom_table(AtomTable*);
+void reset_atom_table(AtomTable*);
+Atom intern_atom(AtomTable*, const char*, size_t);
+Atom find_atom(const AtomTable*, const char*, size_t);
+const char* atom_name(const AtomTable*, Atom);
+uint32_t atom_length(const AtomTable*, Atom);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "parser.h"
+#include "cache.h"
+
+typedef struct {
+    int jobs; // worker threads
+    ParserEngine engine;
+    DydScanner scanner;
+    bool collect_errors;
+    size_t max_errors;
+    bool emit_dyd; // also write the token stream of .mini inputs as .dyd
+    const ParseCache* cache; // results of unchanged inputs, or NULL
+} BatchOptions;
+
+size_t parse_batch(char* const*, size_t, const BatchOptions*, bool*);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+struct Parser;
+struct IrProgram;
+
+// Instructions of the stack machine in vm.c, each followed by its operands.
+#define BYTECODE_OPS(X)                                                     \
+    X(HALT, 0)                                                              \
+    X(CONST, 1)       /* value: push value */                               \
+    X(CONST_WIDE, 2)  /* low high: push a value outside 32 bits */          \
+    X(LOAD, 1)        /* slot: push a slot of the current frame */          \
+    X(STORE, 1)       /* slot: pop into a slot of the current frame */      \
+    X(LOAD_OUTER, 2)  /* hops slot: push a slot of an enclosing frame */    \
+    X(STORE_OUTER, 2) /* hops slot: pop into a slot of an enclosing frame */\
+    X(SUBTRACT, 0)                                                          \
+    X(SUBTRACT_FROM, 0) /* the top value minus the one below it */          \
+    X(MULTIPLY, 0)                                                          \
+    X(SHIFT_LEFT, 1)  /* bits: shift the top value left */                  \
+    X(EQUAL, 0)       /* comparisons push 1 or 0 */                         \
+    X(NOT_EQUAL, 0)                                                         \
+    X(LESS, 0)                                                              \
+    X(LESS_EQUAL, 0)                                                        \
+    X(GREATER, 0)                                                           \
+    X(GREATER_EQUAL, 0)                                                     \
+    X(JUMP, 1)        /* target */                                          \
+    X(JUMP_FALSE, 1)  /* target: pop, jump if 0 */                          \
+    X(CALL, 2)        /* function hops: pop the argument, enter function */ \
+    X(RETURN, 0)      /* push slot 0 of the frame being left */             \
+    X(READ, 0)        /* push a value from the input */                     \
+    X(WRITE, 0)       /* pop a value to the output */
+
+typedef enum {
+#define BYTECODE_ENUM(name, operands) OP_##name,
+    BYTECODE_OPS(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+} Opcode;
+
+// Frames hold slot 0 for the return value, then one slot per variable
+// address from the procedure's faddr to its laddr (for the main program,
+// every address). Variables of nested functions leave unused slots. The
+// operand stack of the frame follows its slots.
+typedef struct {
+    uint32_t entry; // code offset of the first instruction
+    uint32_t frame_size; // slots, including the return value
+    uint32_t stack_size; // most operands on the stack at once
+    uint32_t level; // plev of the procedure
+    uint32_t parameter; // slot of the parameter, 0 if it has none
+} BytecodeFunction;
+
+typedef struct {
+    int32_t* code; // opcodes and operands; main starts at 0 and ends with HALT
+    size_t code_count;
+    size_t code_capacity;
+    BytecodeFunction* functions; // indexed like the procedure table
+    size_t function_count;
+    uint32_t main_frame_size;
+    uint32_t main_stack_size;
+} Bytecode;
+
+bool compile_bytecode(struct Parser*, Bytecode*, char*, size_t);
+bool compile_ir_bytecode(const struct IrProgram*, Bytecode*, char*, size_t);
+void free_bytecode(Bytecode*);
+void print_bytecode(const Bytecode*, FILE*);
+const char* opcode_name(Opcode);
+int opcode_operands(Opcode);
+
+#endif
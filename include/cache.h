@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "parser.h"
+
+// On-disk cache of parse results. An entry holds the .var, .pro and .err
+// output of one input and whether its parse succeeded, and is named after an
+// XXH64 hash of the input bytes seeded with CACHE_VERSION and the options
+// that change the output. Entries are written to a temporary file and renamed
+// into place, so parallel invocations only ever see whole entries. The total
+// size is kept in <dir>/usage under flock(); when it passes the limit, the
+// least recently used entries (by mtime, refreshed on hits) are removed.
+//
+// Entry file, integers little-endian:
+//   header  "MPC1", u32 result, u64 input bytes, u64 .var bytes,
+//           u64 .pro bytes, u64 .err bytes, u64 XXH64 of the outputs (48 bytes)
+//   data    the .var, .pro and .err contents back to back
+#define CACHE_MAGIC "MPC1"
+#define CACHE_VERSION 1 // bump whenever the output for some input changes
+#define CACHE_HEADER_SIZE 48
+#define CACHE_DEFAULT_LIMIT (256ull << 20)
+
+typedef struct {
+    char* dir;
+    uint64_t limit; // bytes of entries kept before eviction
+} ParseCache;
+
+// Options that change what a parse writes, and so are part of the key.
+typedef struct {
+    ParserEngine engine;
+    bool collect_errors;
+    size_t max_errors;
+} CacheOptions;
+
+typedef struct {
+    char entry[32]; // file name within the cache directory
+    uint64_t size; // of the input
+    struct timespec mtime; // of the input when it was hashed
+} CacheKey;
+
+bool cache_open(ParseCache*, const char*, uint64_t);
+void cache_close(ParseCache*);
+bool cache_key(const char*, const CacheOptions*, CacheKey*);
+bool cache_fetch(const ParseCache*, const CacheKey*, const char*, bool*);
+bool cache_store(const ParseCache*, const CacheKey*, const char*, Parser*, bool);
+uint64_t xxh64(const void*, size_t, uint64_t);
+
+#endif
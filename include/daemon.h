@@ -0,0 +1,57 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "parser.h"
+
+// Resident parse server. Each file is parsed once into a parser that is kept,
+// the directories holding them are watched with inotify, and a file is parsed
+// again when it is written or renamed into place. Queries come over a Unix
+// stream socket and are answered from the tables in memory.
+//
+// Frames, integers little-endian, a str being a u16 length and the bytes:
+//   request   u32 length, u8 opcode, arguments
+//   response  u32 length, u8 status, results
+// The length counts the bytes after it; requests are answered in order. A
+// file is its position in the daemon's file list.
+//
+//   opcode      arguments                 results
+//   FILES       -                         u32 count, each: str path, u8 result, u32 generation
+//   VARIABLE    u32 file, str name,       i32 vkind, vtype, vlev, vaddr
+//               str proc
+//   VARIABLES   u32 file, str proc        u32 count, each: str name, i32 vkind, vtype, vlev, vaddr
+//   PROCEDURES  u32 file                  u32 count, each: str name, i32 ptype, plev, faddr, laddr,
+//                                         line of the body's begin, line of its end (0 if unknown)
+//   DIAGNOSTICS u32 file                  u8 result, u32 count, each: i32 line, str message
+//
+// result is 1 if the last parse succeeded; generation counts the parses of a
+// file, so a client can tell that its answers changed.
+#define DAEMON_MAX_REQUEST 65536 // bytes after the length; a longer request closes the connection
+
+typedef enum {
+    DAEMON_FILES = 1,
+    DAEMON_VARIABLE,
+    DAEMON_VARIABLES,
+    DAEMON_PROCEDURES,
+    DAEMON_DIAGNOSTICS,
+} DaemonOpcode;
+
+typedef enum {
+    DAEMON_OK,
+    DAEMON_NOT_FOUND, // no such file, variable or procedure
+    DAEMON_BAD_REQUEST, // unknown opcode or malformed arguments
+} DaemonStatus;
+
+typedef struct {
+    ParserEngine engine;
+    DydScanner scanner;
+    bool collect_errors;
+    size_t max_errors;
+    int threads; // per parse, see parallel.h
+} DaemonOptions;
+
+int run_daemon(const char*, char* const*, size_t, const DaemonOptions*);
+
+#endif
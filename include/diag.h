@@ -0,0 +1,32 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct {
+    int line;
+    size_t offset; // start of the formatted "LINE:n message\n" in DiagnosticList.text
+    size_t length;
+    size_t message; // start of the message itself, after the "LINE:n " prefix
+} Diagnostic;
+
+// Diagnostics collected during a parse, formatted back to back so the whole
+// list can be written out with a single call.
+typedef struct {
+    Diagnostic* items;
+    size_t count;
+    size_t capacity;
+
+    char* text;
+    size_t text_len;
+    size_t text_capacity;
+} DiagnosticList;
+
+bool add_diagnostic(DiagnosticList*, int, const char*);
+void write_diagnostics(const DiagnosticList*, FILE*);
+void clear_diagnostics(DiagnosticList*);
+void free_diagnostics(DiagnosticList*);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef DYDB_H
+#define DYDB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Binary token stream, all integers little-endian:
+//
+//   header   "DYDB", u32 version, u64 token count, u64 value bytes,
+//            u64 pool bytes, u32 atom count, u32 reserved (40 bytes)
+//   types    one byte per token (TokenType)
+//   values   LEB128 varint atom IDs, one per IDENT/CONST token in order
+//   pool     the atoms' spellings, NUL-terminated, atom 1 first
+//
+// The format is compact rather than directly loadable: loading interns every
+// pool spelling into the parser's atom table and decodes each varint, one pass
+// over the file, instead of copying the token arrays as they are.
+#define DYDB_MAGIC "DYDB"
+#define DYDB_VERSION 1
+#define DYDB_HEADER_SIZE 40
+
+struct Parser;
+
+bool load_dydb(struct Parser*, const unsigned char*, size_t, char*, size_t);
+bool write_dydb_file(struct Parser*, const char*);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef DYDSCAN_H
+#define DYDSCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Loading of .dyd text ("value type" lines). The line breaks and the space
+// after each value are found 16 or 32 bytes at a time with SSE2 or AVX2 when
+// the CPU has them, and with memchr() otherwise; every scanner produces the
+// same tokens and errors.
+typedef enum {
+    DYD_SCAN_AUTO, // the best one the CPU supports
+    DYD_SCAN_SCALAR,
+    DYD_SCAN_SSE2,
+    DYD_SCAN_AVX2,
+} DydScanner;
+
+struct Parser;
+
+bool load_dyd(struct Parser*, const char*, size_t, char*, size_t);
+bool dyd_scanner_supported(DydScanner);
+DydScanner best_dyd_scanner(void);
+const char* dyd_scanner_name(DydScanner);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "parser.h"
+
+// Incremental reparsing for editors. After a parse without errors, an edit
+// inside a function body reparses only the innermost body that holds it: the
+// body's old variables are dropped, the new ones are spliced in, and vaddr,
+// faddr and laddr are brought up to date by renumber_symbols() once someone
+// reads the tables. Edits anywhere else, edits that change which procedures a
+// body declares, and parsers that build a syntax tree fall back to program().
+
+// Replaces the removed tokens starting at index first with count new ones and
+// parses again. Tokens are those of the loaded input, EOLNs included; new
+// IDENT and CONST values come from intern_atom() on parser->atoms.
+// Diagnostics are reported as by program(), but the tables are only delivered
+// again by output_to_file(). Returns false if the edit is out of range or the
+// program has errors after it.
+bool parser_edit(Parser*, size_t, size_t, const Token*, size_t);
+bool renumber_symbols(Parser*);
+
+void open_body_span(Parser*, ProcedureEntry*);
+void close_body_span(Parser*, ProcedureEntry*);
+void reset_edits(Parser*, bool);
+void free_edits(Parser*);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "atom.h"
+
+struct Parser;
+
+typedef uint32_t IrValue; // index into IrFunction.insts
+#define IR_NONE 0 // no value; index 0 of the instructions is unused
+
+// Variables that no nested function touches become SSA values; the others
+// stay in frame slots and are accessed with IR_LOAD and IR_STORE, where
+// hops counts static links like the bytecode does.
+typedef enum {
+    IR_NOP,         // removed
+    IR_ALIAS,       // replaced by a; operands are resolved through it
+    IR_CONST,       // imm
+    IR_PARAM,       // the argument of the function
+    IR_LOAD,        // hops, slot
+    IR_STORE,       // a into hops, slot
+    IR_SUBTRACT,    // a - b
+    IR_MULTIPLY,    // a * b
+    IR_SHIFT_LEFT,  // a << imm
+    IR_COMPARE,     // a op b, op is the TokenType in imm
+    IR_CALL,        // function imm (procedure index) with argument a, hops
+    IR_READ,
+    IR_WRITE,       // a
+    IR_PHI,         // a from pred[0], b from pred[1]
+    IR_JUMP,        // to succ[0]
+    IR_BRANCH,      // to succ[0] if a, else succ[1]
+    IR_RETURN,      // a
+    IR_HALT,
+} IrOp;
+
+typedef struct {
+    uint8_t op; // IrOp
+    uint32_t block;
+    IrValue a;
+    IrValue b;
+    int64_t imm; // constant, slot, operator or procedure, see IrOp
+    int32_t hops;
+} IrInst;
+
+typedef struct {
+    IrValue* insts; // phis first, terminator last
+    size_t count;
+    size_t capacity;
+    uint32_t succ[2];
+    uint32_t succ_count;
+    uint32_t pred[2]; // blocks join at most two paths
+    uint32_t pred_count;
+    bool dead; // unreachable, left out of every walk
+} IrBlock;
+
+typedef struct {
+    Atom name;
+    int level; // plev, 0 for the main program
+    int procedure; // index in the procedure table, -1 for the main program
+    uint32_t frame_size; // variable slots, including the return value
+    uint32_t parameter; // slot of the parameter, 0 if it has none
+    bool uses_frame; // some variable lives in a frame slot, loaded and stored
+
+    IrInst* insts;
+    size_t inst_count; // instructions + 1, for the unused index 0
+    size_t inst_capacity;
+    IrBlock* blocks; // block 0 is the entry
+    size_t block_count;
+    size_t block_capacity;
+    bool failed; // an allocation failed; the function is incomplete
+} IrFunction;
+
+typedef struct IrProgram {
+    struct Parser* parser; // symbol names for printing
+    IrFunction* functions; // the main program, then procedures in table order
+    size_t function_count;
+} IrProgram;
+
+#define IR_PASS_COUNT 4 // inline, fold, strength, dce
+
+bool build_ir(struct Parser*, IrProgram*, char*, size_t);
+void free_ir(IrProgram*);
+void print_ir(const IrProgram*, FILE*);
+
+// Pass manager: runs the passes whose enabled entry is set, in pipeline
+// order, and reports the time of each to timing unless it is NULL.
+const char* ir_pass_name(int);
+int find_ir_pass(const char*);
+bool run_ir_passes(IrProgram*, const bool*, FILE*);
+
+// Helpers shared by the builder, the passes and the bytecode lowering.
+IrValue ir_add(IrFunction*, uint32_t, IrOp, IrValue, IrValue, int64_t);
+IrValue ir_resolve(IrFunction*, IrValue);
+uint32_t ir_add_block(IrFunction*);
+bool ir_append(IrFunction*, uint32_t, IrValue);
+void ir_link(IrFunction*, uint32_t, uint32_t);
+void ir_remove_pred(IrFunction*, uint32_t, uint32_t);
+void ir_cleanup(IrFunction*);
+size_t ir_block_order(const IrFunction*, uint32_t*);
+bool ir_has_result(IrOp);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct Parser;
+
+bool lex_source(struct Parser*, const char*, size_t, int*, char*, size_t);
+bool is_mini_file(const char*);
+bool write_dyd_file(struct Parser*, const char*);
+bool write_dyd_tokens(struct Parser*, const char*);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef LLPARSER_H
+#define LLPARSER_H
+
+struct Parser;
+
+void table_block(struct Parser*);
+void table_declaration(struct Parser*);
+void table_execution(struct Parser*);
+void table_expression(struct Parser*);
+
+#endif
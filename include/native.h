@@ -0,0 +1,19 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+struct IrProgram;
+
+// Writes the program as x86-64 System V assembly in AT&T syntax. The main
+// program becomes mini_main, which the runtime of build_native_executable()
+// calls; read and write go through mini_read and mini_write.
+bool emit_native_assembly(const struct IrProgram*, FILE*, char*, size_t);
+
+// Assembles and links the program with its runtime into an executable,
+// using the C compiler named by $CC, or cc.
+bool build_native_executable(const struct IrProgram*, const char*, char*, size_t);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "parser.h"
+
+// Parallel parsing of the functions main declares. When program() runs with
+// threads > 1, a scan of the tokens finds each top-level function body, and
+// worker threads parse the bodies into private tables while the main parse
+// runs as usual. When the main parse reaches one of those bodies it takes the
+// worker's entries instead of parsing it, provided the body parsed without
+// errors, every name it used from outside resolves the same way in the main
+// tables, and nothing before it had an error. Otherwise it parses the body
+// itself, so the tables and diagnostics are always those of a sequential parse.
+
+// Names a body looked up outside itself while parsed apart from main; the
+// lookups answer as if they were found and are checked before adoption.
+typedef struct OutsideLookups {
+    Atom* variables; // looked up in main's scope
+    size_t variable_count;
+    size_t variable_capacity;
+    Atom* procedures; // called but not declared in the body
+    size_t procedure_count;
+    size_t procedure_capacity;
+    bool failed; // out of memory, the body is parsed again by the main parse
+    VariableEntry variable; // what the lookups return
+    ProcedureEntry procedure;
+} OutsideLookups;
+
+bool start_parallel(Parser*);
+void finish_parallel(Parser*);
+bool adopt_parallel_body(Parser*, ProcedureEntry*);
+
+VariableEntry* outside_variable(Parser*, Atom);
+ProcedureEntry* outside_procedure(Parser*, Atom);
+
+#endif
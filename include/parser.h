@@ -1,53 +1,184 @@
 #ifndef PARSER_H
 #define PARSER_H
 #include "token.h"
+#include "atom.h"
 #include "table.h"
+#include "diag.h"
+#include "arena.h"
+#include "ast.h"
+#include "stats.h"
+#include "dydscan.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#define MAX_TOKENS 1024
+#include <setjmp.h>
+
+#define DEFAULT_MAX_ERRORS 100
+#define RECURSIVE_MAX_DEPTH 1000 // nesting the recursive engine leaves to the table engine, see table_execution()
 
 typedef struct {
     TokenType type;
-    char value[16];
+    Atom value; // interned spelling of IDENT and CONST tokens, ATOM_NONE otherwise
 } Token;
 
+// Position in the input tokens, which are the stored tokens with the line
+// breaks put back as EOLN tokens.
+typedef struct {
+    size_t token;
+    size_t line_break;
+} TokenCursor;
+
+typedef enum {
+    SCAN_OK,
+    SCAN_BAD_FORMAT,
+    SCAN_NO_MEMORY,
+} ScanResult;
+
+typedef enum {
+    INPUT_UNKNOWN,
+    INPUT_DYD,  // "value type" text lines
+    INPUT_DYDB, // binary tokens, see dydb.h
+    INPUT_MINI, // source, tokenized by the built-in lexer
+} InputFormat;
+
+struct TokenStream;
+
+// The recursive engine is the default: it is faster. The table engine has no
+// nesting limit from the C stack, and the recursive one passes it whatever is
+// nested more than RECURSIVE_MAX_DEPTH levels deep.
+typedef enum {
+    ENGINE_TABLE, // LL(1) predict table and an explicit stack, see llparser.c
+    ENGINE_RECURSIVE, // the recursive-descent functions below
+} ParserEngine;
+
+// Receivers for the results of a parse, used instead of the .var/.pro/.err
+// files when a parser is created from a buffer. Any callback may be NULL.
+typedef struct {
+    void* context; // passed back to every callback
+    void (*procedure)(void* context, const ProcedureEntry* entry, const char* name);
+    void (*variable)(void* context, const VariableEntry* entry, const char* name, const char* proc);
+    void (*diagnostic)(void* context, int line, const char* message);
+} ParserSinks;
+
+// State kept between parser_edit() calls, see incremental.c.
+typedef struct {
+    bool valid; // the procedure spans describe the tokens: the last parse had no errors
+    size_t error_proc; // position + 1 of the procedure whose reparse left the diagnostics
+    bool keyed; // order keys were assigned since the last full parse
+    bool dirty; // vaddr, faddr and laddr are stale until renumber_symbols()
+    uint64_t* var_keys; // order key of each variable position
+    size_t var_key_capacity;
+    uint64_t* proc_keys; // key of the start and of the end of each procedure
+    size_t proc_key_capacity;
+    size_t sorted; // variable positions below this one are in key order
+
+    // only while a body is reparsed: what is declared after it stays hidden
+    uint64_t hide_from; // variables with this key or a larger one...
+    size_t hide_below; // ...at positions below this one
+    size_t hidden_procs; // procedure positions [hidden_procs, hidden_procs_end)
+    size_t hidden_procs_end;
+} EditState;
+
 typedef struct Parser{
-    Token* tokens;
+    AtomTable atoms;
+    struct TokenStream* stream; // token source of a push parser, NULL otherwise
+
+    // tokens other than EOLN, as parallel arrays
+    uint8_t* token_types; // TokenType of each token
+    Atom* token_values; // interned spelling of IDENT and CONST tokens, ATOM_NONE otherwise
     size_t token_count;
+    size_t token_capacity;
     size_t token_index;
     Token current_token;
+    size_t token_gap; // tokens from this index on are stored token_gap_size slots later
+    size_t token_gap_size; // 0 except after parser_edit(), see close_token_gap()
 
-    VariableEntry* vartab;
+    // the EOLNs: for each one, the index of the token that follows it, so
+    // the values are sorted and the parser reads an EOLN where one matches
+    uint32_t* line_breaks;
+    size_t line_break_count;
+    size_t line_break_capacity;
+    size_t line_index; // next line break to read
+    size_t line_break_gap; // line breaks from this one on are stored line_break_gap_size slots later
+    size_t line_break_gap_size; // and counted back from token_count; 0 except after parser_edit()
+
+    Arena arena; // symbol tables, indexes and scopes of the current parse
+
+    void** var_chunks; // VariableEntry[TABLE_CHUNK_SIZE] each, so entries never move
+    size_t var_chunk_slots; // length of var_chunks
     size_t var_count;
-    size_t var_capacity;
+    size_t var_capacity; // entries in the allocated chunks
+    uint32_t* var_index; // open-addressing hash of (vproc, vname) -> variable position + 1
+    size_t var_index_size;
 
-    ProcedureEntry* proctab;
+    void** proc_chunks; // ProcedureEntry[TABLE_CHUNK_SIZE] each
+    size_t proc_chunk_slots;
     size_t proc_count;
     size_t proc_capacity;
+    uint32_t* proc_index; // open-addressing hash of pname -> procedure position + 1
+    size_t proc_index_size;
 
-    int current_level;
-    char current_proc[16];
+    Scope* scopes; // enclosing procedure scopes, innermost last
+    size_t scope_count;
+    size_t scope_capacity;
+    int current_level; // level of the innermost scope
+    Atom current_proc; // procedure of the innermost scope
     int has_error;
 
+    ParserEngine engine;
+    size_t depth; // functions, statements and expressions the recursive engine is inside
+    DydScanner scanner; // reads .dyd input, DYD_SCAN_AUTO for the best the CPU has
+    bool collect_errors; // record diagnostics and recover instead of exiting on the first one
+    size_t max_errors; // collected diagnostics after which parsing stops
+    bool panic; // an error was reported and the parser has not resynchronized yet
+    bool aborted; // max_errors was reached, the rest of the input reads as EOF
+    DiagnosticList diagnostics;
+    Ast ast; // syntax tree, built when ast.enabled is set
+
     FILE* var;
     FILE* pro;
     FILE* err;
+    ParserSinks sinks;
+    jmp_buf* abort_jump; // where parser_error() unwinds to when not collecting errors
 
     int line_number;
+    EditState edit;
+    ParserStats stats;
+
+    int threads; // threads that parse top-level function bodies, see parallel.h; 0 or 1 for none
+    struct ParallelParse* parallel; // while program() runs on more than one thread
+    struct OutsideLookups* outside; // set in the parsers of those threads only
 } Parser;
 
 void parser_error(Parser*, const char*);
 bool is_valid_identifier(const char*);
 Parser* create_parser(const char*);
+Parser* create_push_parser(const char*);
+Parser* create_buffer_parser(const char*, size_t, const ParserSinks*);
+bool parser_load_file(Parser*, const char*);
+bool parser_load_tokens(Parser*, const char*);
+bool parser_reset(Parser*);
+bool parser_rewind(Parser*);
+bool parser_feed(Parser*, const char*, size_t);
+bool parser_finish(Parser*);
 void destroy_parser(Parser*);
 void print_tokens(Parser*);
+ScanResult scan_token_line(AtomTable*, const char*, const char*, Token*);
+bool append_token(Parser*, TokenType, Atom);
+bool reserve_tokens(Parser*, size_t, size_t);
+void close_token_gap(Parser*);
+size_t input_token_count(Parser*);
+bool next_input_token(Parser*, TokenCursor*, Token*);
+uint32_t line_break(Parser*, size_t);
+int token_line(Parser*, size_t);
 void next_token(Parser*);
 TokenType current_token_type(Parser*);
 TokenType peek_token_type(Parser*);
 void consume_eoln(Parser*);
+void synchronize(Parser*);
 bool match(Parser*, TokenType);
 bool program(Parser*);
 void block(Parser*);
@@ -76,5 +207,6 @@ void parameter_list(Parser*);
 void conditional_expression(Parser*);
 void relation_operator(Parser*);
 void output_to_file(Parser* p);
+void report_diagnostics(Parser*);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+struct Parser;
+
+// Where a parse spent its time and how hard the symbol tables worked, since
+// the parser was created or last reset. Counted only in builds with
+// MINIPARSER_STATS (the CMake option of the same name); otherwise the STAT_
+// macros expand to nothing and every field stays 0.
+typedef struct {
+    double load_ms; // reading and tokenizing the input in create_parser()
+    double parse_ms; // program(), without the output_to_file() it ends with
+    double emit_ms; // output_to_file()
+
+    uint64_t variable_lookups; // find_variable() calls
+    uint64_t variable_probes; // index slots they scanned
+    uint64_t procedure_lookups; // find_procedure() calls
+    uint64_t procedure_probes;
+    uint64_t variable_chunks; // chunks added to the variable table
+    uint64_t procedure_chunks;
+    uint64_t variable_index_growths; // doublings of the variable hash index
+    uint64_t procedure_index_growths;
+    uint64_t parallel_bodies; // function bodies taken from other threads, see parallel.h
+
+    size_t peak_token_bytes;
+    size_t peak_table_bytes; // entries and indexes of both tables
+    size_t max_depth; // deepest recursion of the recursive engine, or parse stack of the table engine
+} ParserStats;
+
+#ifdef MINIPARSER_STATS
+#define STAT_ADD(parser, field, n) ((parser)->stats.field += (n))
+#define STAT_MAX(parser, field, value) \
+    ((value) > (parser)->stats.field ? (void)((parser)->stats.field = (value)) : (void)0)
+#define STAT_TIMER(name) double name = stats_now()
+#define STAT_ELAPSED(parser, field, name) ((parser)->stats.field += stats_now() - (name))
+#else
+#define STAT_ADD(parser, field, n) ((void)0)
+#define STAT_MAX(parser, field, value) ((void)0)
+#define STAT_TIMER(name)
+#define STAT_ELAPSED(parser, field, name) ((void)0)
+#endif
+
+double stats_now(void);
+void record_memory_stats(struct Parser*);
+bool print_stats(struct Parser*, FILE*, bool);
+
+#endif
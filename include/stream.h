@@ -0,0 +1,40 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "parser.h"
+#include <ucontext.h>
+
+#define STREAM_QUEUE_SIZE 256 // tokens scanned ahead before the parser is resumed
+#define STREAM_STACK_SIZE (8 * 1024 * 1024) // reserved, pages are committed on first use
+
+// Token source of a push parser. The recursive-descent functions run on their
+// own stack and are suspended inside next_token()/peek_token_type() whenever
+// the queue runs dry, so parser_feed() can return to the caller.
+typedef struct TokenStream {
+    struct Parser* parser;
+
+    char* text; // unfinished last line plus the bytes of the current chunk
+    size_t text_len;
+    size_t text_capacity;
+    size_t scan_pos; // start of the first line not tokenized yet
+
+    Token queue[STREAM_QUEUE_SIZE]; // tokens scanned but not yet consumed
+    size_t queue_head;
+    size_t queue_count;
+
+    ucontext_t caller;
+    ucontext_t context;
+    void* stack;
+    bool started;
+    bool failed; // malformed input or out of memory, the parse is abandoned
+    bool finished; // parser_finish() was called, no more input will arrive
+    bool done; // program() has returned
+    bool result;
+} TokenStream;
+
+TokenStream* create_token_stream(struct Parser*);
+void destroy_token_stream(TokenStream*);
+void stream_next_token(TokenStream*, Token*);
+TokenType stream_peek_token_type(TokenStream*);
+
+#endif
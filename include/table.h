@@ -3,13 +3,18 @@
 
 #include "token.h"
 #include "var.h"
+#include "atom.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TABLE_CHUNK_SIZE 256 // entries per symbol table chunk, a power of two
 
 // Forward declaration of Parser to avoid circular dependency
 struct Parser;
 
 typedef struct {
-    char vname[16]; // variable name
-    char vproc[16]; // procedure name
+    Atom vname; // variable name
+    Atom vproc; // procedure name
     int vkind; // 0 for variable, 1 for procedure
     VarType vtype; // type of the variable (e.g., int, float, etc.)
     int vlev; // level of the variable
@@ -17,18 +22,46 @@ typedef struct {
 } VariableEntry;
 
 typedef struct {
-    char pname[16];
+    Atom pname;
     VarType ptype; // type of the return value of procedure (e.g., int, void, etc.)
     int plev; // level of the procedure
     int faddr; // address of the first variable in the procedure
     int laddr; // address of the last variable in the procedure
+
+    // where the body was parsed from, for incremental reparsing (incremental.h)
+    int param; // position of the parameter's variable entry, -1 without one
+    int var_start; // positions of the variable entries of the body, [var_start, var_end)
+    int var_end;
+    size_t body_start; // stored token index of the 'begin'
+    size_t body_end; // stored token index after the body
 } ProcedureEntry;
 
-void add_variable(struct Parser*, const char*, VarType, int);
-void add_procedure(struct Parser*, const char*, int, int);
-void update_procedure(struct Parser*, const char*, int, int);
+// A procedure body being parsed. Its variables are the variable entries whose
+// vproc is the scope's procedure, found through the (vproc, vname) hash.
+typedef struct {
+    Atom proc;
+    int level;
+} Scope;
+
+bool enter_scope(struct Parser*, Atom);
+void exit_scope(struct Parser*);
+
+void add_variable(struct Parser*, Atom, VarType, int);
+ProcedureEntry* add_procedure(struct Parser*, Atom, int, int);
+bool append_variable(struct Parser*, const VariableEntry*);
+ProcedureEntry* append_procedure(struct Parser*, const ProcedureEntry*);
+void update_procedure(struct Parser*, Atom, int, int);
+void remove_variable(struct Parser*, size_t);
+void rebuild_variable_index(struct Parser*);
+void index_procedure(struct Parser*, size_t);
+void unindex_procedure(struct Parser*, size_t);
+
+bool init_tables(struct Parser*);
+VariableEntry* variable_at(struct Parser*, size_t);
+ProcedureEntry* procedure_at(struct Parser*, size_t);
 
-VariableEntry* find_variable(struct Parser*, const char*, const char*);
-ProcedureEntry* find_procedure(struct Parser*, const char*);
+VariableEntry* find_variable(struct Parser*, Atom, Atom);
+ProcedureEntry* find_procedure(struct Parser*, Atom);
+VariableEntry* resolve_variable(struct Parser*, Atom);
 
 #endif
\ No newline at end of file
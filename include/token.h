@@ -2,6 +2,7 @@
 #define TOKEN_H
 
 typedef enum {
+    TOKEN_INVALID, // a type number from the input that names no token; shown as "unknown"
     BEGIN = 1,
     END,
     INTEGER,
@@ -29,6 +30,11 @@ typedef enum {
     _EOF,
 } TokenType;
 
+// What the loaders store for a type number read from their input.
+static inline TokenType checked_token_type(int number) {
+    return number >= BEGIN && number <= _EOF ? (TokenType)number : TOKEN_INVALID;
+}
+
 const char* get_token_name(TokenType);
 
 #endif
\ No newline at end of file
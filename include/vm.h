@@ -0,0 +1,24 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "bytecode.h"
+
+#define VM_MAX_CALL_DEPTH (1 << 20) // nested calls before a program is stopped
+
+// Where read and write statements go. Either callback returns false to stop
+// the program, read at the end of the input.
+typedef struct {
+    void* context;
+    bool (*read)(void* context, int64_t* value);
+    bool (*write)(void* context, int64_t value);
+} VmIo;
+
+// Reads decimal numbers from stdin and writes one per line to stdout.
+extern const VmIo vm_stdio;
+
+bool run_bytecode(const Bytecode*, const VmIo*, char*, size_t);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#define WRITER_MAX_BLOCK (64 << 20) // larger output is written in blocks of this size
+
+// Output assembled in memory and handed to the file descriptor of a stdio
+// stream in large blocks, without format parsing. Callers reserve room,
+// fill it with the put_ helpers and advance past what they wrote.
+typedef struct {
+    int fd;
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed; // a write or an allocation failed; later output is dropped
+} Writer;
+
+bool writer_open(Writer*, FILE*, size_t);
+char* writer_reserve(Writer*, size_t);
+bool writer_close(Writer*);
+bool write_stream(FILE*, const char*, size_t);
+bool write_fd(int, const char*, size_t);
+
+static inline void writer_advance(Writer* w, char* end) {
+    w->length = (size_t)(end - w->data);
+}
+
+static inline char* put_bytes(char* out, const char* data, size_t length) {
+    memcpy(out, data, length);
+    return out + length;
+}
+
+// Writes value in decimal like "%d"; out needs room for 11 bytes.
+static inline char* put_int(char* out, int value) {
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    char digits[10];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+static inline size_t int_length(int value) {
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    size_t length = value < 0 ? 2 : 1;
+    while (magnitude >= 10) {
+        magnitude /= 10;
+        length++;
+    }
+    return length;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+void init_arena(Arena* arena) {
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+static ArenaChunk* new_chunk(size_t size) {
+    ArenaChunk* chunk = (ArenaChunk*)malloc(sizeof(ArenaChunk) + size);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+// Returns size bytes aligned to ARENA_ALIGN, or NULL if out of memory.
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaChunk* chunk = arena->current;
+    if (chunk && chunk->size - chunk->used >= size) {
+        void* p = chunk->data + chunk->used;
+        chunk->used += size;
+        return p;
+    }
+
+    // chunks kept by arena_reset(); one too small for this request is skipped
+    // until the next reset
+    while (chunk && chunk->next) {
+        chunk = chunk->next;
+        chunk->used = 0;
+        if (chunk->size >= size) {
+            arena->current = chunk;
+            chunk->used = size;
+            return chunk->data;
+        }
+    }
+
+    size_t chunk_size = chunk ? chunk->size * 2 : ARENA_MIN_CHUNK;
+    if (chunk_size > ARENA_MAX_CHUNK) chunk_size = ARENA_MAX_CHUNK;
+    if (chunk_size < size) chunk_size = size;
+    ArenaChunk* fresh = new_chunk(chunk_size);
+    if (!fresh) {
+        return NULL;
+    }
+    if (chunk) {
+        chunk->next = fresh;
+    }
+    else {
+        arena->first = fresh;
+    }
+    arena->current = fresh;
+    fresh->used = size;
+    return fresh->data;
+}
+
+void* arena_calloc(Arena* arena, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void* p = arena_alloc(arena, count * size);
+    if (p) {
+        memset(p, 0, count * size);
+    }
+    return p;
+}
+
+char* arena_strdup(Arena* arena, const char* s) {
+    size_t len = strlen(s) + 1;
+    char* copy = (char*)arena_alloc(arena, len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+// Invalidates every allocation; the chunks are kept for the next parse.
+void arena_reset(Arena* arena) {
+    arena->current = arena->first;
+    if (arena->current) {
+        arena->current->used = 0;
+    }
+}
+
+void free_arena(Arena* arena) {
+    ArenaChunk* chunk = arena->first;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    init_arena(arena);
+}
@@ -0,0 +1,297 @@
+#include <string.h>
+#include "parser.h"
+#include "ast.h"
+
+#define AST_STACK_SIZE 64 // initial pending and mark capacity
+#define AST_PRINT_MAX_INDENT 32 // deeper levels are printed at this indentation
+
+// Returns items with room for extra more elements, copied into a larger arena
+// block if needed, or NULL if out of memory.
+static void* reserve(Arena* arena, void* items, size_t count, size_t* capacity, size_t extra, size_t size) {
+    if (count + extra <= *capacity) {
+        return items;
+    }
+    size_t new_capacity = *capacity ? *capacity * 2 : AST_STACK_SIZE;
+    while (new_capacity < count + extra) {
+        new_capacity *= 2;
+    }
+    void* grown = arena_alloc(arena, new_capacity * size);
+    if (!grown) {
+        return NULL;
+    }
+    if (count > 0) {
+        memcpy(grown, items, count * size);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+static bool building(Parser* parser) {
+    return parser->ast.enabled && !parser->has_error && parser->ast.kind;
+}
+
+static void out_of_memory(Parser* parser) {
+    parser_error(parser, "Error: failed to grow syntax tree");
+}
+
+static bool grow_nodes(Parser* parser) {
+    Ast* ast = &parser->ast;
+    size_t capacity = ast->capacity;
+    uint8_t* kind = (uint8_t*)reserve(&parser->arena, ast->kind, ast->count, &capacity, 1, sizeof(uint8_t));
+    capacity = ast->capacity;
+    uint32_t* payload = (uint32_t*)reserve(&parser->arena, ast->payload, ast->count, &capacity, 1, sizeof(uint32_t));
+    capacity = ast->capacity;
+    AstNode* first_child = (AstNode*)reserve(&parser->arena, ast->first_child, ast->count, &capacity, 1, sizeof(AstNode));
+    capacity = ast->capacity;
+    AstNode* next_sibling = (AstNode*)reserve(&parser->arena, ast->next_sibling, ast->count, &capacity, 1, sizeof(AstNode));
+    if (!kind || !payload || !first_child || !next_sibling) {
+        return false;
+    }
+    ast->kind = kind;
+    ast->payload = payload;
+    ast->first_child = first_child;
+    ast->next_sibling = next_sibling;
+    ast->capacity = capacity;
+    return true;
+}
+
+static bool push_pending(Parser* parser, AstNode node) {
+    Ast* ast = &parser->ast;
+    AstNode* pending = (AstNode*)reserve(&parser->arena, ast->pending, ast->pending_count, &ast->pending_capacity,
+                                         1, sizeof(AstNode));
+    if (!pending) {
+        return false;
+    }
+    ast->pending = pending;
+    ast->pending[ast->pending_count++] = node;
+    return true;
+}
+
+// Adds a node whose children are pending[first..pending_count) and leaves it
+// pending in their place.
+static void add_node(Parser* parser, AstKind kind, uint32_t payload, size_t first) {
+    Ast* ast = &parser->ast;
+    if (ast->count >= ast->capacity && !grow_nodes(parser)) {
+        out_of_memory(parser);
+        return;
+    }
+    AstNode node = (AstNode)ast->count++;
+    ast->kind[node] = (uint8_t)kind;
+    ast->payload[node] = payload;
+    ast->first_child[node] = first < ast->pending_count ? ast->pending[first] : AST_NONE;
+    ast->next_sibling[node] = AST_NONE;
+    for (size_t i = first; i + 1 < ast->pending_count; i++) {
+        ast->next_sibling[ast->pending[i]] = ast->pending[i + 1];
+    }
+    ast->pending_count = first;
+    if (!push_pending(parser, node)) {
+        out_of_memory(parser);
+    }
+}
+
+// Sets up empty node arrays for the loaded tokens. Most tokens add at most one
+// node and punctuation none, so half the token count rarely needs to grow.
+bool start_ast(Parser* parser) {
+    Ast* ast = &parser->ast;
+    reset_ast(ast);
+    if (!ast->enabled) {
+        return true;
+    }
+    size_t capacity = parser->token_count / 2 + AST_STACK_SIZE;
+    ast->kind = (uint8_t*)arena_alloc(&parser->arena, capacity * sizeof(uint8_t));
+    ast->payload = (uint32_t*)arena_alloc(&parser->arena, capacity * sizeof(uint32_t));
+    ast->first_child = (AstNode*)arena_alloc(&parser->arena, capacity * sizeof(AstNode));
+    ast->next_sibling = (AstNode*)arena_alloc(&parser->arena, capacity * sizeof(AstNode));
+    if (!ast->kind || !ast->payload || !ast->first_child || !ast->next_sibling) {
+        reset_ast(ast);
+        return false;
+    }
+    ast->capacity = capacity;
+    ast->count = 1; // index 0 is AST_NONE
+    ast->kind[AST_NONE] = 0;
+    ast->payload[AST_NONE] = 0;
+    ast->first_child[AST_NONE] = AST_NONE;
+    ast->next_sibling[AST_NONE] = AST_NONE;
+    return true;
+}
+
+void ast_leaf(Parser* parser, AstKind kind, uint32_t payload) {
+    if (building(parser)) {
+        add_node(parser, kind, payload, parser->ast.pending_count);
+    }
+}
+
+// A CONST token, its decimal spelling stored as the value. A value too large
+// for the payload goes in the wide table; one past 64 bits is kept modulo
+// 2^64, as the machine arithmetic would. Neither fails the parse, which must
+// not depend on building the tree.
+void ast_constant(Parser* parser, Atom spelling) {
+    if (!building(parser)) {
+        return;
+    }
+    const char* digits = atom_name(&parser->atoms, spelling);
+    uint64_t value = 0;
+    for (const char* c = digits; *c >= '0' && *c <= '9'; c++) {
+        value = value * 10 + (uint64_t)(*c - '0');
+    }
+    Ast* ast = &parser->ast;
+    uint32_t payload = (uint32_t)value;
+    if (value >= AST_WIDE) {
+        uint64_t* wide = (uint64_t*)reserve(&parser->arena, ast->wide, ast->wide_count, &ast->wide_capacity,
+                                            1, sizeof(uint64_t));
+        if (!wide || ast->wide_count >= AST_WIDE) {
+            out_of_memory(parser);
+            return;
+        }
+        ast->wide = wide;
+        ast->wide[ast->wide_count] = value;
+        payload = AST_WIDE | (uint32_t)ast->wide_count++;
+    }
+    add_node(parser, AST_CONSTANT, payload, ast->pending_count);
+}
+
+// Starts a node whose children are the nodes finished until ast_close().
+void ast_open(Parser* parser, uint32_t payload) {
+    if (!building(parser)) {
+        return;
+    }
+    Ast* ast = &parser->ast;
+    AstMark* marks = (AstMark*)reserve(&parser->arena, ast->marks, ast->mark_count, &ast->mark_capacity,
+                                       1, sizeof(AstMark));
+    if (!marks) {
+        out_of_memory(parser);
+        return;
+    }
+    ast->marks = marks;
+    ast->marks[ast->mark_count].depth = (uint32_t)ast->pending_count;
+    ast->marks[ast->mark_count].payload = payload;
+    ast->mark_count++;
+}
+
+void ast_close(Parser* parser, AstKind kind) {
+    if (!building(parser) || parser->ast.mark_count == 0) {
+        return;
+    }
+    AstMark mark = parser->ast.marks[--parser->ast.mark_count];
+    add_node(parser, kind, mark.payload, mark.depth);
+}
+
+// Joins the last two finished nodes, for left-associative operators.
+void ast_binary(Parser* parser, AstKind kind, uint32_t payload) {
+    if (building(parser) && parser->ast.pending_count >= 2) {
+        add_node(parser, kind, payload, parser->ast.pending_count - 2);
+    }
+}
+
+void finish_ast(Parser* parser) {
+    Ast* ast = &parser->ast;
+    bool complete = building(parser) && ast->pending_count == 1 && ast->mark_count == 0;
+    ast->root = complete ? ast->pending[0] : AST_NONE;
+}
+
+uint64_t ast_constant_value(const Ast* ast, AstNode node) {
+    uint32_t payload = ast->payload[node];
+    return payload & AST_WIDE ? ast->wide[payload & ~AST_WIDE] : payload;
+}
+
+// Forgets the tree; its arrays went with the arena.
+void reset_ast(Ast* ast) {
+    bool enabled = ast->enabled;
+    memset(ast, 0, sizeof(Ast));
+    ast->enabled = enabled;
+}
+
+const char* ast_kind_name(AstKind kind) {
+    switch (kind) {
+        case AST_BLOCK: return "block";
+        case AST_VARIABLE: return "variable";
+        case AST_FUNCTION: return "function";
+        case AST_PARAMETER: return "parameter";
+        case AST_READ: return "read";
+        case AST_WRITE: return "write";
+        case AST_ASSIGN: return "assign";
+        case AST_IF: return "if";
+        case AST_SEQUENCE: return "sequence";
+        case AST_COMPARE: return "compare";
+        case AST_SUBTRACT: return "subtract";
+        case AST_MULTIPLY: return "multiply";
+        case AST_REFERENCE: return "reference";
+        case AST_CONSTANT: return "constant";
+        case AST_CALL: return "call";
+        default: return "unknown";
+    }
+}
+
+static void print_node(Parser* parser, FILE* out, AstNode node, size_t depth) {
+    const Ast* ast = &parser->ast;
+    int indent = (int)(depth < AST_PRINT_MAX_INDENT ? depth : AST_PRINT_MAX_INDENT) * 2;
+    AstKind kind = (AstKind)ast->kind[node];
+    uint32_t payload = ast->payload[node];
+    fprintf(out, "%*s%s", indent, "", ast_kind_name(kind));
+    switch (kind) {
+    case AST_BLOCK:
+    case AST_IF:
+    case AST_SEQUENCE:
+    case AST_SUBTRACT:
+    case AST_MULTIPLY:
+        break;
+    case AST_CONSTANT:
+        fprintf(out, " %llu", (unsigned long long)ast_constant_value(ast, node));
+        break;
+    case AST_COMPARE:
+        fprintf(out, " %s", get_token_name((TokenType)payload));
+        break;
+    default:
+        fprintf(out, " %s", atom_name(&parser->atoms, payload));
+        break;
+    }
+    fputc('\n', out);
+}
+
+// Writes the tree one node per line, children indented under their parent.
+// Walks an explicit stack, so deeply nested input cannot overflow the C stack.
+bool print_ast(Parser* parser, FILE* out) {
+    const Ast* ast = &parser->ast;
+    if (ast->root == AST_NONE) {
+        return true;
+    }
+    typedef struct {
+        AstNode node;
+        size_t depth;
+    } Frame;
+    size_t capacity = AST_STACK_SIZE;
+    size_t count = 0;
+    Frame* stack = (Frame*)malloc(capacity * sizeof(Frame));
+    if (!stack) {
+        return false;
+    }
+    stack[count].node = ast->root;
+    stack[count++].depth = 0;
+    while (count > 0) {
+        Frame frame = stack[--count];
+        print_node(parser, out, frame.node, frame.depth);
+
+        // push the children, then reverse them so the first is printed first
+        size_t first = count;
+        for (AstNode child = ast->first_child[frame.node]; child != AST_NONE; child = ast->next_sibling[child]) {
+            if (count >= capacity) {
+                Frame* grown = (Frame*)realloc(stack, capacity * 2 * sizeof(Frame));
+                if (!grown) {
+                    free(stack);
+                    return false;
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[count].node = child;
+            stack[count++].depth = frame.depth + 1;
+        }
+        for (size_t i = first, j = count; i + 1 < j; i++, j--) {
+            Frame swap = stack[i];
+            stack[i] = stack[j - 1];
+            stack[j - 1] = swap;
+        }
+    }
+    free(stack);
+    return true;
+}
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include "atom.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+static uint32_t hash_bytes(const char* s, size_t len) {
+    uint32_t h = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+static bool grow_index(AtomTable* atoms) {
+    size_t size = atoms->index_size ? atoms->index_size * 2 : 256;
+    uint32_t* index = (uint32_t*)calloc(size, sizeof(uint32_t));
+    if (!index) {
+        return false;
+    }
+    for (uint32_t atom = 1; atom < atoms->count; atom++) {
+        size_t slot = atoms->hashes[atom] & (size - 1);
+        while (index[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        index[slot] = atom;
+    }
+    free(atoms->index);
+    atoms->index = index;
+    atoms->index_size = size;
+    return true;
+}
+
+static bool grow_entries(AtomTable* atoms) {
+    uint32_t capacity = atoms->capacity ? atoms->capacity * 2 : 256;
+    size_t* offsets = (size_t*)realloc(atoms->offsets, capacity * sizeof(size_t));
+    if (!offsets) return false;
+    atoms->offsets = offsets;
+    uint32_t* lengths = (uint32_t*)realloc(atoms->lengths, capacity * sizeof(uint32_t));
+    if (!lengths) return false;
+    atoms->lengths = lengths;
+    uint32_t* hashes = (uint32_t*)realloc(atoms->hashes, capacity * sizeof(uint32_t));
+    if (!hashes) return false;
+    atoms->hashes = hashes;
+    atoms->capacity = capacity;
+    return true;
+}
+
+static bool append_name(AtomTable* atoms, const char* name, size_t len) {
+    if (atoms->pool_len + len + 1 > atoms->pool_capacity) {
+        size_t capacity = atoms->pool_capacity ? atoms->pool_capacity : 4096;
+        while (capacity < atoms->pool_len + len + 1) {
+            capacity *= 2;
+        }
+        char* pool = (char*)realloc(atoms->pool, capacity);
+        if (!pool) {
+            return false;
+        }
+        atoms->pool = pool;
+        atoms->pool_capacity = capacity;
+    }
+    memcpy(atoms->pool + atoms->pool_len, name, len);
+    atoms->pool[atoms->pool_len + len] = '\0';
+    atoms->pool_len += len + 1;
+    return true;
+}
+
+bool init_atom_table(AtomTable* atoms) {
+    memset(atoms, 0, sizeof(AtomTable));
+    if (!grow_entries(atoms) || !grow_index(atoms) || !append_name(atoms, "", 0)) {
+        free_atom_table(atoms);
+        return false;
+    }
+    // atom 0 is ATOM_NONE and names the empty string
+    atoms->offsets[0] = 0;
+    atoms->lengths[0] = 0;
+    atoms->hashes[0] = 0;
+    atoms->count = 1;
+    return true;
+}
+
+void free_atom_table(AtomTable* atoms) {
+    free(atoms->pool);
+    free(atoms->offsets);
+    free(atoms->lengths);
+    free(atoms->hashes);
+    free(atoms->index);
+    memset(atoms, 0, sizeof(AtomTable));
+}
+
+// Forgets every atom but ATOM_NONE, keeping the allocated capacity.
+void reset_atom_table(AtomTable* atoms) {
+    memset(atoms->index, 0, atoms->index_size * sizeof(uint32_t));
+    atoms->count = 1;
+    atoms->pool_len = 1;
+}
+
+// The index slot holding name[0..len), or the empty slot where it would go.
+static size_t find_slot(const AtomTable* atoms, const char* name, size_t len, uint32_t hash) {
+    size_t mask = atoms->index_size - 1;
+    size_t slot = hash & mask;
+    for (; atoms->index[slot] != 0; slot = (slot + 1) & mask) {
+        Atom atom = atoms->index[slot];
+        if (atoms->hashes[atom] == hash && atoms->lengths[atom] == len &&
+            memcmp(atoms->pool + atoms->offsets[atom], name, len) == 0) {
+            break;
+        }
+    }
+    return slot;
+}
+
+// Returns the atom for name[0..len), adding it on first sight; ATOM_NONE if out of memory.
+Atom intern_atom(AtomTable* atoms, const char* name, size_t len) {
+    uint32_t hash = hash_bytes(name, len);
+    size_t slot = find_slot(atoms, name, len, hash);
+    if (atoms->index[slot] != 0) {
+        return atoms->index[slot];
+    }
+
+    if (atoms->count >= atoms->capacity && !grow_entries(atoms)) {
+        return ATOM_NONE;
+    }
+    // keep the load factor at or below 1/2
+    if ((size_t)(atoms->count + 1) * 2 > atoms->index_size) {
+        if (!grow_index(atoms)) {
+            return ATOM_NONE;
+        }
+        size_t mask = atoms->index_size - 1;
+        for (slot = hash & mask; atoms->index[slot] != 0; slot = (slot + 1) & mask) {
+        }
+    }
+    size_t offset = atoms->pool_len;
+    if (!append_name(atoms, name, len)) {
+        return ATOM_NONE;
+    }
+
+    Atom atom = atoms->count++;
+    atoms->offsets[atom] = offset;
+    atoms->lengths[atom] = (uint32_t)len;
+    atoms->hashes[atom] = hash;
+    atoms->index[slot] = atom;
+    return atom;
+}
+
+// Returns the atom for name[0..len) without adding it: ATOM_NONE if it was never interned.
+Atom find_atom(const AtomTable* atoms, const char* name, size_t len) {
+    return atoms->index[find_slot(atoms, name, len, hash_bytes(name, len))];
+}
+
+// The name stays valid until the next intern_atom() call on the same table.
+const char* atom_name(const AtomTable* atoms, Atom atom) {
+    return atoms->pool + atoms->offsets[atom];
+}
+
+uint32_t atom_length(const AtomTable* atoms, Atom atom) {
+    return atoms->lengths[atom];
+}
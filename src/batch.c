@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "batch.h"
+#include "parser.h"
+#include "lexer.h"
+#include "cache.h"
+
+// Files still owned by one worker: the owner takes from the back, thieves
+// take the front half, so each side keeps walking a contiguous run.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t front;
+    size_t back;
+} WorkQueue;
+
+typedef struct {
+    char* const* files;
+    const BatchOptions* options;
+    bool* results;
+    WorkQueue* queues;
+    int worker_count;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int id;
+} Worker;
+
+static bool pop_task(WorkQueue* queue, size_t* task) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->front < queue->back) {
+        *task = --queue->back;
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+// Moves the front half of another worker's queue into our own (empty) queue.
+static bool steal_tasks(Batch* batch, int thief) {
+    for (int i = 1; i < batch->worker_count; i++) {
+        WorkQueue* victim = &batch->queues[(thief + i) % batch->worker_count];
+        pthread_mutex_lock(&victim->lock);
+        size_t available = victim->back - victim->front;
+        if (available == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t take = (available + 1) / 2;
+        size_t front = victim->front;
+        victim->front += take;
+        pthread_mutex_unlock(&victim->lock);
+
+        WorkQueue* own = &batch->queues[thief];
+        pthread_mutex_lock(&own->lock);
+        own->front = front;
+        own->back = front + take;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    return false; // nothing left anywhere, and no new work is ever created
+}
+
+static bool parse_one(Parser** parser, const char* file, const BatchOptions* options) {
+    CacheOptions cache_options = { options->engine, options->collect_errors, options->max_errors };
+    CacheKey key;
+    bool cached = options->cache && cache_key(file, &cache_options, &key);
+    bool result;
+    if (cached && cache_fetch(options->cache, &key, file, &result)) {
+        return result;
+    }
+
+    if (!*parser) {
+        *parser = create_buffer_parser("", 0, NULL);
+        if (!*parser) {
+            return false;
+        }
+        (*parser)->scanner = options->scanner;
+    }
+    else if (!parser_reset(*parser)) {
+        destroy_parser(*parser);
+        *parser = NULL;
+        return false;
+    }
+
+    if (!parser_load_file(*parser, file)) {
+        return false;
+    }
+    if (options->emit_dyd && is_mini_file(file) && !write_dyd_file(*parser, file)) {
+        fprintf(stderr, "Error writing .dyd for %s\n", file);
+    }
+    (*parser)->engine = options->engine;
+    (*parser)->collect_errors = options->collect_errors;
+    (*parser)->max_errors = options->max_errors;
+    result = program(*parser);
+    if (cached) {
+        cache_store(options->cache, &key, file, *parser, result);
+    }
+    return result;
+}
+
+static void* worker_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    Batch* batch = worker->batch;
+    Parser* parser = NULL; // reused for every file this worker handles
+
+    size_t task;
+    for (;;) {
+        if (!pop_task(&batch->queues[worker->id], &task) && !(steal_tasks(batch, worker->id) &&
+                                                             pop_task(&batch->queues[worker->id], &task))) {
+            break;
+        }
+        batch->results[task] = parse_one(&parser, batch->files[task], batch->options);
+    }
+
+    destroy_parser(parser);
+    return NULL;
+}
+
+// Parses each file into its own .var/.pro/.err on options->jobs threads and
+// stores per-file success in results, in input order. Returns the number of
+// files that failed.
+size_t parse_batch(char* const* files, size_t count, const BatchOptions* options, bool* results) {
+    int worker_count = options->jobs > 0 ? options->jobs : 1;
+    if ((size_t)worker_count > count) {
+        worker_count = count > 0 ? (int)count : 1;
+    }
+
+    Batch batch = { files, options, results, NULL, worker_count };
+    batch.queues = (WorkQueue*)calloc(worker_count, sizeof(WorkQueue));
+    Worker* workers = (Worker*)calloc(worker_count, sizeof(Worker));
+    pthread_t* threads = (pthread_t*)calloc(worker_count, sizeof(pthread_t));
+    if (!batch.queues || !workers || !threads) {
+        fprintf(stderr, "Error: failed to allocate batch workers\n");
+        free(batch.queues);
+        free(workers);
+        free(threads);
+        for (size_t i = 0; i < count; i++) {
+            results[i] = false;
+        }
+        return count;
+    }
+
+    // start with an even contiguous split; stealing evens out the rest
+    for (int i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].front = count * i / worker_count;
+        batch.queues[i].back = count * (i + 1) / worker_count;
+        workers[i].batch = &batch;
+        workers[i].id = i;
+    }
+    for (size_t i = 0; i < count; i++) {
+        results[i] = false;
+    }
+
+    int started = 0;
+    for (int i = 1; i < worker_count; i++) {
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+            break; // the workers that did start steal the remaining files
+        }
+        started = i;
+    }
+    worker_main(&workers[0]);
+    for (int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    free(batch.queues);
+    free(workers);
+    free(threads);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!results[i]) failed++;
+    }
+    return failed;
+}
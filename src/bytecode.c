@@ -0,0 +1,914 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "parser.h"
+#include "bytecode.h"
+#include "ir.h"
+
+// Compiles the syntax tree of the last parse (parser->ast) to bytecode.
+// Expressions are emitted by walking their nodes in storage order, which is
+// post-order and therefore already the order of a stack machine; statements
+// go through an explicit work stack, so nesting depth does not use C stack.
+
+typedef struct {
+    Atom proc;
+    int level;
+    int faddr; // variable address stored in slot 1
+    int parent; // enclosing unit, -1 for the main program
+    AstNode body; // AST_BLOCK
+    uint32_t function; // index into Bytecode.functions, unused for main
+    int depth; // operand stack depth at the current instruction
+    int max_depth;
+} Unit;
+
+typedef struct {
+    AstNode node;
+    int phase; // of an AST_IF: 0 before the condition, 1 after then, 2 after else
+    size_t patch; // operand of the jump to fill in when the phase ends
+} Work;
+
+typedef struct {
+    Parser* parser;
+    Bytecode* out;
+    uint32_t* functions; // procedure index + 1 by atom, 0 for none
+    Unit* units; // main first, then functions in the order they are found
+    size_t unit_count;
+    size_t unit_capacity;
+    Work* work;
+    size_t work_count;
+    size_t work_capacity;
+    char* err;
+    size_t err_size;
+    bool failed;
+} Compiler;
+
+static const int opcode_arity[] = {
+#define BYTECODE_ARITY(name, operands) operands,
+    BYTECODE_OPS(BYTECODE_ARITY)
+#undef BYTECODE_ARITY
+};
+
+static const char* const opcode_names[] = {
+#define BYTECODE_NAME(name, operands) #name,
+    BYTECODE_OPS(BYTECODE_NAME)
+#undef BYTECODE_NAME
+};
+
+const char* opcode_name(Opcode op) {
+    return (unsigned)op < sizeof(opcode_names) / sizeof(opcode_names[0]) ? opcode_names[op] : "unknown";
+}
+
+int opcode_operands(Opcode op) {
+    return (unsigned)op < sizeof(opcode_arity) / sizeof(opcode_arity[0]) ? opcode_arity[op] : 0;
+}
+
+static void compile_error(Compiler* c, const char* format, ...) {
+    if (c->failed) {
+        return;
+    }
+    c->failed = true;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(c->err, c->err_size, format, args);
+    va_end(args);
+}
+
+static bool grow(void** items, size_t* capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void* grown = realloc(*items, new_capacity * size);
+    if (!grown) {
+        return false;
+    }
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Appends one code word and returns its offset.
+static size_t emit(Compiler* c, int32_t word) {
+    Bytecode* out = c->out;
+    if (c->failed) {
+        return 0;
+    }
+    if (out->code_count >= INT32_MAX) {
+        compile_error(c, "program too large");
+        return 0;
+    }
+    void* code = out->code;
+    if (!grow(&code, &out->code_capacity, out->code_count + 1, sizeof(int32_t))) {
+        compile_error(c, "out of memory");
+        return 0;
+    }
+    out->code = (int32_t*)code;
+    out->code[out->code_count] = word;
+    return out->code_count++;
+}
+
+// Emits an instruction and tracks the operand stack depth it leaves.
+static void emit_op(Compiler* c, Unit* unit, Opcode op, int effect) {
+    emit(c, op);
+    unit->depth += effect;
+    if (unit->depth > unit->max_depth) {
+        unit->max_depth = unit->depth;
+    }
+}
+
+static void emit_constant(Compiler* c, Unit* unit, int64_t value) {
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        emit_op(c, unit, OP_CONST, 1);
+        emit(c, (int32_t)value);
+    }
+    else {
+        emit_op(c, unit, OP_CONST_WIDE, 1);
+        emit(c, (int32_t)(uint32_t)((uint64_t)value & UINT32_MAX));
+        emit(c, (int32_t)(uint32_t)((uint64_t)value >> 32));
+    }
+}
+
+static void patch(Compiler* c, size_t at) {
+    if (!c->failed) {
+        c->out->code[at] = (int32_t)c->out->code_count;
+    }
+}
+
+// Finds name in the unit or the units around it, like resolve_variable().
+static bool find_slot(Compiler* c, int unit, Atom name, int32_t* hops, int32_t* slot) {
+    int32_t distance = 0;
+    for (int u = unit; u >= 0; u = c->units[u].parent, distance++) {
+        VariableEntry* var = find_variable(c->parser, name, c->units[u].proc);
+        if (var) {
+            *hops = distance;
+            *slot = var->vaddr - c->units[u].faddr + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void emit_load(Compiler* c, int unit, Atom name) {
+    int32_t hops, slot;
+    if (!find_slot(c, unit, name, &hops, &slot)) {
+        compile_error(c, "variable '%s' not declared", atom_name(&c->parser->atoms, name));
+        return;
+    }
+    emit_op(c, &c->units[unit], hops ? OP_LOAD_OUTER : OP_LOAD, 1);
+    if (hops) emit(c, hops);
+    emit(c, slot);
+}
+
+static void emit_store(Compiler* c, int unit, Atom name) {
+    int32_t hops, slot;
+    if (!find_slot(c, unit, name, &hops, &slot)) {
+        if (unit == 0 || name != c->units[unit].proc) {
+            compile_error(c, "variable '%s' not declared", atom_name(&c->parser->atoms, name));
+            return;
+        }
+        hops = 0;
+        slot = 0; // F := ... sets the return value of F
+    }
+    emit_op(c, &c->units[unit], hops ? OP_STORE_OUTER : OP_STORE, -1);
+    if (hops) emit(c, hops);
+    emit(c, slot);
+}
+
+static Opcode compare_opcode(TokenType type) {
+    switch (type) {
+        case EQU: return OP_EQUAL;
+        case NEQ: return OP_NOT_EQUAL;
+        case LT: return OP_LESS;
+        case LE: return OP_LESS_EQUAL;
+        case GT: return OP_GREATER;
+        default: return OP_GREATER_EQUAL;
+    }
+}
+
+static void compile_expression(Compiler* c, int unit, AstNode node) {
+    const Ast* ast = &c->parser->ast;
+    AstNode first = node;
+    while (ast->first_child[first] != AST_NONE) {
+        first = ast->first_child[first];
+    }
+    for (AstNode n = first; n <= node && !c->failed; n++) {
+        uint32_t payload = ast->payload[n];
+        switch ((AstKind)ast->kind[n]) {
+        case AST_REFERENCE:
+            emit_load(c, unit, payload);
+            break;
+        case AST_CONSTANT:
+            emit_constant(c, &c->units[unit], (int64_t)ast_constant_value(ast, n));
+            break;
+        case AST_SUBTRACT:
+            emit_op(c, &c->units[unit], OP_SUBTRACT, -1);
+            break;
+        case AST_MULTIPLY:
+            emit_op(c, &c->units[unit], OP_MULTIPLY, -1);
+            break;
+        case AST_COMPARE:
+            emit_op(c, &c->units[unit], compare_opcode((TokenType)payload), -1);
+            break;
+        case AST_CALL: {
+            uint32_t function = payload < c->parser->atoms.count ? c->functions[payload] : 0;
+            if (function == 0) {
+                compile_error(c, "procedure '%s' not declared", atom_name(&c->parser->atoms, payload));
+                return;
+            }
+            // the callee's enclosing procedure is hops frames up the static chain
+            int32_t hops = c->units[unit].level - (int32_t)c->out->functions[function - 1].level + 1;
+            emit_op(c, &c->units[unit], OP_CALL, 0); // pops the argument, pushes the result
+            emit(c, (int32_t)(function - 1));
+            emit(c, hops);
+            break;
+        }
+        default:
+            compile_error(c, "unexpected %s node in expression", ast_kind_name((AstKind)ast->kind[n]));
+            return;
+        }
+    }
+}
+
+static bool push_work(Compiler* c, AstNode node) {
+    void* work = c->work;
+    if (!grow(&work, &c->work_capacity, c->work_count + 1, sizeof(Work))) {
+        compile_error(c, "out of memory");
+        return false;
+    }
+    c->work = (Work*)work;
+    c->work[c->work_count].node = node;
+    c->work[c->work_count].phase = 0;
+    c->work[c->work_count].patch = 0;
+    c->work_count++;
+    return true;
+}
+
+// Queues a function declared in unit for compilation after it.
+static void add_function(Compiler* c, int unit, AstNode node) {
+    const Ast* ast = &c->parser->ast;
+    Atom name = ast->payload[node];
+    uint32_t function = c->functions[name];
+    if (function == 0) {
+        compile_error(c, "procedure '%s' not declared", atom_name(&c->parser->atoms, name));
+        return;
+    }
+    ProcedureEntry* proc = procedure_at(c->parser, function - 1);
+    void* units = c->units;
+    if (!grow(&units, &c->unit_capacity, c->unit_count + 1, sizeof(Unit))) {
+        compile_error(c, "out of memory");
+        return;
+    }
+    c->units = (Unit*)units;
+    Unit* u = &c->units[c->unit_count++];
+    memset(u, 0, sizeof(Unit));
+    u->proc = name;
+    u->level = proc->plev;
+    u->faddr = proc->faddr;
+    u->parent = unit;
+    u->function = function - 1;
+
+    BytecodeFunction* f = &c->out->functions[function - 1];
+    f->frame_size = (uint32_t)(proc->laddr - proc->faddr + 2);
+    for (AstNode child = ast->first_child[node]; child != AST_NONE; child = ast->next_sibling[child]) {
+        if (ast->kind[child] == AST_PARAMETER) {
+            VariableEntry* var = find_variable(c->parser, ast->payload[child], name);
+            f->parameter = var ? (uint32_t)(var->vaddr - proc->faddr + 1) : 0;
+        }
+        else if (ast->kind[child] == AST_BLOCK) {
+            u->body = child;
+        }
+    }
+}
+
+static void compile_statements(Compiler* c, int unit, AstNode body) {
+    const Ast* ast = &c->parser->ast;
+    c->work_count = 0;
+    push_work(c, body);
+    while (c->work_count > 0 && !c->failed) {
+        size_t top = c->work_count - 1;
+        AstNode node = c->work[top].node;
+        AstNode child = ast->first_child[node];
+        switch ((AstKind)ast->kind[node]) {
+        case AST_BLOCK:
+        case AST_SEQUENCE: {
+            c->work_count--;
+            size_t first = c->work_count;
+            for (; child != AST_NONE; child = ast->next_sibling[child]) {
+                AstKind kind = (AstKind)ast->kind[child];
+                if (kind == AST_FUNCTION) {
+                    add_function(c, unit, child);
+                }
+                else if (kind != AST_VARIABLE && !push_work(c, child)) {
+                    return;
+                }
+            }
+            // run the statements in source order
+            for (size_t i = first, j = c->work_count; i + 1 < j; i++, j--) {
+                Work swap = c->work[i];
+                c->work[i] = c->work[j - 1];
+                c->work[j - 1] = swap;
+            }
+            break;
+        }
+        case AST_READ:
+            c->work_count--;
+            emit_op(c, &c->units[unit], OP_READ, 1);
+            emit_store(c, unit, ast->payload[node]);
+            break;
+        case AST_WRITE:
+            c->work_count--;
+            emit_load(c, unit, ast->payload[node]);
+            emit_op(c, &c->units[unit], OP_WRITE, -1);
+            break;
+        case AST_ASSIGN:
+            c->work_count--;
+            compile_expression(c, unit, child);
+            emit_store(c, unit, ast->payload[node]);
+            break;
+        case AST_IF: {
+            AstNode then_part = ast->next_sibling[child];
+            AstNode else_part = ast->next_sibling[then_part];
+            Work* work = &c->work[top];
+            if (work->phase == 0) {
+                compile_expression(c, unit, child);
+                emit_op(c, &c->units[unit], OP_JUMP_FALSE, -1);
+                work->patch = emit(c, 0);
+                work->phase = 1;
+                push_work(c, then_part);
+            }
+            else if (work->phase == 1 && else_part != AST_NONE) {
+                emit_op(c, &c->units[unit], OP_JUMP, 0);
+                size_t jump = emit(c, 0);
+                patch(c, work->patch);
+                work->patch = jump;
+                work->phase = 2;
+                push_work(c, else_part);
+            }
+            else {
+                patch(c, work->patch);
+                c->work_count--;
+            }
+            break;
+        }
+        default:
+            compile_error(c, "unexpected %s node in statement", ast_kind_name((AstKind)ast->kind[node]));
+            return;
+        }
+    }
+}
+
+// Needs a parse with parser->ast.enabled and no errors, and the symbol tables
+// of that parse. On failure err describes the problem.
+bool compile_bytecode(Parser* parser, Bytecode* out, char* err, size_t err_size) {
+    memset(out, 0, sizeof(Bytecode));
+    if (parser->ast.root == AST_NONE) {
+        snprintf(err, err_size, "no syntax tree to compile");
+        return false;
+    }
+
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.parser = parser;
+    c.out = out;
+    c.err = err;
+    c.err_size = err_size;
+    c.functions = (uint32_t*)calloc(parser->atoms.count, sizeof(uint32_t));
+    out->function_count = parser->proc_count;
+    out->functions = (BytecodeFunction*)calloc(parser->proc_count ? parser->proc_count : 1, sizeof(BytecodeFunction));
+    c.unit_capacity = 16;
+    c.units = (Unit*)malloc(c.unit_capacity * sizeof(Unit));
+    if (!c.functions || !out->functions || !c.units) {
+        compile_error(&c, "out of memory");
+    }
+    for (size_t i = 0; !c.failed && i < parser->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(parser, i);
+        c.functions[proc->pname] = (uint32_t)i + 1;
+        out->functions[i].level = (uint32_t)proc->plev;
+    }
+
+    if (!c.failed) {
+        Unit* main_unit = &c.units[c.unit_count++];
+        memset(main_unit, 0, sizeof(Unit));
+        main_unit->proc = parser->scopes[0].proc;
+        main_unit->parent = -1;
+        main_unit->body = parser->ast.root;
+        out->main_frame_size = (uint32_t)parser->var_count + 1;
+    }
+
+    // the units array grows while functions are found
+    for (size_t u = 0; u < c.unit_count && !c.failed; u++) {
+        if (u > 0) {
+            out->functions[c.units[u].function].entry = (uint32_t)out->code_count;
+        }
+        compile_statements(&c, (int)u, c.units[u].body);
+        emit(&c, u == 0 ? OP_HALT : OP_RETURN);
+        uint32_t stack_size = (uint32_t)c.units[u].max_depth;
+        if (u == 0) {
+            out->main_stack_size = stack_size;
+        }
+        else {
+            out->functions[c.units[u].function].stack_size = stack_size;
+        }
+    }
+
+    free(c.functions);
+    free(c.units);
+    free(c.work);
+    if (c.failed) {
+        free_bytecode(out);
+        return false;
+    }
+    return true;
+}
+
+// Lowering from the IR. A value whose only use comes later in its block
+// stays on the operand stack if it is still on top when that use is emitted;
+// the others, phis included, get frame slots after the variable slots, shared
+// between values whose live ranges do not overlap. Blocks are laid out in
+// topological order, so a live range is the span from definition to last use.
+
+typedef struct {
+    Compiler* c;
+    IrFunction* f;
+    Unit unit; // operand depth
+    uint32_t* order;
+    size_t order_count;
+    uint32_t* uses;
+    uint32_t* use_block; // of the single use; for a phi input, the predecessor
+    bool* phi_input; // some use is a phi input
+    uint32_t* start; // live range in instruction positions
+    uint32_t* end;
+    uint32_t* slots;
+    bool* needs_slot;
+    bool* on_stack;
+    IrValue* stack; // values on the operand stack, top last
+    size_t stack_count;
+    size_t* block_start; // code offset of each block
+    size_t* patches; // pairs of (jump operand offset, target block)
+    size_t patch_count;
+    uint32_t frame_size;
+} Lowering;
+
+static bool stays_on_stack(const Lowering* l, IrValue value) {
+    const IrInst* inst = &l->f->insts[value];
+    if (!ir_has_result((IrOp)inst->op) || inst->op == IR_CONST || inst->op == IR_PARAM || inst->op == IR_PHI) {
+        return false;
+    }
+    return l->uses[value] == 1 && l->use_block[value] == inst->block;
+}
+
+static void note_use(Lowering* l, IrValue value, uint32_t block, uint32_t position) {
+    if (value == IR_NONE) {
+        return;
+    }
+    l->uses[value]++;
+    l->use_block[value] = block;
+    if (position > l->end[value]) {
+        l->end[value] = position;
+    }
+}
+
+// Counts uses and computes live ranges, in the order lower_function() emits.
+static void scan_values(Lowering* l) {
+    IrFunction* f = l->f;
+    uint32_t position = 0;
+    for (size_t i = 0; i < l->order_count; i++) {
+        uint32_t block = l->order[i];
+        const IrBlock* b = &f->blocks[block];
+        for (size_t k = 0; k < b->count; k++) {
+            IrValue value = b->insts[k];
+            const IrInst* inst = &f->insts[value];
+            position++;
+            if (inst->op != IR_PHI) {
+                note_use(l, inst->a, block, position);
+                note_use(l, inst->b, block, position);
+                l->start[value] = position;
+                if (l->end[value] < position) {
+                    l->end[value] = position;
+                }
+            }
+        }
+        // phi inputs are stored at the end of each predecessor
+        for (uint32_t s = 0; s < b->succ_count; s++) {
+            const IrBlock* succ = &f->blocks[b->succ[s]];
+            for (size_t k = 0; k < succ->count; k++) {
+                IrValue phi = succ->insts[k];
+                const IrInst* inst = &f->insts[phi];
+                if (inst->op != IR_PHI) {
+                    continue;
+                }
+                IrValue input = succ->pred[0] == block ? inst->a : inst->b;
+                note_use(l, input, block, position);
+                l->phi_input[input] = true;
+                if (l->start[phi] == 0 || position < l->start[phi]) {
+                    l->start[phi] = position;
+                }
+                if (l->end[phi] < position) {
+                    l->end[phi] = position;
+                }
+            }
+        }
+    }
+}
+
+static void push_value(Lowering* l, IrValue value) {
+    const IrInst* inst = &l->f->insts[value];
+    if (inst->op == IR_CONST) {
+        emit_constant(l->c, &l->unit, inst->imm);
+        return;
+    }
+    emit_op(l->c, &l->unit, OP_LOAD, 1);
+    if (inst->op == IR_PARAM) {
+        emit(l->c, (int32_t)l->f->parameter);
+        return;
+    }
+    l->needs_slot[value] = true;
+    emit(l->c, (int32_t)l->slots[value]);
+}
+
+static void store_value(Lowering* l, IrValue value) {
+    l->needs_slot[value] = true;
+    emit_op(l->c, &l->unit, OP_STORE, -1);
+    emit(l->c, (int32_t)l->slots[value]);
+}
+
+static void spill_stack(Lowering* l) {
+    while (l->stack_count > 0) {
+        IrValue value = l->stack[--l->stack_count];
+        l->on_stack[value] = false;
+        store_value(l, value);
+    }
+}
+
+// Gets the operands onto the stack in order, using those already there.
+// Returns true if the two operands were pushed the other way around.
+static bool push_operands(Lowering* l, const IrValue* operands, int count) {
+    int stacked = 0;
+    for (int i = 0; i < count; i++) {
+        stacked += l->on_stack[operands[i]];
+    }
+    if (count == 2 && stacked == 1 && l->on_stack[operands[1]] && l->stack[l->stack_count - 1] == operands[1]) {
+        l->on_stack[operands[1]] = false;
+        l->stack_count--;
+        push_value(l, operands[0]);
+        return true;
+    }
+    bool in_place = (size_t)stacked <= l->stack_count;
+    for (int i = 0; i < stacked && in_place; i++) {
+        in_place = l->stack[l->stack_count - (size_t)stacked + (size_t)i] == operands[i];
+    }
+    if (in_place) {
+        for (int i = 0; i < stacked; i++) {
+            l->on_stack[operands[i]] = false;
+        }
+        l->stack_count -= (size_t)stacked;
+        for (int i = stacked; i < count; i++) {
+            push_value(l, operands[i]);
+        }
+        return false;
+    }
+    spill_stack(l);
+    for (int i = 0; i < count; i++) {
+        push_value(l, operands[i]);
+    }
+    return false;
+}
+
+// The comparison that gives the same result with its operands swapped.
+static TokenType swap_comparison(TokenType type) {
+    switch (type) {
+        case LT: return GT;
+        case LE: return GE;
+        case GT: return LT;
+        case GE: return LE;
+        default: return type;
+    }
+}
+
+static void emit_jump(Lowering* l, Opcode op, uint32_t target) {
+    emit_op(l->c, &l->unit, op, op == OP_JUMP_FALSE ? -1 : 0);
+    l->patches[l->patch_count++] = emit(l->c, 0);
+    l->patches[l->patch_count++] = target;
+}
+
+static void lower_instruction(Lowering* l, IrValue value, uint32_t next) {
+    Compiler* c = l->c;
+    const IrInst* inst = &l->f->insts[value];
+    const IrBlock* b = &l->f->blocks[inst->block];
+    IrValue operands[2] = { inst->a, inst->b };
+    switch ((IrOp)inst->op) {
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_PHI:
+        return; // pushed by each use, or stored by the predecessors
+    case IR_LOAD:
+        emit_op(c, &l->unit, inst->hops ? OP_LOAD_OUTER : OP_LOAD, 1);
+        if (inst->hops) emit(c, inst->hops);
+        emit(c, (int32_t)inst->imm);
+        break;
+    case IR_STORE:
+        push_operands(l, operands, 1);
+        emit_op(c, &l->unit, inst->hops ? OP_STORE_OUTER : OP_STORE, -1);
+        if (inst->hops) emit(c, inst->hops);
+        emit(c, (int32_t)inst->imm);
+        break;
+    case IR_SUBTRACT:
+        emit_op(c, &l->unit, push_operands(l, operands, 2) ? OP_SUBTRACT_FROM : OP_SUBTRACT, -1);
+        break;
+    case IR_MULTIPLY:
+        push_operands(l, operands, 2);
+        emit_op(c, &l->unit, OP_MULTIPLY, -1);
+        break;
+    case IR_COMPARE: {
+        TokenType type = (TokenType)inst->imm;
+        emit_op(c, &l->unit, compare_opcode(push_operands(l, operands, 2) ? swap_comparison(type) : type), -1);
+        break;
+    }
+    case IR_SHIFT_LEFT:
+        push_operands(l, operands, 1);
+        emit_op(c, &l->unit, OP_SHIFT_LEFT, 0);
+        emit(c, (int32_t)inst->imm);
+        break;
+    case IR_CALL:
+        push_operands(l, operands, 1);
+        emit_op(c, &l->unit, OP_CALL, 0);
+        emit(c, (int32_t)inst->imm);
+        emit(c, inst->hops);
+        break;
+    case IR_READ:
+        emit_op(c, &l->unit, OP_READ, 1);
+        break;
+    case IR_WRITE:
+        push_operands(l, operands, 1);
+        emit_op(c, &l->unit, OP_WRITE, -1);
+        break;
+    case IR_JUMP:
+    case IR_BRANCH:
+    case IR_RETURN:
+    case IR_HALT:
+        // the phis of the successors take their inputs from this block
+        for (uint32_t s = 0; s < b->succ_count; s++) {
+            const IrBlock* succ = &l->f->blocks[b->succ[s]];
+            for (size_t k = 0; k < succ->count; k++) {
+                const IrInst* phi = &l->f->insts[succ->insts[k]];
+                if (phi->op == IR_PHI) {
+                    IrValue input = succ->pred[0] == inst->block ? phi->a : phi->b;
+                    push_operands(l, &input, 1);
+                    store_value(l, succ->insts[k]);
+                }
+            }
+        }
+        if (inst->op == IR_JUMP) {
+            if (b->succ[0] != next) {
+                emit_jump(l, OP_JUMP, b->succ[0]);
+            }
+        }
+        else if (inst->op == IR_BRANCH) {
+            push_operands(l, operands, 1);
+            emit_jump(l, OP_JUMP_FALSE, b->succ[1]);
+            if (b->succ[0] != next) {
+                emit_jump(l, OP_JUMP, b->succ[0]);
+            }
+        }
+        else if (inst->op == IR_RETURN) {
+            // a value kept only for the return already lives in slot 0
+            if (!l->needs_slot[inst->a] || l->slots[inst->a] != 0 || l->f->insts[inst->a].op == IR_PARAM) {
+                push_operands(l, operands, 1);
+                emit_op(c, &l->unit, OP_STORE, -1);
+                emit(c, 0);
+            }
+            emit_op(c, &l->unit, OP_RETURN, 0);
+        }
+        else {
+            emit_op(c, &l->unit, OP_HALT, 0);
+        }
+        return;
+    default:
+        compile_error(c, "unexpected IR instruction %d", inst->op);
+        return;
+    }
+    if (stays_on_stack(l, value)) {
+        l->stack[l->stack_count++] = value;
+        l->on_stack[value] = true;
+    }
+    else if (ir_has_result((IrOp)inst->op)) {
+        store_value(l, value);
+    }
+}
+
+static void lower_blocks(Lowering* l) {
+    l->unit.depth = 0;
+    l->unit.max_depth = 0;
+    l->patch_count = 0;
+    l->stack_count = 0;
+    for (size_t i = 0; i < l->order_count && !l->c->failed; i++) {
+        uint32_t block = l->order[i];
+        uint32_t next = i + 1 < l->order_count ? l->order[i + 1] : UINT32_MAX;
+        const IrBlock* b = &l->f->blocks[block];
+        l->block_start[block] = l->c->out->code_count;
+        for (size_t k = 0; k < b->count; k++) {
+            lower_instruction(l, b->insts[k], next);
+        }
+    }
+    for (size_t i = 0; i < l->patch_count && !l->c->failed; i += 2) {
+        l->c->out->code[l->patches[i]] = (int32_t)l->block_start[l->patches[i + 1]];
+    }
+}
+
+typedef struct {
+    uint32_t start;
+    IrValue value;
+} LiveRange;
+
+static int compare_starts(const void* left, const void* right) {
+    const LiveRange* a = (const LiveRange*)left;
+    const LiveRange* b = (const LiveRange*)right;
+    return a->start != b->start ? (a->start < b->start ? -1 : 1) : (a->value < b->value ? -1 : a->value > b->value);
+}
+
+// Whether the only use of the value is the function's return.
+static bool returns(const Lowering* l, IrValue value) {
+    if (l->uses[value] != 1 || l->phi_input[value]) {
+        return false;
+    }
+    const IrBlock* b = &l->f->blocks[l->use_block[value]];
+    const IrInst* last = &l->f->insts[b->insts[b->count - 1]];
+    return last->op == IR_RETURN && last->a == value;
+}
+
+// Linear scan over the live ranges of the values that were stored.
+static bool assign_slots(Lowering* l) {
+    IrFunction* f = l->f;
+    size_t count = 0;
+    LiveRange* ranges = (LiveRange*)malloc(f->inst_count * sizeof(LiveRange));
+    IrValue* active = (IrValue*)malloc(f->inst_count * sizeof(IrValue)); // by end, a binary heap
+    uint32_t* free_slots = (uint32_t*)malloc(f->inst_count * sizeof(uint32_t));
+    if (!ranges || !active || !free_slots) {
+        free(ranges);
+        free(active);
+        free(free_slots);
+        return false;
+    }
+    for (IrValue v = 1; v < f->inst_count; v++) {
+        if (l->needs_slot[v]) {
+            ranges[count].start = l->start[v];
+            ranges[count++].value = v;
+        }
+    }
+    qsort(ranges, count, sizeof(LiveRange), compare_starts);
+    size_t active_count = 0;
+    size_t free_count = 0;
+    uint32_t next_slot = f->frame_size;
+    for (size_t i = 0; i < count; i++) {
+        IrValue value = ranges[i].value;
+        // ranges that ended before this one starts give their slots back
+        while (active_count > 0 && l->end[active[0]] < l->start[value]) {
+            free_slots[free_count++] = l->slots[active[0]];
+            IrValue last = active[--active_count];
+            size_t hole = 0;
+            for (;;) {
+                size_t child = hole * 2 + 1;
+                if (child >= active_count) break;
+                if (child + 1 < active_count && l->end[active[child + 1]] < l->end[active[child]]) child++;
+                if (l->end[active[child]] >= l->end[last]) break;
+                active[hole] = active[child];
+                hole = child;
+            }
+            if (active_count > 0) active[hole] = last;
+        }
+        if (returns(l, value)) {
+            l->slots[value] = 0; // the return value slot, nothing else uses it
+            continue;
+        }
+        l->slots[value] = free_count > 0 ? free_slots[--free_count] : next_slot++;
+        size_t hole = active_count++;
+        while (hole > 0 && l->end[active[(hole - 1) / 2]] > l->end[value]) {
+            active[hole] = active[(hole - 1) / 2];
+            hole = (hole - 1) / 2;
+        }
+        active[hole] = value;
+    }
+    l->frame_size = next_slot;
+    free(ranges);
+    free(active);
+    free(free_slots);
+    return true;
+}
+
+static void lower_function(Compiler* c, IrFunction* f, uint32_t* frame_size, uint32_t* stack_size) {
+    Lowering l;
+    memset(&l, 0, sizeof(l));
+    l.c = c;
+    l.f = f;
+    size_t values = f->inst_count ? f->inst_count : 1;
+    size_t blocks = f->block_count ? f->block_count : 1;
+    l.order = (uint32_t*)malloc(blocks * sizeof(uint32_t));
+    l.uses = (uint32_t*)calloc(values, sizeof(uint32_t));
+    l.use_block = (uint32_t*)calloc(values, sizeof(uint32_t));
+    l.phi_input = (bool*)calloc(values, sizeof(bool));
+    l.start = (uint32_t*)calloc(values, sizeof(uint32_t));
+    l.end = (uint32_t*)calloc(values, sizeof(uint32_t));
+    l.slots = (uint32_t*)calloc(values, sizeof(uint32_t));
+    l.needs_slot = (bool*)calloc(values, sizeof(bool));
+    l.on_stack = (bool*)calloc(values, sizeof(bool));
+    l.stack = (IrValue*)malloc(values * sizeof(IrValue));
+    l.block_start = (size_t*)malloc(blocks * sizeof(size_t));
+    l.patches = (size_t*)malloc(blocks * 4 * sizeof(size_t));
+    if (!l.order || !l.uses || !l.use_block || !l.phi_input || !l.start || !l.end || !l.slots || !l.needs_slot || !l.on_stack ||
+        !l.stack || !l.block_start || !l.patches) {
+        compile_error(c, "out of memory");
+    }
+    else {
+        l.order_count = ir_block_order(f, l.order);
+        scan_values(&l);
+        // a first pass finds which values need slots, then the code is redone with them
+        size_t entry = c->out->code_count;
+        lower_blocks(&l);
+        c->out->code_count = entry;
+        if (!assign_slots(&l)) {
+            compile_error(c, "out of memory");
+        }
+        memset(l.on_stack, 0, values * sizeof(bool));
+        lower_blocks(&l);
+        *frame_size = l.frame_size;
+        *stack_size = (uint32_t)l.unit.max_depth;
+    }
+    free(l.order);
+    free(l.uses);
+    free(l.use_block);
+    free(l.phi_input);
+    free(l.start);
+    free(l.end);
+    free(l.slots);
+    free(l.needs_slot);
+    free(l.on_stack);
+    free(l.stack);
+    free(l.block_start);
+    free(l.patches);
+}
+
+// Lowers every function of an IR program, the main program first.
+bool compile_ir_bytecode(const IrProgram* program, Bytecode* out, char* err, size_t err_size) {
+    memset(out, 0, sizeof(Bytecode));
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.out = out;
+    c.err = err;
+    c.err_size = err_size;
+    out->function_count = program->function_count - 1;
+    out->functions = (BytecodeFunction*)calloc(out->function_count ? out->function_count : 1,
+                                               sizeof(BytecodeFunction));
+    if (!out->functions) {
+        compile_error(&c, "out of memory");
+    }
+    for (size_t i = 0; i < program->function_count && !c.failed; i++) {
+        IrFunction* f = &program->functions[i];
+        if (f->block_count == 0) {
+            continue;
+        }
+        if (i == 0) {
+            lower_function(&c, f, &out->main_frame_size, &out->main_stack_size);
+            continue;
+        }
+        BytecodeFunction* function = &out->functions[f->procedure];
+        function->entry = (uint32_t)out->code_count;
+        function->level = (uint32_t)f->level;
+        function->parameter = f->parameter;
+        lower_function(&c, f, &function->frame_size, &function->stack_size);
+    }
+    if (c.failed) {
+        free_bytecode(out);
+        return false;
+    }
+    return true;
+}
+
+// Writes one instruction per line: offset, name and operands, with function
+// entries marked.
+void print_bytecode(const Bytecode* code, FILE* out) {
+    fprintf(out, "main frame %u stack %u:\n", code->main_frame_size, code->main_stack_size);
+    for (size_t pc = 0; pc < code->code_count;) {
+        for (size_t i = 0; i < code->function_count; i++) {
+            if (code->functions[i].entry == pc && pc > 0) {
+                fprintf(out, "function %zu frame %u stack %u:\n", i, code->functions[i].frame_size,
+                        code->functions[i].stack_size);
+            }
+        }
+        Opcode op = (Opcode)code->code[pc];
+        fprintf(out, "%6zu  %s", pc, opcode_name(op));
+        for (int i = 1; i <= opcode_operands(op) && pc + (size_t)i < code->code_count; i++) {
+            fprintf(out, " %d", code->code[pc + (size_t)i]);
+        }
+        fputc('\n', out);
+        pc += 1 + (size_t)opcode_operands(op);
+    }
+}
+
+void free_bytecode(Bytecode* code) {
+    free(code->code);
+    free(code->functions);
+    memset(code, 0, sizeof(Bytecode));
+}
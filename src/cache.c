@@ -0,0 +1,440 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "writer.h"
+
+#define TOUCH_INTERVAL 60 // seconds between mtime refreshes of an entry that keeps hitting
+#define STALE_TEMP_AGE 3600 // seconds after which a temporary file is left over from a crash
+
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+static uint32_t read_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t read_u64(const unsigned char* p) {
+    return (uint64_t)read_u32(p) | (uint64_t)read_u32(p + 4) << 32;
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void put_u64(unsigned char* p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+// XXH64 of data. Four independent lanes over 32-byte stripes keep the hash
+// at memory speed, which is what a warm cache run costs.
+uint64_t xxh64(const void* data, size_t length, uint64_t seed) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + length;
+    uint64_t h;
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read_u64(p));
+            v2 = xxh_round(v2, read_u64(p + 8));
+            v3 = xxh_round(v3, read_u64(p + 16));
+            v4 = xxh_round(v4, read_u64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else {
+        h = seed + PRIME64_5;
+    }
+    h += (uint64_t)length;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, read_u64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read_u32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Creates dir and any missing parents.
+static bool make_dirs(char* dir) {
+    for (char* p = dir + 1;; p++) {
+        if (*p != '/' && *p != '\0') {
+            continue;
+        }
+        char c = *p;
+        *p = '\0';
+        bool ok = mkdir(dir, 0777) == 0 || errno == EEXIST;
+        *p = c;
+        if (!ok || c == '\0') {
+            return ok;
+        }
+    }
+}
+
+bool cache_open(ParseCache* cache, const char* dir, uint64_t limit) {
+    cache->dir = strdup(dir);
+    cache->limit = limit;
+    if (!cache->dir) {
+        perror("Failed to allocate cache");
+        return false;
+    }
+    if (!make_dirs(cache->dir)) {
+        fprintf(stderr, "Error creating cache directory %s\n", dir);
+        cache_close(cache);
+        return false;
+    }
+    return true;
+}
+
+void cache_close(ParseCache* cache) {
+    free(cache->dir);
+    cache->dir = NULL;
+}
+
+// Hashes the input into the name of its entry. False if the input cannot be
+// read, in which case the parse reports it.
+bool cache_key(const char* input, const CacheOptions* options, CacheKey* key) {
+    int fd = open(input, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    // the extension picks the input format, the options what gets reported
+    const char* dot = strrchr(input, '.');
+    uint64_t fields[5] = { CACHE_VERSION, (uint64_t)options->engine, options->collect_errors,
+                           options->max_errors, dot ? xxh64(dot, strlen(dot), 0) : 0 };
+    unsigned char seed_bytes[sizeof(fields)];
+    for (size_t i = 0; i < 5; i++) {
+        put_u64(seed_bytes + 8 * i, fields[i]);
+    }
+    uint64_t seed = xxh64(seed_bytes, sizeof(seed_bytes), 0);
+
+    size_t size = (size_t)st.st_size;
+    uint64_t hash = xxh64(NULL, 0, seed);
+    if (size > 0) {
+        void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+        hash = xxh64(map, size, seed);
+        munmap(map, size);
+    }
+    close(fd);
+
+    snprintf(key->entry, sizeof(key->entry), "%016" PRIx64 "-%" PRIx64 ".entry", hash, (uint64_t)size);
+    key->size = (uint64_t)size;
+    key->mtime = st.st_mtim;
+    return true;
+}
+
+static const char* const output_extensions[3] = { ".var", ".pro", ".err" };
+
+// The output file of input with the given extension, named as open_files() does.
+static bool output_path(const char* input, const char* extension, char* path, size_t path_size) {
+    const char* dot = strrchr(input, '.');
+    int base_len = dot ? (int)(dot - input) : (int)strlen(input);
+    return snprintf(path, path_size, "%.*s%s", base_len, input, extension) < (int)path_size;
+}
+
+static bool write_file(const char* path, const unsigned char* data, size_t length) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    bool ok = write_stream(file, (const char*)data, length);
+    return (fclose(file) == 0) && ok;
+}
+
+// Writes the cached outputs next to input and reports whether its parse
+// succeeded. False on a miss or an unusable entry; the caller then parses.
+bool cache_fetch(const ParseCache* cache, const CacheKey* key, const char* input, bool* result) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, key->entry);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < CACHE_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    const unsigned char* data = (const unsigned char*)map;
+
+    uint64_t lengths[3];
+    uint64_t total = 0;
+    for (int i = 0; i < 3; i++) {
+        lengths[i] = read_u64(data + 16 + 8 * i);
+        total += lengths[i];
+    }
+    // a hash collision or a damaged entry is a miss
+    const unsigned char* outputs = data + CACHE_HEADER_SIZE;
+    bool ok = memcmp(data, CACHE_MAGIC, 4) == 0 && read_u64(data + 8) == key->size &&
+              lengths[0] <= size && lengths[1] <= size && lengths[2] <= size &&
+              total == size - CACHE_HEADER_SIZE && xxh64(outputs, (size_t)total, 0) == read_u64(data + 40);
+    for (int i = 0; ok && i < 3; i++) {
+        ok = output_path(input, output_extensions[i], path, sizeof(path)) &&
+             write_file(path, outputs, (size_t)lengths[i]);
+        outputs += lengths[i];
+    }
+    if (ok) {
+        *result = read_u32(data + 4) != 0;
+        // diagnostics go to stderr as well as the .err file
+        write_stream(stderr, (const char*)outputs - lengths[2], (size_t)lengths[2]);
+        if (time(NULL) - st.st_mtim.tv_sec >= TOUCH_INTERVAL) {
+            futimens(fd, NULL);
+        }
+    }
+    munmap(map, size);
+    close(fd);
+    return ok;
+}
+
+// Reads the file at path into data, which has room for exactly length bytes.
+static bool read_file(const char* path, unsigned char* data, size_t length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = true;
+    for (size_t done = 0; ok && done < length;) {
+        ssize_t n = read(fd, data + done, length - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = n > 0;
+        done += ok ? (size_t)n : 0;
+    }
+    close(fd);
+    return ok;
+}
+
+typedef struct {
+    char name[48];
+    uint64_t size;
+    struct timespec mtime;
+} CacheFile;
+
+static int compare_age(const void* a, const void* b) {
+    const CacheFile* x = (const CacheFile*)a;
+    const CacheFile* y = (const CacheFile*)b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec) {
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    }
+    return (x->mtime.tv_nsec > y->mtime.tv_nsec) - (x->mtime.tv_nsec < y->mtime.tv_nsec);
+}
+
+static bool has_suffix(const char* name, const char* suffix) {
+    size_t len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+// Removes the least recently used entries until at most target bytes are
+// left, and temporary files abandoned by crashed writers. Returns the bytes
+// left, measured rather than trusted from the usage file.
+static uint64_t evict(const ParseCache* cache, uint64_t target) {
+    DIR* dir = opendir(cache->dir);
+    if (!dir) {
+        return 0;
+    }
+    CacheFile* files = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        struct stat st;
+        bool entry = has_suffix(ent->d_name, ".entry") && strlen(ent->d_name) < sizeof(files->name);
+        bool temp = strncmp(ent->d_name, "tmp-", 4) == 0;
+        if ((!entry && !temp) || fstatat(dirfd(dir), ent->d_name, &st, 0) != 0) {
+            continue;
+        }
+        if (temp) {
+            if (now - st.st_mtim.tv_sec > STALE_TEMP_AGE) {
+                unlinkat(dirfd(dir), ent->d_name, 0);
+            }
+            continue;
+        }
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 256;
+            CacheFile* new_files = (CacheFile*)realloc(files, new_capacity * sizeof(CacheFile));
+            if (!new_files) {
+                break;
+            }
+            files = new_files;
+            capacity = new_capacity;
+        }
+        strcpy(files[count].name, ent->d_name);
+        files[count].size = (uint64_t)st.st_size;
+        files[count].mtime = st.st_mtim;
+        total += files[count].size;
+        count++;
+    }
+
+    qsort(files, count, sizeof(CacheFile), compare_age);
+    for (size_t i = 0; i < count && total > target; i++) {
+        if (unlinkat(dirfd(dir), files[i].name, 0) == 0 || errno == ENOENT) {
+            total -= files[i].size;
+        }
+    }
+    free(files);
+    closedir(dir);
+    return total;
+}
+
+// Adds added bytes to the running total in <dir>/usage, evicting down to
+// three quarters of the limit once the total passes it. The lock serializes
+// the bookkeeping only; lookups never take it.
+static void update_usage(const ParseCache* cache, uint64_t added) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/usage", cache->dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        return;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return;
+    }
+    char text[32];
+    ssize_t n = pread(fd, text, sizeof(text) - 1, 0);
+    text[n > 0 ? n : 0] = '\0';
+    uint64_t total = strtoull(text, NULL, 10) + added;
+    if (total > cache->limit) {
+        total = evict(cache, cache->limit / 4 * 3);
+    }
+    int length = snprintf(text, sizeof(text), "%" PRIu64 "\n", total);
+    if (pwrite(fd, text, (size_t)length, 0) != length || ftruncate(fd, length) != 0) {
+        perror("Failed to update cache usage");
+    }
+    close(fd); // releases the lock
+}
+
+// Stores the outputs parser just wrote for input under key. Nothing is stored
+// if the input changed since it was hashed.
+bool cache_store(const ParseCache* cache, const CacheKey* key, const char* input, Parser* parser, bool result) {
+    struct stat st;
+    if (stat(input, &st) != 0 || (uint64_t)st.st_size != key->size || st.st_mtim.tv_sec != key->mtime.tv_sec ||
+        st.st_mtim.tv_nsec != key->mtime.tv_nsec) {
+        return false;
+    }
+    FILE* streams[3] = { parser->var, parser->pro, parser->err };
+    char paths[3][4096];
+    uint64_t lengths[3];
+    uint64_t total = 0;
+    for (int i = 0; i < 3; i++) {
+        if (!streams[i] || fflush(streams[i]) != 0 ||
+            !output_path(input, output_extensions[i], paths[i], sizeof(paths[i])) || stat(paths[i], &st) != 0) {
+            return false;
+        }
+        lengths[i] = (uint64_t)st.st_size;
+        total += lengths[i];
+    }
+
+    unsigned char* entry = (unsigned char*)malloc(CACHE_HEADER_SIZE + total);
+    if (!entry) {
+        return false;
+    }
+    unsigned char* outputs = entry + CACHE_HEADER_SIZE;
+    bool ok = true;
+    unsigned char* out = outputs;
+    for (int i = 0; ok && i < 3; i++) {
+        ok = read_file(paths[i], out, (size_t)lengths[i]);
+        out += lengths[i];
+    }
+    memcpy(entry, CACHE_MAGIC, 4);
+    put_u32(entry + 4, result ? 1 : 0);
+    put_u64(entry + 8, key->size);
+    for (int i = 0; i < 3; i++) {
+        put_u64(entry + 16 + 8 * i, lengths[i]);
+    }
+    put_u64(entry + 40, xxh64(outputs, (size_t)total, 0));
+
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s/tmp-XXXXXX", cache->dir);
+    int fd = ok ? mkstemp(temp) : -1;
+    if (fd >= 0) {
+        ok = write_fd(fd, (const char*)entry, (size_t)(CACHE_HEADER_SIZE + total)) && fchmod(fd, 0644) == 0;
+        ok = (close(fd) == 0) && ok;
+        // renaming publishes the whole entry at once
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, key->entry);
+        if (!ok || rename(temp, path) != 0) {
+            unlink(temp);
+            ok = false;
+        }
+    }
+    free(entry);
+    if (ok && fd >= 0) {
+        update_usage(cache, CACHE_HEADER_SIZE + total);
+    }
+    return ok && fd >= 0;
+}
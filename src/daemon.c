@@ -0,0 +1,590 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+// written and closed, renamed into place, or gone
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define LISTEN_BACKLOG 64
+#define READ_CHUNK 4096 // bytes received from a client at a time, at least
+#define SEND_TIMEOUT 5 // seconds a client may leave an answer unread before it is dropped
+
+typedef struct {
+    const char* path;
+    const char* name; // last component of path, as inotify events name it
+    int watch; // of its directory, -1 when that is not watched
+    bool stale; // changed since the last parse
+    Parser* parser; // kept between parses, with the tables of the last one
+    bool tables; // the parser's tables can be queried
+    DiagnosticList diagnostics; // of the last parse, load errors included
+    bool result;
+    uint32_t generation;
+} WatchedFile;
+
+typedef struct {
+    int fd;
+    unsigned char* data; // received bytes not answered yet
+    size_t length;
+    size_t capacity;
+} Client;
+
+typedef struct {
+    WatchedFile* files;
+    size_t file_count;
+    int notify; // inotify descriptor
+    Client* clients;
+    size_t client_count;
+    size_t client_capacity;
+    unsigned char* out; // the response being built
+    size_t out_length;
+    size_t out_capacity;
+    bool out_failed; // out of memory while building it
+} Daemon;
+
+// Arguments of a request, taken front to back.
+typedef struct {
+    const unsigned char* p;
+    size_t left;
+    bool ok; // false once an argument ran past the end
+} Request;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal) {
+    (void)signal;
+    stop_requested = 1;
+}
+
+static void put_bytes(Daemon* d, const void* bytes, size_t length) {
+    if (d->out_length + length > d->out_capacity) {
+        size_t capacity = d->out_capacity ? d->out_capacity : 4096;
+        while (capacity < d->out_length + length) {
+            capacity *= 2;
+        }
+        unsigned char* out = (unsigned char*)realloc(d->out, capacity);
+        if (!out) {
+            d->out_failed = true;
+            return;
+        }
+        d->out = out;
+        d->out_capacity = capacity;
+    }
+    memcpy(d->out + d->out_length, bytes, length);
+    d->out_length += length;
+}
+
+static void write_u32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t read_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u8(Daemon* d, uint8_t v) {
+    put_bytes(d, &v, 1);
+}
+
+static void put_u32(Daemon* d, uint32_t v) {
+    unsigned char bytes[4];
+    write_u32(bytes, v);
+    put_bytes(d, bytes, sizeof(bytes));
+}
+
+static void put_i32(Daemon* d, int v) {
+    put_u32(d, (uint32_t)v);
+}
+
+static void put_str(Daemon* d, const char* s, size_t length) {
+    if (length > UINT16_MAX) {
+        length = UINT16_MAX;
+    }
+    unsigned char bytes[2] = { (unsigned char)length, (unsigned char)(length >> 8) };
+    put_bytes(d, bytes, sizeof(bytes));
+    put_bytes(d, s, length);
+}
+
+static uint8_t take_u8(Request* r) {
+    if (r->left < 1) {
+        r->ok = false;
+        return 0;
+    }
+    r->left--;
+    return *r->p++;
+}
+
+static uint32_t take_u32(Request* r) {
+    if (r->left < 4) {
+        r->ok = false;
+        return 0;
+    }
+    uint32_t v = read_u32(r->p);
+    r->p += 4;
+    r->left -= 4;
+    return v;
+}
+
+static const char* take_str(Request* r, size_t* length) {
+    if (r->left < 2 || r->left - 2 < (size_t)(r->p[0] | r->p[1] << 8)) {
+        r->ok = false;
+        *length = 0;
+        return "";
+    }
+    *length = (size_t)(r->p[0] | r->p[1] << 8);
+    const char* s = (const char*)r->p + 2;
+    r->p += 2 + *length;
+    r->left -= 2 + *length;
+    return s;
+}
+
+static void put_variable(Daemon* d, const VariableEntry* var) {
+    put_i32(d, var->vkind);
+    put_i32(d, (int)var->vtype);
+    put_i32(d, var->vlev);
+    put_i32(d, var->vaddr);
+}
+
+static DaemonStatus list_files(Daemon* d) {
+    put_u32(d, (uint32_t)d->file_count);
+    for (size_t i = 0; i < d->file_count; i++) {
+        WatchedFile* file = &d->files[i];
+        put_str(d, file->path, strlen(file->path));
+        put_u8(d, file->result);
+        put_u32(d, file->generation);
+    }
+    return DAEMON_OK;
+}
+
+static DaemonStatus lookup_variable(Daemon* d, WatchedFile* file, const char* name, size_t name_length,
+                                    const char* proc, size_t proc_length) {
+    Parser* parser = file->parser;
+    // names that were never interned cannot be in the tables
+    Atom vname = find_atom(&parser->atoms, name, name_length);
+    Atom vproc = find_atom(&parser->atoms, proc, proc_length);
+    VariableEntry* var = vname != ATOM_NONE && vproc != ATOM_NONE ? find_variable(parser, vname, vproc) : NULL;
+    if (!var) {
+        return DAEMON_NOT_FOUND;
+    }
+    put_variable(d, var);
+    return DAEMON_OK;
+}
+
+static DaemonStatus list_variables(Daemon* d, WatchedFile* file, const char* proc, size_t proc_length) {
+    Parser* parser = file->parser;
+    Atom vproc = find_atom(&parser->atoms, proc, proc_length);
+    if (vproc == ATOM_NONE || (vproc != find_atom(&parser->atoms, "main", 4) && !find_procedure(parser, vproc))) {
+        return DAEMON_NOT_FOUND;
+    }
+    size_t count_at = d->out_length;
+    uint32_t count = 0;
+    put_u32(d, 0);
+    for (size_t i = 0; i < parser->var_count; i++) {
+        VariableEntry* var = variable_at(parser, i);
+        if (var->vproc == vproc) {
+            put_str(d, atom_name(&parser->atoms, var->vname), atom_length(&parser->atoms, var->vname));
+            put_variable(d, var);
+            count++;
+        }
+    }
+    if (!d->out_failed) {
+        write_u32(d->out + count_at, count);
+    }
+    return DAEMON_OK;
+}
+
+static DaemonStatus list_procedures(Daemon* d, WatchedFile* file) {
+    Parser* parser = file->parser;
+    put_u32(d, (uint32_t)parser->proc_count);
+    for (size_t i = 0; i < parser->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(parser, i);
+        put_str(d, atom_name(&parser->atoms, proc->pname), atom_length(&parser->atoms, proc->pname));
+        put_i32(d, (int)proc->ptype);
+        put_i32(d, proc->plev);
+        put_i32(d, proc->faddr);
+        put_i32(d, proc->laddr);
+        // body_end is past the 'end'; a body cut short by an error has no span
+        bool spanned = proc->body_end > proc->body_start;
+        put_i32(d, spanned ? token_line(parser, proc->body_start) : 0);
+        put_i32(d, spanned ? token_line(parser, proc->body_end - 1) : 0);
+    }
+    return DAEMON_OK;
+}
+
+static DaemonStatus list_diagnostics(Daemon* d, WatchedFile* file) {
+    const DiagnosticList* list = &file->diagnostics;
+    put_u8(d, file->result);
+    put_u32(d, (uint32_t)list->count);
+    for (size_t i = 0; i < list->count; i++) {
+        const Diagnostic* diag = &list->items[i];
+        put_i32(d, diag->line);
+        // without the "LINE:n " prefix and the newline
+        put_str(d, list->text + diag->message, diag->offset + diag->length - diag->message - 1);
+    }
+    return DAEMON_OK;
+}
+
+// Runs one request, leaving its results in the response.
+static DaemonStatus dispatch(Daemon* d, Request* r) {
+    uint8_t opcode = take_u8(r);
+    if (opcode == DAEMON_FILES) {
+        return r->ok && r->left == 0 ? list_files(d) : DAEMON_BAD_REQUEST;
+    }
+    uint32_t index = take_u32(r);
+    const char* name = "";
+    const char* proc = "";
+    size_t name_length = 0;
+    size_t proc_length = 0;
+    if (opcode == DAEMON_VARIABLE) {
+        name = take_str(r, &name_length);
+    }
+    if (opcode == DAEMON_VARIABLE || opcode == DAEMON_VARIABLES) {
+        proc = take_str(r, &proc_length);
+    }
+    if (!r->ok || r->left != 0 || opcode < DAEMON_VARIABLE || opcode > DAEMON_DIAGNOSTICS) {
+        return DAEMON_BAD_REQUEST;
+    }
+    if (index >= d->file_count) {
+        return DAEMON_NOT_FOUND;
+    }
+    WatchedFile* file = &d->files[index];
+    if (opcode == DAEMON_DIAGNOSTICS) {
+        return list_diagnostics(d, file);
+    }
+    if (!file->tables) {
+        return DAEMON_NOT_FOUND;
+    }
+    switch (opcode) {
+    case DAEMON_VARIABLE:
+        return lookup_variable(d, file, name, name_length, proc, proc_length);
+    case DAEMON_VARIABLES:
+        return list_variables(d, file, proc, proc_length);
+    default:
+        return list_procedures(d, file);
+    }
+}
+
+// Builds the response frame to a request; false if it did not fit in memory.
+static bool answer(Daemon* d, Request* r) {
+    d->out_length = 0;
+    d->out_failed = false;
+    put_u32(d, 0);
+    put_u8(d, DAEMON_OK);
+    DaemonStatus status = dispatch(d, r);
+    if (d->out_failed) {
+        return false;
+    }
+    if (status != DAEMON_OK) {
+        d->out_length = 5; // no results with an error
+    }
+    d->out[4] = (unsigned char)status;
+    write_u32(d->out, (uint32_t)(d->out_length - 4));
+    return true;
+}
+
+static bool send_all(int fd, const unsigned char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Reads what the client sent and answers every whole request in it; false
+// once the connection is to be closed.
+static bool serve_client(Daemon* d, Client* client) {
+    if (client->capacity - client->length < READ_CHUNK) {
+        size_t capacity = client->length + READ_CHUNK * 2;
+        unsigned char* data = (unsigned char*)realloc(client->data, capacity);
+        if (!data) {
+            return false;
+        }
+        client->data = data;
+        client->capacity = capacity;
+    }
+    ssize_t n = recv(client->fd, client->data + client->length, client->capacity - client->length, 0);
+    if (n <= 0) {
+        return n < 0 && errno == EINTR;
+    }
+    client->length += (size_t)n;
+
+    size_t start = 0;
+    while (client->length - start >= 4) {
+        uint32_t length = read_u32(client->data + start);
+        if (length > DAEMON_MAX_REQUEST) {
+            return false;
+        }
+        if (client->length - start - 4 < length) {
+            break;
+        }
+        Request request = { client->data + start + 4, length, true };
+        if (!answer(d, &request) || !send_all(client->fd, d->out, d->out_length)) {
+            return false;
+        }
+        start += 4 + (size_t)length;
+    }
+    memmove(client->data, client->data + start, client->length - start);
+    client->length -= start;
+    return true;
+}
+
+static void accept_client(Daemon* d, int listener) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    if (d->client_count >= d->client_capacity) {
+        size_t capacity = d->client_capacity ? d->client_capacity * 2 : 16;
+        Client* clients = (Client*)realloc(d->clients, capacity * sizeof(Client));
+        if (!clients) {
+            close(fd);
+            return;
+        }
+        d->clients = clients;
+        d->client_capacity = capacity;
+    }
+    // answers are sent blocking; a client that stops reading them is dropped
+    struct timeval timeout = { SEND_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    Client* client = &d->clients[d->client_count++];
+    memset(client, 0, sizeof(Client));
+    client->fd = fd;
+}
+
+static void record_diagnostic(void* context, int line, const char* message) {
+    WatchedFile* file = (WatchedFile*)context;
+    if (!add_diagnostic(&file->diagnostics, line, message)) {
+        perror("Failed to record diagnostic");
+    }
+}
+
+static void parse_file(WatchedFile* file) {
+    clear_diagnostics(&file->diagnostics);
+    Parser* parser = file->parser;
+    file->tables = parser_reset(parser);
+    file->result = file->tables && parser_load_tokens(parser, file->path) && program(parser);
+    file->stale = false;
+    file->generation++;
+    printf("%s: Parsing %s\n", file->path, file->result ? "successful" : "failed");
+    fflush(stdout);
+}
+
+// Watches the directory of the file rather than the file, so that a new
+// file renamed over it is seen as well.
+static void watch_file(Daemon* d, WatchedFile* file) {
+    const char* slash = strrchr(file->path, '/');
+    file->name = slash ? slash + 1 : file->path;
+    char* dir = slash ? strndup(file->path, slash == file->path ? 1 : (size_t)(slash - file->path)) : strdup(".");
+    file->watch = dir ? inotify_add_watch(d->notify, dir, WATCH_EVENTS) : -1;
+    if (file->watch < 0) {
+        fprintf(stderr, "Warning: not watching %s for changes: %s\n", file->path, strerror(errno));
+    }
+    free(dir);
+}
+
+// Marks the files named by pending inotify events, then parses them again.
+static void read_events(Daemon* d) {
+    union {
+        struct inotify_event event;
+        char bytes[16384];
+    } buffer;
+    ssize_t n;
+    while ((n = read(d->notify, buffer.bytes, sizeof(buffer.bytes))) > 0) {
+        for (char* p = buffer.bytes; p < buffer.bytes + n;) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            for (size_t i = 0; i < d->file_count; i++) {
+                WatchedFile* file = &d->files[i];
+                if (event->mask & IN_Q_OVERFLOW) {
+                    file->stale = true; // events were lost
+                }
+                else if (file->watch == event->wd && (event->mask & IN_IGNORED)) {
+                    file->watch = -1; // the directory is gone
+                }
+                else if (file->watch == event->wd && event->len > 0 && strcmp(file->name, event->name) == 0) {
+                    file->stale = true;
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    for (size_t i = 0; i < d->file_count; i++) {
+        if (d->files[i].stale) {
+            parse_file(&d->files[i]);
+        }
+    }
+}
+
+// Whether a daemon is still listening on the socket at addr.
+static bool socket_in_use(const struct sockaddr_un* addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return true;
+    }
+    bool in_use = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == 0 || errno != ECONNREFUSED;
+    close(fd);
+    return in_use;
+}
+
+static int listen_on(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Failed to create socket");
+        return -1;
+    }
+    int bound = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    struct stat st;
+    if (bound < 0 && errno == EADDRINUSE && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) && !socket_in_use(&addr)) {
+        // left behind by a daemon that did not exit cleanly
+        unlink(path);
+        bound = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (bound < 0 || listen(fd, LISTEN_BACKLOG) < 0) {
+        fprintf(stderr, "Error listening on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Waits for requests and file changes until SIGINT or SIGTERM.
+static void serve(Daemon* d, int listener) {
+    struct pollfd* fds = NULL;
+    size_t fd_capacity = 0;
+    while (!stop_requested) {
+        size_t count = d->client_count + 2;
+        if (count > fd_capacity) {
+            struct pollfd* grown = (struct pollfd*)realloc(fds, count * 2 * sizeof(struct pollfd));
+            if (!grown) {
+                perror("Failed to allocate poll set");
+                break;
+            }
+            fds = grown;
+            fd_capacity = count * 2;
+        }
+        fds[0].fd = listener;
+        fds[1].fd = d->notify;
+        for (size_t i = 0; i < d->client_count; i++) {
+            fds[i + 2].fd = d->clients[i].fd;
+        }
+        for (size_t i = 0; i < count; i++) {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, (nfds_t)count, -1) < 0) {
+            if (errno != EINTR) {
+                perror("Failed to wait for requests");
+                break;
+            }
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            read_events(d);
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < d->client_count; i++) {
+            Client client = d->clients[i];
+            if (fds[i + 2].revents == 0 || serve_client(d, &client)) {
+                d->clients[kept++] = client;
+            }
+            else {
+                close(client.fd);
+                free(client.data);
+            }
+        }
+        d->client_count = kept;
+        if (fds[0].revents & POLLIN) {
+            accept_client(d, listener);
+        }
+    }
+    free(fds);
+}
+
+// Parses the files, then answers queries on the socket at socket_path and
+// parses each file again when it changes, until SIGINT or SIGTERM. Returns
+// the exit status.
+int run_daemon(const char* socket_path, char* const* paths, size_t count, const DaemonOptions* options) {
+    Daemon d;
+    memset(&d, 0, sizeof(d));
+    d.notify = inotify_init1(IN_NONBLOCK);
+    if (d.notify < 0) {
+        perror("Failed to watch files");
+        return 1;
+    }
+    d.files = (WatchedFile*)calloc(count ? count : 1, sizeof(WatchedFile));
+    bool ok = d.files != NULL;
+    for (; ok && d.file_count < count; d.file_count++) {
+        WatchedFile* file = &d.files[d.file_count];
+        file->path = paths[d.file_count];
+        ParserSinks sinks = { file, NULL, NULL, record_diagnostic };
+        file->parser = create_buffer_parser("", 0, &sinks);
+        if (!file->parser) {
+            ok = false;
+            break;
+        }
+        file->parser->engine = options->engine;
+        file->parser->scanner = options->scanner;
+        file->parser->collect_errors = options->collect_errors;
+        file->parser->max_errors = options->max_errors;
+        file->parser->threads = options->threads;
+        watch_file(&d, file);
+        parse_file(file);
+    }
+
+    int listener = ok ? listen_on(socket_path) : -1;
+    if (listener >= 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = request_stop; // without SA_RESTART, so that poll() returns
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        printf("Listening on %s\n", socket_path);
+        fflush(stdout);
+        serve(&d, listener);
+        close(listener);
+        unlink(socket_path);
+    }
+
+    for (size_t i = 0; i < d.client_count; i++) {
+        close(d.clients[i].fd);
+        free(d.clients[i].data);
+    }
+    for (size_t i = 0; i < d.file_count; i++) {
+        destroy_parser(d.files[i].parser);
+        free_diagnostics(&d.files[i].diagnostics);
+    }
+    free(d.clients);
+    free(d.files);
+    free(d.out);
+    close(d.notify);
+    return listener >= 0 ? 0 : 1;
+}
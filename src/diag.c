@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <string.h>
+#include "diag.h"
+#include "writer.h"
+
+bool add_diagnostic(DiagnosticList* list, int line, const char* msg) {
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 16;
+        Diagnostic* new_items = (Diagnostic*)realloc(list->items, new_capacity * sizeof(Diagnostic));
+        if (!new_items) {
+            return false;
+        }
+        list->items = new_items;
+        list->capacity = new_capacity;
+    }
+
+    int prefix = snprintf(NULL, 0, "LINE:%d ", line);
+    int len = snprintf(NULL, 0, "LINE:%d %s\n", line, msg);
+    if (prefix < 0 || len < 0) {
+        return false;
+    }
+    size_t needed = list->text_len + (size_t)len + 1;
+    if (needed > list->text_capacity) {
+        size_t new_capacity = list->text_capacity ? list->text_capacity : 1024;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        char* new_text = (char*)realloc(list->text, new_capacity);
+        if (!new_text) {
+            return false;
+        }
+        list->text = new_text;
+        list->text_capacity = new_capacity;
+    }
+    snprintf(list->text + list->text_len, (size_t)len + 1, "LINE:%d %s\n", line, msg);
+
+    Diagnostic* diag = &list->items[list->count++];
+    diag->line = line;
+    diag->offset = list->text_len;
+    diag->length = (size_t)len;
+    diag->message = list->text_len + (size_t)prefix;
+    list->text_len += (size_t)len;
+    return true;
+}
+
+void write_diagnostics(const DiagnosticList* list, FILE* file) {
+    if (file && list->text_len > 0) {
+        write_stream(file, list->text, list->text_len);
+    }
+}
+
+void clear_diagnostics(DiagnosticList* list) {
+    list->count = 0;
+    list->text_len = 0;
+}
+
+void free_diagnostics(DiagnosticList* list) {
+    free(list->items);
+    free(list->text);
+    memset(list, 0, sizeof(DiagnosticList));
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+#include "dydb.h"
+
+static uint32_t read_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t read_u64(const unsigned char* p) {
+    return (uint64_t)read_u32(p) | (uint64_t)read_u32(p + 4) << 32;
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void put_u64(unsigned char* p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static bool has_value(int type) {
+    return type == IDENT || type == CONST;
+}
+
+// Fills the parser's tokens from a mapped .dydb image. The file's atom IDs are
+// remapped onto the parser's atom table, which may already hold atoms, so the
+// pool is re-interned and the values decoded rather than copied.
+bool load_dydb(Parser* parser, const unsigned char* data, size_t size, char* error, size_t error_size) {
+    if (size < DYDB_HEADER_SIZE || memcmp(data, DYDB_MAGIC, 4) != 0) {
+        snprintf(error, error_size, "Error: not a .dydb file");
+        return false;
+    }
+    if (read_u32(data + 4) != DYDB_VERSION) {
+        snprintf(error, error_size, "Error: unsupported .dydb version %u", read_u32(data + 4));
+        return false;
+    }
+    uint64_t token_count = read_u64(data + 8);
+    uint64_t value_bytes = read_u64(data + 16);
+    uint64_t pool_bytes = read_u64(data + 24);
+    uint32_t atom_count = read_u32(data + 32);
+    uint64_t body = size - DYDB_HEADER_SIZE;
+    if (token_count > body || value_bytes > body - token_count || pool_bytes != body - token_count - value_bytes) {
+        snprintf(error, error_size, "Error: truncated .dydb file");
+        return false;
+    }
+
+    const unsigned char* types = data + DYDB_HEADER_SIZE;
+    const unsigned char* values = types + token_count;
+    const unsigned char* values_end = values + value_bytes;
+    const char* pool = (const char*)values_end;
+    const char* pool_end = pool + pool_bytes;
+
+    // EOLNs go to the line breaks, the rest to the token arrays
+    size_t line_breaks = 0;
+    for (size_t i = 0; i < token_count; i++) {
+        line_breaks += types[i] == EOLN;
+    }
+    uint32_t* remap = (uint32_t*)malloc(((size_t)atom_count + 1) * sizeof(uint32_t));
+    if (!remap || !reserve_tokens(parser, (size_t)token_count - line_breaks, line_breaks)) {
+        free(remap);
+        snprintf(error, error_size, "Error: failed to allocate tokens");
+        return false;
+    }
+
+    remap[0] = ATOM_NONE;
+    const char* name = pool;
+    for (uint32_t i = 1; i <= atom_count; i++) {
+        const char* nul = name < pool_end ? memchr(name, '\0', pool_end - name) : NULL;
+        if (!nul) {
+            free(remap);
+            snprintf(error, error_size, "Error: corrupt .dydb string pool");
+            return false;
+        }
+        remap[i] = intern_atom(&parser->atoms, name, nul - name);
+        if (remap[i] == ATOM_NONE) {
+            free(remap);
+            snprintf(error, error_size, "Error: failed to intern identifier");
+            return false;
+        }
+        name = nul + 1;
+    }
+
+    uint8_t* token_types = parser->token_types;
+    Atom* token_values = parser->token_values;
+    size_t n = 0;
+    size_t b = 0;
+    const unsigned char* p = values;
+    for (size_t i = 0; i < token_count; i++) {
+        if (types[i] == EOLN) {
+            parser->line_breaks[b++] = (uint32_t)n;
+            continue;
+        }
+        token_types[n] = (uint8_t)checked_token_type(types[i]);
+        token_values[n] = ATOM_NONE;
+        if (has_value(types[i])) {
+            uint64_t id = 0;
+            int shift = 0;
+            do {
+                if (p >= values_end || shift > 28) {
+                    free(remap);
+                    snprintf(error, error_size, "Error: corrupt .dydb value stream");
+                    return false;
+                }
+                id |= (uint64_t)(*p & 0x7f) << shift;
+                shift += 7;
+            } while (*p++ & 0x80);
+            if (id == 0 || id > atom_count) {
+                free(remap);
+                snprintf(error, error_size, "Error: corrupt .dydb value stream");
+                return false;
+            }
+            token_values[n] = remap[id];
+        }
+        n++;
+    }
+    parser->token_count = n;
+    parser->line_break_count = b;
+    free(remap);
+    return true;
+}
+
+// Writes the loaded tokens as .dydb. Only atoms the tokens use are stored,
+// numbered by first use so that frequent early names get short varints.
+bool write_dydb_file(Parser* parser, const char* filename) {
+    close_token_gap(parser);
+    size_t count = input_token_count(parser);
+    uint32_t* file_id = (uint32_t*)calloc(parser->atoms.count, sizeof(uint32_t));
+    unsigned char* values = (unsigned char*)malloc(parser->token_count * 5 + 1);
+    unsigned char* types = (unsigned char*)malloc(count + 1);
+    if (!file_id || !values || !types) {
+        free(file_id);
+        free(values);
+        free(types);
+        return false;
+    }
+
+    uint32_t atom_count = 0;
+    uint64_t pool_bytes = 0;
+    size_t value_bytes = 0;
+    TokenCursor cursor = { 0, 0 };
+    Token token;
+    for (size_t i = 0; next_input_token(parser, &cursor, &token); i++) {
+        types[i] = (unsigned char)token.type;
+        if (!has_value(token.type)) {
+            continue;
+        }
+        if (file_id[token.value] == 0) {
+            file_id[token.value] = ++atom_count;
+            pool_bytes += atom_length(&parser->atoms, token.value) + 1;
+        }
+        uint32_t id = file_id[token.value];
+        while (id >= 0x80) {
+            values[value_bytes++] = (unsigned char)(id | 0x80);
+            id >>= 7;
+        }
+        values[value_bytes++] = (unsigned char)id;
+    }
+
+    unsigned char header[DYDB_HEADER_SIZE];
+    memcpy(header, DYDB_MAGIC, 4);
+    put_u32(header + 4, DYDB_VERSION);
+    put_u64(header + 8, count);
+    put_u64(header + 16, value_bytes);
+    put_u64(header + 24, pool_bytes);
+    put_u32(header + 32, atom_count);
+    put_u32(header + 36, 0);
+
+    bool ok = false;
+    FILE* file = fopen(filename, "wb");
+    if (file) {
+        ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+             fwrite(types, 1, count, file) == count &&
+             fwrite(values, 1, value_bytes, file) == value_bytes;
+        // file IDs follow first use, so walking the tokens again yields the pool in order
+        uint32_t written = 0;
+        for (size_t i = 0; ok && i < parser->token_count && written < atom_count; i++) {
+            Atom value = parser->token_values[i];
+            if (has_value(parser->token_types[i]) && file_id[value] == written + 1) {
+                const char* name = atom_name(&parser->atoms, value);
+                size_t len = atom_length(&parser->atoms, value) + 1;
+                ok = fwrite(name, 1, len, file) == len;
+                written++;
+            }
+        }
+        ok = (fclose(file) == 0) && ok;
+    }
+
+    free(file_id);
+    free(values);
+    free(types);
+    return ok;
+}
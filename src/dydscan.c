@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+#include "dydscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DYD_SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define NAME_CACHE_SIZE 4096 // slots of the short name cache, a power of two
+
+// A name of 1 to 8 bytes as an integer, the bytes past it cleared, and the atom it was interned as.
+typedef struct {
+    uint64_t word;
+    uint32_t length;
+    Atom atom;
+} CachedName;
+
+// The token arrays being filled, written directly while they have room.
+typedef struct {
+    Parser* parser;
+    size_t count;
+    size_t break_count;
+    const char* line; // start of the line being scanned
+    const char* space; // its first space, or NULL before one was seen
+    const char* end; // of the text
+    CachedName* names; // recently interned short names, or NULL
+    const char* error;
+} DydLoader;
+
+// Hands the counts back to the parser, for append_token() or at the end.
+static void sync_counts(DydLoader* loader) {
+    loader->parser->token_count = loader->count;
+    loader->parser->line_break_count = loader->break_count;
+}
+
+static bool emit_token(DydLoader* loader, TokenType type, Atom value) {
+    Parser* parser = loader->parser;
+    if (type == EOLN) {
+        if (loader->break_count < parser->line_break_capacity && loader->count <= UINT32_MAX) {
+            parser->line_breaks[loader->break_count++] = (uint32_t)loader->count;
+            return true;
+        }
+    }
+    else if (loader->count < parser->token_capacity) {
+        parser->token_types[loader->count] = (uint8_t)type;
+        parser->token_values[loader->count++] = value;
+        return true;
+    }
+    // full: append_token() grows the arrays
+    sync_counts(loader);
+    if (!append_token(parser, type, value)) {
+        loader->error = "Error: failed to allocate tokens";
+        return false;
+    }
+    loader->count = parser->token_count;
+    loader->break_count = parser->line_break_count;
+    return true;
+}
+
+// intern_atom(), answered without hashing the name for the short names a
+// program repeats on most of its lines.
+static inline Atom intern_value(DydLoader* loader, const char* name, size_t length) {
+    if (!loader->names || length == 0 || length > 8 || loader->end - name < 8) {
+        return intern_atom(&loader->parser->atoms, name, length);
+    }
+    uint64_t word;
+    memcpy(&word, name, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word >>= 64 - 8 * length;
+#else
+    word &= ~(uint64_t)0 >> (64 - 8 * length);
+#endif
+    CachedName* cached = &loader->names[((word + length) * 0x9e3779b97f4a7c15u) >> 52 & (NAME_CACHE_SIZE - 1)];
+    if (cached->word != word || cached->length != length || cached->atom == ATOM_NONE) {
+        cached->atom = intern_atom(&loader->parser->atoms, name, length);
+        cached->word = word;
+        cached->length = (uint32_t)length;
+    }
+    return cached->atom;
+}
+
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Decodes the line [line, eol) with scan_token_line(), for type columns
+// other than a plain one- or two-digit number.
+static bool emit_scanned_line(DydLoader* loader, const char* line, const char* eol) {
+    Token token;
+    ScanResult result = scan_token_line(&loader->parser->atoms, line, eol, &token);
+    if (result == SCAN_OK) {
+        return emit_token(loader, token.type, token.value);
+    }
+    loader->error = result == SCAN_NO_MEMORY ? "Error: failed to intern identifier" : "Error: invalid line format";
+    return false;
+}
+
+// Decodes the line [line, eol) whose first space is space (NULL if it has
+// none), with the same result as scan_token_line().
+static inline bool emit_line(DydLoader* loader, const char* line, const char* eol, const char* space) {
+    if (line == eol) {
+        return true; // Skip empty lines
+    }
+    if (!space) {
+        loader->error = "Error: invalid line format";
+        return false;
+    }
+    const char* digits = space + 1;
+    ptrdiff_t width = eol - digits;
+    bool plain = (width == 1 || width == 2) && is_digit(digits[0]) && (width == 1 || is_digit(digits[1]));
+    if (!plain) {
+        return emit_scanned_line(loader, line, eol);
+    }
+    TokenType type = checked_token_type(width == 1 ? digits[0] - '0' : (digits[0] - '0') * 10 + (digits[1] - '0'));
+    Atom value = ATOM_NONE;
+    if (type == IDENT || type == CONST) {
+        value = intern_value(loader, line, space - line);
+        if (value == ATOM_NONE) {
+            loader->error = "Error: failed to intern identifier";
+            return false;
+        }
+    }
+    return emit_token(loader, type, value);
+}
+
+// Finishes the lines in [begin, end) one byte at a time, and the last line
+// if the text does not end with a line break.
+static bool scan_tail(DydLoader* loader, const char* begin, const char* end) {
+    for (const char* p = begin; p < end; p++) {
+        if (*p == '\n') {
+            if (!emit_line(loader, loader->line, p, loader->space)) {
+                return false;
+            }
+            loader->line = p + 1;
+            loader->space = NULL;
+        }
+        else if (*p == ' ' && !loader->space) {
+            loader->space = p;
+        }
+    }
+    return loader->line >= end || emit_line(loader, loader->line, end, loader->space);
+}
+
+static bool scan_scalar(DydLoader* loader, const char* begin, const char* end) {
+    const char* line = begin;
+    while (line < end) {
+        const char* eol = memchr(line, '\n', end - line);
+        if (!eol) eol = end;
+        if (!emit_line(loader, line, eol, memchr(line, ' ', eol - line))) {
+            return false;
+        }
+        line = eol + 1;
+    }
+    return true;
+}
+
+#ifdef DYD_SCAN_X86
+// Walks the line breaks and spaces of the 64 bytes at p, given as bit masks.
+static inline bool scan_bits(DydLoader* loader, const char* p, uint64_t newlines, uint64_t spaces) {
+    uint64_t bits = newlines | spaces;
+    while (bits) {
+        unsigned offset = (unsigned)__builtin_ctzll(bits);
+        bits &= bits - 1;
+        if (newlines >> offset & 1) {
+            if (!emit_line(loader, loader->line, p + offset, loader->space)) {
+                return false;
+            }
+            loader->line = p + offset + 1;
+            loader->space = NULL;
+        }
+        else if (!loader->space) {
+            loader->space = p + offset;
+        }
+    }
+    return true;
+}
+
+__attribute__((target("sse2")))
+static bool scan_sse2(DydLoader* loader, const char* begin, const char* end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i space = _mm_set1_epi8(' ');
+    const char* p = begin;
+    for (; end - p >= 64; p += 64) {
+        uint64_t newlines = 0;
+        uint64_t spaces = 0;
+        for (int i = 0; i < 4; i++) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+            newlines |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)) << (16 * i);
+            spaces |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)) << (16 * i);
+        }
+        if (!scan_bits(loader, p, newlines, spaces)) {
+            return false;
+        }
+    }
+    return scan_tail(loader, p, end);
+}
+
+__attribute__((target("avx2")))
+static bool scan_avx2(DydLoader* loader, const char* begin, const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const char* p = begin;
+    for (; end - p >= 64; p += 64) {
+        __m256i low = _mm256_loadu_si256((const __m256i*)p);
+        __m256i high = _mm256_loadu_si256((const __m256i*)(p + 32));
+        uint64_t newlines = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newline)) |
+                            (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newline)) << 32;
+        uint64_t spaces = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, space)) |
+                          (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, space)) << 32;
+        if (!scan_bits(loader, p, newlines, spaces)) {
+            return false;
+        }
+    }
+    return scan_tail(loader, p, end);
+}
+#endif
+
+DydScanner best_dyd_scanner(void) {
+#ifdef DYD_SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return DYD_SCAN_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return DYD_SCAN_SSE2;
+    }
+#endif
+    return DYD_SCAN_SCALAR;
+}
+
+bool dyd_scanner_supported(DydScanner scanner) {
+    return scanner <= best_dyd_scanner();
+}
+
+const char* dyd_scanner_name(DydScanner scanner) {
+    static const char* const names[] = { "auto", "scalar", "sse2", "avx2" };
+    return names[scanner];
+}
+
+// Fills the parser's tokens from .dyd text with the parser's scanner, or the
+// best one if the CPU does not support that. On failure a message is left in error.
+bool load_dyd(Parser* parser, const char* data, size_t size, char* error, size_t error_size) {
+    // lines are usually 5 to 10 bytes long; the arrays grow if that was too few
+    if (!reserve_tokens(parser, size / 6 + 16, size / 24 + 16)) {
+        snprintf(error, error_size, "Error: failed to allocate tokens");
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+    const char* end = data + size;
+    DydLoader loader = { parser, 0, 0, data, NULL, end, NULL, NULL };
+    loader.names = (CachedName*)calloc(NAME_CACHE_SIZE, sizeof(CachedName)); // only an optimization
+    DydScanner scanner = parser->scanner;
+    if (scanner == DYD_SCAN_AUTO || !dyd_scanner_supported(scanner)) {
+        scanner = best_dyd_scanner();
+    }
+    bool ok;
+    switch (scanner) {
+#ifdef DYD_SCAN_X86
+    case DYD_SCAN_AVX2:
+        ok = scan_avx2(&loader, data, end);
+        break;
+    case DYD_SCAN_SSE2:
+        ok = scan_sse2(&loader, data, end);
+        break;
+#endif
+    default:
+        ok = scan_scalar(&loader, data, end);
+        break;
+    }
+    sync_counts(&loader);
+    free(loader.names);
+    if (!ok) {
+        snprintf(error, error_size, "%s", loader.error);
+    }
+    return ok;
+}
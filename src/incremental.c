@@ -0,0 +1,636 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "incremental.h"
+#include "llparser.h"
+
+// Order keys. Every variable entry, and the start and the end of every
+// procedure, is an event in source order with a 64-bit key that grows with
+// that order. The first edit after a full parse numbers the events
+// KEY_SPACING apart; a reparsed body spreads its events evenly between the
+// keys of its procedure's parameter (or start) and end. So the variables a
+// reparse appends sort into place, and renumber_symbols() recovers vaddr,
+// faddr and laddr by counting keys.
+#define KEY_SPACING ((uint64_t)1 << 32)
+
+#define GAP_ROOM 4096 // spare token slots when the array has to grow for an edit
+
+typedef struct {
+    uint64_t key;
+    size_t position;
+} KeyedPosition;
+
+void reset_edits(Parser* parser, bool valid) {
+    EditState* edit = &parser->edit;
+    edit->valid = valid && !parser->stream;
+    edit->error_proc = 0;
+    edit->keyed = false;
+    edit->dirty = false;
+    edit->sorted = 0;
+    edit->hide_from = 0;
+    edit->hidden_procs = edit->hidden_procs_end = 0;
+}
+
+void free_edits(Parser* parser) {
+    free(parser->edit.var_keys);
+    free(parser->edit.proc_keys);
+}
+
+// Called with the 'begin' of the body as the current token.
+void open_body_span(Parser* parser, ProcedureEntry* proc) {
+    if (!proc) {
+        return;
+    }
+    proc->body_start = parser->token_index - 1;
+    // only the parameter can have been declared since the procedure's name
+    proc->param = parser->var_count > (size_t)proc->faddr ? proc->faddr : -1;
+    proc->var_start = (int)parser->var_count;
+}
+
+// Called with the token after the body as the current token.
+void close_body_span(Parser* parser, ProcedureEntry* proc) {
+    if (!proc) {
+        return;
+    }
+    // an EOLN is not stored, so the token after it is the next one
+    proc->body_end = parser->token_index - (parser->current_token.type != EOLN);
+    proc->var_end = (int)parser->var_count;
+}
+
+static bool reserve_keys(uint64_t** keys, size_t* capacity, size_t count) {
+    if (count <= *capacity) {
+        return true;
+    }
+    size_t new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    uint64_t* grown = (uint64_t*)realloc(*keys, new_capacity * sizeof(uint64_t));
+    if (!grown) {
+        return false;
+    }
+    *keys = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Keys base + step, base + 2 * step, ... for the events of the variable
+// positions [first, end) and of the procedures [proc_first, proc_end)
+// declared among them, whose faddr and laddr are positions as a parse leaves
+// them.
+static bool number_events(Parser* parser, size_t first, size_t end, size_t proc_first, size_t proc_end,
+                          uint64_t base, uint64_t step) {
+    EditState* edit = &parser->edit;
+    size_t* open = (size_t*)malloc((proc_end - proc_first + 1) * sizeof(size_t));
+    if (!open) {
+        return false;
+    }
+    size_t depth = 0;
+    size_t next = proc_first;
+    uint64_t key = base;
+    for (size_t p = first;; p++) {
+        // procedures that ended before p close, then those starting at p
+        // open; one without variables does both before the next opens
+        for (;;) {
+            while (depth > 0 && (size_t)(procedure_at(parser, open[depth - 1])->laddr + 1) <= p) {
+                edit->proc_keys[2 * open[--depth] + 1] = key += step;
+            }
+            if (next < proc_end && (size_t)procedure_at(parser, next)->faddr <= p) {
+                edit->proc_keys[2 * next] = key += step;
+                open[depth++] = next++;
+                continue;
+            }
+            break;
+        }
+        if (p == end) {
+            break;
+        }
+        edit->var_keys[p] = key += step;
+    }
+    while (depth > 0) { // only after errors
+        edit->proc_keys[2 * open[--depth] + 1] = key += step;
+    }
+    free(open);
+    return true;
+}
+
+static bool init_keys(Parser* parser) {
+    EditState* edit = &parser->edit;
+    if (!reserve_keys(&edit->var_keys, &edit->var_key_capacity, parser->var_count) ||
+        !reserve_keys(&edit->proc_keys, &edit->proc_key_capacity, 2 * parser->proc_count) ||
+        !number_events(parser, 0, parser->var_count, 0, parser->proc_count, 0, KEY_SPACING)) {
+        return false;
+    }
+    edit->sorted = parser->var_count;
+    edit->keyed = true;
+    return true;
+}
+
+static size_t slot(Parser* parser, size_t i) {
+    return i < parser->token_gap ? i : i + parser->token_gap_size;
+}
+
+static void move_tokens(Parser* parser, size_t to, size_t from, size_t count) {
+    memmove(parser->token_types + to, parser->token_types + from, count * sizeof(uint8_t));
+    memmove(parser->token_values + to, parser->token_values + from, count * sizeof(Atom));
+}
+
+// Replaces stored tokens, which keep a gap at the last edit: the next edit
+// moves only the tokens between the two, and the gap is closed only before a
+// full parse.
+static bool splice_tokens(Parser* parser, size_t first, size_t removed, const uint8_t* types, const Atom* values,
+                          size_t count) {
+    if (parser->token_gap_size == 0) { // the spare capacity is the gap
+        parser->token_gap = parser->token_count;
+        parser->token_gap_size = parser->token_capacity - parser->token_count;
+    }
+    size_t gap = parser->token_gap;
+    size_t size = parser->token_gap_size;
+    if (size + removed < count) {
+        size_t tail = parser->token_count - gap;
+        size_t capacity = parser->token_count - removed + count + parser->token_count / 16 + GAP_ROOM;
+        uint8_t* grown_types = (uint8_t*)realloc(parser->token_types, capacity * sizeof(uint8_t));
+        if (!grown_types) {
+            return false;
+        }
+        parser->token_types = grown_types;
+        Atom* grown_values = (Atom*)realloc(parser->token_values, capacity * sizeof(Atom));
+        if (!grown_values) {
+            return false;
+        }
+        parser->token_values = grown_values;
+        move_tokens(parser, capacity - tail, gap + size, tail);
+        parser->token_capacity = capacity;
+        size = capacity - parser->token_count;
+    }
+
+    if (size == 0) {
+        gap = first; // nothing to move
+    }
+    if (first < gap) {
+        move_tokens(parser, first + size, first, gap - first);
+    }
+    else if (first > gap) {
+        move_tokens(parser, gap, gap + size, first - gap);
+    }
+    size += removed;
+    memcpy(parser->token_types + first, types, count * sizeof(uint8_t));
+    memcpy(parser->token_values + first, values, count * sizeof(Atom));
+    parser->token_gap = first + count;
+    parser->token_gap_size = size - count;
+    parser->token_count = parser->token_count - removed + count;
+    return true;
+}
+
+// Makes room for count line breaks and keeps the gap open: the breaks after
+// it are counted back from the end, which an empty gap would not tell apart.
+static bool reserve_line_breaks(Parser* parser, size_t count) {
+    if (count < parser->line_break_capacity) {
+        return true;
+    }
+    size_t capacity = count + parser->line_break_count / 16 + GAP_ROOM;
+    uint32_t* grown = (uint32_t*)realloc(parser->line_breaks, capacity * sizeof(uint32_t));
+    if (!grown) {
+        return false;
+    }
+    if (parser->line_break_gap_size != 0) {
+        size_t tail = parser->line_break_count - parser->line_break_gap;
+        memmove(grown + capacity - tail, grown + parser->line_break_gap + parser->line_break_gap_size,
+                tail * sizeof(uint32_t));
+        parser->line_break_gap_size = capacity - parser->line_break_count;
+    }
+    parser->line_breaks = grown;
+    parser->line_break_capacity = capacity;
+    return true;
+}
+
+// Replaces the line breaks [first, first + removed) with count new ones, for
+// which there must be room. The breaks keep a gap at the last edit like the
+// tokens do; the ones after it are stored as the number of tokens after
+// them, so that they need no update when an edit before them inserts or
+// removes tokens. total is the number of stored tokens before the edit.
+static void splice_line_breaks(Parser* parser, size_t first, size_t removed, const uint32_t* breaks, size_t count,
+                               size_t total) {
+    uint32_t* line_breaks = parser->line_breaks;
+    if (parser->line_break_gap_size == 0) {
+        parser->line_break_gap = parser->line_break_count;
+        parser->line_break_gap_size = parser->line_break_capacity - parser->line_break_count;
+    }
+    size_t gap = parser->line_break_gap;
+    size_t size = parser->line_break_gap_size;
+    for (size_t i = gap; i > first; i--) {
+        line_breaks[i - 1 + size] = (uint32_t)(total - line_breaks[i - 1]);
+    }
+    for (size_t i = gap; i < first; i++) {
+        line_breaks[i] = (uint32_t)(total - line_breaks[i + size]);
+    }
+    size += removed;
+    memcpy(line_breaks + first, breaks, count * sizeof(uint32_t));
+    parser->line_break_gap = first + count;
+    parser->line_break_gap_size = size - count;
+    parser->line_break_count = parser->line_break_count - removed + count;
+}
+
+// Line breaks before the input token at index, which is where that token
+// falls among the line breaks; the stored tokens before it are the rest.
+static size_t breaks_before(Parser* parser, size_t index) {
+    size_t low = 0;
+    size_t high = parser->line_break_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (line_break(parser, mid) + mid < index) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Writes the outputs of a file parser from the start again.
+static void truncate_output(FILE* file) {
+    if (file && fflush(file) == 0) {
+        rewind(file);
+        if (ftruncate(fileno(file), 0) != 0) {
+            perror("Failed to truncate output file");
+        }
+    }
+}
+
+static bool reparse_all(Parser* parser) {
+    truncate_output(parser->err);
+    truncate_output(parser->pro);
+    truncate_output(parser->var);
+    if (!parser_rewind(parser)) {
+        return false;
+    }
+    return program(parser);
+}
+
+// The procedures whose bodies hold the stored tokens [first, first + removed),
+// outermost first. The edit must not touch the 'begin' or the 'end' of the
+// innermost one.
+static size_t enclosing_bodies(Parser* parser, size_t first, size_t removed, size_t* chain) {
+    size_t depth = 0;
+    for (size_t i = 0; i < parser->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(parser, i);
+        if (proc->body_start < first && first + removed < proc->body_end) {
+            chain[depth++] = i;
+        }
+    }
+    return depth;
+}
+
+static void remove_variables(Parser* parser, ProcedureEntry* proc) {
+    for (int i = proc->var_start; i < proc->var_end; i++) {
+        remove_variable(parser, (size_t)i);
+    }
+}
+
+// Reparses the body of the innermost procedure of chain, after count stored
+// tokens replaced removed ones in it. Returns false, leaving the
+// tables in any state, when only a full parse gives the right result.
+static bool reparse_body(Parser* parser, const size_t* chain, size_t depth, size_t removed, size_t count) {
+    EditState* edit = &parser->edit;
+    size_t f = chain[depth - 1];
+    ProcedureEntry* fn = procedure_at(parser, f);
+    size_t old_end = fn->body_end;
+    size_t body_end = old_end - removed + count;
+    size_t length = body_end - fn->body_start;
+
+    // the procedures declared in the body follow it in the table
+    size_t nested_end = f + 1;
+    while (nested_end < parser->proc_count && procedure_at(parser, nested_end)->body_start < old_end) {
+        nested_end++;
+    }
+    size_t nested = nested_end - f - 1;
+
+    // the line breaks after the 'begin', up to the token after the body
+    int line = token_line(parser, fn->body_start);
+    size_t break_first = (size_t)line - 1;
+    size_t break_count = (size_t)token_line(parser, body_end) - 1 - break_first;
+
+    uint8_t* body_types = (uint8_t*)malloc(length * sizeof(uint8_t));
+    Atom* body_values = (Atom*)malloc(length * sizeof(Atom));
+    uint32_t* body_breaks = (uint32_t*)malloc((break_count + 1) * sizeof(uint32_t));
+    if (!body_types || !body_values || !body_breaks) {
+        free(body_types);
+        free(body_values);
+        free(body_breaks);
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        size_t k = slot(parser, fn->body_start + i);
+        body_types[i] = parser->token_types[k];
+        body_values[i] = parser->token_values[k];
+    }
+    for (size_t i = 0; i < break_count; i++) {
+        body_breaks[i] = line_break(parser, break_first + i) - (uint32_t)fn->body_start;
+    }
+
+    // forget what the old body declared
+    remove_variables(parser, fn);
+    for (size_t i = f + 1; i < nested_end; i++) {
+        remove_variables(parser, procedure_at(parser, i));
+        unindex_procedure(parser, i);
+    }
+    if (fn->param >= 0) {
+        variable_at(parser, (size_t)fn->param)->vtype = VAR_UNKNOWN; // as declared by the header
+    }
+    clear_diagnostics(&parser->diagnostics);
+
+    bool entered = true;
+    parser->scope_count = 1;
+    parser->current_proc = parser->scopes[0].proc;
+    parser->current_level = parser->scopes[0].level;
+    for (size_t i = 0; entered && i < depth; i++) {
+        entered = enter_scope(parser, procedure_at(parser, chain[i])->pname);
+    }
+
+    uint8_t* token_types = parser->token_types;
+    Atom* token_values = parser->token_values;
+    size_t token_count = parser->token_count;
+    uint32_t* line_breaks = parser->line_breaks;
+    size_t line_break_count = parser->line_break_count;
+    bool collect_errors = parser->collect_errors;
+    size_t var_first = parser->var_count;
+    size_t proc_first = parser->proc_count;
+    bool complete = false;
+    if (entered) {
+        edit->hide_from = edit->proc_keys[2 * f + 1];
+        edit->hide_below = parser->var_count;
+        edit->hidden_procs = nested_end;
+        edit->hidden_procs_end = parser->proc_count;
+
+        // errors are collected rather than reported until the result is kept
+        parser->token_types = body_types;
+        parser->token_values = body_values;
+        parser->token_count = length;
+        parser->token_index = 0;
+        parser->line_breaks = body_breaks;
+        parser->line_break_count = break_count;
+        parser->line_index = 0;
+        parser->current_token.type = _EOF;
+        parser->current_token.value = ATOM_NONE;
+        parser->line_number = line;
+        parser->collect_errors = true;
+        parser->has_error = 0;
+        parser->panic = false;
+        parser->aborted = false;
+        next_token(parser);
+        if (parser->engine == ENGINE_RECURSIVE) {
+            block(parser);
+        }
+        else {
+            table_block(parser);
+        }
+        // the body ended with the last token, as it did before the edit
+        complete = parser->token_index == length && parser->current_token.type == _EOF &&
+                   !parser->panic && !parser->aborted;
+
+        parser->token_types = token_types;
+        parser->token_values = token_values;
+        parser->token_count = token_count;
+        parser->token_index = token_count;
+        parser->line_breaks = line_breaks;
+        parser->line_break_count = line_break_count;
+        parser->line_index = line_break_count;
+        parser->collect_errors = collect_errors;
+        edit->hide_from = 0;
+        edit->hidden_procs = edit->hidden_procs_end = 0;
+    }
+    parser->scope_count = 1;
+    parser->current_proc = parser->scopes[0].proc;
+    parser->current_level = parser->scopes[0].level;
+    free(body_types);
+    free(body_values);
+    free(body_breaks);
+
+    if (!complete || (!collect_errors && parser->diagnostics.count > 0) ||
+        parser->proc_count - proc_first != nested) {
+        return false;
+    }
+    // the same procedures, or calls elsewhere would resolve differently
+    for (size_t i = 0; i < nested; i++) {
+        if (procedure_at(parser, proc_first + i)->pname != procedure_at(parser, f + 1 + i)->pname) {
+            return false;
+        }
+    }
+
+    // the new entries of the nested procedures take the places of the old ones
+    for (size_t i = 0; i < nested; i++) {
+        unindex_procedure(parser, proc_first + i);
+    }
+    for (size_t i = 0; i < nested; i++) {
+        ProcedureEntry* proc = procedure_at(parser, f + 1 + i);
+        *proc = *procedure_at(parser, proc_first + i);
+        proc->body_start += fn->body_start;
+        proc->body_end += fn->body_start;
+        index_procedure(parser, f + 1 + i);
+    }
+    parser->proc_count = proc_first;
+    fn->var_start = (int)var_first;
+    fn->var_end = (int)parser->var_count;
+    fn->body_end = body_end;
+
+    uint64_t low = fn->param >= 0 ? edit->var_keys[fn->param] : edit->proc_keys[2 * f];
+    uint64_t high = edit->proc_keys[2 * f + 1];
+    uint64_t step = (high - low) / ((parser->var_count - var_first) + 2 * nested + 1);
+    if (step == 0 || // nested reparses used up the room between the keys
+        !reserve_keys(&edit->var_keys, &edit->var_key_capacity, parser->var_count) ||
+        !number_events(parser, var_first, parser->var_count, f + 1, nested_end, low, step)) {
+        return false;
+    }
+
+    // the bodies after the edit moved, the ones around it grew or shrank
+    for (size_t i = 0; i < parser->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(parser, i);
+        if (i >= f && i < nested_end) {
+            continue;
+        }
+        if (proc->body_start >= old_end) {
+            proc->body_start = proc->body_start - removed + count;
+            proc->body_end = proc->body_end - removed + count;
+        }
+        else if (proc->body_end >= old_end) {
+            proc->body_end = proc->body_end - removed + count;
+        }
+    }
+
+    parser->has_error = parser->diagnostics.count > 0;
+    edit->error_proc = parser->has_error ? f + 1 : 0;
+    edit->dirty = true;
+    return true;
+}
+
+bool parser_edit(Parser* parser, size_t first, size_t removed, const Token* tokens, size_t count) {
+    size_t input_count = input_token_count(parser);
+    if (parser->stream || first > input_count || removed > input_count - first) {
+        return false;
+    }
+    EditState* edit = &parser->edit;
+
+    // the edit in stored tokens and in line breaks
+    size_t break_first = breaks_before(parser, first);
+    size_t break_end = breaks_before(parser, first + removed);
+    size_t stored_first = first - break_first;
+    size_t stored_removed = first + removed - break_end - stored_first;
+    uint8_t* types = (uint8_t*)malloc((count + 1) * sizeof(uint8_t));
+    Atom* values = (Atom*)malloc((count + 1) * sizeof(Atom));
+    uint32_t* breaks = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+    if (!types || !values || !breaks) {
+        free(types);
+        free(values);
+        free(breaks);
+        return false;
+    }
+    size_t stored_count = 0;
+    size_t break_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (tokens[i].type == EOLN) {
+            breaks[break_count++] = (uint32_t)(stored_first + stored_count);
+        }
+        else {
+            types[stored_count] = (uint8_t)tokens[i].type;
+            values[stored_count++] = tokens[i].value;
+        }
+    }
+
+    size_t* chain = NULL;
+    size_t depth = 0;
+    bool incremental = edit->valid && !parser->ast.enabled && parser->proc_count > 0;
+    if (incremental) {
+        chain = (size_t*)malloc(parser->proc_count * sizeof(size_t));
+        depth = chain ? enclosing_bodies(parser, stored_first, stored_removed, chain) : 0;
+        // diagnostics left by an earlier reparse are replaced only by
+        // reparsing the same body again
+        incremental = depth > 0 && (!parser->has_error || edit->error_proc == chain[depth - 1] + 1);
+    }
+
+    // splicing the line breaks cannot fail once there is room, so a failed
+    // edit changes nothing
+    size_t total = parser->token_count;
+    bool spliced = reserve_line_breaks(parser, parser->line_break_count - (break_end - break_first) + break_count) &&
+                   splice_tokens(parser, stored_first, stored_removed, types, values, stored_count);
+    if (spliced) {
+        splice_line_breaks(parser, break_first, break_end - break_first, breaks, break_count, total);
+    }
+    free(types);
+    free(values);
+    free(breaks);
+    if (!spliced) {
+        free(chain);
+        return false;
+    }
+
+    if (incremental) {
+        incremental = (edit->keyed || init_keys(parser)) &&
+                      reparse_body(parser, chain, depth, stored_removed, stored_count);
+    }
+    free(chain);
+    if (!incremental) {
+        return reparse_all(parser);
+    }
+    if (parser->collect_errors) {
+        report_diagnostics(parser);
+    }
+    return !parser->has_error;
+}
+
+static int compare_keys(const void* a, const void* b) {
+    uint64_t x = ((const KeyedPosition*)a)->key;
+    uint64_t y = ((const KeyedPosition*)b)->key;
+    return (x > y) - (x < y);
+}
+
+// Number of keys below key in the sorted keys.
+static size_t keys_below(const uint64_t* keys, size_t count, uint64_t key) {
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (keys[mid] < key) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Puts the variables back in source order without the removed ones, so that
+// positions are addresses again, and recomputes faddr and laddr. The entries
+// below edit->sorted are in order already; the ones reparses appended are
+// sorted and merged in.
+bool renumber_symbols(Parser* parser) {
+    EditState* edit = &parser->edit;
+    if (!edit->dirty) {
+        return true;
+    }
+    size_t count = parser->var_count;
+    KeyedPosition* appended = (KeyedPosition*)malloc((count - edit->sorted + 1) * sizeof(KeyedPosition));
+    VariableEntry* entries = (VariableEntry*)malloc((count + 1) * sizeof(VariableEntry));
+    uint64_t* keys = (uint64_t*)malloc((count + 1) * sizeof(uint64_t));
+    if (!appended || !entries || !keys) {
+        free(appended);
+        free(entries);
+        free(keys);
+        return false;
+    }
+
+    size_t appended_count = 0;
+    for (size_t p = edit->sorted; p < count; p++) {
+        if (variable_at(parser, p)->vproc != ATOM_NONE) {
+            appended[appended_count].key = edit->var_keys[p];
+            appended[appended_count++].position = p;
+        }
+    }
+    qsort(appended, appended_count, sizeof(KeyedPosition), compare_keys);
+
+    size_t n = 0;
+    size_t next = 0;
+    for (size_t p = 0; p < edit->sorted || next < appended_count;) {
+        size_t position;
+        if (p < edit->sorted && variable_at(parser, p)->vproc == ATOM_NONE) {
+            p++;
+            continue;
+        }
+        if (next < appended_count && (p >= edit->sorted || appended[next].key < edit->var_keys[p])) {
+            position = appended[next++].position;
+        }
+        else {
+            position = p++;
+        }
+        entries[n] = *variable_at(parser, position);
+        entries[n].vaddr = (int)n;
+        keys[n++] = edit->var_keys[position];
+    }
+    for (size_t i = 0; i < n; i++) {
+        *variable_at(parser, i) = entries[i];
+    }
+    memcpy(edit->var_keys, keys, n * sizeof(uint64_t));
+    parser->var_count = n;
+    edit->sorted = n;
+    rebuild_variable_index(parser);
+
+    for (size_t i = 0; i < parser->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(parser, i);
+        proc->faddr = (int)keys_below(keys, n, edit->proc_keys[2 * i]);
+        proc->laddr = (int)keys_below(keys, n, edit->proc_keys[2 * i + 1]) - 1;
+        if (proc->param >= 0) {
+            proc->param = proc->faddr;
+        }
+        proc->var_start = proc->faddr + (proc->param >= 0);
+        proc->var_end = proc->laddr + 1;
+    }
+
+    free(appended);
+    free(entries);
+    free(keys);
+    edit->dirty = false;
+    return true;
+}
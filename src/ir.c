@@ -0,0 +1,903 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "parser.h"
+#include "ir.h"
+
+// Builds SSA form from the syntax tree of the last parse. The only control
+// flow is if/else, so every join has two predecessors and the phis of a join
+// are known as soon as both branches are built: the builder keeps an undo
+// log of variable assignments and merges the slots either branch changed.
+
+typedef struct {
+    Atom proc;
+    int level;
+    int faddr;
+    int parent; // enclosing unit, -1 for the main program
+    AstNode body;
+    IrFunction* function;
+} Unit;
+
+typedef struct {
+    uint32_t slot;
+    IrValue value;
+} SlotValue;
+
+typedef struct {
+    AstNode node;
+    int phase; // of an AST_IF: 0 before the condition, 1 after then, 2 after else
+    uint32_t branch; // block ending in the IR_BRANCH
+    uint32_t then_end; // last block of the then branch
+    size_t log_mark; // assignments before the if
+    size_t then_first; // then branch results in Builder.pairs
+    size_t then_count;
+} Work;
+
+typedef struct {
+    Parser* parser;
+    IrProgram* out;
+    uint32_t* functions; // procedure index + 1 by atom, 0 for none
+    bool* memory; // by variable address: used by a nested function
+    Unit* units;
+    size_t unit_count;
+    size_t unit_capacity;
+
+    // state of the unit being built
+    uint32_t block;
+    IrValue* map; // current value of each promoted slot
+    SlotValue* log; // assignments as (slot, previous value), for undoing a branch
+    size_t log_count;
+    size_t log_capacity;
+    SlotValue* pairs; // values a finished then branch left
+    size_t pair_count;
+    size_t pair_capacity;
+    IrValue* stack; // expression operands, or nodes while scanning
+    size_t stack_count;
+    size_t stack_capacity;
+    Work* work;
+    size_t work_count;
+    size_t work_capacity;
+    uint32_t* stamps; // per slot, for the merges
+    IrValue* then_values;
+    IrValue* else_values;
+    uint32_t stamp;
+
+    char* err;
+    size_t err_size;
+    bool failed;
+} Builder;
+
+static void build_error(Builder* b, const char* format, ...) {
+    if (b->failed) {
+        return;
+    }
+    b->failed = true;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(b->err, b->err_size, format, args);
+    va_end(args);
+}
+
+// Makes room for needed items of the given size in a malloc'd array.
+static bool grow(void** items, size_t* capacity, size_t needed, size_t size) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    size_t new_capacity = *capacity ? *capacity * 2 : 16;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void* grown = realloc(*items, new_capacity * size);
+    if (!grown) {
+        return false;
+    }
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+bool ir_has_result(IrOp op) {
+    switch (op) {
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_LOAD:
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_SHIFT_LEFT:
+    case IR_COMPARE:
+    case IR_CALL:
+    case IR_READ:
+    case IR_PHI:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool ir_append(IrFunction* f, uint32_t block, IrValue value) {
+    IrBlock* b = &f->blocks[block];
+    void* insts = b->insts;
+    if (!grow(&insts, &b->capacity, b->count + 1, sizeof(IrValue))) {
+        f->failed = true;
+        return false;
+    }
+    b->insts = (IrValue*)insts;
+    b->insts[b->count++] = value;
+    f->insts[value].block = block;
+    return true;
+}
+
+// Adds an instruction at the end of block.
+IrValue ir_add(IrFunction* f, uint32_t block, IrOp op, IrValue a, IrValue b, int64_t imm) {
+    if (f->failed) {
+        return IR_NONE;
+    }
+    if (f->inst_count == 0) {
+        f->inst_count = 1; // index 0 is IR_NONE
+    }
+    void* insts = f->insts;
+    if (!grow(&insts, &f->inst_capacity, f->inst_count + 1, sizeof(IrInst))) {
+        f->failed = true;
+        return IR_NONE;
+    }
+    f->insts = (IrInst*)insts;
+    IrValue value = (IrValue)f->inst_count++;
+    IrInst* inst = &f->insts[value];
+    inst->op = (uint8_t)op;
+    inst->block = block;
+    inst->a = a;
+    inst->b = b;
+    inst->imm = imm;
+    inst->hops = 0;
+    return ir_append(f, block, value) ? value : IR_NONE;
+}
+
+uint32_t ir_add_block(IrFunction* f) {
+    void* blocks = f->blocks;
+    if (f->failed || !grow(&blocks, &f->block_capacity, f->block_count + 1, sizeof(IrBlock))) {
+        f->failed = true;
+        return 0;
+    }
+    f->blocks = (IrBlock*)blocks;
+    memset(&f->blocks[f->block_count], 0, sizeof(IrBlock));
+    return (uint32_t)f->block_count++;
+}
+
+void ir_link(IrFunction* f, uint32_t from, uint32_t to) {
+    if (f->failed) {
+        return;
+    }
+    IrBlock* source = &f->blocks[from];
+    IrBlock* target = &f->blocks[to];
+    source->succ[source->succ_count++] = to;
+    target->pred[target->pred_count++] = from;
+}
+
+IrValue ir_resolve(IrFunction* f, IrValue value) {
+    IrValue target = value;
+    while (target != IR_NONE && f->insts[target].op == IR_ALIAS) {
+        target = f->insts[target].a;
+    }
+    // shorten the chain for the next lookup
+    while (value != target && f->insts[value].op == IR_ALIAS) {
+        IrValue next = f->insts[value].a;
+        f->insts[value].a = target;
+        value = next;
+    }
+    return target;
+}
+
+// Blocks reachable from the entry in reverse postorder, which is a
+// topological order since the graph has no cycles. Returns their count.
+size_t ir_block_order(const IrFunction* f, uint32_t* order) {
+    if (f->block_count == 0) {
+        return 0;
+    }
+    uint8_t* state = (uint8_t*)calloc(f->block_count, 1);
+    uint32_t* stack = (uint32_t*)malloc(f->block_count * 2 * sizeof(uint32_t));
+    if (!state || !stack) {
+        free(state);
+        free(stack);
+        return 0;
+    }
+    size_t count = f->block_count;
+    size_t top = 0;
+    stack[top++] = 0;
+    state[0] = 1;
+    while (top > 0) {
+        uint32_t block = stack[top - 1];
+        const IrBlock* b = &f->blocks[block];
+        bool pushed = false;
+        // the last successor is finished first, so the first one comes next in the order
+        for (uint32_t i = b->succ_count; i > 0; i--) {
+            uint32_t next = b->succ[i - 1];
+            if (state[next] == 0) {
+                state[next] = 1;
+                stack[top++] = next;
+                pushed = true;
+                break;
+            }
+        }
+        if (!pushed) {
+            top--;
+            order[--count] = block;
+        }
+    }
+    // shift the reachable blocks to the front
+    size_t reachable = f->block_count - count;
+    memmove(order, order + count, reachable * sizeof(uint32_t));
+    free(state);
+    free(stack);
+    return reachable;
+}
+
+// Drops the edge from pred to block; phis of a block left with one
+// predecessor become aliases of their remaining input.
+void ir_remove_pred(IrFunction* f, uint32_t block, uint32_t pred) {
+    IrBlock* b = &f->blocks[block];
+    for (uint32_t i = 0; i < b->pred_count; i++) {
+        if (b->pred[i] != pred) {
+            continue;
+        }
+        for (size_t k = 0; k < b->count; k++) {
+            IrInst* inst = &f->insts[b->insts[k]];
+            if (inst->op != IR_PHI) {
+                continue;
+            }
+            inst->op = IR_ALIAS;
+            inst->a = i == 0 ? inst->b : inst->a;
+            inst->b = IR_NONE;
+        }
+        if (i == 0) {
+            b->pred[0] = b->pred[1];
+        }
+        b->pred_count--;
+        return;
+    }
+}
+
+// Resolves aliases, drops removed instructions and unreachable blocks, and
+// merges straight-line blocks.
+void ir_cleanup(IrFunction* f) {
+    if (f->failed || f->block_count == 0) {
+        return;
+    }
+    uint32_t* order = (uint32_t*)malloc(f->block_count * sizeof(uint32_t));
+    bool* reached = (bool*)calloc(f->block_count, sizeof(bool));
+    if (!order || !reached) {
+        free(order);
+        free(reached);
+        f->failed = true;
+        return;
+    }
+    size_t count = ir_block_order(f, order);
+    for (size_t i = 0; i < count; i++) {
+        reached[order[i]] = true;
+    }
+    for (uint32_t block = 0; block < f->block_count; block++) {
+        IrBlock* b = &f->blocks[block];
+        if (reached[block] || b->dead) {
+            continue;
+        }
+        for (uint32_t i = 0; i < b->succ_count; i++) {
+            ir_remove_pred(f, b->succ[i], block);
+        }
+        b->dead = true;
+        b->succ_count = 0;
+        b->pred_count = 0;
+        b->count = 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        IrBlock* b = &f->blocks[order[i]];
+        size_t kept = 0;
+        for (size_t k = 0; k < b->count; k++) {
+            IrInst* inst = &f->insts[b->insts[k]];
+            if (inst->op == IR_NOP || inst->op == IR_ALIAS) {
+                continue;
+            }
+            inst->a = ir_resolve(f, inst->a);
+            inst->b = ir_resolve(f, inst->b);
+            b->insts[kept++] = b->insts[k];
+        }
+        b->count = kept;
+    }
+    // a block that only continues its single predecessor joins it
+    for (size_t i = 0; i < count && !f->failed; i++) {
+        uint32_t block = order[i];
+        while (!f->blocks[block].dead && f->blocks[block].count > 0) {
+            IrBlock* b = &f->blocks[block];
+            uint32_t next = b->succ[0];
+            if (f->insts[b->insts[b->count - 1]].op != IR_JUMP || next == 0 || f->blocks[next].pred_count != 1) {
+                break;
+            }
+            IrBlock* s = &f->blocks[next];
+            b->count--;
+            for (size_t k = 0; k < s->count; k++) {
+                ir_append(f, block, s->insts[k]);
+            }
+            b->succ_count = s->succ_count;
+            for (uint32_t n = 0; n < s->succ_count; n++) {
+                IrBlock* succ = &f->blocks[s->succ[n]];
+                b->succ[n] = s->succ[n];
+                for (uint32_t p = 0; p < succ->pred_count; p++) {
+                    if (succ->pred[p] == next) {
+                        succ->pred[p] = block;
+                    }
+                }
+            }
+            s->dead = true;
+            s->count = 0;
+            s->succ_count = 0;
+            s->pred_count = 0;
+        }
+    }
+    free(order);
+    free(reached);
+}
+
+// Finds name in the unit or the units around it, like resolve_variable().
+static VariableEntry* find_unit_variable(Builder* b, int unit, Atom name, int32_t* hops) {
+    int32_t distance = 0;
+    for (int u = unit; u >= 0; u = b->units[u].parent, distance++) {
+        VariableEntry* var = find_variable(b->parser, name, b->units[u].proc);
+        if (var) {
+            *hops = distance;
+            return var;
+        }
+    }
+    return NULL;
+}
+
+static void mark_memory(Builder* b, int unit, Atom name) {
+    int32_t hops;
+    VariableEntry* var = find_unit_variable(b, unit, name, &hops);
+    if (var && hops > 0) {
+        b->memory[var->vaddr] = true;
+    }
+}
+
+static bool add_unit(Builder* b, int parent, AstNode node) {
+    const Ast* ast = &b->parser->ast;
+    Atom name = ast->payload[node];
+    uint32_t function = name < b->parser->atoms.count ? b->functions[name] : 0;
+    if (function == 0) {
+        build_error(b, "procedure '%s' not declared", atom_name(&b->parser->atoms, name));
+        return false;
+    }
+    ProcedureEntry* proc = procedure_at(b->parser, function - 1);
+    void* units = b->units;
+    if (!grow(&units, &b->unit_capacity, b->unit_count + 1, sizeof(Unit))) {
+        build_error(b, "out of memory");
+        return false;
+    }
+    b->units = (Unit*)units;
+    Unit* u = &b->units[b->unit_count++];
+    u->proc = name;
+    u->level = proc->plev;
+    u->faddr = proc->faddr;
+    u->parent = parent;
+    u->body = AST_NONE;
+    u->function = &b->out->functions[function];
+
+    IrFunction* f = u->function;
+    f->name = name;
+    f->level = proc->plev;
+    f->procedure = (int)function - 1;
+    f->frame_size = (uint32_t)(proc->laddr - proc->faddr + 2);
+    for (AstNode child = ast->first_child[node]; child != AST_NONE; child = ast->next_sibling[child]) {
+        if (ast->kind[child] == AST_PARAMETER) {
+            VariableEntry* var = find_variable(b->parser, ast->payload[child], name);
+            f->parameter = var ? (uint32_t)(var->vaddr - proc->faddr + 1) : 0;
+        }
+        else if (ast->kind[child] == AST_BLOCK) {
+            u->body = child;
+        }
+    }
+    return true;
+}
+
+static bool push_value(Builder* b, IrValue value) {
+    void* stack = b->stack;
+    if (!grow(&stack, &b->stack_capacity, b->stack_count + 1, sizeof(IrValue))) {
+        build_error(b, "out of memory");
+        return false;
+    }
+    b->stack = (IrValue*)stack;
+    b->stack[b->stack_count++] = value;
+    return true;
+}
+
+// Finds every unit and marks the variables used from inside a nested one.
+// Functions can be declared in nested blocks, so each body is walked whole.
+static void scan_units(Builder* b) {
+    const Ast* ast = &b->parser->ast;
+    for (size_t u = 0; u < b->unit_count && !b->failed; u++) {
+        b->stack_count = 0;
+        push_value(b, b->units[u].body);
+        while (b->stack_count > 0 && !b->failed) {
+            AstNode node = b->stack[--b->stack_count];
+            switch ((AstKind)ast->kind[node]) {
+            case AST_FUNCTION:
+                add_unit(b, (int)u, node);
+                continue;
+            case AST_REFERENCE:
+            case AST_ASSIGN:
+            case AST_READ:
+            case AST_WRITE:
+                mark_memory(b, (int)u, ast->payload[node]);
+                break;
+            default:
+                break;
+            }
+            for (AstNode child = ast->first_child[node]; child != AST_NONE; child = ast->next_sibling[child]) {
+                push_value(b, child);
+            }
+        }
+    }
+}
+
+static void set_slot(Builder* b, uint32_t slot, IrValue value) {
+    void* log = b->log;
+    if (!grow(&log, &b->log_capacity, b->log_count + 1, sizeof(SlotValue))) {
+        build_error(b, "out of memory");
+        return;
+    }
+    b->log = (SlotValue*)log;
+    b->log[b->log_count].slot = slot;
+    b->log[b->log_count].value = b->map[slot];
+    b->log_count++;
+    b->map[slot] = value;
+}
+
+// Slot of var in the frame of the unit hops levels out from unit.
+static uint32_t variable_slot(Builder* b, int unit, int32_t hops, const VariableEntry* var) {
+    for (; hops > 0; hops--) {
+        unit = b->units[unit].parent;
+    }
+    return (uint32_t)(var->vaddr - b->units[unit].faddr + 1);
+}
+
+static IrValue load_variable(Builder* b, int unit, Atom name) {
+    IrFunction* f = b->units[unit].function;
+    int32_t hops;
+    VariableEntry* var = find_unit_variable(b, unit, name, &hops);
+    if (!var) {
+        build_error(b, "variable '%s' not declared", atom_name(&b->parser->atoms, name));
+        return IR_NONE;
+    }
+    uint32_t slot = variable_slot(b, unit, hops, var);
+    if (b->memory[var->vaddr]) {
+        IrValue value = ir_add(f, b->block, IR_LOAD, IR_NONE, IR_NONE, slot);
+        if (value) f->insts[value].hops = hops;
+        return value;
+    }
+    return b->map[slot];
+}
+
+static void store_variable(Builder* b, int unit, Atom name, IrValue value) {
+    IrFunction* f = b->units[unit].function;
+    int32_t hops = 0;
+    VariableEntry* var = find_unit_variable(b, unit, name, &hops);
+    if (!var) {
+        if (unit == 0 || name != b->units[unit].proc) {
+            build_error(b, "variable '%s' not declared", atom_name(&b->parser->atoms, name));
+            return;
+        }
+        set_slot(b, 0, value); // F := ... sets the return value of F
+        return;
+    }
+    uint32_t slot = variable_slot(b, unit, hops, var);
+    if (b->memory[var->vaddr]) {
+        IrValue store = ir_add(f, b->block, IR_STORE, value, IR_NONE, slot);
+        if (store) f->insts[store].hops = hops;
+        return;
+    }
+    set_slot(b, slot, value);
+}
+
+
+static IrValue build_expression(Builder* b, int unit, AstNode node) {
+    const Ast* ast = &b->parser->ast;
+    IrFunction* f = b->units[unit].function;
+    AstNode first = node;
+    while (ast->first_child[first] != AST_NONE) {
+        first = ast->first_child[first];
+    }
+    size_t base = b->stack_count;
+    for (AstNode n = first; n <= node && !b->failed; n++) {
+        uint32_t payload = ast->payload[n];
+        IrValue value = IR_NONE;
+        switch ((AstKind)ast->kind[n]) {
+        case AST_REFERENCE:
+            value = load_variable(b, unit, payload);
+            break;
+        case AST_CONSTANT:
+            value = ir_add(f, b->block, IR_CONST, IR_NONE, IR_NONE, (int64_t)ast_constant_value(ast, n));
+            break;
+        case AST_SUBTRACT:
+        case AST_MULTIPLY:
+        case AST_COMPARE: {
+            IrValue right = b->stack[--b->stack_count];
+            IrValue left = b->stack[--b->stack_count];
+            IrOp op = ast->kind[n] == AST_SUBTRACT ? IR_SUBTRACT : ast->kind[n] == AST_MULTIPLY ? IR_MULTIPLY : IR_COMPARE;
+            value = ir_add(f, b->block, op, left, right, ast->kind[n] == AST_COMPARE ? payload : 0);
+            break;
+        }
+        case AST_CALL: {
+            uint32_t function = payload < b->parser->atoms.count ? b->functions[payload] : 0;
+            if (function == 0) {
+                build_error(b, "procedure '%s' not declared", atom_name(&b->parser->atoms, payload));
+                break;
+            }
+            IrValue argument = b->stack[--b->stack_count];
+            value = ir_add(f, b->block, IR_CALL, argument, IR_NONE, (int64_t)function - 1);
+            if (value) {
+                // the callee's enclosing procedure is hops frames up the static chain
+                f->insts[value].hops = b->units[unit].level - procedure_at(b->parser, function - 1)->plev + 1;
+            }
+            break;
+        }
+        default:
+            build_error(b, "unexpected %s node in expression", ast_kind_name((AstKind)ast->kind[n]));
+            break;
+        }
+        push_value(b, value);
+    }
+    IrValue result = b->stack_count > base ? b->stack[b->stack_count - 1] : IR_NONE;
+    b->stack_count = base;
+    return result;
+}
+
+static bool push_work(Builder* b, AstNode node) {
+    void* work = b->work;
+    if (!grow(&work, &b->work_capacity, b->work_count + 1, sizeof(Work))) {
+        build_error(b, "out of memory");
+        return false;
+    }
+    b->work = (Work*)work;
+    memset(&b->work[b->work_count], 0, sizeof(Work));
+    b->work[b->work_count++].node = node;
+    return true;
+}
+
+// Undoes the assignments after mark and returns how many (slot, value)
+// pairs of the branch were saved to b->pairs.
+static size_t close_branch(Builder* b, size_t mark) {
+    size_t count = b->log_count - mark;
+    void* pairs = b->pairs;
+    if (!grow(&pairs, &b->pair_capacity, b->pair_count + count, sizeof(SlotValue))) {
+        build_error(b, "out of memory");
+        return 0;
+    }
+    b->pairs = (SlotValue*)pairs;
+    for (size_t i = mark; i < b->log_count; i++) {
+        b->pairs[b->pair_count].slot = b->log[i].slot;
+        b->pairs[b->pair_count].value = b->map[b->log[i].slot];
+        b->pair_count++;
+    }
+    for (size_t i = b->log_count; i > mark; i--) {
+        b->map[b->log[i - 1].slot] = b->log[i - 1].value;
+    }
+    b->log_count = mark;
+    return count;
+}
+
+// Adds the phis of join for the slots either branch assigned. The then branch
+// arrives from join's first predecessor, the other path from its second; the
+// map holds the values from before the if. Both branches' pairs are adjacent
+// in b->pairs, then first.
+static void merge_branches(Builder* b, IrFunction* f, uint32_t join, size_t first, size_t then_count,
+                           size_t else_count) {
+    SlotValue* pairs = b->pairs + first;
+    size_t count = then_count + else_count;
+    for (size_t i = 0; i < count; i++) {
+        b->then_values[pairs[i].slot] = b->map[pairs[i].slot];
+        b->else_values[pairs[i].slot] = b->map[pairs[i].slot];
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (i < then_count) {
+            b->then_values[pairs[i].slot] = pairs[i].value;
+        }
+        else {
+            b->else_values[pairs[i].slot] = pairs[i].value;
+        }
+    }
+    // each slot once, in the order first assigned
+    uint32_t stamp = ++b->stamp;
+    for (size_t i = 0; i < count && !b->failed; i++) {
+        uint32_t slot = pairs[i].slot;
+        if (b->stamps[slot] == stamp) {
+            continue;
+        }
+        b->stamps[slot] = stamp;
+        IrValue then_value = b->then_values[slot];
+        IrValue else_value = b->else_values[slot];
+        if (then_value == else_value) {
+            if (then_value != b->map[slot]) {
+                set_slot(b, slot, then_value);
+            }
+            continue;
+        }
+        set_slot(b, slot, ir_add(f, join, IR_PHI, then_value, else_value, 0));
+    }
+}
+
+static void build_statements(Builder* b, int unit) {
+    const Ast* ast = &b->parser->ast;
+    IrFunction* f = b->units[unit].function;
+    b->work_count = 0;
+    push_work(b, b->units[unit].body);
+    while (b->work_count > 0 && !b->failed && !f->failed) {
+        size_t top = b->work_count - 1;
+        AstNode node = b->work[top].node;
+        AstNode child = ast->first_child[node];
+        switch ((AstKind)ast->kind[node]) {
+        case AST_BLOCK:
+        case AST_SEQUENCE: {
+            b->work_count--;
+            size_t first = b->work_count;
+            for (; child != AST_NONE; child = ast->next_sibling[child]) {
+                AstKind kind = (AstKind)ast->kind[child];
+                if (kind != AST_VARIABLE && kind != AST_FUNCTION && !push_work(b, child)) {
+                    return;
+                }
+            }
+            // run the statements in source order
+            for (size_t i = first, j = b->work_count; i + 1 < j; i++, j--) {
+                Work swap = b->work[i];
+                b->work[i] = b->work[j - 1];
+                b->work[j - 1] = swap;
+            }
+            break;
+        }
+        case AST_READ:
+            b->work_count--;
+            store_variable(b, unit, ast->payload[node], ir_add(f, b->block, IR_READ, IR_NONE, IR_NONE, 0));
+            break;
+        case AST_WRITE:
+            b->work_count--;
+            ir_add(f, b->block, IR_WRITE, load_variable(b, unit, ast->payload[node]), IR_NONE, 0);
+            break;
+        case AST_ASSIGN:
+            b->work_count--;
+            store_variable(b, unit, ast->payload[node], build_expression(b, unit, child));
+            break;
+        case AST_IF: {
+            AstNode then_part = ast->next_sibling[child];
+            AstNode else_part = ast->next_sibling[then_part];
+            Work* work = &b->work[top];
+            if (work->phase == 0) {
+                ir_add(f, b->block, IR_BRANCH, build_expression(b, unit, child), IR_NONE, 0);
+                work->branch = b->block;
+                work->log_mark = b->log_count;
+                work->phase = 1;
+                b->block = ir_add_block(f);
+                ir_link(f, work->branch, b->block);
+                push_work(b, then_part);
+            }
+            else if (work->phase == 1) {
+                work->then_end = b->block;
+                work->then_first = b->pair_count;
+                work->then_count = close_branch(b, work->log_mark);
+                if (else_part != AST_NONE) {
+                    work->phase = 2;
+                    b->block = ir_add_block(f);
+                    ir_link(f, work->branch, b->block);
+                    push_work(b, else_part);
+                    break;
+                }
+                uint32_t join = ir_add_block(f);
+                ir_add(f, work->then_end, IR_JUMP, IR_NONE, IR_NONE, 0);
+                ir_link(f, work->then_end, join);
+                ir_link(f, work->branch, join);
+                b->block = join;
+                merge_branches(b, f, join, work->then_first, work->then_count, 0);
+                b->pair_count = work->then_first;
+                b->work_count--;
+            }
+            else {
+                uint32_t else_end = b->block;
+                size_t else_count = close_branch(b, work->log_mark);
+                uint32_t join = ir_add_block(f);
+                ir_add(f, work->then_end, IR_JUMP, IR_NONE, IR_NONE, 0);
+                ir_add(f, else_end, IR_JUMP, IR_NONE, IR_NONE, 0);
+                ir_link(f, work->then_end, join);
+                ir_link(f, else_end, join);
+                b->block = join;
+                merge_branches(b, f, join, work->then_first, work->then_count, else_count);
+                b->pair_count = work->then_first;
+                b->work_count--;
+            }
+            break;
+        }
+        default:
+            build_error(b, "unexpected %s node in statement", ast_kind_name((AstKind)ast->kind[node]));
+            return;
+        }
+    }
+}
+
+static void build_unit(Builder* b, int unit) {
+    IrFunction* f = b->units[unit].function;
+    size_t slots = f->frame_size;
+    b->map = (IrValue*)malloc(slots * sizeof(IrValue));
+    b->stamps = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    b->then_values = (IrValue*)malloc(slots * sizeof(IrValue));
+    b->else_values = (IrValue*)malloc(slots * sizeof(IrValue));
+    if (!b->map || !b->stamps || !b->then_values || !b->else_values) {
+        build_error(b, "out of memory");
+    }
+    else {
+        b->block = ir_add_block(f);
+        // variables start at 0
+        IrValue zero = ir_add(f, b->block, IR_CONST, IR_NONE, IR_NONE, 0);
+        for (size_t slot = 0; slot < slots; slot++) {
+            b->map[slot] = zero;
+        }
+        if (f->parameter) {
+            b->map[f->parameter] = ir_add(f, b->block, IR_PARAM, IR_NONE, IR_NONE, f->parameter);
+        }
+        for (size_t slot = 1; slot < slots; slot++) {
+            f->uses_frame |= b->memory[b->units[unit].faddr + slot - 1];
+        }
+        b->log_count = 0;
+        b->pair_count = 0;
+        b->stamp = 0;
+        build_statements(b, unit);
+        if (unit == 0) {
+            ir_add(f, b->block, IR_HALT, IR_NONE, IR_NONE, 0);
+        }
+        else {
+            ir_add(f, b->block, IR_RETURN, b->map[0], IR_NONE, 0);
+        }
+        if (f->failed) {
+            build_error(b, "out of memory");
+        }
+    }
+    free(b->map);
+    free(b->stamps);
+    free(b->then_values);
+    free(b->else_values);
+    b->map = NULL;
+    b->stamps = NULL;
+    b->then_values = NULL;
+    b->else_values = NULL;
+}
+
+// Needs a parse with parser->ast.enabled and no errors, and the symbol tables
+// of that parse. On failure err describes the problem.
+bool build_ir(Parser* parser, IrProgram* out, char* err, size_t err_size) {
+    memset(out, 0, sizeof(IrProgram));
+    out->parser = parser;
+    if (parser->ast.root == AST_NONE) {
+        snprintf(err, err_size, "no syntax tree to compile");
+        return false;
+    }
+
+    Builder b;
+    memset(&b, 0, sizeof(b));
+    b.parser = parser;
+    b.out = out;
+    b.err = err;
+    b.err_size = err_size;
+    b.functions = (uint32_t*)calloc(parser->atoms.count, sizeof(uint32_t));
+    b.memory = (bool*)calloc(parser->var_count + 1, sizeof(bool));
+    out->function_count = parser->proc_count + 1;
+    out->functions = (IrFunction*)calloc(out->function_count, sizeof(IrFunction));
+    b.unit_capacity = 16;
+    b.units = (Unit*)malloc(b.unit_capacity * sizeof(Unit));
+    if (!b.functions || !b.memory || !out->functions || !b.units) {
+        build_error(&b, "out of memory");
+    }
+    for (size_t i = 0; !b.failed && i < parser->proc_count; i++) {
+        b.functions[procedure_at(parser, i)->pname] = (uint32_t)i + 1;
+    }
+
+    if (!b.failed) {
+        Unit* main_unit = &b.units[b.unit_count++];
+        memset(main_unit, 0, sizeof(Unit));
+        main_unit->proc = parser->scopes[0].proc;
+        main_unit->parent = -1;
+        main_unit->body = parser->ast.root;
+        main_unit->function = &out->functions[0];
+        out->functions[0].name = main_unit->proc;
+        out->functions[0].procedure = -1;
+        out->functions[0].frame_size = (uint32_t)parser->var_count + 1;
+        scan_units(&b);
+    }
+    for (size_t u = 0; u < b.unit_count && !b.failed; u++) {
+        build_unit(&b, (int)u);
+        ir_cleanup(b.units[u].function);
+    }
+
+    free(b.functions);
+    free(b.memory);
+    free(b.units);
+    free(b.log);
+    free(b.pairs);
+    free(b.stack);
+    free(b.work);
+    if (b.failed) {
+        free_ir(out);
+        return false;
+    }
+    return true;
+}
+
+void free_ir(IrProgram* program) {
+    for (size_t i = 0; i < program->function_count; i++) {
+        IrFunction* f = &program->functions[i];
+        for (size_t k = 0; k < f->block_count; k++) {
+            free(f->blocks[k].insts);
+        }
+        free(f->blocks);
+        free(f->insts);
+    }
+    free(program->functions);
+    memset(program, 0, sizeof(IrProgram));
+}
+
+static const char* function_name(const IrProgram* program, int procedure) {
+    if (procedure < 0 || (size_t)procedure + 1 >= program->function_count) {
+        return "?";
+    }
+    return atom_name(&program->parser->atoms, program->functions[procedure + 1].name);
+}
+
+static void print_inst(const IrProgram* program, const IrFunction* f, IrValue value, FILE* out) {
+    const IrInst* inst = &f->insts[value];
+    const IrBlock* b = &f->blocks[inst->block];
+    fprintf(out, "    ");
+    if (ir_has_result((IrOp)inst->op)) {
+        fprintf(out, "v%u = ", value);
+    }
+    switch ((IrOp)inst->op) {
+    case IR_CONST: fprintf(out, "const %lld", (long long)inst->imm); break;
+    case IR_PARAM: fprintf(out, "param"); break;
+    case IR_LOAD: fprintf(out, "load %d %lld", inst->hops, (long long)inst->imm); break;
+    case IR_STORE: fprintf(out, "store %d %lld v%u", inst->hops, (long long)inst->imm, inst->a); break;
+    case IR_SUBTRACT: fprintf(out, "subtract v%u v%u", inst->a, inst->b); break;
+    case IR_MULTIPLY: fprintf(out, "multiply v%u v%u", inst->a, inst->b); break;
+    case IR_SHIFT_LEFT: fprintf(out, "shift_left v%u %lld", inst->a, (long long)inst->imm); break;
+    case IR_COMPARE:
+        fprintf(out, "compare %s v%u v%u", get_token_name((TokenType)inst->imm), inst->a, inst->b);
+        break;
+    case IR_CALL:
+        fprintf(out, "call %s v%u hops %d", function_name(program, (int)inst->imm), inst->a, inst->hops);
+        break;
+    case IR_READ: fprintf(out, "read"); break;
+    case IR_WRITE: fprintf(out, "write v%u", inst->a); break;
+    case IR_PHI: fprintf(out, "phi v%u b%u, v%u b%u", inst->a, b->pred[0], inst->b, b->pred[1]); break;
+    case IR_JUMP: fprintf(out, "jump b%u", b->succ[0]); break;
+    case IR_BRANCH: fprintf(out, "branch v%u b%u b%u", inst->a, b->succ[0], b->succ[1]); break;
+    case IR_RETURN: fprintf(out, "return v%u", inst->a); break;
+    case IR_HALT: fprintf(out, "halt"); break;
+    default: fprintf(out, "?"); break;
+    }
+    fputc('\n', out);
+}
+
+// Writes every function, blocks in execution order.
+void print_ir(const IrProgram* program, FILE* out) {
+    for (size_t i = 0; i < program->function_count; i++) {
+        const IrFunction* f = &program->functions[i];
+        if (f->block_count == 0) {
+            continue;
+        }
+        fprintf(out, "function %s level %d frame %u\n", atom_name(&program->parser->atoms, f->name), f->level,
+                f->frame_size);
+        uint32_t* order = (uint32_t*)malloc(f->block_count * sizeof(uint32_t));
+        if (!order) {
+            return;
+        }
+        size_t count = ir_block_order(f, order);
+        for (size_t k = 0; k < count; k++) {
+            const IrBlock* b = &f->blocks[order[k]];
+            fprintf(out, "  b%u:\n", order[k]);
+            for (size_t n = 0; n < b->count; n++) {
+                print_inst(program, f, b->insts[n], out);
+            }
+        }
+        free(order);
+    }
+}
@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "parser.h"
+#include "lexer.h"
+
+static TokenType keyword_type(const char* word, size_t len) {
+    static const TokenType keywords[] = { BEGIN, END, INTEGER, IF, THEN, ELSE, FUNCTION, READ, WRITE };
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        const char* name = get_token_name(keywords[i]);
+        if (strlen(name) == len && memcmp(name, word, len) == 0) {
+            return keywords[i];
+        }
+    }
+    return IDENT;
+}
+
+// Tokenizes .mini source straight into the parser's tokens, producing the same
+// stream as the external lexer's .dyd: an EOLN per line break and a final EOF.
+// On failure the offending line and a message are left in error_line/error.
+bool lex_source(Parser* parser, const char* src, size_t len, int* error_line, char* error, size_t error_size) {
+    const char* p = src;
+    const char* end = src + len;
+    int line = 1;
+
+    while (p < end) {
+        char c = *p;
+        if (c == '\n') {
+            if (!append_token(parser, EOLN, ATOM_NONE)) goto no_memory;
+            line++;
+            p++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r') {
+            p++;
+            continue;
+        }
+
+        if (isalpha((unsigned char)c) || isdigit((unsigned char)c)) {
+            const char* start = p;
+            TokenType type;
+            if (isalpha((unsigned char)c)) {
+                while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+                type = keyword_type(start, p - start);
+            }
+            else {
+                while (p < end && isdigit((unsigned char)*p)) p++;
+                type = CONST;
+            }
+            Atom value = ATOM_NONE;
+            if (type == IDENT || type == CONST) {
+                value = intern_atom(&parser->atoms, start, p - start);
+                if (value == ATOM_NONE) goto no_memory;
+            }
+            if (!append_token(parser, type, value)) goto no_memory;
+            continue;
+        }
+
+        TokenType type;
+        size_t width = 1;
+        char next = p + 1 < end ? p[1] : '\0';
+        switch (c) {
+        case ':':
+            if (next != '=') {
+                *error_line = line;
+                snprintf(error, error_size, "expected '=' after ':'");
+                return false;
+            }
+            type = ASSIGN;
+            width = 2;
+            break;
+        case '<':
+            if (next == '=') { type = LE; width = 2; }
+            else if (next == '>') { type = NEQ; width = 2; }
+            else type = LT;
+            break;
+        case '>':
+            if (next == '=') { type = GE; width = 2; }
+            else type = GT;
+            break;
+        case '=': type = EQU; break;
+        case '-': type = MINUS; break;
+        case '*': type = MUL; break;
+        case '(': type = OPENPAREN; break;
+        case ')': type = CLOSEPAREN; break;
+        case ';': type = SEMICOLON; break;
+        default:
+            *error_line = line;
+            snprintf(error, error_size, "invalid character '%c'", c);
+            return false;
+        }
+        if (!append_token(parser, type, ATOM_NONE)) goto no_memory;
+        p += width;
+    }
+
+    if (!append_token(parser, _EOF, ATOM_NONE)) goto no_memory;
+    return true;
+
+no_memory:
+    *error_line = 0;
+    snprintf(error, error_size, "Error: failed to allocate tokens");
+    return false;
+}
+
+bool is_mini_file(const char* filename) {
+    const char* dot = strrchr(filename, '.');
+    return dot && strcmp(dot, ".mini") == 0;
+}
+
+// Writes the loaded tokens to filename in the text .dyd format.
+bool write_dyd_tokens(Parser* parser, const char* filename) {
+    close_token_gap(parser);
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        return false;
+    }
+    TokenCursor cursor = { 0, 0 };
+    Token token;
+    while (next_input_token(parser, &cursor, &token)) {
+        const char* value;
+        switch (token.type) {
+        case EOLN: value = "EOLN"; break;
+        case _EOF: value = "EOF"; break;
+        case IDENT:
+        case CONST: value = atom_name(&parser->atoms, token.value); break;
+        default: value = get_token_name(token.type); break;
+        }
+        fprintf(file, "%s %d\n", value, token.type);
+    }
+    return fclose(file) == 0;
+}
+
+// Writes the .dyd next to a .mini source, for tools that still consume the
+// intermediate file.
+bool write_dyd_file(Parser* parser, const char* source_filename) {
+    const char* dot = strrchr(source_filename, '.');
+    size_t base_len = dot ? (size_t)(dot - source_filename) : strlen(source_filename);
+    char* dyd_filename = (char*)malloc(base_len + 5);
+    if (!dyd_filename) {
+        return false;
+    }
+    memcpy(dyd_filename, source_filename, base_len);
+    strcpy(dyd_filename + base_len, ".dyd");
+
+    bool ok = write_dyd_tokens(parser, dyd_filename);
+    free(dyd_filename);
+    return ok;
+}
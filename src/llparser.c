@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <string.h>
+#include "parser.h"
+#include "llparser.h"
+#include "incremental.h"
+#include "parallel.h"
+#include "grammar_table.h"
+
+// Table-driven counterpart of block(). Productions are expanded onto an
+// explicit stack in the arena, so neither nesting depth nor expression length
+// is limited by the C stack. A symbol marked '!' in the grammar abandons the
+// rest of its production on failure, like the early returns of the recursive
+// functions.
+
+typedef struct {
+    Atom name;
+    int var_start;
+    ProcedureEntry* proc; // NULL if the declaration was rejected
+} LLFunction;
+
+typedef struct LLState {
+    uint16_t* stack;
+    size_t count;
+    size_t capacity;
+
+    LLFunction* functions; // function declarations being parsed, innermost last
+    size_t function_count;
+    size_t function_capacity;
+
+    Atom pending_name; // declared function between its name and its '('
+    int pending_start;
+    TokenType relation; // operator of the condition being parsed
+} LLState;
+
+// Returns items with room for extra more elements, copied into a larger arena
+// block if needed, or NULL if out of memory.
+static void* reserve(Arena* arena, void* items, size_t count, size_t* capacity, size_t extra, size_t size) {
+    if (count + extra <= *capacity) {
+        return items;
+    }
+    size_t new_capacity = *capacity ? *capacity * 2 : 256;
+    while (new_capacity < count + extra) {
+        new_capacity *= 2;
+    }
+    void* grown = arena_alloc(arena, new_capacity * size);
+    if (!grown) {
+        return NULL;
+    }
+    if (count > 0) {
+        memcpy(grown, items, count * size);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+// next_token() for the common case of an in-memory token array, without the
+// call into parser.c
+static inline void advance(Parser* parser) {
+    if (parser->stream || parser->aborted || parser->token_index >= parser->token_count) {
+        next_token(parser);
+        return;
+    }
+    if (parser->current_token.type == EOLN) {
+        parser->line_number++;
+    }
+    if (parser->line_index < parser->line_break_count &&
+        parser->line_breaks[parser->line_index] == parser->token_index) {
+        parser->line_index++;
+        parser->current_token.type = EOLN;
+        parser->current_token.value = ATOM_NONE;
+        return;
+    }
+    parser->current_token.type = (TokenType)parser->token_types[parser->token_index];
+    parser->current_token.value = parser->token_values[parser->token_index++];
+}
+
+// peek_token_type() likewise
+static inline TokenType peek(Parser* parser) {
+    if (parser->stream || parser->aborted || parser->token_index >= parser->token_count) {
+        return peek_token_type(parser);
+    }
+    if (parser->line_index < parser->line_break_count &&
+        parser->line_breaks[parser->line_index] == parser->token_index) {
+        return EOLN;
+    }
+    return (TokenType)parser->token_types[parser->token_index];
+}
+
+static void token_error(Parser* parser, const char* format, TokenType type) {
+    char error_msg[256];
+    snprintf(error_msg, sizeof(error_msg), format, get_token_name(type));
+    parser_error(parser, error_msg);
+}
+
+static void undeclared_variable(Parser* parser, Atom name) {
+    char error_msg[256];
+    snprintf(error_msg, sizeof(error_msg),
+             "variable '%s' not declared in procedure '%s'",
+             atom_name(&parser->atoms, name), atom_name(&parser->atoms, parser->current_proc));
+    parser_error(parser, error_msg);
+}
+
+static bool act_expect_end(Parser* parser, LLState* state) {
+    (void)state;
+    match(parser, END); // never matches here, reports the stray token
+    return true;
+}
+
+static bool act_synchronize(Parser* parser, LLState* state) {
+    (void)state;
+    synchronize(parser);
+    return true;
+}
+
+static bool act_recover(Parser* parser, LLState* state) {
+    (void)state;
+    if (parser->panic) {
+        synchronize(parser);
+    }
+    return true;
+}
+
+static bool act_declare_variable(Parser* parser, LLState* state) {
+    (void)state;
+    if (parser->current_token.type != IDENT) {
+        token_error(parser, "expected identifier but found '%s'", parser->current_token.type);
+        return false;
+    }
+    add_variable(parser, parser->current_token.value, VAR_INT, 0);
+    ast_leaf(parser, AST_VARIABLE, parser->current_token.value);
+    return true;
+}
+
+static bool act_function_name(Parser* parser, LLState* state) {
+    if (parser->current_token.type != IDENT) {
+        token_error(parser, "expected function name but found '%s'", parser->current_token.type);
+        return false;
+    }
+    state->pending_name = parser->current_token.value;
+    state->pending_start = parser->var_count;
+    return true;
+}
+
+static bool act_enter_function(Parser* parser, LLState* state) {
+    if (!enter_scope(parser, state->pending_name)) {
+        parser_error(parser, "Error: failed to allocate scope");
+        return false;
+    }
+    LLFunction* functions = (LLFunction*)reserve(&parser->arena, state->functions, state->function_count,
+                                                 &state->function_capacity, 1, sizeof(LLFunction));
+    if (!functions) {
+        exit_scope(parser);
+        parser_error(parser, "Error: failed to allocate scope");
+        return false;
+    }
+    state->functions = functions;
+    ProcedureEntry* proc = add_procedure(parser, state->pending_name, state->pending_start, -1); // -1 means not finalized yet
+    LLFunction* function = &state->functions[state->function_count++];
+    function->name = state->pending_name;
+    function->var_start = state->pending_start;
+    function->proc = proc;
+    ast_open(parser, state->pending_name);
+    return true;
+}
+
+static bool act_begin_body(Parser* parser, LLState* state) {
+    ProcedureEntry* proc = state->functions[state->function_count - 1].proc;
+    if (!proc) {
+        return true; // as in func_declaration(), the body is parsed only for its diagnostics
+    }
+    open_body_span(parser, proc);
+    // 'block' is next on the stack; a body another thread parsed replaces it
+    if (LL_SYMBOL(state->stack[state->count - 1]) == NT_block && adopt_parallel_body(parser, proc)) {
+        state->count--;
+    }
+    return true;
+}
+
+static bool act_end_function(Parser* parser, LLState* state) {
+    LLFunction* function = &state->functions[--state->function_count];
+    ast_close(parser, AST_FUNCTION);
+    if (function->proc) {
+        close_body_span(parser, function->proc);
+        update_procedure(parser, function->name, function->var_start, parser->var_count - 1);
+    }
+    exit_scope(parser);
+    return true;
+}
+
+// the function header did not parse, its body is skipped
+static bool act_leave_function(Parser* parser, LLState* state) {
+    state->function_count--;
+    exit_scope(parser);
+    return true;
+}
+
+static bool act_declare_parameter(Parser* parser, LLState* state) {
+    (void)state;
+    add_variable(parser, parser->current_token.value, VAR_UNKNOWN, 1);
+    ast_leaf(parser, AST_PARAMETER, parser->current_token.value);
+    return true;
+}
+
+static bool io_target(Parser* parser, const char* format, AstKind kind) {
+    if (parser->current_token.type != IDENT) {
+        token_error(parser, format, parser->current_token.type);
+        return false;
+    }
+    Atom name = parser->current_token.value;
+    if (resolve_variable(parser, name) == NULL) {
+        undeclared_variable(parser, name);
+        return false;
+    }
+    ast_leaf(parser, kind, name);
+    return true;
+}
+
+static bool act_read_target(Parser* parser, LLState* state) {
+    (void)state;
+    return io_target(parser, "expected identifier in read statement but found '%s'", AST_READ);
+}
+
+static bool act_write_target(Parser* parser, LLState* state) {
+    (void)state;
+    return io_target(parser, "expected identifier in write statement but found '%s'", AST_WRITE);
+}
+
+static bool act_variable_reference(Parser* parser, LLState* state) {
+    (void)state;
+    return io_target(parser, "expected identifier in variable reference but found '%s'", AST_REFERENCE);
+}
+
+static bool act_call_target(Parser* parser, LLState* state) {
+    (void)state;
+    if (parser->current_token.type != IDENT) {
+        token_error(parser, "expected function name in function call but found '%s'", parser->current_token.type);
+        return false;
+    }
+    Atom name = parser->current_token.value;
+    if (find_procedure(parser, name) == NULL) {
+        char error_msg[256];
+        snprintf(error_msg, sizeof(error_msg),
+                 "procedure '%s' not declared",
+                 atom_name(&parser->atoms, name));
+        parser_error(parser, error_msg);
+        return false;
+    }
+    ast_open(parser, name);
+    return true;
+}
+
+// syntax tree actions, see ast.h
+
+static bool act_open(Parser* parser, LLState* state) {
+    (void)state;
+    ast_open(parser, ATOM_NONE);
+    return true;
+}
+
+static bool act_close_block(Parser* parser, LLState* state) {
+    (void)state;
+    ast_close(parser, AST_BLOCK);
+    return true;
+}
+
+static bool act_open_assignment(Parser* parser, LLState* state) {
+    (void)state;
+    ast_open(parser, parser->current_token.value);
+    return true;
+}
+
+static bool act_close_assignment(Parser* parser, LLState* state) {
+    (void)state;
+    ast_close(parser, AST_ASSIGN);
+    return true;
+}
+
+static bool act_subtract(Parser* parser, LLState* state) {
+    (void)state;
+    ast_binary(parser, AST_SUBTRACT, 0);
+    return true;
+}
+
+static bool act_multiply(Parser* parser, LLState* state) {
+    (void)state;
+    ast_binary(parser, AST_MULTIPLY, 0);
+    return true;
+}
+
+static bool act_constant(Parser* parser, LLState* state) {
+    (void)state;
+    ast_constant(parser, parser->current_token.value);
+    return true;
+}
+
+static bool act_close_call(Parser* parser, LLState* state) {
+    (void)state;
+    ast_close(parser, AST_CALL);
+    return true;
+}
+
+static bool act_close_sequence(Parser* parser, LLState* state) {
+    (void)state;
+    ast_close(parser, AST_SEQUENCE);
+    return true;
+}
+
+static bool act_close_if(Parser* parser, LLState* state) {
+    (void)state;
+    ast_close(parser, AST_IF);
+    return true;
+}
+
+static bool act_operator(Parser* parser, LLState* state) {
+    state->relation = parser->current_token.type;
+    return true;
+}
+
+static bool act_compare(Parser* parser, LLState* state) {
+    ast_binary(parser, AST_COMPARE, state->relation);
+    return true;
+}
+
+// only INTEGER followed by FUNCTION or IDENT is valid
+static int resolve_declaration(Parser* parser) {
+    TokenType lookahead = peek(parser);
+    if (lookahead == FUNCTION) {
+        return 0;
+    }
+    if (lookahead == IDENT) {
+        return 1;
+    }
+    token_error(parser, "expected variable or function declaration but found '%s'", lookahead);
+    return -1;
+}
+
+// an undeclared target is reported here and its statement skipped
+static int resolve_assignment_statement(Parser* parser) {
+    if (parser->current_token.type != IDENT) {
+        token_error(parser, "expected identifier in assignment statement but found '%s'", parser->current_token.type);
+        return -1;
+    }
+    Atom name = parser->current_token.value;
+    bool is_return_assignment = (name == parser->current_proc);
+    if (!is_return_assignment && resolve_variable(parser, name) == NULL) {
+        undeclared_variable(parser, name);
+        return 1;
+    }
+    return 0;
+}
+
+// only asked for an IDENT
+static int resolve_factor(Parser* parser) {
+    return peek(parser) == OPENPAREN ? 0 : 1;
+}
+
+// Pops the rest of a production whose symbol failed, running the %abort
+// action if that takes its frame marker off as well.
+static void abandon(Parser* parser, LLState* state, unsigned skip) {
+    state->count -= skip;
+    uint16_t last = state->stack[state->count];
+    if (skip > 0 && last >= LL_FRAME) {
+        ll_action(parser, state, last - LL_FRAME + LL_FIRST_ACTION);
+    }
+}
+
+// Parses the nonterminal start, and what it expands to, from the current token.
+static void table_parse(Parser* parser, uint16_t start) {
+    LLState state;
+    memset(&state, 0, sizeof(state));
+    state.stack = (uint16_t*)reserve(&parser->arena, NULL, 0, &state.capacity, 1, sizeof(uint16_t));
+    if (!state.stack) {
+        parser_error(parser, "Error: failed to allocate parse stack");
+        return;
+    }
+
+    // the tree-building actions are only on the stack when they have work to do
+    const LLProduction* productions = parser->ast.enabled ? ll_tree_productions : ll_productions;
+
+    // the first symbol of each expansion is handled directly instead of
+    // being pushed and popped again
+    uint16_t entry = start;
+    for (;;) {
+        unsigned symbol = LL_SYMBOL(entry);
+
+        if (symbol < LL_FIRST_NONTERMINAL) {
+            if (parser->current_token.type == (TokenType)symbol) {
+                advance(parser);
+                if (symbol == SEMICOLON) {
+                    parser->panic = false; // as in match()
+                }
+            }
+            else if (!match(parser, (TokenType)symbol)) { // reports the mismatch
+                abandon(parser, &state, LL_SKIP(entry));
+            }
+        }
+        else if (symbol < LL_FIRST_ACTION) {
+            TokenType type = parser->current_token.type;
+            unsigned column = (unsigned)type < LL_COLUMNS ? (unsigned)type : 0;
+            int nonterminal = symbol - LL_FIRST_NONTERMINAL;
+            unsigned predicted = ll_predict[nonterminal][column];
+            int production = -1;
+            if (predicted == LL_RESOLVE) {
+                int alternative = ll_resolve(parser, symbol);
+                if (alternative >= 0) {
+                    production = ll_first_production[nonterminal] + alternative;
+                }
+            }
+            else if (predicted == 0) {
+                token_error(parser, ll_errors[nonterminal], type);
+            }
+            else {
+                production = predicted - 1;
+            }
+
+            if (production >= 0 && productions[production].length > 0) {
+                const uint16_t* rhs = &ll_rhs[productions[production].start];
+                size_t rest = productions[production].length - 1;
+                if (state.count + rest > state.capacity) {
+                    uint16_t* stack = (uint16_t*)reserve(&parser->arena, state.stack, state.count, &state.capacity,
+                                                         rest, sizeof(uint16_t));
+                    if (!stack) {
+                        parser_error(parser, "Error: failed to grow parse stack");
+                        return;
+                    }
+                    state.stack = stack;
+                }
+                // right-hand sides are a few symbols long, a loop beats a memcpy() call
+                for (size_t i = 0; i < rest; i++) {
+                    state.stack[state.count++] = rhs[i];
+                }
+                STAT_MAX(parser, max_depth, state.count);
+                entry = rhs[rest];
+                continue;
+            }
+        }
+        else if (symbol < LL_FRAME) {
+            if (!ll_action(parser, &state, symbol)) {
+                abandon(parser, &state, LL_SKIP(entry));
+            }
+        }
+        // a frame marker reached in order: its production completed normally
+
+        if (state.count == 0) {
+            break;
+        }
+        entry = state.stack[--state.count];
+    }
+}
+
+void table_block(Parser* parser) {
+    table_parse(parser, LL_START);
+}
+
+// Where the recursive engine would nest deeper than RECURSIVE_MAX_DEPTH, it
+// hands the construct to these; the productions match its functions, so the
+// result is the same.
+void table_declaration(Parser* parser) {
+    table_parse(parser, NT_declaration);
+}
+
+void table_execution(Parser* parser) {
+    table_parse(parser, NT_execution);
+}
+
+void table_expression(Parser* parser) {
+    table_parse(parser, NT_arithmetic_expression);
+}
@@ -1,22 +1,492 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "parser.h"
+#include "batch.h"
+#include "lexer.h"
+#include "dydb.h"
+#include "dydscan.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "ir.h"
+#include "native.h"
+#include "cache.h"
+#include "daemon.h"
 
+#define STREAM_CHUNK_SIZE 65536
+
+// Feeds the input through the push API as it becomes readable (pipes, FIFOs).
+static bool stream_file(Parser* parser, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening file %s\n", filename);
+        return false;
+    }
+
+    char buf[STREAM_CHUNK_SIZE];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (!parser_feed(parser, buf, (size_t)n)) {
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    if (n < 0) {
+        perror("Failed to read input");
+        return false;
+    }
+    return parser_finish(parser);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--stream] [--engine table|recursive] [--collect-errors] [--max-errors N] [--emit-dyd] [--ast] [--run] [--optimize] [--no-pass NAME] [--pass-timing] [--ir] [--bytecode] [--emit-asm] [--native OUTPUT] [--cache DIR [--cache-size MB]] [--stats text|json] [--threads N] [--scanner NAME] <input_file.dyd|.dydb|.mini>\n", prog);
+    fprintf(stderr, "       %s [--jobs N] [--engine table|recursive] [--collect-errors] [--max-errors N] [--emit-dyd] [--cache DIR [--cache-size MB]] [--scanner NAME] <file | @filelist>...\n", prog);
+    fprintf(stderr, "       %s --daemon SOCKET [--engine table|recursive] [--collect-errors] [--max-errors N] [--threads N] [--scanner NAME] <file | @filelist>...\n", prog);
+    fprintf(stderr, "       %s --convert <input_file.dyd|.dydb|.mini> <output_file.dyd|.dydb>\n", prog);
+}
+
+typedef struct {
+    bool run; // execute the program, reading from stdin
+    bool optimize; // compile through the IR and its passes
+    bool print_ir;
+    bool print_bytecode;
+    bool pass_timing;
+    bool print_asm;
+    const char* native; // executable to build, or NULL
+    bool passes[IR_PASS_COUNT];
+} RunOptions;
+
+// Builds and optimizes the IR, then lowers it to bytecode or native code as
+// the options ask.
+static bool optimize_program(Parser* parser, const RunOptions* options, Bytecode* code, char* err, size_t err_size) {
+    IrProgram ir;
+    if (!build_ir(parser, &ir, err, err_size)) {
+        return false;
+    }
+    bool ok = run_ir_passes(&ir, options->passes, options->pass_timing ? stderr : NULL);
+    if (!ok) {
+        snprintf(err, err_size, "out of memory");
+    }
+    if (ok && options->print_ir) {
+        print_ir(&ir, stdout);
+    }
+    if (ok && options->print_asm) {
+        ok = emit_native_assembly(&ir, stdout, err, err_size);
+    }
+    if (ok && options->native) {
+        ok = build_native_executable(&ir, options->native, err, err_size);
+    }
+    if (ok && (options->run || options->print_bytecode)) {
+        ok = compile_ir_bytecode(&ir, code, err, err_size);
+    }
+    free_ir(&ir);
+    return ok;
+}
+
+// Compiles the parsed program and runs it as the options say.
+static bool run_program(Parser* parser, const RunOptions* options) {
+    char err[256];
+    Bytecode code;
+    memset(&code, 0, sizeof(code));
+    bool through_ir = options->optimize || options->print_ir || options->print_asm || options->native;
+    bool compiled = through_ir ? optimize_program(parser, options, &code, err, sizeof(err))
+                               : compile_bytecode(parser, &code, err, sizeof(err));
+    if (!compiled) {
+        fprintf(stderr, "Error: %s\n", err);
+        return false;
+    }
+    if (options->print_bytecode) {
+        print_bytecode(&code, stdout);
+    }
+    if (!options->run) {
+        free_bytecode(&code);
+        return true;
+    }
+    bool ok = run_bytecode(&code, &vm_stdio, err, sizeof(err));
+    fflush(stdout);
+    if (!ok) {
+        fprintf(stderr, "Runtime error: %s\n", err);
+    }
+    free_bytecode(&code);
+    return ok;
+}
+
+// A failed parse used to exit without printing anything, so its message goes
+// to stderr and stdout carries only the success line.
+static void report_result(bool result) {
+    if (result) {
+        printf("Parsing successful\n");
+    }
+    else {
+        fprintf(stderr, "Parsing failed\n");
+    }
+}
+
+// Rewrites the tokens of one input file in the format named by the output extension.
+static int convert(const char* input, const char* output) {
+    const char* dot = strrchr(output, '.');
+    bool binary = dot && strcmp(dot, ".dydb") == 0;
+    if (!binary && !(dot && strcmp(dot, ".dyd") == 0)) {
+        fprintf(stderr, "Error: output file must have a .dyd or .dydb extension\n");
+        return 1;
+    }
+
+    Parser* parser = create_buffer_parser("", 0, NULL);
+    if (!parser) {
+        return 1;
+    }
+    bool ok = parser_reset(parser) && parser_load_tokens(parser, input);
+    if (ok && !(binary ? write_dydb_file(parser, output) : write_dyd_tokens(parser, output))) {
+        fprintf(stderr, "Error writing %s\n", output);
+        ok = false;
+    }
+    destroy_parser(parser);
+    return ok ? 0 : 1;
+}
+
+typedef struct {
+    char** items;
+    size_t count;
+    size_t capacity;
+} FileList;
+
+static bool add_file(FileList* list, const char* file) {
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 64;
+        char** new_items = (char**)realloc(list->items, new_capacity * sizeof(char*));
+        if (!new_items) {
+            return false;
+        }
+        list->items = new_items;
+        list->capacity = new_capacity;
+    }
+    list->items[list->count] = strdup(file);
+    return list->items[list->count++] != NULL;
+}
+
+// Adds every non-empty line of an @filelist argument.
+static bool add_file_list(FileList* list, const char* listname) {
+    FILE* file = fopen(listname, "r");
+    if (!file) {
+        fprintf(stderr, "Error opening file list %s\n", listname);
+        return false;
+    }
+    char* line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    bool ok = true;
+    while (ok && (read = getline(&line, &len, file)) != -1) {
+        while (read > 0 && (line[read - 1] == '\n' || line[read - 1] == '\r')) {
+            line[--read] = '\0';
+        }
+        if (read > 0) {
+            ok = add_file(list, line);
+        }
+    }
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+static void free_file_list(FileList* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+}
+
+// Adds the files named by the remaining arguments, freeing the list on failure.
+static bool add_file_args(FileList* list, char** args, int count) {
+    for (int i = 0; i < count; i++) {
+        bool ok = args[i][0] == '@' ? add_file_list(list, args[i] + 1) : add_file(list, args[i]);
+        if (!ok) {
+            free_file_list(list);
+            return false;
+        }
+    }
+    return true;
+}
+
+static int run_batch(FileList* files, const BatchOptions* options) {
+    bool* results = (bool*)calloc(files->count ? files->count : 1, sizeof(bool));
+    if (!results) {
+        perror("Failed to allocate batch results");
+        return 1;
+    }
+    size_t failed = parse_batch(files->items, files->count, options, results);
+
+    // reported in input order, however the files were scheduled
+    for (size_t i = 0; i < files->count; i++) {
+        printf("%s: Parsing %s\n", files->items[i], results[i] ? "successful" : "failed");
+    }
+    printf("%zu files, %zu failed\n", files->count, failed);
+    free(results);
+    return failed == 0 ? 0 : 1;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_file.dyd>\n", argv[0]);
+    bool push = false;
+    bool collect = false;
+    long max_errors = DEFAULT_MAX_ERRORS;
+    long jobs = 0;
+    long threads = 0;
+    bool emit_dyd = false;
+    bool ast = false;
+    const char* cache_dir = NULL;
+    const char* daemon_socket = NULL;
+    int stats = 0; // 1 for text, 2 for JSON
+    long cache_size = (long)(CACHE_DEFAULT_LIMIT >> 20);
+    RunOptions run;
+    memset(&run, 0, sizeof(run));
+    for (int pass = 0; pass < IR_PASS_COUNT; pass++) {
+        run.passes[pass] = true;
+    }
+    ParserEngine engine = ENGINE_RECURSIVE;
+    DydScanner scanner = DYD_SCAN_AUTO;
+
+    if (argc >= 2 && strcmp(argv[1], "--convert") == 0) {
+        if (argc != 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        return convert(argv[2], argv[3]);
+    }
+
+    int i = 1;
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            push = true;
+        }
+        else if (strcmp(argv[i], "--collect-errors") == 0) {
+            collect = true;
+        }
+        else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc) {
+            collect = true;
+            max_errors = strtol(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--emit-dyd") == 0) {
+            emit_dyd = true;
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cache_size = strtol(argv[++i], NULL, 10);
+            if (cache_size <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "text") == 0) {
+                stats = 1;
+            }
+            else if (strcmp(argv[i], "json") == 0) {
+                stats = 2;
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+#ifndef MINIPARSER_STATS
+            fprintf(stderr, "Error: --stats needs a build with MINIPARSER_STATS\n");
+            return 1;
+#endif
+        }
+        else if (strcmp(argv[i], "--ast") == 0) {
+            ast = true;
+        }
+        else if (strcmp(argv[i], "--run") == 0) {
+            run.run = true;
+        }
+        else if (strcmp(argv[i], "--optimize") == 0) {
+            run.optimize = true;
+        }
+        else if (strcmp(argv[i], "--ir") == 0) {
+            run.print_ir = true;
+        }
+        else if (strcmp(argv[i], "--bytecode") == 0) {
+            run.print_bytecode = true;
+        }
+        else if (strcmp(argv[i], "--emit-asm") == 0) {
+            run.print_asm = true;
+        }
+        else if (strcmp(argv[i], "--native") == 0 && i + 1 < argc) {
+            run.native = argv[++i];
+        }
+        else if (strcmp(argv[i], "--pass-timing") == 0) {
+            run.pass_timing = true;
+        }
+        else if (strcmp(argv[i], "--no-pass") == 0 && i + 1 < argc) {
+            int pass = find_ir_pass(argv[++i]);
+            if (pass < 0) {
+                fprintf(stderr, "Unknown pass %s; passes are", argv[i]);
+                for (pass = 0; pass < IR_PASS_COUNT; pass++) {
+                    fprintf(stderr, " %s", ir_pass_name(pass));
+                }
+                fprintf(stderr, "\n");
+                return 1;
+            }
+            run.passes[pass] = false;
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "table") == 0) {
+                engine = ENGINE_TABLE;
+            }
+            else if (strcmp(argv[i], "recursive") == 0) {
+                engine = ENGINE_RECURSIVE;
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = strtol(argv[++i], NULL, 10);
+            if (jobs <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--scanner") == 0 && i + 1 < argc) {
+            i++;
+            int named = DYD_SCAN_AUTO;
+            while (named <= DYD_SCAN_AVX2 && strcmp(argv[i], dyd_scanner_name((DydScanner)named)) != 0) {
+                named++;
+            }
+            if (named > DYD_SCAN_AVX2) {
+                usage(argv[0]);
+                return 1;
+            }
+            scanner = (DydScanner)named;
+            if (!dyd_scanner_supported(scanner)) {
+                fprintf(stderr, "Error: this CPU does not support the %s scanner\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--daemon") == 0 && i + 1 < argc) {
+            daemon_socket = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtol(argv[++i], NULL, 10);
+            if (threads <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    bool executes = run.run || run.optimize || run.print_ir || run.print_bytecode || run.print_asm || run.native;
+    bool batch = !daemon_socket && (jobs > 0 || argc - i > 1 || (i < argc && argv[i][0] == '@'));
+    // the daemon keeps tables in memory and writes no files
+    bool daemon_conflict = daemon_socket && (push || ast || executes || stats || emit_dyd || cache_dir || jobs);
+    // a cache hit skips everything but the .var/.pro/.err outputs
+    bool cache_conflict = cache_dir && (push || ast || executes || emit_dyd || stats);
+    if (i >= argc || max_errors <= 0 || (batch && (push || ast || executes || stats || threads)) ||
+        (threads && push) || cache_conflict || daemon_conflict) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (daemon_socket) {
+        FileList files = { NULL, 0, 0 };
+        if (!add_file_args(&files, argv + i, argc - i)) {
+            return 1;
+        }
+        DaemonOptions options = { engine, scanner, collect, (size_t)max_errors, (int)threads };
+        int status = run_daemon(daemon_socket, files.items, files.count, &options);
+        free_file_list(&files);
+        return status;
+    }
+
+    ParseCache cache = { NULL, 0 };
+    if (cache_dir && !cache_open(&cache, cache_dir, (uint64_t)cache_size << 20)) {
         return 1;
     }
 
-    Parser* parser = create_parser(argv[1]);
+    if (batch) {
+        FileList files = { NULL, 0, 0 };
+        if (!add_file_args(&files, argv + i, argc - i)) {
+            return 1;
+        }
+        BatchOptions options;
+        options.jobs = jobs > 0 ? (int)jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        options.engine = engine;
+        options.scanner = scanner;
+        options.collect_errors = collect;
+        options.max_errors = (size_t)max_errors;
+        options.emit_dyd = emit_dyd;
+        options.cache = cache_dir ? &cache : NULL;
+        int status = run_batch(&files, &options);
+        free_file_list(&files);
+        cache_close(&cache);
+        return status;
+    }
+
+    const char* filename = argv[i];
+    CacheOptions cache_options = { engine, collect, (size_t)max_errors };
+    CacheKey key;
+    bool cached = cache_dir && cache_key(filename, &cache_options, &key);
+    bool hit_result;
+    if (cached && cache_fetch(&cache, &key, filename, &hit_result)) {
+        report_result(hit_result);
+        cache_close(&cache);
+        return hit_result ? 0 : 1;
+    }
+
+    Parser* parser;
+    if (push) {
+        parser = create_push_parser(filename);
+    }
+    else {
+        // create_parser(), with the scanner set before the tokens are loaded
+        parser = create_buffer_parser("", 0, NULL);
+        if (parser) {
+            parser->scanner = scanner;
+            if (!parser_load_file(parser, filename)) {
+                destroy_parser(parser);
+                parser = NULL;
+            }
+        }
+    }
     if (!parser) {
+        cache_close(&cache);
         return 1;
     }
+    parser->engine = engine;
+    parser->collect_errors = collect;
+    parser->max_errors = (size_t)max_errors;
+    parser->ast.enabled = ast || executes;
+    parser->threads = (int)threads;
+    if (emit_dyd && is_mini_file(filename) && !write_dyd_file(parser, filename)) {
+        fprintf(stderr, "Error writing .dyd for %s\n", filename);
+    }
+
+    bool result = push ? stream_file(parser, filename) : program(parser);
+    if (cached) {
+        cache_store(&cache, &key, filename, parser, result);
+    }
+    cache_close(&cache);
+    if (result && ast && !print_ast(parser, stdout)) {
+        perror("Failed to print syntax tree");
+    }
+
+    // on stderr, so that it never mixes with the program's own output
+    if (stats && !print_stats(parser, stderr, stats == 2)) {
+        perror("Failed to print statistics");
+    }
+
+    bool ran = !executes || (result && run_program(parser, &run));
+    // a program that runs prints only its own output
+    if (!run.run || !result) {
+        report_result(result);
+    }
 
-    bool result = program(parser);
-    
-    printf("Parsing %s\n", result ? "successful" : "failed");
-    
     destroy_parser(parser);
-    return result ? 0 : 1;
-}
\ No newline at end of file
+    return result && ran ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+# Grammar of the mini language for the table-driven parser (llparser.c).
+# llgen turns it into the predict table at build time.
+#
+#   name : symbols | symbols ;   productions; the first nonterminal is the start symbol
+#   TOKEN            a terminal (TokenType name); TOKEN! abandons the rest of
+#                    the production when it does not match, like
+#                    "if (!match(parser, TOKEN)) return;"
+#   @action          calls act_action() in llparser.c; @action! abandons the
+#                    rest of the production when it returns false
+#   [T U] or [*]     lookahead of an alternative, instead of its FIRST set;
+#                    * is every token no other alternative takes
+#
+# An empty alternative is the default: it is chosen for every token the other
+# alternatives do not predict, which is how the loops of the recursive-descent
+# functions end. The productions follow those functions one to one, so both
+# engines report the same diagnostics and recover the same way.
+#
+#   %token T ...          terminals, in TokenType order
+#   %resolve name         alternatives chosen by resolve_name() where their
+#                         lookaheads overlap (LL(2) and semantic choices), and
+#                         for tokens none of them takes unless name has an %error
+#   %abort name @action   runs when a production of name is abandoned
+#   %error name "text"    reported when no alternative predicts the current token;
+#                         %s is the token
+#   %tree @action ...     actions that only build the syntax tree (ast.h); the
+#                         table used without a tree leaves them out
+
+%token BEGIN END INTEGER IF THEN ELSE FUNCTION READ WRITE IDENT CONST EQU NEQ LE LT GE GT MINUS MUL ASSIGN OPENPAREN CLOSEPAREN SEMICOLON EOLN _EOF
+
+%resolve declaration
+%resolve assignment_statement
+%resolve factor
+%abort func_body @leave_function
+%error execution "unexpected token '%s' in execution"
+%error factor "unexpected token '%s' in factor"
+%error relation_operator "expected relational operator but found '%s'"
+%tree @open @close_block @open_assignment @close_assignment @subtract @multiply @constant @close_call @close_sequence @close_if @operator @compare
+
+block : BEGIN! EOLN! @open declarations executions eolns stray_tokens END! @close_block eolns ;
+
+# only reachable when collecting errors: report the token that cannot start a
+# statement, skip past it and carry on with the statements after it
+stray_tokens : [END _EOF]
+             | [*] @expect_end @synchronize executions eolns stray_tokens
+             ;
+
+declarations : declaration @recover declarations
+             |
+             ;
+
+declaration : func_declaration
+            | var_declaration
+            ;
+
+var_declaration : var SEMICOLON! eolns ;
+
+var : INTEGER! @declare_variable! IDENT ;
+
+func_declaration : INTEGER! FUNCTION! @function_name! IDENT OPENPAREN! @enter_function! func_body ;
+
+func_body : parameter CLOSEPAREN! SEMICOLON! eolns @begin_body block @end_function ;
+
+parameter : @declare_parameter IDENT
+          |
+          ;
+
+executions : execution @recover executions
+           |
+           ;
+
+execution : read_statement
+          | write_statement
+          | conditional_statement
+          | assignment_statement
+          | block
+          ;
+
+read_statement : READ! OPENPAREN! @read_target! IDENT CLOSEPAREN! SEMICOLON! eolns ;
+
+write_statement : WRITE! OPENPAREN! @write_target! IDENT CLOSEPAREN! SEMICOLON! eolns ;
+
+# declared target, or an undeclared one that is skipped up to its ';'
+assignment_statement : @open_assignment IDENT ASSIGN! arithmetic_expression @close_assignment SEMICOLON! eolns
+                     | IDENT undeclared_assignment SEMICOLON
+                     ;
+
+undeclared_assignment : ASSIGN arithmetic_expression
+                      |
+                      ;
+
+arithmetic_expression : term arithmetic_expression_prime ;
+
+arithmetic_expression_prime : MINUS term @subtract arithmetic_expression_prime
+                            |
+                            ;
+
+term : factor term_prime ;
+
+term_prime : MUL factor @multiply term_prime
+           |
+           ;
+
+factor : func_call
+       | var_reference
+       | @constant CONST
+       | OPENPAREN arithmetic_expression CLOSEPAREN
+       ;
+
+var_reference : @variable_reference! IDENT ;
+
+func_call : @call_target! IDENT OPENPAREN parameter_list CLOSEPAREN @close_call ;
+
+# only a single parameter for now
+parameter_list : arithmetic_expression ;
+
+conditional_statement : IF! @open conditional_expression THEN! eolns @open executions @close_sequence else_part @close_if ;
+
+else_part : ELSE eolns @open executions @close_sequence
+          |
+          ;
+
+conditional_expression : arithmetic_expression @operator relation_operator arithmetic_expression @compare ;
+
+relation_operator : EQU | NEQ | LT | GT | GE | LE ;
+
+eolns : EOLN eolns
+      |
+      ;
@@ -0,0 +1,924 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "native.h"
+#include "ir.h"
+#include "parser.h"
+#include "vm.h"
+
+extern char** environ;
+
+// Frames are addressed from %rbp: the static link (the %rbp of the enclosing
+// procedure) at -8, then frame slot s at -8 - 8s if some variable of the
+// function lives in the frame, then spilled values and saved registers.
+// Other values live in registers; %rax and %r11 stay free as scratch.
+// Procedures take the argument in %rdi and the static link in %rsi, and
+// return in %rax. Every procedure stores its link, even one that never uses
+// it: a procedure nested in it may walk through its frame to reach one
+// further out.
+
+#define NATIVE_MAX_STACK ((uint64_t)1 << 30) // the runtime never reserves more
+
+typedef enum {
+    RAX, RCX, RDX, RBX, RSI, RDI, RBP, R8, R9, R10, R11, R12, R13, R14, R15, REGISTER_COUNT
+} Register;
+
+static const char* const register_names[REGISTER_COUNT] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsi", "%rdi", "%rbp", "%r8",
+    "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+};
+
+// Allocation order; values live across a call only get callee-saved ones.
+static const Register caller_saved[] = { RCX, RDX, RSI, RDI, R8, R9, R10 };
+static const Register callee_saved[] = { RBX, R12, R13, R14, R15 };
+
+typedef enum { LOC_NONE, LOC_REGISTER, LOC_MEMORY, LOC_CONSTANT } LocationKind;
+
+typedef struct {
+    uint8_t kind; // LocationKind
+    uint8_t reg; // the register, or the base of a memory location
+    int32_t offset;
+    int64_t imm;
+} Location;
+
+typedef struct {
+    Location src;
+    Location dst;
+} Move;
+
+typedef struct {
+    uint32_t start;
+    IrValue value;
+} Interval;
+
+typedef struct {
+    const IrProgram* program;
+    IrFunction* f;
+    FILE* out;
+    size_t index; // of the function in the program, for labels
+    uint32_t* order;
+    size_t order_count;
+    uint32_t* start; // live range in instruction positions
+    uint32_t* end;
+    uint32_t* uses;
+    bool* argument; // some use passes the value to a call
+    uint32_t* calls; // calls at or before each position
+    Location* locations;
+    Interval* intervals;
+    IrValue* active; // allocated values, a binary heap by end
+    size_t active_count;
+    int32_t* free_spills;
+    size_t free_spill_count;
+    Move* moves;
+    bool free_registers[REGISTER_COUNT];
+    bool saved[REGISTER_COUNT];
+    uint32_t spill_count;
+    int32_t spill_base; // spill slots start below this offset
+    int32_t frame_bytes; // below %rbp
+    IrValue fused; // comparison left in the flags for the branch after it
+    TokenType fused_type;
+} Emitter;
+
+static Location register_location(Register reg) {
+    Location l = { LOC_REGISTER, (uint8_t)reg, 0, 0 };
+    return l;
+}
+
+static Location memory_location(Register base, int32_t offset) {
+    Location l = { LOC_MEMORY, (uint8_t)base, offset, 0 };
+    return l;
+}
+
+static Location constant_location(int64_t imm) {
+    Location l = { LOC_CONSTANT, 0, 0, imm };
+    return l;
+}
+
+static int32_t slot_offset(int64_t slot) {
+    return (int32_t)(-8 - 8 * slot);
+}
+
+static bool same_location(Location a, Location b) {
+    if (a.kind != b.kind) {
+        return false;
+    }
+    switch (a.kind) {
+    case LOC_REGISTER: return a.reg == b.reg;
+    case LOC_MEMORY: return a.reg == b.reg && a.offset == b.offset;
+    case LOC_CONSTANT: return a.imm == b.imm;
+    default: return true;
+    }
+}
+
+static bool fits_int32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static const char* format_location(Location l, char* buf, size_t size) {
+    switch (l.kind) {
+    case LOC_REGISTER:
+        return register_names[l.reg];
+    case LOC_MEMORY:
+        snprintf(buf, size, "%d(%s)", l.offset, register_names[l.reg]);
+        return buf;
+    default:
+        snprintf(buf, size, "$%" PRId64, l.imm);
+        return buf;
+    }
+}
+
+static void emit_binary(Emitter* e, const char* op, Location src, Location dst) {
+    char a[48], b[48];
+    fprintf(e->out, "\t%s\t%s, %s\n", op, format_location(src, a, sizeof(a)), format_location(dst, b, sizeof(b)));
+}
+
+static void emit_move(Emitter* e, Location src, Location dst) {
+    if (dst.kind == LOC_NONE || same_location(src, dst)) {
+        return;
+    }
+    if (src.kind == LOC_CONSTANT && !fits_int32(src.imm)) {
+        if (dst.kind == LOC_REGISTER) {
+            emit_binary(e, "movabsq", src, dst);
+            return;
+        }
+        emit_binary(e, "movabsq", src, register_location(R11));
+        src = register_location(R11);
+    }
+    else if (src.kind == LOC_MEMORY && dst.kind == LOC_MEMORY) {
+        emit_binary(e, "movq", src, register_location(R11));
+        src = register_location(R11);
+    }
+    emit_binary(e, "movq", src, dst);
+}
+
+// A location an instruction can read as its source operand.
+static Location source_operand(Emitter* e, Location l) {
+    if (l.kind == LOC_CONSTANT && !fits_int32(l.imm)) {
+        emit_move(e, l, register_location(R11));
+        return register_location(R11);
+    }
+    return l;
+}
+
+static Location value_location(const Emitter* e, IrValue value) {
+    const IrInst* inst = &e->f->insts[value];
+    return inst->op == IR_CONST ? constant_location(inst->imm) : e->locations[value];
+}
+
+// Leaves the %rbp of the frame hops levels out in reg, or returns %rbp.
+static Register outer_frame(Emitter* e, int32_t hops, Register reg) {
+    if (hops == 0) {
+        return RBP;
+    }
+    emit_binary(e, "movq", memory_location(RBP, -8), register_location(reg));
+    for (int32_t i = 1; i < hops; i++) {
+        emit_binary(e, "movq", memory_location(reg, -8), register_location(reg));
+    }
+    return reg;
+}
+
+static void emit_label(Emitter* e, uint32_t block) {
+    fprintf(e->out, ".L%zu_%u:\n", e->index, block);
+}
+
+static void emit_jump(Emitter* e, const char* op, uint32_t block) {
+    fprintf(e->out, "\t%s\t.L%zu_%u\n", op, e->index, block);
+}
+
+static void emit_call(Emitter* e, const char* symbol) {
+    fprintf(e->out, "\tcall\t%s\n", symbol);
+}
+
+static const char* condition_code(TokenType type) {
+    switch (type) {
+        case EQU: return "e";
+        case NEQ: return "ne";
+        case LT: return "l";
+        case LE: return "le";
+        case GT: return "g";
+        default: return "ge";
+    }
+}
+
+static TokenType negate_comparison(TokenType type) {
+    switch (type) {
+        case EQU: return NEQ;
+        case NEQ: return EQU;
+        case LT: return GE;
+        case LE: return GT;
+        case GT: return LE;
+        default: return LT;
+    }
+}
+
+static TokenType swap_comparison(TokenType type) {
+    switch (type) {
+        case LT: return GT;
+        case LE: return GE;
+        case GT: return LT;
+        case GE: return LE;
+        default: return type;
+    }
+}
+
+static bool is_call(IrOp op) {
+    return op == IR_CALL || op == IR_READ || op == IR_WRITE;
+}
+
+static void note_use(Emitter* e, IrValue value, uint32_t position, bool argument) {
+    if (value == IR_NONE) {
+        return;
+    }
+    e->uses[value]++;
+    e->argument[value] |= argument;
+    if (position > e->end[value]) {
+        e->end[value] = position;
+    }
+}
+
+// Live ranges over the blocks in emission order; phis are written at the end
+// of each predecessor. Blocks are in topological order, so a value is live
+// from its definition to its last use.
+static void scan_values(Emitter* e) {
+    IrFunction* f = e->f;
+    uint32_t position = 0;
+    e->calls[0] = 0;
+    for (size_t i = 0; i < e->order_count; i++) {
+        uint32_t block = e->order[i];
+        const IrBlock* b = &f->blocks[block];
+        for (size_t k = 0; k < b->count; k++) {
+            IrValue value = b->insts[k];
+            const IrInst* inst = &f->insts[value];
+            position++;
+            e->calls[position] = e->calls[position - 1] + is_call((IrOp)inst->op);
+            if (inst->op == IR_PHI) {
+                continue;
+            }
+            bool argument = inst->op == IR_CALL || inst->op == IR_WRITE;
+            note_use(e, inst->a, position, argument);
+            note_use(e, inst->b, position, argument);
+            e->start[value] = inst->op == IR_PARAM ? 0 : position;
+            if (e->end[value] < position) {
+                e->end[value] = position;
+            }
+        }
+        for (uint32_t s = 0; s < b->succ_count; s++) {
+            const IrBlock* succ = &f->blocks[b->succ[s]];
+            for (size_t k = 0; k < succ->count; k++) {
+                IrValue phi = succ->insts[k];
+                const IrInst* inst = &f->insts[phi];
+                if (inst->op != IR_PHI) {
+                    continue;
+                }
+                note_use(e, succ->pred[0] == block ? inst->a : inst->b, position, false);
+                if (e->start[phi] == 0 || position < e->start[phi]) {
+                    e->start[phi] = position;
+                }
+                if (e->end[phi] < position) {
+                    e->end[phi] = position;
+                }
+            }
+        }
+    }
+}
+
+static bool crosses_call(const Emitter* e, IrValue value) {
+    return e->end[value] > e->start[value] + 1 && e->calls[e->end[value] - 1] > e->calls[e->start[value]];
+}
+
+static void push_active(Emitter* e, IrValue value) {
+    size_t hole = e->active_count++;
+    while (hole > 0 && e->end[e->active[(hole - 1) / 2]] > e->end[value]) {
+        e->active[hole] = e->active[(hole - 1) / 2];
+        hole = (hole - 1) / 2;
+    }
+    e->active[hole] = value;
+}
+
+static IrValue pop_active(Emitter* e) {
+    IrValue top = e->active[0];
+    IrValue last = e->active[--e->active_count];
+    size_t hole = 0;
+    for (;;) {
+        size_t child = hole * 2 + 1;
+        if (child >= e->active_count) break;
+        if (child + 1 < e->active_count && e->end[e->active[child + 1]] < e->end[e->active[child]]) child++;
+        if (e->end[e->active[child]] >= e->end[last]) break;
+        e->active[hole] = e->active[child];
+        hole = child;
+    }
+    if (e->active_count > 0) e->active[hole] = last;
+    return top;
+}
+
+static int compare_starts(const void* left, const void* right) {
+    const Interval* a = (const Interval*)left;
+    const Interval* b = (const Interval*)right;
+    return a->start != b->start ? (a->start < b->start ? -1 : 1) : (a->value < b->value ? -1 : a->value > b->value);
+}
+
+static Location take_register(Emitter* e, const Register* regs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (e->free_registers[regs[i]]) {
+            e->free_registers[regs[i]] = false;
+            return register_location(regs[i]);
+        }
+    }
+    Location none = { LOC_NONE, 0, 0, 0 };
+    return none;
+}
+
+// Linear scan: a value takes a free register its range allows, or a spill
+// slot, and gives it back once the ranges that start later are past its end.
+static void allocate_registers(Emitter* e) {
+    IrFunction* f = e->f;
+    size_t count = 0;
+    for (size_t i = 0; i < e->order_count; i++) {
+        const IrBlock* b = &f->blocks[e->order[i]];
+        for (size_t k = 0; k < b->count; k++) {
+            IrValue value = b->insts[k];
+            IrOp op = (IrOp)f->insts[value].op;
+            if (ir_has_result(op) && op != IR_CONST && e->uses[value] > 0) {
+                e->intervals[count].start = e->start[value];
+                e->intervals[count++].value = value;
+            }
+        }
+    }
+    qsort(e->intervals, count, sizeof(Interval), compare_starts);
+    for (size_t i = 0; i < REGISTER_COUNT; i++) {
+        e->free_registers[i] = false;
+    }
+    for (size_t i = 0; i < sizeof(caller_saved) / sizeof(caller_saved[0]); i++) {
+        e->free_registers[caller_saved[i]] = true;
+    }
+    for (size_t i = 0; i < sizeof(callee_saved) / sizeof(callee_saved[0]); i++) {
+        e->free_registers[callee_saved[i]] = true;
+    }
+    e->spill_base = f->uses_frame ? slot_offset(f->frame_size - 1) : -8;
+
+    for (size_t i = 0; i < count; i++) {
+        IrValue value = e->intervals[i].value;
+        while (e->active_count > 0 && e->end[e->active[0]] < e->start[value]) {
+            Location done = e->locations[pop_active(e)];
+            if (done.kind == LOC_REGISTER) {
+                e->free_registers[done.reg] = true;
+            }
+            else {
+                e->free_spills[e->free_spill_count++] = done.offset;
+            }
+        }
+        Location l;
+        if (crosses_call(e, value)) {
+            l = take_register(e, callee_saved, sizeof(callee_saved) / sizeof(callee_saved[0]));
+        }
+        else {
+            // the argument of a call is best computed where the call wants it
+            static const Register argument[] = { RDI };
+            l = take_register(e, argument, e->argument[value] ? 1 : 0);
+            if (l.kind == LOC_NONE) l = take_register(e, caller_saved, sizeof(caller_saved) / sizeof(caller_saved[0]));
+            if (l.kind == LOC_NONE) l = take_register(e, callee_saved, sizeof(callee_saved) / sizeof(callee_saved[0]));
+        }
+        if (l.kind == LOC_REGISTER) {
+            e->saved[l.reg] |= l.reg == RBX || l.reg >= R12;
+        }
+        else if (e->free_spill_count > 0) {
+            l = memory_location(RBP, e->free_spills[--e->free_spill_count]);
+        }
+        else {
+            l = memory_location(RBP, e->spill_base - 8 * (int32_t)++e->spill_count);
+        }
+        e->locations[value] = l;
+        push_active(e, value);
+    }
+}
+
+// Performs moves that all read before any writes, breaking cycles with %rax.
+static void emit_parallel_moves(Emitter* e, Move* moves, size_t count) {
+    size_t pending = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (moves[i].dst.kind != LOC_NONE && !same_location(moves[i].src, moves[i].dst)) {
+            moves[pending++] = moves[i];
+        }
+    }
+    while (pending > 0) {
+        size_t ready = pending;
+        for (size_t i = 0; i < pending && ready == pending; i++) {
+            bool read_later = false;
+            for (size_t j = 0; j < pending && !read_later; j++) {
+                read_later = j != i && same_location(moves[j].src, moves[i].dst);
+            }
+            if (!read_later) {
+                ready = i;
+            }
+        }
+        if (ready == pending) {
+            // every destination is still to be read: keep one aside
+            Location kept = moves[0].dst;
+            emit_move(e, kept, register_location(RAX));
+            for (size_t j = 0; j < pending; j++) {
+                if (same_location(moves[j].src, kept)) {
+                    moves[j].src = register_location(RAX);
+                }
+            }
+            ready = 0;
+        }
+        emit_move(e, moves[ready].src, moves[ready].dst);
+        moves[ready] = moves[--pending];
+    }
+}
+
+static void emit_epilogue(Emitter* e) {
+    int32_t offset = e->spill_base - 8 * (int32_t)e->spill_count;
+    for (int reg = 0; reg < REGISTER_COUNT; reg++) {
+        if (e->saved[reg]) {
+            offset -= 8;
+            emit_binary(e, "movq", memory_location(RBP, offset), register_location((Register)reg));
+        }
+    }
+    fprintf(e->out, "\tleave\n\tret\n");
+}
+
+static void emit_prologue(Emitter* e) {
+    IrFunction* f = e->f;
+    if (f->procedure >= 0) {
+        fprintf(e->out, "\tcmpq\tmini_stack_limit(%%rip), %%rsp\n\tjb\t.Lstack_exhausted\n");
+    }
+    fprintf(e->out, "\tpushq\t%%rbp\n\tmovq\t%%rsp, %%rbp\n");
+    if (e->frame_bytes > 0) {
+        fprintf(e->out, "\tsubq\t$%d, %%rsp\n", e->frame_bytes);
+    }
+}
+
+static void emit_terminator(Emitter* e, const IrBlock* b, const IrInst* inst, uint32_t next) {
+    IrFunction* f = e->f;
+    // the phis of the successors take their inputs from this block
+    size_t count = 0;
+    for (uint32_t s = 0; s < b->succ_count; s++) {
+        const IrBlock* succ = &f->blocks[b->succ[s]];
+        for (size_t k = 0; k < succ->count; k++) {
+            const IrInst* phi = &f->insts[succ->insts[k]];
+            if (phi->op == IR_PHI) {
+                e->moves[count].src = value_location(e, succ->pred[0] == inst->block ? phi->a : phi->b);
+                e->moves[count++].dst = e->locations[succ->insts[k]];
+            }
+        }
+    }
+    emit_parallel_moves(e, e->moves, count);
+
+    switch ((IrOp)inst->op) {
+    case IR_JUMP:
+        if (b->succ[0] != next) {
+            emit_jump(e, "jmp", b->succ[0]);
+        }
+        break;
+    case IR_BRANCH: {
+        TokenType type = e->fused_type;
+        if (e->fused != inst->a) {
+            Location condition = value_location(e, inst->a);
+            if (condition.kind == LOC_CONSTANT) {
+                uint32_t target = b->succ[condition.imm ? 0 : 1];
+                if (target != next) {
+                    emit_jump(e, "jmp", target);
+                }
+                break;
+            }
+            if (condition.kind == LOC_REGISTER) {
+                emit_binary(e, "testq", condition, condition);
+            }
+            else {
+                emit_binary(e, "cmpq", constant_location(0), condition);
+            }
+            type = NEQ;
+        }
+        char jump[8];
+        if (b->succ[1] == next) {
+            snprintf(jump, sizeof(jump), "j%s", condition_code(type));
+            emit_jump(e, jump, b->succ[0]);
+            break;
+        }
+        snprintf(jump, sizeof(jump), "j%s", condition_code(negate_comparison(type)));
+        emit_jump(e, jump, b->succ[1]);
+        if (b->succ[0] != next) {
+            emit_jump(e, "jmp", b->succ[0]);
+        }
+        break;
+    }
+    case IR_RETURN:
+        emit_move(e, value_location(e, inst->a), register_location(RAX));
+        emit_epilogue(e);
+        break;
+    default:
+        emit_epilogue(e);
+        break;
+    }
+}
+
+// Computes into the destination if it is a register, else into %rax.
+static Location work_register(Location dst) {
+    return dst.kind == LOC_REGISTER ? dst : register_location(RAX);
+}
+
+static void emit_instruction(Emitter* e, const IrBlock* b, size_t k, uint32_t next) {
+    IrFunction* f = e->f;
+    IrValue value = b->insts[k];
+    const IrInst* inst = &f->insts[value];
+    Location dst = e->locations[value];
+    switch ((IrOp)inst->op) {
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_PHI:
+        return; // used in place, moved in by the prologue, or by the predecessors
+    case IR_LOAD: {
+        if (dst.kind == LOC_NONE) return;
+        Register base = outer_frame(e, inst->hops, RAX);
+        Location work = work_register(dst);
+        emit_binary(e, "movq", memory_location(base, slot_offset(inst->imm)), work);
+        emit_move(e, work, dst);
+        return;
+    }
+    case IR_STORE: {
+        Location src = value_location(e, inst->a);
+        if (src.kind == LOC_MEMORY || (src.kind == LOC_CONSTANT && !fits_int32(src.imm))) {
+            emit_move(e, src, register_location(R11));
+            src = register_location(R11);
+        }
+        Register base = outer_frame(e, inst->hops, RAX);
+        emit_binary(e, "movq", src, memory_location(base, slot_offset(inst->imm)));
+        return;
+    }
+    case IR_SUBTRACT: {
+        if (dst.kind == LOC_NONE) return;
+        Location a = value_location(e, inst->a);
+        Location work = work_register(dst);
+        if (a.kind == LOC_CONSTANT && a.imm == 0) {
+            emit_move(e, value_location(e, inst->b), work);
+            fprintf(e->out, "\tnegq\t%s\n", register_names[work.reg]);
+            emit_move(e, work, dst);
+            return;
+        }
+        emit_move(e, a, work);
+        emit_binary(e, "subq", source_operand(e, value_location(e, inst->b)), work);
+        emit_move(e, work, dst);
+        return;
+    }
+    case IR_MULTIPLY: {
+        if (dst.kind == LOC_NONE) return;
+        Location a = value_location(e, inst->a);
+        Location b2 = value_location(e, inst->b);
+        if (a.kind == LOC_CONSTANT && b2.kind != LOC_CONSTANT) {
+            Location swap = a;
+            a = b2;
+            b2 = swap;
+        }
+        Location work = work_register(dst);
+        if (b2.kind == LOC_CONSTANT && fits_int32(b2.imm) && a.kind != LOC_CONSTANT) {
+            char imm[48], src[48];
+            fprintf(e->out, "\timulq\t%s, %s, %s\n", format_location(b2, imm, sizeof(imm)),
+                    format_location(a, src, sizeof(src)), register_names[work.reg]);
+        }
+        else {
+            emit_move(e, a, work);
+            emit_binary(e, "imulq", source_operand(e, b2), work);
+        }
+        emit_move(e, work, dst);
+        return;
+    }
+    case IR_SHIFT_LEFT: {
+        if (dst.kind == LOC_NONE) return;
+        Location work = work_register(dst);
+        emit_move(e, value_location(e, inst->a), work);
+        emit_binary(e, "shlq", constant_location(inst->imm & 63), work);
+        emit_move(e, work, dst);
+        return;
+    }
+    case IR_COMPARE: {
+        Location left = value_location(e, inst->a);
+        Location right = value_location(e, inst->b);
+        TokenType type = (TokenType)inst->imm;
+        if (left.kind == LOC_CONSTANT && right.kind != LOC_CONSTANT) {
+            Location swap = left;
+            left = right;
+            right = swap;
+            type = swap_comparison(type);
+        }
+        if (left.kind == LOC_CONSTANT) {
+            emit_move(e, left, register_location(RAX));
+            left = register_location(RAX);
+        }
+        right = source_operand(e, right);
+        if (left.kind == LOC_MEMORY && right.kind == LOC_MEMORY) {
+            emit_move(e, right, register_location(R11));
+            right = register_location(R11);
+        }
+        emit_binary(e, "cmpq", right, left);
+        // a branch right after that is the only use tests the flags itself
+        const IrInst* last = &f->insts[b->insts[b->count - 1]];
+        if (k + 2 == b->count && last->op == IR_BRANCH && last->a == value && e->uses[value] == 1) {
+            e->fused = value;
+            e->fused_type = type;
+            return;
+        }
+        if (dst.kind == LOC_NONE) return;
+        fprintf(e->out, "\tset%s\t%%al\n\tmovzbl\t%%al, %%eax\n", condition_code(type));
+        emit_move(e, register_location(RAX), dst);
+        return;
+    }
+    case IR_CALL: {
+        emit_move(e, value_location(e, inst->a), register_location(RDI));
+        Register link = outer_frame(e, inst->hops, RSI);
+        if (link != RSI) {
+            emit_binary(e, "movq", register_location(link), register_location(RSI));
+        }
+        char symbol[32];
+        snprintf(symbol, sizeof(symbol), "mini_f%" PRId64, inst->imm);
+        emit_call(e, symbol);
+        emit_move(e, register_location(RAX), dst);
+        return;
+    }
+    case IR_READ:
+        emit_call(e, "mini_read");
+        emit_move(e, register_location(RAX), dst);
+        return;
+    case IR_WRITE:
+        emit_move(e, value_location(e, inst->a), register_location(RDI));
+        emit_call(e, "mini_write");
+        return;
+    default:
+        emit_terminator(e, b, inst, next);
+        return;
+    }
+}
+
+// Emits one function; returns its stack use in bytes, or 0 on failure.
+static uint32_t emit_function(const IrProgram* program, size_t index, FILE* out) {
+    IrFunction* f = &program->functions[index];
+    Emitter e;
+    memset(&e, 0, sizeof(e));
+    e.program = program;
+    e.f = f;
+    e.out = out;
+    e.index = index;
+    size_t values = f->inst_count ? f->inst_count : 1;
+    e.order = (uint32_t*)malloc((f->block_count ? f->block_count : 1) * sizeof(uint32_t));
+    e.start = (uint32_t*)calloc(values, sizeof(uint32_t));
+    e.end = (uint32_t*)calloc(values, sizeof(uint32_t));
+    e.uses = (uint32_t*)calloc(values, sizeof(uint32_t));
+    e.argument = (bool*)calloc(values, sizeof(bool));
+    e.calls = (uint32_t*)malloc((values + 2) * sizeof(uint32_t));
+    e.locations = (Location*)calloc(values, sizeof(Location));
+    e.intervals = (Interval*)malloc(values * sizeof(Interval));
+    e.active = (IrValue*)malloc(values * sizeof(IrValue));
+    e.free_spills = (int32_t*)malloc(values * sizeof(int32_t));
+    e.moves = (Move*)malloc(values * sizeof(Move));
+    uint32_t stack_bytes = 0;
+    if (e.order && e.start && e.end && e.uses && e.argument && e.calls && e.locations && e.intervals && e.active &&
+        e.free_spills && e.moves) {
+        e.order_count = ir_block_order(f, e.order);
+        scan_values(&e);
+        allocate_registers(&e);
+        int32_t saves = 0;
+        for (int reg = 0; reg < REGISTER_COUNT; reg++) {
+            saves += e.saved[reg];
+        }
+        e.frame_bytes = -(e.spill_base - 8 * (int32_t)e.spill_count - 8 * saves);
+        e.frame_bytes = (e.frame_bytes + 15) & ~15;
+        stack_bytes = (uint32_t)e.frame_bytes + 16;
+
+        const char* name = atom_name(&program->parser->atoms, f->name);
+        if (f->procedure < 0) {
+            fprintf(out, "\n# main program\n\t.globl\tmini_main\n\t.p2align 4\nmini_main:\n");
+        }
+        else {
+            fprintf(out, "\n# function %s, level %d\n\t.p2align 4\nmini_f%d:\n", name ? name : "?", f->level,
+                    f->procedure);
+        }
+        emit_prologue(&e);
+        int32_t offset = e.spill_base - 8 * (int32_t)e.spill_count;
+        for (int reg = 0; reg < REGISTER_COUNT; reg++) {
+            if (e.saved[reg]) {
+                offset -= 8;
+                emit_binary(&e, "movq", register_location((Register)reg), memory_location(RBP, offset));
+            }
+        }
+        if (f->procedure >= 0) {
+            emit_binary(&e, "movq", register_location(RSI), memory_location(RBP, -8));
+        }
+        if (f->uses_frame && f->frame_size > 1) {
+            // variables start at 0; the parameter goes to its slot as well
+            uint32_t slots = f->frame_size - 1;
+            if (slots <= 8) {
+                for (uint32_t slot = 1; slot <= slots; slot++) {
+                    emit_binary(&e, "movq", constant_location(0), memory_location(RBP, slot_offset(slot)));
+                }
+            }
+            else {
+                emit_binary(&e, "leaq", memory_location(RBP, slot_offset(slots)), register_location(RAX));
+                fprintf(out, "\tmovl\t$%u, %%r11d\n.L%zu_zero:\n\tmovq\t$0, (%%rax)\n\taddq\t$8, %%rax\n"
+                        "\tdecq\t%%r11\n\tjnz\t.L%zu_zero\n", slots, index, index);
+            }
+            if (f->parameter) {
+                emit_binary(&e, "movq", register_location(RDI), memory_location(RBP, slot_offset(f->parameter)));
+            }
+        }
+        for (size_t i = 0; i < e.order_count; i++) {
+            const IrBlock* b = &f->blocks[e.order[i]];
+            for (size_t k = 0; k < b->count; k++) {
+                if (f->insts[b->insts[k]].op == IR_PARAM) {
+                    emit_move(&e, register_location(RDI), e.locations[b->insts[k]]);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < e.order_count; i++) {
+            uint32_t block = e.order[i];
+            uint32_t next = i + 1 < e.order_count ? e.order[i + 1] : UINT32_MAX;
+            const IrBlock* b = &f->blocks[block];
+            if (i > 0) {
+                emit_label(&e, block);
+            }
+            e.fused = IR_NONE;
+            for (size_t k = 0; k < b->count; k++) {
+                emit_instruction(&e, b, k, next);
+            }
+        }
+    }
+    free(e.order);
+    free(e.start);
+    free(e.end);
+    free(e.uses);
+    free(e.argument);
+    free(e.calls);
+    free(e.locations);
+    free(e.intervals);
+    free(e.active);
+    free(e.free_spills);
+    free(e.moves);
+    return stack_bytes;
+}
+
+bool emit_native_assembly(const IrProgram* program, FILE* out, char* err, size_t err_size) {
+    fprintf(out, "# generated by miniparser\n\t.text\n");
+    uint64_t main_bytes = 0;
+    uint64_t frame_bytes = 0;
+    for (size_t i = 0; i < program->function_count; i++) {
+        if (program->functions[i].block_count == 0) {
+            continue;
+        }
+        uint32_t bytes = emit_function(program, i, out);
+        if (bytes == 0) {
+            snprintf(err, err_size, "out of memory");
+            return false;
+        }
+        if (i == 0) {
+            main_bytes = bytes;
+        }
+        else if (bytes > frame_bytes) {
+            frame_bytes = bytes;
+        }
+    }
+    // enough stack for as many calls as the interpreter allows
+    uint64_t stack = main_bytes + frame_bytes * VM_MAX_CALL_DEPTH;
+    if (stack > NATIVE_MAX_STACK) {
+        stack = NATIVE_MAX_STACK;
+    }
+    fprintf(out, "\n.Lstack_exhausted:\n\tandq\t$-16, %%rsp\n\tcall\tmini_stack_overflow\n");
+    fprintf(out, "\n\t.section\t.rodata\n\t.globl\tmini_stack_size\n\t.p2align 3\nmini_stack_size:\n\t.quad\t%" PRIu64 "\n",
+            stack);
+    fprintf(out, "\t.section\t.note.GNU-stack,\"\",@progbits\n");
+    if (ferror(out)) {
+        snprintf(err, err_size, "failed to write the assembly");
+        return false;
+    }
+    return true;
+}
+
+// Runs mini_main on a thread with the stack the program asks for, and stops
+// it with the interpreter's messages.
+static const char runtime_source[] =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <stdint.h>\n"
+    "#include <inttypes.h>\n"
+    "#include <pthread.h>\n"
+    "\n"
+    "#define MARGIN 65536\n"
+    "\n"
+    "void mini_main(void);\n"
+    "extern const uint64_t mini_stack_size;\n"
+    "char* mini_stack_limit;\n"
+    "\n"
+    "static void mini_fail(const char* message) {\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"Runtime error: %s\\n\", message);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "int64_t mini_read(void) {\n"
+    "    int64_t value;\n"
+    "    if (scanf(\"%\" SCNd64, &value) != 1) {\n"
+    "        mini_fail(\"no input left to read\");\n"
+    "    }\n"
+    "    return value;\n"
+    "}\n"
+    "\n"
+    "void mini_write(int64_t value) {\n"
+    "    if (printf(\"%\" PRId64 \"\\n\", value) <= 0) {\n"
+    "        mini_fail(\"failed to write output\");\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "void mini_stack_overflow(void) {\n"
+    "    mini_fail(\"call stack overflow\");\n"
+    "}\n"
+    "\n"
+    "static void* mini_thread(void* unused) {\n"
+    "    char top;\n"
+    "    (void)unused;\n"
+    "    mini_stack_limit = &top - mini_stack_size;\n"
+    "    mini_main();\n"
+    "    return NULL;\n"
+    "}\n"
+    "\n"
+    "int main(void) {\n"
+    "    pthread_attr_t attr;\n"
+    "    pthread_t thread;\n"
+    "    if (pthread_attr_init(&attr) != 0 || pthread_attr_setstacksize(&attr, mini_stack_size + 2 * MARGIN) != 0 ||\n"
+    "        pthread_create(&thread, &attr, mini_thread, NULL) != 0) {\n"
+    "        fprintf(stderr, \"Runtime error: cannot reserve the stack\\n\");\n"
+    "        return 1;\n"
+    "    }\n"
+    "    pthread_join(thread, NULL);\n"
+    "    if (fflush(stdout) != 0) {\n"
+    "        mini_fail(\"failed to write output\");\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n";
+
+static bool write_file(const char* path, const char* text) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    bool ok = fputs(text, file) >= 0;
+    return fclose(file) == 0 && ok;
+}
+
+static bool run_compiler(const char* output, const char* assembly, const char* runtime, char* err, size_t err_size) {
+    const char* cc = getenv("CC");
+    if (!cc || !*cc) {
+        cc = "cc";
+    }
+    char* argv[] = { (char*)cc, "-O2", "-pthread", "-o", (char*)output, (char*)assembly, (char*)runtime, NULL };
+    pid_t pid;
+    int status = posix_spawnp(&pid, cc, NULL, NULL, argv, environ);
+    if (status != 0) {
+        snprintf(err, err_size, "cannot run %s: %s", cc, strerror(status));
+        return false;
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        snprintf(err, err_size, "%s failed to build %s", cc, output);
+        return false;
+    }
+    return true;
+}
+
+bool build_native_executable(const IrProgram* program, const char* output, char* err, size_t err_size) {
+    const char* tmp = getenv("TMPDIR");
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s/miniparserXXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if (!mkdtemp(dir)) {
+        snprintf(err, err_size, "cannot create a temporary directory: %s", strerror(errno));
+        return false;
+    }
+    char assembly[4200], runtime[4200];
+    snprintf(assembly, sizeof(assembly), "%s/program.s", dir);
+    snprintf(runtime, sizeof(runtime), "%s/runtime.c", dir);
+
+    bool ok = false;
+    FILE* file = fopen(assembly, "w");
+    if (!file) {
+        snprintf(err, err_size, "cannot write %s", assembly);
+    }
+    else {
+        ok = emit_native_assembly(program, file, err, err_size);
+        if (fclose(file) != 0 && ok) {
+            snprintf(err, err_size, "cannot write %s", assembly);
+            ok = false;
+        }
+    }
+    if (ok && !write_file(runtime, runtime_source)) {
+        snprintf(err, err_size, "cannot write %s", runtime);
+        ok = false;
+    }
+    ok = ok && run_compiler(output, assembly, runtime, err, err_size);
+    unlink(assembly);
+    unlink(runtime);
+    rmdir(dir);
+    return ok;
+}
@@ -0,0 +1,473 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "parallel.h"
+#include "llparser.h"
+
+typedef enum {
+    BODY_PENDING,
+    BODY_CLAIMED, // being parsed
+    BODY_DONE,
+} BodyState;
+
+// A top-level function body found by the scan, and once parsed, its results.
+typedef struct {
+    Atom name;
+    Atom param; // ATOM_NONE without a parameter
+    size_t begin; // stored token index of the 'begin'
+    size_t end; // stored token index after the 'end'
+    size_t first_line_break; // line breaks before the 'begin', and up to end
+    size_t last_line_break;
+
+    BodyState state;
+    bool ok; // parsed without errors; the rest is only set then
+    VariableEntry* vars; // in order, the parameter first if there is one
+    size_t var_count;
+    ProcedureEntry* procs; // nested procedures, variable positions relative to vars
+    size_t proc_count;
+    Atom* variables; // outside lookups, see OutsideLookups
+    size_t variable_count;
+    Atom* procedures;
+    size_t procedure_count;
+} ParallelBody;
+
+struct ParallelParse;
+
+typedef struct {
+    struct ParallelParse* parallel;
+    Parser parser; // private tables over the shared tokens and atoms
+    OutsideLookups lookups;
+    pthread_t thread;
+} BodyWorker;
+
+typedef struct ParallelParse {
+    Parser* parser;
+    Atom main_proc;
+    ParallelBody* bodies; // in token order
+    size_t count;
+    size_t next; // bodies before this one were claimed or skipped
+    size_t adopted; // bodies before this one were reached by the main parse
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t done; // a body was parsed
+
+    BodyWorker* workers; // the first one belongs to the main thread
+    int worker_count;
+    int started; // threads running workers[1..started]
+} ParallelParse;
+
+static bool add_body(ParallelParse* parallel, size_t* capacity, const ParallelBody* body) {
+    if (parallel->count >= *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        ParallelBody* grown = (ParallelBody*)realloc(parallel->bodies, new_capacity * sizeof(ParallelBody));
+        if (!grown) {
+            return false;
+        }
+        parallel->bodies = grown;
+        *capacity = new_capacity;
+    }
+    parallel->bodies[parallel->count++] = *body;
+    return true;
+}
+
+// Finds the functions main declares: 'integer function NAME ( [PARAM] ) ;'
+// and a body whose begin/end pairs balance. The scan stops at the first
+// declaration of another shape; the parse itself checks everything again.
+static bool scan_bodies(ParallelParse* parallel) {
+    Parser* parser = parallel->parser;
+    const uint8_t* types = parser->token_types;
+    size_t count = parser->token_count;
+    Atom main_proc = parallel->main_proc;
+    size_t capacity = 0;
+    if (count == 0 || types[0] != BEGIN) {
+        return true;
+    }
+    size_t i = 1;
+    while (i + 2 < count && types[i] == INTEGER) {
+        if (types[i + 1] == IDENT && types[i + 2] == SEMICOLON) {
+            i += 3;
+            continue;
+        }
+        if (types[i + 1] != FUNCTION || i + 7 >= count || types[i + 2] != IDENT || types[i + 3] != OPENPAREN) {
+            break;
+        }
+        ParallelBody body;
+        memset(&body, 0, sizeof(body));
+        body.name = parser->token_values[i + 2];
+        size_t j = i + 4;
+        if (types[j] == IDENT) {
+            body.param = parser->token_values[j++];
+        }
+        if (j + 2 >= count || types[j] != CLOSEPAREN || types[j + 1] != SEMICOLON || types[j + 2] != BEGIN) {
+            break;
+        }
+        body.begin = j + 2;
+        size_t depth = 0;
+        for (j = body.begin; j < count; j++) {
+            depth += types[j] == BEGIN;
+            if (types[j] == END && --depth == 0) {
+                break;
+            }
+        }
+        if (j == count) {
+            break;
+        }
+        body.end = j + 1;
+        body.first_line_break = (size_t)token_line(parser, body.begin) - 1;
+        body.last_line_break = (size_t)token_line(parser, body.end) - 1;
+        // a function called main shares main's scope; the main parse handles it
+        if (body.name != main_proc && !add_body(parallel, &capacity, &body)) {
+            return false;
+        }
+        i = body.end;
+    }
+    return true;
+}
+
+static bool init_worker(BodyWorker* worker, ParallelParse* parallel) {
+    Parser* shared = parallel->parser;
+    Parser* parser = &worker->parser;
+    memset(worker, 0, sizeof(*worker));
+    worker->parallel = parallel;
+    parser->atoms = shared->atoms; // read only, nothing is interned
+    parser->token_types = shared->token_types;
+    parser->token_values = shared->token_values;
+    parser->line_breaks = shared->line_breaks;
+    parser->engine = shared->engine;
+    // the first error makes the body go to the main parse, nothing else is needed
+    parser->collect_errors = true;
+    parser->max_errors = 1;
+    parser->outside = &worker->lookups;
+    init_arena(&parser->arena);
+    return true;
+}
+
+static void free_worker(BodyWorker* worker) {
+    free_arena(&worker->parser.arena);
+    free_diagnostics(&worker->parser.diagnostics);
+    free(worker->lookups.variables);
+    free(worker->lookups.procedures);
+}
+
+// Copies what the body declared and looked up out of the worker's parser,
+// which is rewound for the next body.
+static bool keep_results(ParallelBody* body, BodyWorker* worker) {
+    Parser* parser = &worker->parser;
+    OutsideLookups* lookups = &worker->lookups;
+    size_t size = parser->var_count * sizeof(VariableEntry) + parser->proc_count * sizeof(ProcedureEntry) +
+                  (lookups->variable_count + lookups->procedure_count) * sizeof(Atom);
+    char* block = (char*)malloc(size ? size : 1);
+    if (!block) {
+        return false;
+    }
+    body->vars = (VariableEntry*)block;
+    body->var_count = parser->var_count;
+    for (size_t i = 0; i < parser->var_count; i++) {
+        body->vars[i] = *variable_at(parser, i);
+    }
+    body->procs = (ProcedureEntry*)(body->vars + body->var_count);
+    body->proc_count = parser->proc_count;
+    for (size_t i = 0; i < parser->proc_count; i++) {
+        body->procs[i] = *procedure_at(parser, i);
+    }
+    body->variables = (Atom*)(body->procs + body->proc_count);
+    body->variable_count = lookups->variable_count;
+    for (size_t i = 0; i < lookups->variable_count; i++) {
+        body->variables[i] = lookups->variables[i];
+    }
+    body->procedures = body->variables + body->variable_count;
+    body->procedure_count = lookups->procedure_count;
+    for (size_t i = 0; i < lookups->procedure_count; i++) {
+        body->procedures[i] = lookups->procedures[i];
+    }
+    return true;
+}
+
+// Parses a body as block() would inside its function, with the tokens after
+// it reading as EOF.
+static void parse_body(BodyWorker* worker, ParallelBody* body) {
+    Parser* parser = &worker->parser;
+    OutsideLookups* lookups = &worker->lookups;
+    arena_reset(&parser->arena);
+    clear_diagnostics(&parser->diagnostics);
+    lookups->variable_count = lookups->procedure_count = 0;
+    lookups->failed = false;
+    parser->has_error = 0;
+    parser->panic = parser->aborted = false;
+    parser->depth = 0;
+    parser->current_level = -1;
+
+    bool ok = init_tables(parser) && enter_scope(parser, worker->parallel->main_proc) &&
+              enter_scope(parser, body->name);
+    if (ok) {
+        if (body->param != ATOM_NONE) {
+            add_variable(parser, body->param, VAR_UNKNOWN, 1); // as parameter() declares it
+        }
+        parser->token_index = body->begin;
+        parser->token_count = body->end;
+        parser->line_index = body->first_line_break;
+        parser->line_break_count = body->last_line_break;
+        parser->line_number = (int)body->first_line_break + 1;
+        parser->current_token.type = _EOF;
+        parser->current_token.value = ATOM_NONE;
+        next_token(parser);
+        if (parser->engine == ENGINE_RECURSIVE) {
+            block(parser);
+        }
+        else {
+            table_block(parser);
+        }
+        ok = !parser->has_error && !lookups->failed && parser->current_token.type == _EOF;
+    }
+    body->ok = ok && keep_results(body, worker);
+}
+
+// Takes the first body nobody has claimed yet, or returns NULL.
+static ParallelBody* claim_next(ParallelParse* parallel) {
+    ParallelBody* body = NULL;
+    pthread_mutex_lock(&parallel->lock);
+    while (!parallel->stop && parallel->next < parallel->count) {
+        ParallelBody* candidate = &parallel->bodies[parallel->next++];
+        if (candidate->state == BODY_PENDING) {
+            candidate->state = BODY_CLAIMED;
+            body = candidate;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&parallel->lock);
+    return body;
+}
+
+static void mark_done(ParallelParse* parallel, ParallelBody* body) {
+    pthread_mutex_lock(&parallel->lock);
+    body->state = BODY_DONE;
+    pthread_cond_broadcast(&parallel->done);
+    pthread_mutex_unlock(&parallel->lock);
+}
+
+static void* worker_main(void* arg) {
+    BodyWorker* worker = (BodyWorker*)arg;
+    ParallelBody* body;
+    while ((body = claim_next(worker->parallel)) != NULL) {
+        parse_body(worker, body);
+        mark_done(worker->parallel, body);
+    }
+    return NULL;
+}
+
+// Scans the tokens and starts parser->threads - 1 worker threads on the
+// bodies found; the main thread helps with the bodies it reaches first.
+// Returns false, leaving a sequential parse, if there is nothing to share.
+bool start_parallel(Parser* parser) {
+    if (parser->threads <= 1 || parser->stream || parser->ast.enabled || parser->outside) {
+        return false;
+    }
+    ParallelParse* parallel = (ParallelParse*)calloc(1, sizeof(ParallelParse));
+    if (!parallel) {
+        return false;
+    }
+    parallel->parser = parser;
+    parallel->main_proc = parser->scopes[0].proc;
+    if (!scan_bodies(parallel) || parallel->count < 2) {
+        free(parallel->bodies);
+        free(parallel);
+        return false;
+    }
+    parallel->worker_count = parser->threads;
+    if ((size_t)parallel->worker_count > parallel->count) {
+        parallel->worker_count = (int)parallel->count;
+    }
+    parallel->workers = (BodyWorker*)calloc(parallel->worker_count, sizeof(BodyWorker));
+    if (!parallel->workers) {
+        free(parallel->bodies);
+        free(parallel);
+        return false;
+    }
+    pthread_mutex_init(&parallel->lock, NULL);
+    pthread_cond_init(&parallel->done, NULL);
+    for (int i = 0; i < parallel->worker_count; i++) {
+        init_worker(&parallel->workers[i], parallel);
+    }
+    for (int i = 1; i < parallel->worker_count; i++) {
+        if (pthread_create(&parallel->workers[i].thread, NULL, worker_main, &parallel->workers[i]) != 0) {
+            break; // the main thread parses what the others leave
+        }
+        parallel->started = i;
+    }
+    parser->parallel = parallel;
+    return true;
+}
+
+// Stops the workers once they finish their current body and frees
+// everything; called when the main parse ends, normally or not.
+void finish_parallel(Parser* parser) {
+    ParallelParse* parallel = parser->parallel;
+    if (!parallel) {
+        return;
+    }
+    pthread_mutex_lock(&parallel->lock);
+    parallel->stop = true;
+    pthread_mutex_unlock(&parallel->lock);
+    for (int i = 1; i <= parallel->started; i++) {
+        pthread_join(parallel->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < parallel->worker_count; i++) {
+        free_worker(&parallel->workers[i]);
+    }
+    for (size_t i = 0; i < parallel->count; i++) {
+        if (parallel->bodies[i].ok) {
+            free(parallel->bodies[i].vars); // the block holding all results
+        }
+    }
+    pthread_cond_destroy(&parallel->done);
+    pthread_mutex_destroy(&parallel->lock);
+    free(parallel->workers);
+    free(parallel->bodies);
+    free(parallel);
+    parser->parallel = NULL;
+}
+
+// Returns the body once parsed, parsing it here if no worker has started on it.
+static ParallelBody* wait_for_body(ParallelParse* parallel, ParallelBody* body) {
+    pthread_mutex_lock(&parallel->lock);
+    if (body->state == BODY_PENDING) {
+        body->state = BODY_CLAIMED;
+        pthread_mutex_unlock(&parallel->lock);
+        parse_body(&parallel->workers[0], body);
+        mark_done(parallel, body);
+        return body;
+    }
+    while (body->state != BODY_DONE) {
+        pthread_cond_wait(&parallel->done, &parallel->lock);
+    }
+    pthread_mutex_unlock(&parallel->lock);
+    return body;
+}
+
+// Whether the worker's parse is the one the main parse would make here: the
+// same header, every outside name found as the worker assumed, and no nested
+// procedure whose declaration the main tables would reject.
+static bool body_fits(Parser* parser, ProcedureEntry* proc, const ParallelBody* body) {
+    Atom main_proc = parser->scopes[0].proc;
+    if (proc->pname != body->name || (proc->param >= 0) != (body->param != ATOM_NONE) ||
+        (proc->param >= 0 && variable_at(parser, proc->param)->vname != body->param)) {
+        return false;
+    }
+    for (size_t i = 0; i < body->variable_count; i++) {
+        if (!find_variable(parser, body->variables[i], main_proc)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < body->procedure_count; i++) {
+        if (!find_procedure(parser, body->procedures[i])) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < body->proc_count; i++) {
+        if (body->procs[i].pname == main_proc || find_procedure(parser, body->procs[i].pname)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Called by the main parse with the 'begin' of proc's body as the current
+// token. If a worker parsed this body and its results fit, adds its entries
+// to the tables, leaves the parser where block() would have, and returns
+// true; otherwise the caller parses the body.
+bool adopt_parallel_body(Parser* parser, ProcedureEntry* proc) {
+    ParallelParse* parallel = parser->parallel;
+    if (!parallel || !proc || parser->scope_count != 2 || parser->current_token.type != BEGIN) {
+        return false;
+    }
+    if (parser->has_error) {
+        // the rest is parsed sequentially anyway
+        pthread_mutex_lock(&parallel->lock);
+        parallel->stop = true;
+        pthread_mutex_unlock(&parallel->lock);
+        return false;
+    }
+    size_t begin = parser->token_index - 1;
+    while (parallel->adopted < parallel->count && parallel->bodies[parallel->adopted].begin < begin) {
+        parallel->adopted++;
+    }
+    if (parallel->adopted == parallel->count || parallel->bodies[parallel->adopted].begin != begin) {
+        return false;
+    }
+    ParallelBody* body = wait_for_body(parallel, &parallel->bodies[parallel->adopted++]);
+    if (!body->ok || !body_fits(parser, proc, body)) {
+        return false;
+    }
+
+    // worker position i is position faddr + i here, as in a sequential parse
+    int offset = proc->faddr;
+    size_t first = 0;
+    if (proc->param >= 0) {
+        variable_at(parser, proc->param)->vtype = body->vars[0].vtype; // 'integer p;' in the body
+        first = 1;
+    }
+    for (size_t i = first; i < body->var_count; i++) {
+        if (!append_variable(parser, &body->vars[i])) {
+            return true; // reported; the parse has failed
+        }
+    }
+    for (size_t i = 0; i < body->proc_count; i++) {
+        ProcedureEntry entry = body->procs[i];
+        entry.faddr += offset;
+        entry.laddr += offset;
+        entry.param = entry.param >= 0 ? entry.param + offset : -1;
+        entry.var_start += offset;
+        entry.var_end += offset;
+        if (!append_procedure(parser, &entry)) {
+            return true;
+        }
+    }
+
+    // as after block() matched the 'end' and the line breaks after it
+    parser->token_index = body->end;
+    parser->line_number = token_line(parser, body->end - 1);
+    parser->line_index = (size_t)parser->line_number - 1;
+    parser->current_token.type = END;
+    parser->current_token.value = ATOM_NONE;
+    next_token(parser);
+    consume_eoln(parser);
+    STAT_ADD(parser, parallel_bodies, 1);
+    return true;
+}
+
+VariableEntry* outside_variable(Parser* parser, Atom name) {
+    OutsideLookups* lookups = parser->outside;
+    // the same name is often used several times in a row
+    if (lookups->variable_count == 0 || lookups->variables[lookups->variable_count - 1] != name) {
+        if (lookups->variable_count >= lookups->variable_capacity) {
+            size_t new_capacity = lookups->variable_capacity ? lookups->variable_capacity * 2 : 64;
+            Atom* grown = (Atom*)realloc(lookups->variables, new_capacity * sizeof(Atom));
+            if (!grown) {
+                lookups->failed = true;
+                return &lookups->variable;
+            }
+            lookups->variables = grown;
+            lookups->variable_capacity = new_capacity;
+        }
+        lookups->variables[lookups->variable_count++] = name;
+    }
+    return &lookups->variable;
+}
+
+ProcedureEntry* outside_procedure(Parser* parser, Atom name) {
+    OutsideLookups* lookups = parser->outside;
+    if (lookups->procedure_count == 0 || lookups->procedures[lookups->procedure_count - 1] != name) {
+        if (lookups->procedure_count >= lookups->procedure_capacity) {
+            size_t new_capacity = lookups->procedure_capacity ? lookups->procedure_capacity * 2 : 64;
+            Atom* grown = (Atom*)realloc(lookups->procedures, new_capacity * sizeof(Atom));
+            if (!grown) {
+                lookups->failed = true;
+                return &lookups->procedure;
+            }
+            lookups->procedures = grown;
+            lookups->procedure_capacity = new_capacity;
+        }
+        lookups->procedures[lookups->procedure_count++] = name;
+    }
+    return &lookups->procedure;
+}
@@ -3,126 +3,381 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <setjmp.h>
 #include "parser.h"
+#include "stream.h"
+#include "lexer.h"
+#include "dydb.h"
+#include "dydscan.h"
+#include "llparser.h"
 #include "var.h"
+#include "writer.h"
+#include "incremental.h"
+#include "parallel.h"
+
+static bool grow_tokens(Parser* parser, size_t capacity) {
+    uint8_t* types = (uint8_t*)realloc(parser->token_types, capacity * sizeof(uint8_t));
+    if (!types) {
+        return false;
+    }
+    parser->token_types = types;
+    Atom* values = (Atom*)realloc(parser->token_values, capacity * sizeof(Atom));
+    if (!values) {
+        return false;
+    }
+    parser->token_values = values;
+    parser->token_capacity = capacity;
+    return true;
+}
 
-Parser* create_parser(const char* filename) {
-    Parser* parser = (Parser*)malloc(sizeof(Parser));
-    if (!parser) {
-        perror("Failed to allocate parser");
-        exit(EXIT_FAILURE);
+static bool append_line_break(Parser* parser) {
+    if (parser->token_count > UINT32_MAX) {
+        return false;
     }
+    if (parser->line_break_count >= parser->line_break_capacity) {
+        size_t new_capacity = parser->line_break_capacity ? parser->line_break_capacity * 2 : 256;
+        uint32_t* grown = (uint32_t*)realloc(parser->line_breaks, new_capacity * sizeof(uint32_t));
+        if (!grown) {
+            return false;
+        }
+        parser->line_breaks = grown;
+        parser->line_break_capacity = new_capacity;
+    }
+    parser->line_breaks[parser->line_break_count++] = (uint32_t)parser->token_count;
+    return true;
+}
 
-    char* filename_copy = strdup(filename);
-    if (!filename_copy) {
-        perror("Failed to copy filename");
-        free(parser);
-        exit(EXIT_FAILURE);
+// An EOLN only records where the line breaks.
+bool append_token(Parser* parser, TokenType type, Atom value) {
+    if (type == EOLN) {
+        return append_line_break(parser);
+    }
+    if (parser->token_count >= parser->token_capacity &&
+        !grow_tokens(parser, parser->token_capacity ? parser->token_capacity * 2 : 256)) {
+        return false;
     }
+    parser->token_types[parser->token_count] = (uint8_t)checked_token_type(type);
+    parser->token_values[parser->token_count++] = value;
+    return true;
+}
 
-    char* dot = strrchr(filename_copy, '.');
-    if (!dot || strcmp(dot, ".dyd") != 0) {
-        fprintf(stderr, "Error: input file must have a .dyd extension\n");
-        free(filename_copy);
-        free(parser);
-        exit(EXIT_FAILURE);
+// Makes room for count tokens and line_breaks EOLNs, dropping any loaded
+// tokens.
+bool reserve_tokens(Parser* parser, size_t count, size_t line_breaks) {
+    parser->token_count = 0;
+    parser->token_gap_size = 0;
+    parser->line_break_count = 0;
+    parser->line_break_gap_size = 0;
+    if (count > UINT32_MAX || (count > parser->token_capacity && !grow_tokens(parser, count))) {
+        return false;
+    }
+    if (line_breaks > parser->line_break_capacity) {
+        uint32_t* grown = (uint32_t*)realloc(parser->line_breaks, line_breaks * sizeof(uint32_t));
+        if (!grown) {
+            return false;
+        }
+        parser->line_breaks = grown;
+        parser->line_break_capacity = line_breaks;
     }
+    return true;
+}
 
-    FILE* file = fopen(filename_copy, "r");
-    if (!file) {
-        fprintf(stderr, "Error opening file %s\n", filename_copy);
-        free(filename_copy);
-        free(parser);
-        exit(EXIT_FAILURE);
+// Closes the gaps parser_edit() leaves in the token arrays and the line
+// breaks, so that they are contiguous again for a full parse or for writing
+// the tokens out.
+void close_token_gap(Parser* parser) {
+    if (parser->token_gap_size != 0) {
+        size_t gap = parser->token_gap;
+        size_t size = parser->token_gap_size;
+        memmove(parser->token_types + gap, parser->token_types + gap + size,
+                (parser->token_count - gap) * sizeof(uint8_t));
+        memmove(parser->token_values + gap, parser->token_values + gap + size,
+                (parser->token_count - gap) * sizeof(Atom));
+        parser->token_gap_size = 0;
+    }
+    if (parser->line_break_gap_size != 0) {
+        for (size_t i = parser->line_break_gap; i < parser->line_break_count; i++) {
+            parser->line_breaks[i] = line_break(parser, i);
+        }
+        parser->line_break_gap_size = 0;
     }
+}
 
-    parser->tokens = malloc(MAX_TOKENS * sizeof(Token));
-    if (!parser->tokens) {
-        perror("Failed to allocate tokens");
-        free(filename_copy);
-        free(parser);
-        exit(EXIT_FAILURE);
+// Number of input tokens, EOLNs included.
+size_t input_token_count(Parser* parser) {
+    return parser->token_count + parser->line_break_count;
+}
+
+// Reads the input token at cursor, if any, and moves past it. The token gap
+// must be closed.
+bool next_input_token(Parser* parser, TokenCursor* cursor, Token* token) {
+    if (cursor->line_break < parser->line_break_count &&
+        parser->line_breaks[cursor->line_break] == cursor->token) {
+        cursor->line_break++;
+        token->type = EOLN;
+        token->value = ATOM_NONE;
+        return true;
     }
-    parser->token_count = 0;
+    if (cursor->token < parser->token_count) {
+        token->type = (TokenType)parser->token_types[cursor->token];
+        token->value = parser->token_values[cursor->token++];
+        return true;
+    }
+    return false;
+}
 
-    char* line = NULL;
-    size_t len = 0;
-    ssize_t read;
+// The line break at index, wherever the gap is.
+uint32_t line_break(Parser* parser, size_t index) {
+    if (parser->line_break_gap_size == 0 || index < parser->line_break_gap) {
+        return parser->line_breaks[index];
+    }
+    return (uint32_t)(parser->token_count - parser->line_breaks[index + parser->line_break_gap_size]);
+}
 
-    while ((read = getline(&line, &len, file)) != -1) {
-        if (strcmp(line, "\n") == 0 || line[0] == '\n') {
-            continue; // Skip empty lines
+// Line of the stored token at index, found by binary search of the line
+// breaks.
+int token_line(Parser* parser, size_t index) {
+    size_t low = 0;
+    size_t high = parser->line_break_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (line_break(parser, mid) <= index) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
         }
+    }
+    return (int)low + 1;
+}
 
-        if (parser->token_count >= MAX_TOKENS) {
-            fprintf(stderr, "tokens overflow\n");
-            free(line);
-            fclose(file);
-            free(filename_copy);
-            free(parser->tokens);
-            free(parser);
-            exit(EXIT_FAILURE);
+// atoi() on the type column, without needing a NUL-terminated string; a
+// number too large to be a token type comes out as _EOF + 1
+static int parse_type(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    int value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (value <= _EOF) {
+            value = value * 10 + (*p - '0');
         }
+        p++;
+    }
+    if (value > _EOF) {
+        value = _EOF + 1;
+    }
+    return negative ? -value : value;
+}
 
-        Token* new_token = &parser->tokens[parser->token_count];
-        const char* space = strchr(line, ' ');
-        if (space == NULL) {
-            fprintf(stderr, "Error: invalid line format\n");
-            free(line);
-            fclose(file);
-            free(filename_copy);
-            free(parser->tokens);
-            free(parser);
-            exit(EXIT_FAILURE);
+// Decodes one non-empty "value type" line, interning the value of identifiers and constants.
+ScanResult scan_token_line(AtomTable* atoms, const char* line, const char* eol, Token* token) {
+    const char* space = memchr(line, ' ', eol - line);
+    if (space == NULL) {
+        return SCAN_BAD_FORMAT;
+    }
+    token->type = checked_token_type(parse_type(space + 1, eol));
+    token->value = ATOM_NONE;
+    if (token->type == IDENT || token->type == CONST) {
+        token->value = intern_atom(atoms, line, space - line);
+        if (token->value == ATOM_NONE) {
+            return SCAN_NO_MEMORY;
         }
+    }
+    return SCAN_OK;
+}
+
+// Reports a failure to set up a parser, through the diagnostic sink when there
+// is one. line is 0 unless the failure is tied to a line of the input.
+static void setup_error_at(const ParserSinks* sinks, int line, const char* msg) {
+    if (sinks && sinks->diagnostic) {
+        sinks->diagnostic(sinks->context, line, msg);
+    }
+    else if (line > 0) {
+        fprintf(stderr, "LINE:%d %s\n", line, msg);
+    }
+    else {
+        fprintf(stderr, "%s\n", msg);
+    }
+}
+
+static void setup_error(const ParserSinks* sinks, const char* msg) {
+    setup_error_at(sinks, 0, msg);
+}
+
+// Tokenizes .mini source with the built-in lexer.
+static bool lex(Parser* parser, const char* begin, size_t size) {
+    int error_line = 0;
+    char error[128];
+    if (!lex_source(parser, begin, size, &error_line, error, sizeof(error))) {
+        setup_error_at(&parser->sinks, error_line, error);
+        return false;
+    }
+    return true;
+}
+
+// Tokenizes a whole .dyd text, see dydscan.h.
+static bool tokenize(Parser* parser, const char* begin, size_t size) {
+    char error[128];
+    if (!load_dyd(parser, begin, size, error, sizeof(error))) {
+        setup_error(&parser->sinks, error);
+        return false;
+    }
+    return true;
+}
+
+// Decodes a binary .dydb token image.
+static bool decode(Parser* parser, const char* begin, size_t size) {
+    char error[128];
+    if (!load_dydb(parser, (const unsigned char*)begin, size, error, sizeof(error))) {
+        setup_error(&parser->sinks, error);
+        return false;
+    }
+    return true;
+}
+
+static InputFormat input_format(const char* filename) {
+    const char* dot = strrchr(filename, '.');
+    if (!dot) return INPUT_UNKNOWN;
+    if (strcmp(dot, ".dyd") == 0) return INPUT_DYD;
+    if (strcmp(dot, ".dydb") == 0) return INPUT_DYDB;
+    if (strcmp(dot, ".mini") == 0) return INPUT_MINI;
+    return INPUT_UNKNOWN;
+}
 
-        size_t value_len = space - line;
-        if (value_len >= sizeof(new_token->value)) {
-            value_len = sizeof(new_token->value) - 1;
+// Map the input file and tokenize it; the mapping is released afterwards.
+static bool load_tokens(Parser* parser, const char* filename, InputFormat format) {
+    // reported like the errors of the input itself, so buffer parsers get them too
+    char error[512];
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        snprintf(error, sizeof(error), "Error opening file %s", filename);
+        setup_error(&parser->sinks, error);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        snprintf(error, sizeof(error), "Failed to stat input file: %s", strerror(errno));
+        setup_error(&parser->sinks, error);
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char* begin = NULL;
+    if (size > 0) {
+        void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            snprintf(error, sizeof(error), "Failed to map input file: %s", strerror(errno));
+            setup_error(&parser->sinks, error);
+            close(fd);
+            return false;
         }
-        strncpy(new_token->value, line, value_len);
-        new_token->value[value_len] = '\0';
+        posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+        begin = (const char*)map;
+    }
+    close(fd);
 
-        new_token->type = atoi(space + 1);
+    bool ok;
+    switch (format) {
+    case INPUT_MINI:
+        ok = lex(parser, begin, size);
+        break;
+    case INPUT_DYDB:
+        ok = decode(parser, begin, size);
+        break;
+    default:
+        ok = tokenize(parser, begin, size);
+        break;
+    }
+    if (begin) munmap((void*)begin, size);
+    return ok;
+}
 
-        parser->token_count++;
+// Allocates a parser with empty tables and the main scope open, or returns NULL.
+static Parser* alloc_parser(const ParserSinks* sinks) {
+    Parser* parser = (Parser*)calloc(1, sizeof(Parser));
+    if (!parser) {
+        setup_error(sinks, "Error: failed to allocate parser");
+        return NULL;
+    }
+    if (sinks) {
+        parser->sinks = *sinks;
     }
 
-    free(line);
-    fclose(file);
+    if (!init_atom_table(&parser->atoms)) {
+        setup_error(sinks, "Error: failed to allocate atom table");
+        free(parser);
+        return NULL;
+    }
 
     parser->token_index = 0;
     parser->current_token.type = _EOF;
-    parser->current_token.value[0] = '\0';
-
-    parser->var_capacity = 100;
-    parser->var_count = 0;
-    parser->vartab = (VariableEntry*)malloc(parser->var_capacity * sizeof(VariableEntry));
-    if (!parser->vartab) {
-        perror("Failed to allocate variable table");
-        free(filename_copy);
-        free(parser->tokens);
-        free(parser);
-        exit(EXIT_FAILURE);
-    }
+    parser->current_token.value = ATOM_NONE;
 
-    parser->proc_capacity = 50;
-    parser->proc_count = 0;
-    parser->proctab = (ProcedureEntry*)malloc(parser->proc_capacity * sizeof(ProcedureEntry));
-    if (!parser->proctab) {
-        perror("Failed to allocate procedure table");
-        free(filename_copy);
-        free(parser->tokens);
-        free(parser->vartab);
-        free(parser);
-        exit(EXIT_FAILURE);
+    init_arena(&parser->arena);
+    if (!init_tables(parser)) {
+        setup_error(sinks, "Error: failed to allocate symbol tables");
+        destroy_parser(parser);
+        return NULL;
     }
 
-    parser->current_level = 0;
-    strcpy(parser->current_proc, "main");
+    Atom main_proc = intern_atom(&parser->atoms, "main", 4);
+    parser->current_level = -1;
+    if (main_proc == ATOM_NONE || !enter_scope(parser, main_proc)) {
+        setup_error(sinks, "Error: failed to create main scope");
+        destroy_parser(parser);
+        return NULL;
+    }
     parser->has_error = 0;
+    parser->engine = ENGINE_RECURSIVE;
+    parser->max_errors = DEFAULT_MAX_ERRORS;
     parser->line_number = 1;
+    return parser;
+}
+
+// Loads (or, for a push parser, prepares to receive) the tokens of filename
+// and opens the .var/.pro/.err files next to it.
+static bool open_files(Parser* parser, const char* filename, bool push) {
+    char* filename_copy = arena_strdup(&parser->arena, filename);
+    if (!filename_copy) {
+        perror("Failed to copy filename");
+        return false;
+    }
+
+    char* dot = strrchr(filename_copy, '.');
+    InputFormat format = input_format(filename_copy);
+    if (format == INPUT_UNKNOWN || (push && format != INPUT_DYD)) {
+        fprintf(stderr, push ? "Error: input file must have a .dyd extension\n"
+                             : "Error: input file must have a .dyd, .dydb or .mini extension\n");
+        return false;
+    }
+
+    if (push) {
+        parser->stream = create_token_stream(parser);
+        if (!parser->stream) {
+            perror("Failed to allocate token stream");
+            return false;
+        }
+    }
+    else {
+        STAT_TIMER(start);
+        bool loaded = load_tokens(parser, filename_copy, format);
+        STAT_ELAPSED(parser, load_ms, start);
+        if (!loaded) {
+            return false;
+        }
+    }
 
     *dot = '\0'; // Remove the extension
 
@@ -134,26 +389,128 @@ Parser* create_parser(const char* filename) {
     snprintf(pro_filename, sizeof(pro_filename), "%s.pro", filename_copy);
     snprintf(var_filename, sizeof(var_filename), "%s.var", filename_copy);
 
-    free(filename_copy);
-
     parser->err = fopen(err_filename, "w");
     parser->pro = fopen(pro_filename, "w");
     parser->var = fopen(var_filename, "w");
 
     if (!parser->err || !parser->pro || !parser->var) {
         perror("Error opening output files");
+        return false;
+    }
+
+    return true;
+}
+
+static Parser* open_parser(const char* filename, bool push) {
+    Parser* parser = alloc_parser(NULL);
+    if (parser && !open_files(parser, filename, push)) {
         destroy_parser(parser);
-        exit(EXIT_FAILURE);
+        return NULL;
+    }
+    return parser;
+}
+
+Parser* create_parser(const char* filename) {
+    return open_parser(filename, false);
+}
+
+// The file name only determines the output files; tokens arrive through parser_feed().
+Parser* create_push_parser(const char* filename) {
+    return open_parser(filename, true);
+}
+
+// Loads another input file into a parser that was just created or reset.
+bool parser_load_file(Parser* parser, const char* filename) {
+    return open_files(parser, filename, false);
+}
+
+// Loads only the tokens of a .dyd, .dydb or .mini file, without opening any
+// output files (for format conversion).
+bool parser_load_tokens(Parser* parser, const char* filename) {
+    InputFormat format = input_format(filename);
+    if (format == INPUT_UNKNOWN) {
+        setup_error(&parser->sinks, "Error: input file must have a .dyd, .dydb or .mini extension");
+        return false;
+    }
+    return load_tokens(parser, filename, format);
+}
+
+// Clears everything left by the previous parse so the parser can be loaded
+// again. Allocated capacity, options and sinks are kept. Returns false if the
+// tables could not be set up again; the parser can then only be destroyed.
+bool parser_reset(Parser* parser) {
+    if (parser->err) fclose(parser->err);
+    if (parser->pro) fclose(parser->pro);
+    if (parser->var) fclose(parser->var);
+    parser->err = parser->pro = parser->var = NULL;
+    if (parser->stream) {
+        destroy_token_stream(parser->stream);
+        parser->stream = NULL;
     }
 
+    reset_atom_table(&parser->atoms);
+    memset(&parser->stats, 0, sizeof(parser->stats));
+    parser->token_count = 0;
+    parser->token_gap_size = 0;
+    parser->line_break_count = 0;
+    parser->line_break_gap_size = 0;
+    return parser_rewind(parser);
+}
+
+// Clears the tables and diagnostics of the previous parse but keeps the
+// tokens, so that program() can parse them again.
+bool parser_rewind(Parser* parser) {
+    parser->token_index = 0;
+    parser->line_index = 0;
+    parser->current_token.type = _EOF;
+    parser->current_token.value = ATOM_NONE;
+
+    // the arena keeps its chunks, so after the first few files this
+    // rewinds and reuses memory instead of allocating it
+    arena_reset(&parser->arena);
+    bool ok = init_tables(parser);
+    parser->current_level = -1;
+    // the scope stack keeps its capacity, so entering main cannot fail
+    if (ok) {
+        enter_scope(parser, intern_atom(&parser->atoms, "main", 4));
+    }
+
+    clear_diagnostics(&parser->diagnostics);
+    reset_ast(&parser->ast);
+    reset_edits(parser, false);
+    parser->has_error = 0;
+    parser->panic = false;
+    parser->aborted = false;
+    parser->abort_jump = NULL;
+    parser->line_number = 1;
+    return ok;
+}
+
+// Parses .dyd text held in memory. No files are touched: symbol tables and
+// diagnostics are delivered through the sinks, and setup failures are reported
+// to sinks->diagnostic with line 0 before NULL is returned.
+Parser* create_buffer_parser(const char* data, size_t len, const ParserSinks* sinks) {
+    Parser* parser = alloc_parser(sinks);
+    if (!parser) {
+        return NULL;
+    }
+    if (!tokenize(parser, data, len)) {
+        destroy_parser(parser);
+        return NULL;
+    }
     return parser;
 }
 
 void destroy_parser(Parser* parser) {
     if (!parser) return;
-    free(parser->tokens);
-    free(parser->vartab);
-    free(parser->proctab);
+    if (parser->stream) destroy_token_stream(parser->stream);
+    free_atom_table(&parser->atoms);
+    free(parser->token_types);
+    free(parser->token_values);
+    free(parser->line_breaks);
+    free_arena(&parser->arena);
+    free_diagnostics(&parser->diagnostics);
+    free_edits(parser);
     if (parser->err) fclose(parser->err);
     if (parser->pro) fclose(parser->pro);
     if (parser->var) fclose(parser->var);
@@ -162,8 +519,13 @@ void destroy_parser(Parser* parser) {
 
 // debug function to print tokens
 void print_tokens(Parser* parser) {
-    for (int i = 0; i < parser->token_count; i++) {
-        printf("Token %d: value='%s', type=%d\n", i, parser->tokens[i].value, parser->tokens[i].type);
+    close_token_gap(parser);
+    TokenCursor cursor = { 0, 0 };
+    Token token;
+    for (int i = 0; next_input_token(parser, &cursor, &token); i++) {
+        const char* value = token.value != ATOM_NONE ? atom_name(&parser->atoms, token.value)
+                                                     : get_token_name(token.type);
+        printf("Token %d: value='%s', type=%d\n", i, value, token.type);
     }
 }
 
@@ -171,13 +533,27 @@ void next_token(Parser* parser) {
     if (current_token_type(parser) == EOLN) {
         parser->line_number++;
     }
- 
-    if (parser->token_index < parser->token_count) {
-        parser->current_token = parser->tokens[parser->token_index++];
-   }
+
+    if (parser->aborted) {
+        parser->current_token.type = _EOF;
+        parser->current_token.value = ATOM_NONE;
+    }
+    else if (parser->stream) {
+        stream_next_token(parser->stream, &parser->current_token);
+    }
+    else if (parser->line_index < parser->line_break_count &&
+             parser->line_breaks[parser->line_index] == parser->token_index) {
+        parser->line_index++;
+        parser->current_token.type = EOLN;
+        parser->current_token.value = ATOM_NONE;
+    }
+    else if (parser->token_index < parser->token_count) {
+        parser->current_token.type = (TokenType)parser->token_types[parser->token_index];
+        parser->current_token.value = parser->token_values[parser->token_index++];
+    }
     else {
         parser->current_token.type = _EOF;
-        parser->current_token.value[0] = '\0';
+        parser->current_token.value = ATOM_NONE;
     }
 }
 
@@ -186,8 +562,18 @@ TokenType current_token_type(Parser* parser) {
 }
 
 TokenType peek_token_type(Parser* parser) {
-    if (parser->token_index < parser->token_count) {
-        return parser->tokens[parser->token_index].type;
+    if (parser->aborted) {
+        return _EOF;
+    }
+    else if (parser->stream) {
+        return stream_peek_token_type(parser->stream);
+    }
+    else if (parser->line_index < parser->line_break_count &&
+             parser->line_breaks[parser->line_index] == parser->token_index) {
+        return EOLN;
+    }
+    else if (parser->token_index < parser->token_count) {
+        return (TokenType)parser->token_types[parser->token_index];
     }
     else {
         return _EOF;
@@ -200,9 +586,27 @@ void consume_eoln(Parser* parser){
     }
 }
 
+// Panic-mode recovery: skip to the end of the current statement or line.
+// A ';' is consumed, an 'end' is left for the enclosing block to match.
+void synchronize(Parser* parser) {
+    TokenType type = current_token_type(parser);
+    while (type != SEMICOLON && type != EOLN && type != END && type != _EOF) {
+        next_token(parser);
+        type = current_token_type(parser);
+    }
+    if (type == SEMICOLON) {
+        next_token(parser);
+    }
+    consume_eoln(parser);
+    parser->panic = false;
+}
+
 bool match(Parser* parser, TokenType type) {
     if (current_token_type(parser) == type) {
         next_token(parser);
+        if (type == SEMICOLON) {
+            parser->panic = false; // the statement ended normally, back in sync
+        }
         return true;
     }
     else {
@@ -222,15 +626,56 @@ bool match(Parser* parser, TokenType type) {
 
 void parser_error(Parser* parser, const char* msg) {
     parser->has_error = 1;
-    if (parser->err) {
-        fprintf(parser->err, "LINE:%d %s\n", parser->line_number, msg);
+
+    if (parser->collect_errors) {
+        // errors reported before resynchronizing are usually caused by the first one
+        if (parser->panic || parser->aborted) {
+            return;
+        }
+        parser->panic = true;
+        if (!add_diagnostic(&parser->diagnostics, parser->line_number, msg)) {
+            perror("Failed to record diagnostic");
+            parser->aborted = true;
+        }
+        else if (parser->diagnostics.count >= parser->max_errors) {
+            add_diagnostic(&parser->diagnostics, parser->line_number, "too many errors, stopping");
+            parser->aborted = true;
+        }
+        if (parser->aborted) {
+            parser->current_token.type = _EOF;
+            parser->current_token.value = ATOM_NONE;
+        }
+        return;
     }
-    fprintf(stderr, "LINE:%d %s\n", parser->line_number, msg);
 
-    // clear the resources and exit
-    destroy_parser(parser);
+    if (parser->sinks.diagnostic) {
+        parser->sinks.diagnostic(parser->sinks.context, parser->line_number, msg);
+    }
+    else {
+        // formatted once for both the .err file and stderr
+        size_t msg_len = strlen(msg);
+        char text[512];
+        char* line = msg_len + 24 <= sizeof(text) ? text : (char*)malloc(msg_len + 24);
+        if (line) {
+            char* end = put_bytes(line, "LINE:", 5);
+            end = put_int(end, parser->line_number);
+            *end++ = ' ';
+            end = put_bytes(end, msg, msg_len);
+            *end++ = '\n';
+            if (parser->err) {
+                write_stream(parser->err, line, (size_t)(end - line));
+            }
+            write_stream(stderr, line, (size_t)(end - line));
+            if (line != text) {
+                free(line);
+            }
+        }
+    }
 
-    exit(EXIT_FAILURE);
+    // unwind to program(), which stops the parse
+    if (parser->abort_jump) {
+        longjmp(*parser->abort_jump, 1);
+    }
 }
 
 bool is_valid_identifier(const char* str) {
@@ -241,12 +686,53 @@ bool is_valid_identifier(const char* str) {
     return true;
 }
 
+// Enters a function, statement or expression; false, with the caller to hand
+// it to the table engine instead, when that would nest deeper than
+// RECURSIVE_MAX_DEPTH, so that no input can overflow the C stack.
+static bool enter_level(Parser* parser) {
+    if (parser->depth >= RECURSIVE_MAX_DEPTH) {
+        return false;
+    }
+    parser->depth++;
+    STAT_MAX(parser, max_depth, parser->depth);
+    return true;
+}
+
 bool program(Parser* parser) {
+    jmp_buf abort_jump;
     parser->has_error = 0;
     parser->line_number = 1;
-    next_token(parser); // Initialize the first token
-    block(parser);
-    output_to_file(parser);
+    parser->abort_jump = &abort_jump;
+    parser->depth = 0;
+    close_token_gap(parser);
+    STAT_TIMER(start);
+    start_parallel(parser);
+    if (setjmp(abort_jump) == 0) {
+        if (!start_ast(parser)) {
+            parser_error(parser, "Error: failed to allocate syntax tree");
+        }
+        next_token(parser); // Initialize the first token
+        if (parser->engine == ENGINE_RECURSIVE) {
+            block(parser);
+        }
+        else {
+            table_block(parser);
+        }
+        finish_parallel(parser);
+        finish_ast(parser);
+        STAT_ELAPSED(parser, parse_ms, start);
+        output_to_file(parser);
+        if (parser->collect_errors) {
+            report_diagnostics(parser);
+        }
+    }
+    else {
+        finish_parallel(parser);
+        STAT_ELAPSED(parser, parse_ms, start);
+    }
+    record_memory_stats(parser);
+    parser->abort_jump = NULL;
+    reset_edits(parser, !parser->has_error);
     return !parser->has_error;
 }
 
@@ -254,6 +740,7 @@ void block(Parser* parser) {
     if (!match(parser, BEGIN) || !match(parser, EOLN)) {
         return;
     }
+    ast_open(parser, ATOM_NONE);
 
     declarations(parser);
 
@@ -261,9 +748,19 @@ void block(Parser* parser) {
 
     consume_eoln(parser);
 
+    // when collecting errors, report a token that cannot start a statement,
+    // skip past it and carry on with the statements after it
+    while (parser->collect_errors && current_token_type(parser) != END && current_token_type(parser) != _EOF) {
+        match(parser, END);
+        synchronize(parser);
+        executions(parser);
+        consume_eoln(parser);
+    }
+
     if (!match(parser, END)) {
         return;
     }
+    ast_close(parser, AST_BLOCK);
 
     consume_eoln(parser);
 }
@@ -271,13 +768,21 @@ void block(Parser* parser) {
 void declarations(Parser* parser) {
     while (current_token_type(parser) == INTEGER) {
         declaration(parser);
+        if (parser->panic) {
+            synchronize(parser);
+        }
     }
 }
 
 void declaration(Parser* parser) {
     TokenType lookahead = peek_token_type(parser); // lookahead one token
     if (lookahead == FUNCTION) {
+        if (!enter_level(parser)) {
+            table_declaration(parser);
+            return;
+        }
         func_declaration(parser);
+        parser->depth--;
     }
     else if (lookahead == IDENT) {
         var_declaration(parser); 
@@ -317,6 +822,7 @@ void var(Parser* parser, int kind) {
     }
 
     add_variable(parser, parser->current_token.value, VAR_INT, kind);
+    ast_leaf(parser, AST_VARIABLE, parser->current_token.value);
     match(parser, IDENT); // consume identifier
 }
 
@@ -335,8 +841,7 @@ void func_declaration(Parser* parser) {
         return;
     }
 
-    char func_name[16];
-    strcpy(func_name, parser->current_token.value);
+    Atom func_name = parser->current_token.value;
 
     int var_start = parser->var_count;
     match(parser, IDENT); // consume function name
@@ -345,36 +850,48 @@ void func_declaration(Parser* parser) {
         return;
     }
 
-    char old_proc[16];
-    strcpy(old_proc, parser->current_proc);
-    strcpy(parser->current_proc, func_name);
-    parser->current_level++;
+    if (!enter_scope(parser, func_name)) {
+        parser_error(parser, "Error: failed to allocate scope");
+        return;
+    }
 
-    add_procedure(parser, func_name, var_start, -1); // -1 means not finalized yet
+    ProcedureEntry* proc = add_procedure(parser, func_name, var_start, -1); // -1 means not finalized yet
+    ast_open(parser, func_name);
 
     parameter(parser);
 
     if (!match(parser, CLOSEPAREN)) {
-        parser->current_level--;
-        strcpy(parser->current_proc, old_proc);
+        exit_scope(parser);
         return;
     }
 
     if (!match(parser, SEMICOLON)) {
-        parser->current_level--;
-        strcpy(parser->current_proc, old_proc);
+        exit_scope(parser);
         return;
     }
 
     consume_eoln(parser);
 
-    block(parser);
+    // without an entry (a name already taken, when collecting errors) the
+    // body is parsed only for its diagnostics
+    if (!proc) {
+        block(parser);
+        ast_close(parser, AST_FUNCTION);
+        exit_scope(parser);
+        return;
+    }
+
+    open_body_span(parser, proc);
+    if (!adopt_parallel_body(parser, proc)) {
+        block(parser);
+    }
+    ast_close(parser, AST_FUNCTION);
+    close_body_span(parser, proc);
 
     int var_end = parser->var_count - 1;
     update_procedure(parser, func_name, var_start, var_end);
 
-    strcpy(parser->current_proc, old_proc);
-    parser->current_level--;
+    exit_scope(parser);
 }
 
 bool is_execution_token(TokenType type) {
@@ -384,10 +901,17 @@ bool is_execution_token(TokenType type) {
 void executions(Parser* parser) {
     while (is_execution_token(current_token_type(parser))) {
         execution(parser);
+        if (parser->panic) {
+            synchronize(parser);
+        }
     }
 }
 
 void execution(Parser* parser) {
+    if (!enter_level(parser)) {
+        table_execution(parser);
+        return;
+    }
     TokenType cur_type = current_token_type(parser);
     switch (cur_type) {
     case READ:
@@ -421,6 +945,7 @@ void execution(Parser* parser) {
     }
     break;
     }
+    parser->depth--;
 }
 
 void parameter(Parser* parser) {
@@ -428,6 +953,7 @@ void parameter(Parser* parser) {
         return; 
     }
     add_variable(parser, parser->current_token.value, VAR_UNKNOWN, 1);
+    ast_leaf(parser, AST_PARAMETER, parser->current_token.value);
     match(parser, IDENT);
 }
 
@@ -450,16 +976,18 @@ void read_statement(Parser* parser) {
         return;
     }
 
-    VariableEntry* var_entry = find_variable(parser, parser->current_token.value, parser->current_proc);
+    Atom name = parser->current_token.value;
+    VariableEntry* var_entry = resolve_variable(parser, name);
     if (var_entry == NULL) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "variable '%s' not declared in procedure '%s'", 
-                 parser->current_token.value, parser->current_proc);
+                 atom_name(&parser->atoms, name), atom_name(&parser->atoms, parser->current_proc));
         parser_error(parser, error_msg);
         return;
     }
 
+    ast_leaf(parser, AST_READ, name);
     match(parser, IDENT);
 
     if (!match(parser, CLOSEPAREN)) {
@@ -492,16 +1020,18 @@ void write_statement(Parser* parser) {
         return;
     }
 
-    VariableEntry* var_entry = find_variable(parser, parser->current_token.value, parser->current_proc);
+    Atom name = parser->current_token.value;
+    VariableEntry* var_entry = resolve_variable(parser, name);
     if (var_entry == NULL) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "variable '%s' not declared in procedure '%s'", 
-                 parser->current_token.value, parser->current_proc);
+                 atom_name(&parser->atoms, name), atom_name(&parser->atoms, parser->current_proc));
         parser_error(parser, error_msg);
         return;
     }
 
+    ast_leaf(parser, AST_WRITE, name);
     match(parser, IDENT);
 
     if (!match(parser, CLOSEPAREN)) {
@@ -526,15 +1056,15 @@ void assignment_statement(Parser* parser) {
         return;
     }
 
-    bool is_return_assignment = (strcmp(parser->current_token.value, parser->current_proc) == 0);
+    bool is_return_assignment = (parser->current_token.value == parser->current_proc);
 
-    VariableEntry* var_entry = find_variable(parser, parser->current_token.value, parser->current_proc);
-
-    if (var_entry == NULL && !is_return_assignment) {
+    Atom name = parser->current_token.value;
+    // the function's own name needs no variable, so it is not looked up
+    if (!is_return_assignment && resolve_variable(parser, name) == NULL) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "variable '%s' not declared in procedure '%s'", 
-                 parser->current_token.value, parser->current_proc);
+                 atom_name(&parser->atoms, name), atom_name(&parser->atoms, parser->current_proc));
         parser_error(parser, error_msg);
         match(parser, IDENT);
         if (current_token_type(parser) == ASSIGN) {
@@ -545,12 +1075,14 @@ void assignment_statement(Parser* parser) {
         return;
     }
 
+    ast_open(parser, name);
     match(parser, IDENT);
     if (!match(parser, ASSIGN)) {
         return;
     }
 
     arithmetic_expression(parser);
+    ast_close(parser, AST_ASSIGN);
     if (!match(parser, SEMICOLON)) {
         return;
     }
@@ -559,15 +1091,22 @@ void assignment_statement(Parser* parser) {
 }
 
 void arithmetic_expression(Parser* parser) {
+    if (!enter_level(parser)) {
+        table_expression(parser);
+        return;
+    }
     term(parser);
     arithmetic_expression_prime(parser);
+    parser->depth--;
 }
 
+// The primes loop where the grammar recurses, so an expression's length
+// does not nest calls.
 void arithmetic_expression_prime(Parser* parser) {
-    if (current_token_type(parser) == MINUS) {
+    while (current_token_type(parser) == MINUS) {
         match(parser, MINUS);
         term(parser);
-        arithmetic_expression_prime(parser);
+        ast_binary(parser, AST_SUBTRACT, 0);
     }
 }
 
@@ -577,10 +1116,10 @@ void term(Parser* parser) {
 }
 
 void term_prime(Parser* parser) {
-    if (current_token_type(parser) == MUL) {
+    while (current_token_type(parser) == MUL) {
         match(parser, MUL);
         factor(parser);
-        term_prime(parser);
+        ast_binary(parser, AST_MULTIPLY, 0);
     }
 }
 
@@ -597,6 +1136,7 @@ void factor(Parser* parser) {
         break;
 
     case CONST:
+        ast_constant(parser, parser->current_token.value);
         match(parser, CONST);
         break;
 
@@ -630,16 +1170,18 @@ void var_reference(Parser* parser) {
         return;
     }
 
-    VariableEntry* var_entry = find_variable(parser, parser->current_token.value, parser->current_proc);
+    Atom name = parser->current_token.value;
+    VariableEntry* var_entry = resolve_variable(parser, name);
     if (var_entry == NULL) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "variable '%s' not declared in procedure '%s'", 
-                 parser->current_token.value, parser->current_proc);
+                 atom_name(&parser->atoms, name), atom_name(&parser->atoms, parser->current_proc));
         parser_error(parser, error_msg);
         return;
     }
 
+    ast_leaf(parser, AST_REFERENCE, name);
     match(parser, IDENT);
 }
 
@@ -654,20 +1196,23 @@ void func_call(Parser* parser) {
         return;
     }
 
-    ProcedureEntry* proc_entry = find_procedure(parser, parser->current_token.value);
+    Atom name = parser->current_token.value;
+    ProcedureEntry* proc_entry = find_procedure(parser, name);
     if (proc_entry == NULL) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "procedure '%s' not declared", 
-                 parser->current_token.value);
+                 atom_name(&parser->atoms, name));
         parser_error(parser, error_msg);
         return;
     }
 
+    ast_open(parser, name);
     match(parser, IDENT);
     match(parser, OPENPAREN);
     parameter_list(parser);
     match(parser, CLOSEPAREN);
+    ast_close(parser, AST_CALL);
 }
 
 // only support single parameter for now
@@ -679,6 +1224,7 @@ void conditional_statement(Parser* parser) {
     if (!match(parser, IF)) {
         return;
     }
+    ast_open(parser, ATOM_NONE);
 
     conditional_expression(parser);
 
@@ -688,19 +1234,26 @@ void conditional_statement(Parser* parser) {
 
     consume_eoln(parser);
 
+    ast_open(parser, ATOM_NONE);
     executions(parser);
+    ast_close(parser, AST_SEQUENCE);
 
     if (current_token_type(parser) == ELSE) {
         match(parser, ELSE);
         consume_eoln(parser);
+        ast_open(parser, ATOM_NONE);
         executions(parser);
+        ast_close(parser, AST_SEQUENCE);
     }
+    ast_close(parser, AST_IF);
 }
 
 void conditional_expression(Parser* parser) {
     arithmetic_expression(parser);
+    TokenType operator = current_token_type(parser);
     relation_operator(parser);
     arithmetic_expression(parser);
+    ast_binary(parser, AST_COMPARE, operator);
 }
 
 void relation_operator(Parser* parser) {
@@ -728,16 +1281,159 @@ void relation_operator(Parser* parser) {
     }
 }
 
-void output_to_file(Parser* p) {
-    for (int i = 0; i < p->proc_count; i++) {
-        ProcedureEntry* proc = &p->proctab[i];
-        fprintf(p->pro, "%s %s %d %d %d\n",
-            proc->pname, var_type_to_string(proc->ptype), proc->plev, proc->faddr, proc->laddr);
+// Delivers collected diagnostics to the sink, or writes them to the .err file and stderr.
+void report_diagnostics(Parser* p) {
+    if (p->sinks.diagnostic) {
+        for (size_t i = 0; i < p->diagnostics.count; i++) {
+            Diagnostic* diag = &p->diagnostics.items[i];
+            // the message without the trailing newline of the formatted text
+            int msg_len = (int)(diag->offset + diag->length - diag->message - 1);
+            char msg[512];
+            snprintf(msg, sizeof(msg), "%.*s", msg_len, p->diagnostics.text + diag->message);
+            p->sinks.diagnostic(p->sinks.context, diag->line, msg);
+        }
+        return;
     }
+    write_diagnostics(&p->diagnostics, p->err);
+    write_diagnostics(&p->diagnostics, stderr);
+}
 
-    for (int i = 0; i < p->var_count; i++) {
-        VariableEntry* var = &p->vartab[i];
-        fprintf(p->var, "%s %s %d %s %d %d\n",
-            var->vname, var->vproc, var->vkind, var_type_to_string(var->vtype),var->vlev, var->vaddr);
+// Rows of the .pro and .var files. The exact size is counted first, so the
+// buffer is allocated once and each table goes out with a single write. Rows
+// reserve room for the longest numbers, which the extra room at the end of
+// the buffer covers.
+#define INT_ROOM 11 // characters of the longest int
+
+typedef struct {
+    const char* names[VAR_UNKNOWN + 1];
+    size_t lengths[VAR_UNKNOWN + 1];
+} TypeNames;
+
+static void init_type_names(TypeNames* types) {
+    for (int type = 0; type <= VAR_UNKNOWN; type++) {
+        types->names[type] = var_type_to_string((VarType)type);
+        types->lengths[type] = strlen(types->names[type]);
+    }
+}
+
+static const char* type_name(const TypeNames* types, VarType type, size_t* length) {
+    if ((unsigned)type <= VAR_UNKNOWN) {
+        *length = types->lengths[type];
+        return types->names[type];
+    }
+    const char* name = var_type_to_string(type);
+    *length = strlen(name);
+    return name;
+}
+
+// "name type plev faddr laddr" per procedure.
+static void write_procedures(Parser* p) {
+    TypeNames types;
+    init_type_names(&types);
+    size_t size = 0;
+    size_t length;
+    for (size_t i = 0; i < p->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(p, i);
+        type_name(&types, proc->ptype, &length);
+        size += atom_length(&p->atoms, proc->pname) + length + int_length(proc->plev) + int_length(proc->faddr) +
+                int_length(proc->laddr) + 5;
+    }
+    Writer w;
+    writer_open(&w, p->pro, size + 3 * INT_ROOM);
+    for (size_t i = 0; i < p->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(p, i);
+        const char* type = type_name(&types, proc->ptype, &length);
+        uint32_t name_length = atom_length(&p->atoms, proc->pname);
+        char* out = writer_reserve(&w, name_length + length + 3 * INT_ROOM + 5);
+        if (!out) {
+            break;
+        }
+        out = put_bytes(out, atom_name(&p->atoms, proc->pname), name_length);
+        *out++ = ' ';
+        out = put_bytes(out, type, length);
+        *out++ = ' ';
+        out = put_int(out, proc->plev);
+        *out++ = ' ';
+        out = put_int(out, proc->faddr);
+        *out++ = ' ';
+        out = put_int(out, proc->laddr);
+        *out++ = '\n';
+        writer_advance(&w, out);
+    }
+    if (!writer_close(&w)) {
+        perror("Failed to write procedure table");
+    }
+}
+
+// "name proc kind type vlev vaddr" per variable.
+static void write_variables(Parser* p) {
+    TypeNames types;
+    init_type_names(&types);
+    size_t size = 0;
+    size_t length;
+    for (size_t i = 0; i < p->var_count; i++) {
+        VariableEntry* var = variable_at(p, i);
+        type_name(&types, var->vtype, &length);
+        size += atom_length(&p->atoms, var->vname) + atom_length(&p->atoms, var->vproc) + int_length(var->vkind) +
+                length + int_length(var->vlev) + int_length(var->vaddr) + 6;
+    }
+    Writer w;
+    writer_open(&w, p->var, size + 3 * INT_ROOM);
+    for (size_t i = 0; i < p->var_count; i++) {
+        VariableEntry* var = variable_at(p, i);
+        const char* type = type_name(&types, var->vtype, &length);
+        uint32_t name_length = atom_length(&p->atoms, var->vname);
+        uint32_t proc_length = atom_length(&p->atoms, var->vproc);
+        char* out = writer_reserve(&w, name_length + proc_length + length + 3 * INT_ROOM + 6);
+        if (!out) {
+            break;
+        }
+        out = put_bytes(out, atom_name(&p->atoms, var->vname), name_length);
+        *out++ = ' ';
+        out = put_bytes(out, atom_name(&p->atoms, var->vproc), proc_length);
+        *out++ = ' ';
+        out = put_int(out, var->vkind);
+        *out++ = ' ';
+        out = put_bytes(out, type, length);
+        *out++ = ' ';
+        out = put_int(out, var->vlev);
+        *out++ = ' ';
+        out = put_int(out, var->vaddr);
+        *out++ = '\n';
+        writer_advance(&w, out);
+    }
+    if (!writer_close(&w)) {
+        perror("Failed to write variable table");
+    }
+}
+
+static void write_tables(Parser* p) {
+    if (!renumber_symbols(p)) {
+        perror("Failed to renumber symbols");
+        return;
+    }
+    if (p->sinks.procedure || p->sinks.variable) {
+        for (size_t i = 0; p->sinks.procedure && i < p->proc_count; i++) {
+            ProcedureEntry* proc = procedure_at(p, i);
+            p->sinks.procedure(p->sinks.context, proc, atom_name(&p->atoms, proc->pname));
+        }
+        for (size_t i = 0; p->sinks.variable && i < p->var_count; i++) {
+            VariableEntry* var = variable_at(p, i);
+            p->sinks.variable(p->sinks.context, var, atom_name(&p->atoms, var->vname), atom_name(&p->atoms, var->vproc));
+        }
+        return;
     }
-}
\ No newline at end of file
+
+    if (p->pro) {
+        write_procedures(p);
+    }
+    if (p->var) {
+        write_variables(p);
+    }
+}
+
+void output_to_file(Parser* p) {
+    STAT_TIMER(start);
+    write_tables(p);
+    STAT_ELAPSED(p, emit_ms, start);
+}
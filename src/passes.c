@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "token.h"
+#include "ir.h"
+
+#define IR_INLINE_LIMIT 40 // instructions of a function inlined at its call sites
+
+// Memory slots of a function as (hops, slot) keys, in an open-addressing table
+// whose entries expire when the generation moves on.
+typedef struct {
+    uint64_t* keys;
+    IrValue* values;
+    uint32_t* generations;
+    size_t mask;
+    uint32_t generation;
+} SlotTable;
+
+static bool init_slots(SlotTable* table, size_t entries) {
+    size_t size = 16;
+    while (size < entries * 2) {
+        size *= 2;
+    }
+    table->keys = (uint64_t*)malloc(size * sizeof(uint64_t));
+    table->values = (IrValue*)malloc(size * sizeof(IrValue));
+    table->generations = (uint32_t*)calloc(size, sizeof(uint32_t));
+    table->mask = size - 1;
+    table->generation = 1;
+    return table->keys && table->values && table->generations;
+}
+
+static void free_slots(SlotTable* table) {
+    free(table->keys);
+    free(table->values);
+    free(table->generations);
+}
+
+// Entry for key, current or free to take.
+static size_t slot_entry(SlotTable* table, const IrInst* inst) {
+    uint64_t key = (uint64_t)(uint32_t)inst->hops << 32 | (uint32_t)inst->imm;
+    size_t i = (size_t)(key * 0x9E3779B97F4A7C15ull >> 32) & table->mask;
+    while (table->generations[i] == table->generation && table->keys[i] != key) {
+        i = (i + 1) & table->mask;
+    }
+    if (table->generations[i] != table->generation) {
+        table->keys[i] = key;
+        table->values[i] = IR_NONE;
+        table->generations[i] = table->generation;
+    }
+    return i;
+}
+
+static size_t memory_operations(const IrFunction* f) {
+    size_t count = 0;
+    for (size_t v = 1; v < f->inst_count; v++) {
+        count += f->insts[v].op == IR_LOAD || f->insts[v].op == IR_STORE;
+    }
+    return count;
+}
+
+static uint32_t* block_order(IrFunction* f, size_t* count) {
+    uint32_t* order = (uint32_t*)malloc((f->block_count ? f->block_count : 1) * sizeof(uint32_t));
+    if (!order) {
+        f->failed = true;
+        *count = 0;
+        return NULL;
+    }
+    *count = ir_block_order(f, order);
+    return order;
+}
+
+static void make_constant(IrInst* inst, int64_t value) {
+    inst->op = IR_CONST;
+    inst->a = IR_NONE;
+    inst->b = IR_NONE;
+    inst->imm = value;
+    inst->hops = 0;
+}
+
+static void make_alias(IrInst* inst, IrValue target) {
+    inst->op = IR_ALIAS;
+    inst->a = target;
+    inst->b = IR_NONE;
+}
+
+static bool compare_values(int64_t left, int64_t right, int64_t op) {
+    switch (op) {
+        case EQU: return left == right;
+        case NEQ: return left != right;
+        case LT: return left < right;
+        case LE: return left <= right;
+        case GT: return left > right;
+        default: return left >= right;
+    }
+}
+
+// Constant folding and propagation. Operands are SSA values, so a folded
+// instruction becomes a constant or an alias and its users pick it up when
+// they are visited, blocks in topological order. Memory slots are forwarded
+// from stores and loads earlier in the same block while no call intervenes.
+static void fold_constants(IrProgram* program, IrFunction* f) {
+    (void)program;
+    SlotTable memory = { NULL, NULL, NULL, 0, 0 };
+    size_t count;
+    uint32_t* order = block_order(f, &count);
+    if (!order || !init_slots(&memory, memory_operations(f))) {
+        free(order);
+        free_slots(&memory);
+        f->failed = true;
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint32_t block = order[i];
+        memory.generation++;
+        for (size_t k = 0; k < f->blocks[block].count; k++) {
+            IrValue value = f->blocks[block].insts[k];
+            IrInst* inst = &f->insts[value];
+            inst->a = ir_resolve(f, inst->a);
+            inst->b = ir_resolve(f, inst->b);
+            const IrInst* a = &f->insts[inst->a];
+            const IrInst* b = &f->insts[inst->b];
+            bool a_const = inst->a != IR_NONE && a->op == IR_CONST;
+            bool b_const = inst->b != IR_NONE && b->op == IR_CONST;
+            switch ((IrOp)inst->op) {
+            case IR_SUBTRACT:
+                if (a_const && b_const) {
+                    make_constant(inst, (int64_t)((uint64_t)a->imm - (uint64_t)b->imm));
+                }
+                else if (b_const && b->imm == 0) {
+                    make_alias(inst, inst->a);
+                }
+                else if (inst->a == inst->b) {
+                    make_constant(inst, 0);
+                }
+                break;
+            case IR_MULTIPLY:
+                if (a_const && b_const) {
+                    make_constant(inst, (int64_t)((uint64_t)a->imm * (uint64_t)b->imm));
+                }
+                else if ((a_const && a->imm == 0) || (b_const && b->imm == 0)) {
+                    make_constant(inst, 0);
+                }
+                else if (a_const && a->imm == 1) {
+                    make_alias(inst, inst->b);
+                }
+                else if (b_const && b->imm == 1) {
+                    make_alias(inst, inst->a);
+                }
+                break;
+            case IR_SHIFT_LEFT:
+                if (a_const) {
+                    make_constant(inst, (int64_t)((uint64_t)a->imm << inst->imm));
+                }
+                break;
+            case IR_COMPARE:
+                if (a_const && b_const) {
+                    make_constant(inst, compare_values(a->imm, b->imm, inst->imm));
+                }
+                else if (inst->a == inst->b) {
+                    make_constant(inst, compare_values(0, 0, inst->imm));
+                }
+                break;
+            case IR_PHI:
+                if (inst->a == inst->b) {
+                    make_alias(inst, inst->a);
+                }
+                else if (a_const && b_const && a->imm == b->imm) {
+                    make_constant(inst, a->imm);
+                }
+                break;
+            case IR_BRANCH:
+                if (a_const) {
+                    IrBlock* here = &f->blocks[block];
+                    uint32_t taken = here->succ[a->imm ? 0 : 1];
+                    uint32_t other = here->succ[a->imm ? 1 : 0];
+                    inst->op = IR_JUMP;
+                    inst->a = IR_NONE;
+                    here->succ[0] = taken;
+                    here->succ_count = 1;
+                    // the untaken side loses this path; cleanup drops it if unreachable
+                    ir_remove_pred(f, other, block);
+                }
+                break;
+            case IR_LOAD: {
+                size_t entry = slot_entry(&memory, inst);
+                if (memory.values[entry] != IR_NONE) {
+                    make_alias(inst, memory.values[entry]);
+                }
+                else {
+                    memory.values[entry] = value;
+                }
+                break;
+            }
+            case IR_STORE:
+                memory.values[slot_entry(&memory, inst)] = inst->a;
+                break;
+            case IR_CALL:
+                memory.generation++; // the callee may use any slot it can reach
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    free(order);
+    free_slots(&memory);
+}
+
+// Multiplications by a power of two become shifts.
+static void reduce_strength(IrProgram* program, IrFunction* f) {
+    (void)program;
+    for (size_t v = 1; v < f->inst_count; v++) {
+        IrInst* inst = &f->insts[v];
+        if (inst->op != IR_MULTIPLY) {
+            continue;
+        }
+        IrValue operands[2] = { ir_resolve(f, inst->a), ir_resolve(f, inst->b) };
+        for (int side = 1; side >= 0; side--) {
+            const IrInst* constant = &f->insts[operands[side]];
+            if (constant->op != IR_CONST || constant->imm <= 0 || (constant->imm & (constant->imm - 1)) != 0) {
+                continue;
+            }
+            int bits = 0;
+            while ((constant->imm >> bits) != 1) {
+                bits++;
+            }
+            IrValue other = operands[1 - side];
+            if (bits == 0) {
+                make_alias(inst, other);
+            }
+            else {
+                inst->op = IR_SHIFT_LEFT;
+                inst->a = other;
+                inst->b = IR_NONE;
+                inst->imm = bits;
+            }
+            break;
+        }
+    }
+}
+
+// Removes stores that are overwritten in the same block before anything can
+// read them, and stores to the function's own frame just before it ends.
+static void eliminate_dead_stores(IrFunction* f, SlotTable* memory) {
+    enum { OVERWRITTEN = 1, READ = 2 };
+    for (uint32_t block = 0; block < f->block_count; block++) {
+        IrBlock* b = &f->blocks[block];
+        if (b->dead || b->count == 0) {
+            continue;
+        }
+        IrOp last = (IrOp)f->insts[b->insts[b->count - 1]].op;
+        bool frame_ends = last == IR_RETURN || last == IR_HALT;
+        memory->generation++;
+        for (size_t k = b->count; k > 0; k--) {
+            IrInst* inst = &f->insts[b->insts[k - 1]];
+            if (inst->op == IR_CALL) {
+                memory->generation++;
+                frame_ends = false;
+            }
+            else if (inst->op == IR_LOAD) {
+                memory->values[slot_entry(memory, inst)] = READ;
+            }
+            else if (inst->op == IR_STORE) {
+                size_t entry = slot_entry(memory, inst);
+                IrValue state = memory->values[entry];
+                if (state == OVERWRITTEN || (state != READ && frame_ends && inst->hops == 0)) {
+                    inst->op = IR_NOP;
+                    continue;
+                }
+                memory->values[entry] = OVERWRITTEN;
+            }
+        }
+    }
+}
+
+// Dead code elimination: keeps instructions with effects and what they use.
+static void eliminate_dead_code(IrProgram* program, IrFunction* f) {
+    (void)program;
+    SlotTable memory = { NULL, NULL, NULL, 0, 0 };
+    bool* live = (bool*)calloc(f->inst_count ? f->inst_count : 1, sizeof(bool));
+    IrValue* work = (IrValue*)malloc((f->inst_count ? f->inst_count : 1) * sizeof(IrValue));
+    if (!live || !work || !init_slots(&memory, memory_operations(f))) {
+        free(live);
+        free(work);
+        free_slots(&memory);
+        f->failed = true;
+        return;
+    }
+    eliminate_dead_stores(f, &memory);
+    free_slots(&memory);
+
+    size_t count = 0;
+    for (uint32_t block = 0; block < f->block_count; block++) {
+        const IrBlock* b = &f->blocks[block];
+        for (size_t k = 0; k < b->count; k++) {
+            IrValue value = b->insts[k];
+            switch ((IrOp)f->insts[value].op) {
+            case IR_STORE:
+            case IR_CALL:
+            case IR_READ:
+            case IR_WRITE:
+            case IR_JUMP:
+            case IR_BRANCH:
+            case IR_RETURN:
+            case IR_HALT:
+                live[value] = true;
+                work[count++] = value;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    while (count > 0) {
+        IrInst* inst = &f->insts[work[--count]];
+        IrValue operands[2] = { ir_resolve(f, inst->a), ir_resolve(f, inst->b) };
+        for (int i = 0; i < 2; i++) {
+            if (operands[i] != IR_NONE && !live[operands[i]]) {
+                live[operands[i]] = true;
+                work[count++] = operands[i];
+            }
+        }
+    }
+    for (uint32_t block = 0; block < f->block_count; block++) {
+        const IrBlock* b = &f->blocks[block];
+        for (size_t k = 0; k < b->count; k++) {
+            if (!live[b->insts[k]]) {
+                f->insts[b->insts[k]].op = IR_NOP;
+            }
+        }
+    }
+    free(live);
+    free(work);
+}
+
+static size_t live_instructions(const IrFunction* f) {
+    size_t count = 0;
+    for (uint32_t block = 0; block < f->block_count; block++) {
+        count += f->blocks[block].count;
+    }
+    return count;
+}
+
+// Small functions that make no calls and keep nothing in their own frame can
+// be copied into their callers: their frame would only hold SSA values.
+static bool can_inline(const IrFunction* callee) {
+    if (callee->block_count == 0 || callee->failed || live_instructions(callee) > IR_INLINE_LIMIT) {
+        return false;
+    }
+    for (uint32_t block = 0; block < callee->block_count; block++) {
+        const IrBlock* b = &callee->blocks[block];
+        for (size_t k = 0; k < b->count; k++) {
+            const IrInst* inst = &callee->insts[b->insts[k]];
+            if (inst->op == IR_CALL || ((inst->op == IR_LOAD || inst->op == IR_STORE) && inst->hops == 0)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Replaces the call at position k of block with a copy of callee's blocks.
+// The rest of the block moves to a new block the copy jumps to on return.
+static void inline_call(IrFunction* f, uint32_t block, size_t k, const IrFunction* callee) {
+    IrValue call = f->blocks[block].insts[k];
+    IrValue argument = f->insts[call].a;
+    int32_t hops = f->insts[call].hops;
+    uint32_t* order = (uint32_t*)malloc(callee->block_count * sizeof(uint32_t));
+    uint32_t* blocks = (uint32_t*)malloc(callee->block_count * sizeof(uint32_t));
+    IrValue* values = (IrValue*)calloc(callee->inst_count, sizeof(IrValue));
+    if (!order || !blocks || !values) {
+        free(order);
+        free(blocks);
+        free(values);
+        f->failed = true;
+        return;
+    }
+    size_t count = ir_block_order(callee, order);
+
+    uint32_t rest = ir_add_block(f);
+    for (size_t n = 0; n < count; n++) {
+        blocks[order[n]] = ir_add_block(f);
+    }
+    if (f->failed) {
+        free(order);
+        free(blocks);
+        free(values);
+        return;
+    }
+    IrBlock* b = &f->blocks[block];
+    for (size_t n = k + 1; n < b->count; n++) {
+        ir_append(f, rest, b->insts[n]);
+        b = &f->blocks[block];
+    }
+    b->count = k;
+    IrBlock* r = &f->blocks[rest];
+    r->succ_count = b->succ_count;
+    for (uint32_t s = 0; s < b->succ_count; s++) {
+        r->succ[s] = b->succ[s];
+        IrBlock* succ = &f->blocks[b->succ[s]];
+        for (uint32_t p = 0; p < succ->pred_count; p++) {
+            if (succ->pred[p] == block) {
+                succ->pred[p] = rest;
+            }
+        }
+    }
+    b->succ_count = 0;
+    ir_add(f, block, IR_JUMP, IR_NONE, IR_NONE, 0);
+    ir_link(f, block, blocks[order[0]]);
+
+    IrValue result = IR_NONE;
+    for (size_t n = 0; n < count && !f->failed; n++) {
+        const IrBlock* source = &callee->blocks[order[n]];
+        uint32_t target = blocks[order[n]];
+        IrBlock* copy = &f->blocks[target];
+        if (n > 0) {
+            copy->pred_count = source->pred_count;
+            for (uint32_t p = 0; p < source->pred_count; p++) {
+                copy->pred[p] = blocks[source->pred[p]];
+            }
+        }
+        copy->succ_count = source->succ_count;
+        for (uint32_t s = 0; s < source->succ_count; s++) {
+            copy->succ[s] = blocks[source->succ[s]];
+        }
+        for (size_t i = 0; i < source->count; i++) {
+            IrValue value = source->insts[i];
+            const IrInst* inst = &callee->insts[value];
+            if (inst->op == IR_PARAM) {
+                values[value] = argument;
+                continue;
+            }
+            if (inst->op == IR_RETURN) {
+                result = values[inst->a];
+                ir_add(f, target, IR_JUMP, IR_NONE, IR_NONE, 0);
+                ir_link(f, target, rest);
+                continue;
+            }
+            IrValue added = ir_add(f, target, (IrOp)inst->op, values[inst->a], values[inst->b], inst->imm);
+            if (added != IR_NONE) {
+                // slots of enclosing frames are reached from the caller's frame
+                f->insts[added].hops = inst->op == IR_CALL ? inst->hops : inst->hops ? inst->hops + hops - 1 : 0;
+            }
+            values[value] = added;
+        }
+    }
+    make_alias(&f->insts[call], result);
+    free(order);
+    free(blocks);
+    free(values);
+}
+
+static void inline_calls(IrProgram* program, IrFunction* f) {
+    signed char* inlinable = (signed char*)calloc(program->function_count, 1);
+    if (!inlinable) {
+        f->failed = true;
+        return;
+    }
+    // blocks added by inlining are visited as well, the rest of a block included
+    for (uint32_t block = 0; block < f->block_count && !f->failed; block++) {
+        for (size_t k = 0; k < f->blocks[block].count; k++) {
+            const IrInst* inst = &f->insts[f->blocks[block].insts[k]];
+            if (inst->op != IR_CALL) {
+                continue;
+            }
+            size_t index = (size_t)inst->imm + 1;
+            IrFunction* callee = &program->functions[index];
+            if (inlinable[index] == 0) {
+                inlinable[index] = callee != f && can_inline(callee) ? 1 : -1;
+            }
+            if (inlinable[index] > 0) {
+                inline_call(f, block, k, callee);
+                break;
+            }
+        }
+    }
+    free(inlinable);
+}
+
+typedef struct {
+    const char* name;
+    void (*run)(IrProgram*, IrFunction*);
+} IrPass;
+
+// Pipeline order: inlining first so the other passes see through the calls.
+static const IrPass ir_passes[IR_PASS_COUNT] = {
+    { "inline", inline_calls },
+    { "fold", fold_constants },
+    { "strength", reduce_strength },
+    { "dce", eliminate_dead_code },
+};
+
+const char* ir_pass_name(int pass) {
+    return pass >= 0 && pass < IR_PASS_COUNT ? ir_passes[pass].name : NULL;
+}
+
+int find_ir_pass(const char* name) {
+    for (int pass = 0; pass < IR_PASS_COUNT; pass++) {
+        if (strcmp(ir_passes[pass].name, name) == 0) {
+            return pass;
+        }
+    }
+    return -1;
+}
+
+static size_t program_instructions(const IrProgram* program) {
+    size_t count = 0;
+    for (size_t i = 0; i < program->function_count; i++) {
+        count += live_instructions(&program->functions[i]);
+    }
+    return count;
+}
+
+bool run_ir_passes(IrProgram* program, const bool* enabled, FILE* timing) {
+    for (int pass = 0; pass < IR_PASS_COUNT; pass++) {
+        if (!enabled[pass]) {
+            continue;
+        }
+        struct timespec start, end;
+        size_t before = timing ? program_instructions(program) : 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t i = 0; i < program->function_count; i++) {
+            IrFunction* f = &program->functions[i];
+            ir_passes[pass].run(program, f);
+            ir_cleanup(f);
+            if (f->failed) {
+                return false;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (timing) {
+            double ms = (double)(end.tv_sec - start.tv_sec) * 1e3 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+            fprintf(timing, "pass %-8s %10.3f ms  %zu -> %zu instructions\n", ir_passes[pass].name, ms, before,
+                    program_instructions(program));
+        }
+    }
+    return true;
+}
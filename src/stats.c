@@ -0,0 +1,73 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "parser.h"
+#include "stats.h"
+
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Tokens and tables only grow during a parse, so sampling them when it ends
+// catches the peak.
+void record_memory_stats(Parser* parser) {
+#ifdef MINIPARSER_STATS
+    size_t token_bytes = parser->token_capacity * (sizeof(uint8_t) + sizeof(Atom)) +
+                         parser->line_break_capacity * sizeof(uint32_t);
+    size_t table_bytes = parser->var_capacity * sizeof(VariableEntry) +
+                         parser->proc_capacity * sizeof(ProcedureEntry) +
+                         (parser->var_index_size + parser->proc_index_size) * sizeof(uint32_t);
+    STAT_MAX(parser, peak_token_bytes, token_bytes);
+    STAT_MAX(parser, peak_table_bytes, table_bytes);
+#else
+    (void)parser;
+#endif
+}
+
+static void print_time(FILE* out, bool json, const char* name, double value) {
+    if (json) {
+        fprintf(out, "  \"%s\": %.3f,\n", name, value);
+    }
+    else {
+        fprintf(out, "%-24s %.3f\n", name, value);
+    }
+}
+
+static void print_count(FILE* out, bool json, const char* name, unsigned long long value, bool last) {
+    if (json) {
+        fprintf(out, "  \"%s\": %llu%s\n", name, value, last ? "" : ",");
+    }
+    else {
+        fprintf(out, "%-24s %llu\n", name, value);
+    }
+}
+
+// Writes the statistics as "name value" lines, or as one JSON object.
+bool print_stats(Parser* parser, FILE* out, bool json) {
+    const ParserStats* s = &parser->stats;
+    if (json) {
+        fprintf(out, "{\n");
+    }
+    print_time(out, json, "load_ms", s->load_ms);
+    print_time(out, json, "parse_ms", s->parse_ms);
+    print_time(out, json, "emit_ms", s->emit_ms);
+    print_count(out, json, "tokens", input_token_count(parser), false);
+    print_count(out, json, "line_breaks", parser->line_break_count, false);
+    print_count(out, json, "variable_lookups", s->variable_lookups, false);
+    print_count(out, json, "variable_probes", s->variable_probes, false);
+    print_count(out, json, "procedure_lookups", s->procedure_lookups, false);
+    print_count(out, json, "procedure_probes", s->procedure_probes, false);
+    print_count(out, json, "variable_chunks", s->variable_chunks, false);
+    print_count(out, json, "procedure_chunks", s->procedure_chunks, false);
+    print_count(out, json, "variable_index_growths", s->variable_index_growths, false);
+    print_count(out, json, "procedure_index_growths", s->procedure_index_growths, false);
+    print_count(out, json, "parallel_bodies", s->parallel_bodies, false);
+    print_count(out, json, "peak_token_bytes", s->peak_token_bytes, false);
+    print_count(out, json, "peak_table_bytes", s->peak_table_bytes, false);
+    print_count(out, json, "max_depth", s->max_depth, true);
+    if (json) {
+        fprintf(out, "}\n");
+    }
+    return fflush(out) == 0;
+}
@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "parser.h"
+#include "stream.h"
+
+TokenStream* create_token_stream(Parser* parser) {
+    TokenStream* stream = (TokenStream*)calloc(1, sizeof(TokenStream));
+    if (!stream) {
+        return NULL;
+    }
+    stream->parser = parser;
+
+    stream->stack = mmap(NULL, STREAM_STACK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stream->stack == MAP_FAILED) {
+        free(stream);
+        return NULL;
+    }
+    // guard page so a runaway recursion faults instead of corrupting the heap
+    mprotect(stream->stack, (size_t)sysconf(_SC_PAGESIZE), PROT_NONE);
+    return stream;
+}
+
+void destroy_token_stream(TokenStream* stream) {
+    if (!stream) return;
+    munmap(stream->stack, STREAM_STACK_SIZE);
+    free(stream->text);
+    free(stream);
+}
+
+static void stream_main(unsigned int hi, unsigned int lo) {
+    TokenStream* stream = (TokenStream*)(uintptr_t)(((uint64_t)hi << 32) | lo);
+    stream->result = program(stream->parser);
+    stream->done = true;
+    // returning switches back to stream->caller through uc_link
+}
+
+// Runs the parser until it needs a token that has not arrived yet.
+static void stream_resume(TokenStream* stream) {
+    if (stream->done) {
+        return;
+    }
+
+    if (!stream->started) {
+        getcontext(&stream->context);
+        stream->context.uc_stack.ss_sp = stream->stack;
+        stream->context.uc_stack.ss_size = STREAM_STACK_SIZE;
+        stream->context.uc_link = &stream->caller;
+        uint64_t addr = (uint64_t)(uintptr_t)stream;
+        makecontext(&stream->context, (void (*)(void))stream_main, 2,
+                    (unsigned int)(addr >> 32), (unsigned int)addr);
+        stream->started = true;
+    }
+
+    swapcontext(&stream->caller, &stream->context);
+}
+
+// Called on the parser stack: hand control back to parser_feed()/parser_finish().
+static void stream_wait(TokenStream* stream) {
+    swapcontext(&stream->context, &stream->caller);
+}
+
+static bool stream_scan_line(TokenStream* stream, const char* line, const char* eol) {
+    if (line == eol) {
+        return true; // Skip empty lines
+    }
+
+    Token token;
+    switch (scan_token_line(&stream->parser->atoms, line, eol, &token)) {
+    case SCAN_OK:
+        break;
+    case SCAN_BAD_FORMAT:
+        fprintf(stderr, "Error: invalid line format\n");
+        stream->failed = true;
+        return false;
+    case SCAN_NO_MEMORY:
+        fprintf(stderr, "Error: failed to intern identifier\n");
+        stream->failed = true;
+        return false;
+    }
+
+    if (stream->done) {
+        return true; // the program is complete, trailing tokens are never looked at
+    }
+
+    if (stream->queue_count == STREAM_QUEUE_SIZE) {
+        stream_resume(stream);
+    }
+    size_t tail = (stream->queue_head + stream->queue_count) % STREAM_QUEUE_SIZE;
+    stream->queue[tail] = token;
+    stream->queue_count++;
+    return true;
+}
+
+// Tokens carry interned values, so only the unfinished last line has to be kept.
+static void stream_compact(TokenStream* stream) {
+    if (stream->scan_pos == 0) {
+        return;
+    }
+    memmove(stream->text, stream->text + stream->scan_pos, stream->text_len - stream->scan_pos);
+    stream->text_len -= stream->scan_pos;
+    stream->scan_pos = 0;
+}
+
+// Returns false once the input turned out to be malformed; the parse is abandoned.
+bool parser_feed(Parser* parser, const char* buf, size_t len) {
+    TokenStream* stream = parser->stream;
+    if (!stream || stream->finished || stream->failed) {
+        return false;
+    }
+
+    stream_compact(stream);
+    if (stream->text_len + len > stream->text_capacity) {
+        size_t new_capacity = stream->text_capacity ? stream->text_capacity : 4096;
+        while (new_capacity < stream->text_len + len) {
+            new_capacity *= 2;
+        }
+        char* new_text = (char*)realloc(stream->text, new_capacity);
+        if (!new_text) {
+            fprintf(stderr, "Error: failed to grow token stream buffer\n");
+            stream->failed = true;
+            return false;
+        }
+        stream->text = new_text;
+        stream->text_capacity = new_capacity;
+    }
+    memcpy(stream->text + stream->text_len, buf, len);
+    stream->text_len += len;
+
+    const char* end = stream->text + stream->text_len;
+    const char* line = stream->text + stream->scan_pos;
+    const char* eol;
+    while (line < end && (eol = memchr(line, '\n', end - line)) != NULL) {
+        if (!stream_scan_line(stream, line, eol)) {
+            return false;
+        }
+        line = eol + 1;
+    }
+    stream->scan_pos = line - stream->text;
+
+    if (stream->queue_count > 0) {
+        stream_resume(stream);
+    }
+    return true;
+}
+
+// Signals the end of input, completes the parse and writes the output files.
+bool parser_finish(Parser* parser) {
+    TokenStream* stream = parser->stream;
+    if (!stream || stream->failed) {
+        return false;
+    }
+
+    if (!stream->finished) {
+        if (stream->scan_pos < stream->text_len) {
+            // last line without a trailing newline
+            if (!stream_scan_line(stream, stream->text + stream->scan_pos, stream->text + stream->text_len)) {
+                return false;
+            }
+            stream->scan_pos = stream->text_len;
+        }
+        stream->finished = true;
+        stream_resume(stream);
+    }
+    return stream->result;
+}
+
+void stream_next_token(TokenStream* stream, Token* token) {
+    while (stream->queue_count == 0) {
+        if (stream->finished) {
+            token->type = _EOF;
+            token->value = ATOM_NONE;
+            return;
+        }
+        stream_wait(stream);
+    }
+    *token = stream->queue[stream->queue_head];
+    stream->queue_head = (stream->queue_head + 1) % STREAM_QUEUE_SIZE;
+    stream->queue_count--;
+}
+
+TokenType stream_peek_token_type(TokenStream* stream) {
+    while (stream->queue_count == 0) {
+        if (stream->finished) {
+            return _EOF;
+        }
+        stream_wait(stream);
+    }
+    return stream->queue[stream->queue_head].type;
+}
@@ -1,12 +1,196 @@
 #include "parser.h"
+#include "parallel.h"
 #include <stdio.h>
+#include <string.h>
 
-void add_variable(Parser* parser, const char* value, VarType type, int kind) {
-    if (!is_valid_identifier(value)) {
+// Atoms are small dense integers, so a multiplicative mix is enough to spread them.
+static uint32_t hash_variable(Atom name, Atom proc) {
+    uint32_t h = name * 0x9e3779b1u ^ proc * 0x85ebca77u;
+    return h ^ (h >> 16);
+}
+
+static uint32_t hash_procedure(Atom name) {
+    uint32_t h = name * 0x9e3779b1u;
+    return h ^ (h >> 16);
+}
+
+// Smallest power of two holding capacity entries at a load factor of at most 1/2.
+static size_t index_size_for(size_t capacity) {
+    size_t size = 16;
+    while (size < capacity * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+static void index_insert(uint32_t* index, size_t size, uint32_t hash, size_t entry) {
+    size_t mask = size - 1;
+    size_t slot = hash & mask;
+    while (index[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    index[slot] = (uint32_t)entry + 1; // 0 marks an empty slot
+}
+
+static uint32_t hash_variable_at(Parser* parser, size_t i);
+static uint32_t hash_procedure_at(Parser* parser, size_t i);
+
+// Takes entry out of the index. The entries after it in the same probe run
+// move back into the hole unless that would put them before their home slot,
+// so lookups never meet an empty slot too early.
+static void index_remove(Parser* parser, uint32_t* index, size_t size, uint32_t hash, size_t entry,
+                         uint32_t (*hash_at)(Parser*, size_t)) {
+    size_t mask = size - 1;
+    size_t hole = hash & mask;
+    while (index[hole] != (uint32_t)entry + 1) {
+        if (index[hole] == 0) {
+            return;
+        }
+        hole = (hole + 1) & mask;
+    }
+    for (size_t slot = (hole + 1) & mask; index[slot] != 0; slot = (slot + 1) & mask) {
+        size_t home = hash_at(parser, index[slot] - 1) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            index[hole] = index[slot];
+            hole = slot;
+        }
+    }
+    index[hole] = 0;
+}
+
+VariableEntry* variable_at(Parser* parser, size_t i) {
+    return &((VariableEntry*)parser->var_chunks[i / TABLE_CHUNK_SIZE])[i % TABLE_CHUNK_SIZE];
+}
+
+ProcedureEntry* procedure_at(Parser* parser, size_t i) {
+    return &((ProcedureEntry*)parser->proc_chunks[i / TABLE_CHUNK_SIZE])[i % TABLE_CHUNK_SIZE];
+}
+
+static uint32_t hash_variable_at(Parser* parser, size_t i) {
+    VariableEntry* var = variable_at(parser, i);
+    return hash_variable(var->vname, var->vproc);
+}
+
+static uint32_t hash_procedure_at(Parser* parser, size_t i) {
+    return hash_procedure(procedure_at(parser, i)->pname);
+}
+
+// Allocates the empty tables of a parse from the arena. Sizes reached by the
+// previous parse are kept, so a reused parser starts out large enough.
+bool init_tables(Parser* parser) {
+    if (parser->var_index_size == 0) {
+        parser->var_index_size = index_size_for(100);
+        parser->proc_index_size = index_size_for(50);
+        parser->var_chunk_slots = 16;
+        parser->proc_chunk_slots = 16;
+        parser->scope_capacity = 16;
+    }
+    parser->var_count = parser->var_capacity = 0;
+    parser->proc_count = parser->proc_capacity = 0;
+    parser->scope_count = 0;
+
+    parser->var_index = (uint32_t*)arena_calloc(&parser->arena, parser->var_index_size, sizeof(uint32_t));
+    parser->proc_index = (uint32_t*)arena_calloc(&parser->arena, parser->proc_index_size, sizeof(uint32_t));
+    parser->var_chunks = (void**)arena_alloc(&parser->arena, parser->var_chunk_slots * sizeof(void*));
+    parser->proc_chunks = (void**)arena_alloc(&parser->arena, parser->proc_chunk_slots * sizeof(void*));
+    parser->scopes = (Scope*)arena_alloc(&parser->arena, parser->scope_capacity * sizeof(Scope));
+    return parser->var_index && parser->proc_index && parser->var_chunks && parser->proc_chunks && parser->scopes;
+}
+
+// Adds a chunk of entry_size * TABLE_CHUNK_SIZE bytes to a chunk directory,
+// doubling the directory when it is full. Existing entries stay in place.
+static bool add_chunk(Arena* arena, void*** chunks, size_t* slots, size_t* capacity, size_t entry_size) {
+    size_t count = *capacity / TABLE_CHUNK_SIZE;
+    if (count >= *slots) {
+        void** grown = (void**)arena_alloc(arena, *slots * 2 * sizeof(void*));
+        if (!grown) {
+            return false;
+        }
+        memcpy(grown, *chunks, count * sizeof(void*));
+        *chunks = grown;
+        *slots *= 2;
+    }
+    void* chunk = arena_alloc(arena, entry_size * TABLE_CHUNK_SIZE);
+    if (!chunk) {
+        return false;
+    }
+    (*chunks)[count] = chunk;
+    *capacity += TABLE_CHUNK_SIZE;
+    return true;
+}
+
+// Doubles the variable hash index and reinserts every entry.
+static bool grow_variable_index(Parser* parser) {
+    size_t size = parser->var_index_size * 2;
+    uint32_t* index = (uint32_t*)arena_calloc(&parser->arena, size, sizeof(uint32_t));
+    if (!index) {
+        return false;
+    }
+    for (size_t i = 0; i < parser->var_count; i++) {
+        VariableEntry* var = variable_at(parser, i);
+        if (var->vproc != ATOM_NONE) { // removed by an incremental reparse
+            index_insert(index, size, hash_variable(var->vname, var->vproc), i);
+        }
+    }
+    parser->var_index = index;
+    parser->var_index_size = size;
+    STAT_ADD(parser, variable_index_growths, 1);
+    return true;
+}
+
+// Doubles the procedure hash index and reinserts every entry.
+static bool grow_procedure_index(Parser* parser) {
+    size_t size = parser->proc_index_size * 2;
+    uint32_t* index = (uint32_t*)arena_calloc(&parser->arena, size, sizeof(uint32_t));
+    if (!index) {
+        return false;
+    }
+    for (size_t i = 0; i < parser->proc_count; i++) {
+        ProcedureEntry* proc = procedure_at(parser, i);
+        index_insert(index, size, hash_procedure(proc->pname), i);
+    }
+    parser->proc_index = index;
+    parser->proc_index_size = size;
+    STAT_ADD(parser, procedure_index_growths, 1);
+    return true;
+}
+
+// Opens the scope of procedure proc one level below the current one.
+bool enter_scope(Parser* parser, Atom proc) {
+    if (parser->scope_count >= parser->scope_capacity) {
+        size_t new_capacity = parser->scope_capacity ? parser->scope_capacity * 2 : 16;
+        Scope* new_scopes = (Scope*)arena_alloc(&parser->arena, new_capacity * sizeof(Scope));
+        if (!new_scopes) {
+            return false;
+        }
+        memcpy(new_scopes, parser->scopes, parser->scope_count * sizeof(Scope));
+        parser->scopes = new_scopes;
+        parser->scope_capacity = new_capacity;
+    }
+    Scope* scope = &parser->scopes[parser->scope_count++];
+    scope->proc = proc;
+    scope->level = parser->current_level + 1;
+    parser->current_proc = scope->proc;
+    parser->current_level = scope->level;
+    return true;
+}
+
+void exit_scope(Parser* parser) {
+    if (parser->scope_count <= 1) {
+        return; // the main scope stays open
+    }
+    parser->scope_count--;
+    Scope* scope = &parser->scopes[parser->scope_count - 1];
+    parser->current_proc = scope->proc;
+    parser->current_level = scope->level;
+}
+
+void add_variable(Parser* parser, Atom value, VarType type, int kind) {
+    if (!is_valid_identifier(atom_name(&parser->atoms, value))) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "invalid identifier '%s'", 
-                 value);
+                 atom_name(&parser->atoms, value));
         parser_error(parser, error_msg);
         return;
     }
@@ -20,80 +204,107 @@ void add_variable(Parser* parser, const char* value, VarType type, int kind) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "variable '%s' already declared in procedure '%s'", 
-                 value, parser->current_proc);
+                 atom_name(&parser->atoms, value), atom_name(&parser->atoms, parser->current_proc));
         parser_error(parser, error_msg);
         return;
     }
 
+    VariableEntry entry;
+    entry.vname = value;
+    entry.vproc = parser->current_proc;
+    entry.vkind = kind; // 0 for variable, 1 for parameter
+    entry.vtype = type;
+    entry.vlev = parser->current_level;
+    append_variable(parser, &entry);
+}
+
+// Stores a copy of entry at the next position, which becomes its vaddr, and
+// indexes it. No checks: add_variable() has made them.
+bool append_variable(Parser* parser, const VariableEntry* entry) {
     if (parser->var_count >= parser->var_capacity) {
-        parser->var_capacity *= 2;
-        VariableEntry* new_vartab = (VariableEntry*)realloc(parser->vartab, parser->var_capacity * sizeof(VariableEntry));
-        if (!new_vartab) {
-            perror("Failed to reallocate variable table");
-            parser_error(parser, "Error: failed to reallocate variable table\n");
-            return;
+        if (!add_chunk(&parser->arena, &parser->var_chunks, &parser->var_chunk_slots, &parser->var_capacity, sizeof(VariableEntry))) {
+            parser_error(parser, "Error: failed to grow variable table");
+            return false;
         }
-        parser->vartab = new_vartab;
+        STAT_ADD(parser, variable_chunks, 1);
+    }
+    // keep the load factor at or below 1/2
+    if ((parser->var_count + 1) * 2 > parser->var_index_size && !grow_variable_index(parser)) {
+        parser_error(parser, "Error: failed to grow variable index");
+        return false;
     }
 
-    VariableEntry* var_entry = &parser->vartab[parser->var_count];
-    strncpy(var_entry->vname, value, sizeof(var_entry->vname) - 1);
-    var_entry->vname[sizeof(var_entry->vname) - 1] = '\0';
-    strncpy(var_entry->vproc, parser->current_proc, sizeof(var_entry->vproc) - 1);
-    var_entry->vproc[sizeof(var_entry->vproc) - 1] = '\0';
-    var_entry->vkind = kind; // 0 for variable, 1 for parameter
-    var_entry->vtype = type;
-    var_entry->vlev = parser->current_level;
+    VariableEntry* var_entry = variable_at(parser, parser->var_count);
+    *var_entry = *entry;
     var_entry->vaddr = parser->var_count++; // Simple address allocation based on count
+    index_insert(parser->var_index, parser->var_index_size,
+                 hash_variable(var_entry->vname, var_entry->vproc), var_entry->vaddr);
+    return true;
 }
 
-void add_procedure(Parser* parser, const char* name, int var_start, int var_end) {
-    if (!is_valid_identifier(name)) {
+static ProcedureEntry* lookup_procedure(Parser* parser, Atom proc_name);
+
+ProcedureEntry* add_procedure(Parser* parser, Atom name, int var_start, int var_end) {
+    if (!is_valid_identifier(atom_name(&parser->atoms, name))) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "invalid procedure name '%s'", 
-                 name);
+                 atom_name(&parser->atoms, name));
         parser_error(parser, error_msg);
-        return;
+        return NULL;
     }
 
-    if (find_procedure(parser, name) != NULL) {
+    if (lookup_procedure(parser, name) != NULL) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "procedure '%s' already declared", 
-                 name);
+                 atom_name(&parser->atoms, name));
         parser_error(parser, error_msg);
-        return;
+        return NULL;
     }
 
+    ProcedureEntry entry;
+    entry.pname = name;
+    entry.faddr = var_start;
+    entry.laddr = var_end; // -1 means not finalized yet
+    entry.plev = parser->current_level;
+    entry.ptype = VAR_FUNCTION;
+    entry.param = -1;
+    entry.var_start = entry.var_end = var_start;
+    entry.body_start = entry.body_end = 0; // no body parsed yet
+    return append_procedure(parser, &entry);
+}
+
+// Stores a copy of entry at the next position and indexes it. No checks:
+// add_procedure() has made them.
+ProcedureEntry* append_procedure(Parser* parser, const ProcedureEntry* entry) {
     if (parser->proc_count >= parser->proc_capacity) {
-        parser->proc_capacity *= 2;
-        ProcedureEntry* new_proctab = (ProcedureEntry*)realloc(parser->proctab, parser->proc_capacity * sizeof(ProcedureEntry));
-        if (!new_proctab) {
-            perror("Failed to reallocate procedure table");
-            parser_error(parser, "Error: failed to reallocate procedure table\n");
-            return;
+        if (!add_chunk(&parser->arena, &parser->proc_chunks, &parser->proc_chunk_slots, &parser->proc_capacity, sizeof(ProcedureEntry))) {
+            parser_error(parser, "Error: failed to grow procedure table");
+            return NULL;
         }
-        parser->proctab = new_proctab;
+        STAT_ADD(parser, procedure_chunks, 1);
+    }
+    if ((parser->proc_count + 1) * 2 > parser->proc_index_size && !grow_procedure_index(parser)) {
+        parser_error(parser, "Error: failed to grow procedure index");
+        return NULL;
     }
 
-    ProcedureEntry* proc_entry = &parser->proctab[parser->proc_count];
-    strncpy(proc_entry->pname, name, sizeof(proc_entry->pname) - 1);
-    proc_entry->pname[sizeof(proc_entry->pname) - 1] = '\0';
-    proc_entry->faddr = var_start;
-    proc_entry->laddr = var_end; // -1 means not finalized yet
-    proc_entry->plev = parser->current_level;
-    proc_entry->ptype = VAR_FUNCTION;
+    ProcedureEntry* proc_entry = procedure_at(parser, parser->proc_count);
+    *proc_entry = *entry;
+    index_insert(parser->proc_index, parser->proc_index_size,
+                 hash_procedure(proc_entry->pname), parser->proc_count);
     parser->proc_count++;
+    return proc_entry;
 }
 
-void update_procedure(Parser* parser, const char* name, int var_start, int var_end) {
+void update_procedure(Parser* parser, Atom name, int var_start, int var_end) {
     ProcedureEntry* proc = find_procedure(parser, name);
     if (!proc) {
         char error_msg[256];
         snprintf(error_msg, sizeof(error_msg), 
                  "Internal Error: procedure '%s' not found for update", 
-                 name);
+                 atom_name(&parser->atoms, name));
         parser_error(parser, error_msg);
         return;
     }
@@ -101,21 +312,93 @@ void update_procedure(Parser* parser, const char* name, int var_start, int var_e
     proc->laddr = var_end;
 }
 
-VariableEntry* find_variable(Parser* parser, const char* var_name, const char* proc_name) {
-    for (int i = 0; i < parser->var_count; i++) {
-        if (strcmp(parser->vartab[i].vname, var_name) == 0 &&
-            strcmp(parser->vartab[i].vproc, proc_name) == 0) {
-            return &parser->vartab[i];
+// Takes the variable at position out of the index for good; the entry stays
+// in place, marked with vproc ATOM_NONE, until renumber_symbols() drops it.
+void remove_variable(Parser* parser, size_t position) {
+    VariableEntry* var = variable_at(parser, position);
+    if (var->vproc == ATOM_NONE) {
+        return;
+    }
+    index_remove(parser, parser->var_index, parser->var_index_size, hash_variable(var->vname, var->vproc),
+                 position, hash_variable_at);
+    var->vname = var->vproc = ATOM_NONE;
+}
+
+// Indexes every variable again, after renumber_symbols() moved them.
+void rebuild_variable_index(Parser* parser) {
+    memset(parser->var_index, 0, parser->var_index_size * sizeof(uint32_t));
+    for (size_t i = 0; i < parser->var_count; i++) {
+        index_insert(parser->var_index, parser->var_index_size, hash_variable_at(parser, i), i);
+    }
+}
+
+// Adds or takes out the index slot of the procedure at position, for the
+// nested procedures an incremental reparse declares again.
+void index_procedure(Parser* parser, size_t position) {
+    index_insert(parser->proc_index, parser->proc_index_size, hash_procedure_at(parser, position), position);
+}
+
+void unindex_procedure(Parser* parser, size_t position) {
+    index_remove(parser, parser->proc_index, parser->proc_index_size, hash_procedure_at(parser, position),
+                 position, hash_procedure_at);
+}
+
+// While an incremental reparse runs, declarations that come after the
+// reparsed body in the source are not visible yet, as in a full parse.
+static inline bool declared_later(Parser* parser, size_t position) {
+    const EditState* edit = &parser->edit;
+    return edit->hide_from != 0 && position < edit->hide_below && edit->var_keys[position] >= edit->hide_from;
+}
+
+VariableEntry* find_variable(Parser* parser, Atom var_name, Atom proc_name) {
+    size_t mask = parser->var_index_size - 1;
+    size_t slot = hash_variable(var_name, proc_name) & mask;
+    STAT_ADD(parser, variable_lookups, 1);
+    for (; parser->var_index[slot] != 0; slot = (slot + 1) & mask) {
+        VariableEntry* var = variable_at(parser, parser->var_index[slot] - 1);
+        STAT_ADD(parser, variable_probes, 1);
+        if (var->vname == var_name && var->vproc == proc_name) {
+            return declared_later(parser, parser->var_index[slot] - 1) ? NULL : var;
         }
     }
     return NULL;
 }
 
-ProcedureEntry* find_procedure(Parser* parser, const char* proc_name) {
-    for (int i = 0; i < parser->proc_count; i++) {
-        if (strcmp(parser->proctab[i].pname, proc_name) == 0) {
-            return &parser->proctab[i];
+// The procedures of this parse only, without those of outside_procedure().
+static ProcedureEntry* lookup_procedure(Parser* parser, Atom proc_name) {
+    size_t mask = parser->proc_index_size - 1;
+    size_t slot = hash_procedure(proc_name) & mask;
+    STAT_ADD(parser, procedure_lookups, 1);
+    for (; parser->proc_index[slot] != 0; slot = (slot + 1) & mask) {
+        size_t position = parser->proc_index[slot] - 1;
+        ProcedureEntry* proc = procedure_at(parser, position);
+        STAT_ADD(parser, procedure_probes, 1);
+        if (proc->pname == proc_name) {
+            bool later = position >= parser->edit.hidden_procs && position < parser->edit.hidden_procs_end;
+            return later ? NULL : proc;
         }
     }
     return NULL;
-}
\ No newline at end of file
+}
+
+ProcedureEntry* find_procedure(Parser* parser, Atom proc_name) {
+    ProcedureEntry* proc = lookup_procedure(parser, proc_name);
+    if (!proc && parser->outside) {
+        return outside_procedure(parser, proc_name);
+    }
+    return proc;
+}
+
+// Looks name up in the innermost scope first, then in each enclosing one.
+VariableEntry* resolve_variable(Parser* parser, Atom name) {
+    for (size_t i = parser->scope_count; i > 0; i--) {
+        if (i == 1 && parser->outside) {
+            return outside_variable(parser, name); // main's variables are not in this parser's tables
+        }
+        VariableEntry* var = find_variable(parser, name, parser->scopes[i - 1].proc);
+        if (var) {
+            return var;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "vm.h"
+
+// Threaded dispatch through a table of label addresses where the compiler
+// supports it, a switch otherwise.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#pragma GCC diagnostic ignored "-Wpedantic" // label addresses are the GNU extension used
+#endif
+
+#define VM_STACK_SIZE 4096 // initial value stack slots
+#define VM_FRAME_COUNT 256 // initial call frames
+
+typedef struct {
+    const int32_t* return_pc;
+    size_t base; // index of slot 0 in the value stack
+    size_t outer; // frame of the enclosing procedure
+} VmFrame;
+
+static bool stdio_read(void* context, int64_t* value) {
+    (void)context;
+    return scanf("%" SCNd64, value) == 1;
+}
+
+static bool stdio_write(void* context, int64_t value) {
+    (void)context;
+    return printf("%" PRId64 "\n", value) > 0;
+}
+
+const VmIo vm_stdio = { NULL, stdio_read, stdio_write };
+
+// Arithmetic wraps around like unsigned integers instead of being undefined.
+static inline int64_t wrap_subtract(int64_t a, int64_t b) {
+    return (int64_t)((uint64_t)a - (uint64_t)b);
+}
+
+static inline int64_t wrap_multiply(int64_t a, int64_t b) {
+    return (int64_t)((uint64_t)a * (uint64_t)b);
+}
+
+bool run_bytecode(const Bytecode* program, const VmIo* io, char* err, size_t err_size) {
+    size_t capacity = VM_STACK_SIZE;
+    while (capacity < (size_t)program->main_frame_size + program->main_stack_size) {
+        capacity *= 2;
+    }
+    size_t frame_capacity = VM_FRAME_COUNT;
+    int64_t* stack = (int64_t*)calloc(capacity, sizeof(int64_t));
+    VmFrame* frames = (VmFrame*)malloc(frame_capacity * sizeof(VmFrame));
+    if (!stack || !frames) {
+        free(stack);
+        free(frames);
+        snprintf(err, err_size, "out of memory");
+        return false;
+    }
+
+    const int32_t* code = program->code;
+    const int32_t* pc = code;
+    int64_t* fp = stack;
+    int64_t* sp = stack + program->main_frame_size;
+    size_t frame = 0;
+    size_t frame_count = 1;
+    frames[0].return_pc = NULL;
+    frames[0].base = 0;
+    frames[0].outer = 0;
+    bool ok = true;
+
+#define VM_FAIL(...) do { snprintf(err, err_size, __VA_ARGS__); ok = false; goto done; } while (0)
+#define VM_COMPARE(op) do { sp[-2] = sp[-2] op sp[-1]; sp--; } while (0)
+
+#ifdef VM_COMPUTED_GOTO
+    static const void* const dispatch[] = {
+#define VM_LABEL(name, operands) &&do_##name,
+        BYTECODE_OPS(VM_LABEL)
+#undef VM_LABEL
+    };
+#define VM_CASE(name) do_##name:
+#define VM_NEXT() goto *dispatch[*pc++]
+    VM_NEXT();
+#else
+#define VM_CASE(name) case OP_##name:
+#define VM_NEXT() continue
+    for (;;) {
+        switch ((Opcode)*pc++) {
+#endif
+
+    VM_CASE(HALT)
+        goto done;
+    VM_CASE(CONST)
+        *sp++ = *pc++;
+        VM_NEXT();
+    VM_CASE(CONST_WIDE)
+        *sp++ = (int64_t)((uint64_t)(uint32_t)pc[0] | (uint64_t)(uint32_t)pc[1] << 32);
+        pc += 2;
+        VM_NEXT();
+    VM_CASE(LOAD)
+        *sp++ = fp[*pc++];
+        VM_NEXT();
+    VM_CASE(STORE)
+        fp[*pc++] = *--sp;
+        VM_NEXT();
+    VM_CASE(LOAD_OUTER) {
+        size_t f = frame;
+        for (int32_t hops = *pc++; hops > 0; hops--) {
+            f = frames[f].outer;
+        }
+        *sp++ = stack[frames[f].base + (size_t)*pc++];
+        VM_NEXT();
+    }
+    VM_CASE(STORE_OUTER) {
+        size_t f = frame;
+        for (int32_t hops = *pc++; hops > 0; hops--) {
+            f = frames[f].outer;
+        }
+        stack[frames[f].base + (size_t)*pc++] = *--sp;
+        VM_NEXT();
+    }
+    VM_CASE(SUBTRACT)
+        sp[-2] = wrap_subtract(sp[-2], sp[-1]);
+        sp--;
+        VM_NEXT();
+    VM_CASE(SUBTRACT_FROM)
+        sp[-2] = wrap_subtract(sp[-1], sp[-2]);
+        sp--;
+        VM_NEXT();
+    VM_CASE(MULTIPLY)
+        sp[-2] = wrap_multiply(sp[-2], sp[-1]);
+        sp--;
+        VM_NEXT();
+    VM_CASE(SHIFT_LEFT)
+        sp[-1] = (int64_t)((uint64_t)sp[-1] << *pc++);
+        VM_NEXT();
+    VM_CASE(EQUAL)
+        VM_COMPARE(==);
+        VM_NEXT();
+    VM_CASE(NOT_EQUAL)
+        VM_COMPARE(!=);
+        VM_NEXT();
+    VM_CASE(LESS)
+        VM_COMPARE(<);
+        VM_NEXT();
+    VM_CASE(LESS_EQUAL)
+        VM_COMPARE(<=);
+        VM_NEXT();
+    VM_CASE(GREATER)
+        VM_COMPARE(>);
+        VM_NEXT();
+    VM_CASE(GREATER_EQUAL)
+        VM_COMPARE(>=);
+        VM_NEXT();
+    VM_CASE(JUMP)
+        pc = code + *pc;
+        VM_NEXT();
+    VM_CASE(JUMP_FALSE)
+        pc = *--sp ? pc + 1 : code + *pc;
+        VM_NEXT();
+    VM_CASE(CALL) {
+        const BytecodeFunction* callee = &program->functions[pc[0]];
+        size_t outer = frame;
+        for (int32_t hops = pc[1]; hops > 0; hops--) {
+            outer = frames[outer].outer;
+        }
+        pc += 2;
+        int64_t argument = *--sp;
+        size_t base = (size_t)(sp - stack);
+
+        if (frame_count >= frame_capacity) {
+            if (frame_count >= VM_MAX_CALL_DEPTH) {
+                VM_FAIL("call stack overflow");
+            }
+            VmFrame* grown = (VmFrame*)realloc(frames, frame_capacity * 2 * sizeof(VmFrame));
+            if (!grown) {
+                VM_FAIL("out of memory");
+            }
+            frames = grown;
+            frame_capacity *= 2;
+        }
+        size_t needed = base + callee->frame_size + callee->stack_size;
+        if (needed > capacity) {
+            size_t new_capacity = capacity * 2;
+            while (needed > new_capacity) {
+                new_capacity *= 2;
+            }
+            size_t fp_offset = (size_t)(fp - stack);
+            int64_t* grown = (int64_t*)realloc(stack, new_capacity * sizeof(int64_t));
+            if (!grown) {
+                VM_FAIL("out of memory");
+            }
+            stack = grown;
+            capacity = new_capacity;
+            fp = stack + fp_offset;
+        }
+
+        frames[frame_count].return_pc = pc;
+        frames[frame_count].base = base;
+        frames[frame_count].outer = outer;
+        frame = frame_count++;
+        fp = stack + base;
+        memset(fp, 0, callee->frame_size * sizeof(int64_t)); // variables start at 0
+        if (callee->parameter) {
+            fp[callee->parameter] = argument;
+        }
+        sp = fp + callee->frame_size;
+        pc = code + callee->entry;
+        VM_NEXT();
+    }
+    VM_CASE(RETURN) {
+        int64_t result = fp[0];
+        pc = frames[frame].return_pc;
+        sp = fp;
+        frame = --frame_count - 1;
+        fp = stack + frames[frame].base;
+        *sp++ = result;
+        VM_NEXT();
+    }
+    VM_CASE(READ) {
+        int64_t value;
+        if (!io->read(io->context, &value)) {
+            VM_FAIL("no input left to read");
+        }
+        *sp++ = value;
+        VM_NEXT();
+    }
+    VM_CASE(WRITE)
+        if (!io->write(io->context, *--sp)) {
+            VM_FAIL("failed to write output");
+        }
+        VM_NEXT();
+
+#ifndef VM_COMPUTED_GOTO
+        default:
+            VM_FAIL("bad opcode %d", pc[-1]);
+        }
+    }
+#endif
+
+done:
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_COMPARE
+#undef VM_FAIL
+    free(stack);
+    free(frames);
+    return ok;
+}
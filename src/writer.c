@@ -0,0 +1,75 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include "writer.h"
+
+// Writes all of data to fd, retrying short and interrupted writes.
+bool write_fd(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Writes straight to the descriptor of the stream, after anything stdio still
+// holds for it.
+bool write_stream(FILE* stream, const char* data, size_t length) {
+    return fflush(stream) == 0 && write_fd(fileno(stream), data, length);
+}
+
+// Sized for the expected output, up to WRITER_MAX_BLOCK, so that output that
+// fits goes out with a single write.
+bool writer_open(Writer* w, FILE* stream, size_t expected) {
+    memset(w, 0, sizeof(Writer));
+    w->fd = fileno(stream);
+    w->capacity = expected < WRITER_MAX_BLOCK ? expected : WRITER_MAX_BLOCK;
+    if (w->capacity == 0) {
+        w->capacity = 1;
+    }
+    w->data = (char*)malloc(w->capacity);
+    w->failed = !w->data || fflush(stream) != 0;
+    return !w->failed;
+}
+
+// Room for length more bytes, after writing out what the buffer holds if it
+// is full. NULL once the writer failed.
+char* writer_reserve(Writer* w, size_t length) {
+    if (w->failed) {
+        return NULL;
+    }
+    if (length > w->capacity - w->length) {
+        if (w->length > 0 && !write_fd(w->fd, w->data, w->length)) {
+            w->failed = true;
+            return NULL;
+        }
+        w->length = 0;
+        if (length > w->capacity) {
+            char* data = (char*)realloc(w->data, length);
+            if (!data) {
+                w->failed = true;
+                return NULL;
+            }
+            w->data = data;
+            w->capacity = length;
+        }
+    }
+    return w->data + w->length;
+}
+
+bool writer_close(Writer* w) {
+    if (!w->failed && w->length > 0 && !write_fd(w->fd, w->data, w->length)) {
+        w->failed = true;
+    }
+    free(w->data);
+    w->data = NULL;
+    return !w->failed;
+}
@@ -0,0 +1 @@
+F function 1 1 1
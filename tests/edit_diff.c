@@ -0,0 +1,367 @@
+// edit_diff: differential check of incremental reparsing (incremental.h). A
+// file is loaded and parsed, then edited token by token with parser_edit():
+// lines declared, assigned, called, written or deleted, and single tokens
+// replaced, deleted or inserted, mostly inside function bodies. After every
+// edit the result, the diagnostics and, when it succeeds, the tables must be
+// those of a new parser given the edited tokens. An edit that breaks the
+// program is usually undone, so that later edits reparse incrementally again.
+// Every file is edited with both engines, with and without collecting errors,
+// and sequentially and with THREADS threads.
+//
+//   edit_diff [--threads THREADS] [--seeds N] [--edits N] FILE...
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "parser.h"
+#include "incremental.h"
+
+#define MAX_INSERT 8 // tokens one edit inserts, at most
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+// What a parse delivered through the sinks.
+typedef struct {
+    Text tables;
+    Text diagnostics;
+} Capture;
+
+typedef struct {
+    Token* items;
+    size_t count;
+} TokenList;
+
+typedef struct {
+    ParserEngine engine;
+    bool collect_errors;
+    int threads;
+} Mode;
+
+static uint64_t rng_state;
+
+static unsigned rng(unsigned n) {
+    rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)((rng_state >> 33) % n);
+}
+
+static void add(Text* t, const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length >= sizeof(line)) {
+        length = sizeof(line) - 1;
+    }
+    if (t->length + (size_t)length + 1 > t->capacity) {
+        t->capacity = (t->length + (size_t)length + 1) * 2;
+        t->data = (char*)realloc(t->data, t->capacity);
+        if (!t->data) {
+            perror("Failed to allocate text");
+            exit(1);
+        }
+    }
+    memcpy(t->data + t->length, line, (size_t)length + 1);
+    t->length += (size_t)length;
+}
+
+static bool same_text(const Text* a, const Text* b) {
+    return a->length == b->length && (a->length == 0 || memcmp(a->data, b->data, a->length) == 0);
+}
+
+static void on_procedure(void* context, const ProcedureEntry* entry, const char* name) {
+    add(&((Capture*)context)->tables, "pro %s %d %d %d %d\n", name, (int)entry->ptype, entry->plev, entry->faddr,
+        entry->laddr);
+}
+
+static void on_variable(void* context, const VariableEntry* entry, const char* name, const char* proc) {
+    add(&((Capture*)context)->tables, "var %s %s %d %d %d %d\n", name, proc, entry->vkind, (int)entry->vtype,
+        entry->vlev, entry->vaddr);
+}
+
+static void on_diagnostic(void* context, int line, const char* message) {
+    add(&((Capture*)context)->diagnostics, "err %d %s\n", line, message);
+}
+
+static void clear(Capture* capture) {
+    capture->tables.length = 0;
+    capture->diagnostics.length = 0;
+}
+
+static void set_mode(Parser* parser, const Mode* mode) {
+    parser->engine = mode->engine;
+    parser->collect_errors = mode->collect_errors;
+    parser->threads = mode->threads;
+}
+
+// Replaces removed tokens at first with count new ones, as parser_edit() does.
+static void apply(TokenList* tokens, size_t first, size_t removed, const Token* inserted, size_t count) {
+    Token* items = (Token*)malloc((tokens->count - removed + count + 1) * sizeof(Token));
+    if (!items) {
+        perror("Failed to allocate tokens");
+        exit(1);
+    }
+    memcpy(items, tokens->items, first * sizeof(Token));
+    memcpy(items + first, inserted, count * sizeof(Token));
+    memcpy(items + first + count, tokens->items + first + removed, (tokens->count - first - removed) * sizeof(Token));
+    free(tokens->items);
+    tokens->items = items;
+    tokens->count = tokens->count - removed + count;
+}
+
+// Parses tokens, whose values are atoms of edited, in a new parser.
+static bool parse_fresh(Parser* edited, const TokenList* tokens, const Mode* mode, Capture* capture) {
+    clear(capture);
+    ParserSinks sinks = { capture, on_procedure, on_variable, on_diagnostic };
+    Parser* parser = create_buffer_parser("", 0, &sinks);
+    if (!parser || !reserve_tokens(parser, tokens->count + 1, 0)) {
+        fprintf(stderr, "Error: failed to set up a parser\n");
+        exit(1);
+    }
+    set_mode(parser, mode);
+    for (size_t i = 0; i < tokens->count; i++) {
+        Token token = tokens->items[i];
+        if (token.value != ATOM_NONE) {
+            const char* name = atom_name(&edited->atoms, token.value);
+            token.value = intern_atom(&parser->atoms, name, strlen(name));
+        }
+        if (!append_token(parser, token.type, token.value)) {
+            fprintf(stderr, "Error: failed to store tokens\n");
+            exit(1);
+        }
+    }
+    bool result = program(parser);
+    destroy_parser(parser);
+    return result;
+}
+
+// Makes the edit and compares the edited parser with a new one; false, after
+// reporting it, if they differ.
+static bool check_edit(Parser* parser, TokenList* tokens, const Mode* mode, Capture* edited, Capture* fresh,
+                       size_t first, size_t removed, const Token* inserted, size_t count, bool* result) {
+    clear(edited);
+    *result = parser_edit(parser, first, removed, inserted, count);
+    apply(tokens, first, removed, inserted, count);
+    // a full reparse delivers the tables too; only those of output_to_file() count
+    edited->tables.length = 0;
+    if (*result) {
+        output_to_file(parser);
+    }
+    bool fresh_result = parse_fresh(parser, tokens, mode, fresh);
+    if (*result != fresh_result || !same_text(&edited->diagnostics, &fresh->diagnostics) ||
+        (*result && !same_text(&edited->tables, &fresh->tables))) {
+        printf("MISMATCH engine %s, collect %d, threads %d: tokens %zu-%zu replaced by %zu\n",
+               mode->engine == ENGINE_TABLE ? "table" : "recursive", mode->collect_errors, mode->threads, first,
+               first + removed, count);
+        return false;
+    }
+    return true;
+}
+
+// Edits file at random from seed; false if an edit went wrong.
+static bool edit_file(const char* file, unsigned seed, int edits, const Mode* mode) {
+    Capture edited = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+    Capture fresh = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+    ParserSinks sinks = { &edited, on_procedure, on_variable, on_diagnostic };
+    Parser* parser = create_buffer_parser("", 0, &sinks);
+    if (!parser || !parser_load_tokens(parser, file)) {
+        exit(1);
+    }
+    set_mode(parser, mode);
+    TokenList tokens = { NULL, input_token_count(parser) };
+    tokens.items = (Token*)malloc((tokens.count + 1) * sizeof(Token));
+    Atom* names = (Atom*)malloc((tokens.count + 1) * sizeof(Atom));
+    size_t name_count = 0;
+    if (!tokens.items || !names) {
+        perror("Failed to allocate tokens");
+        exit(1);
+    }
+    TokenCursor cursor = { 0, 0 };
+    for (size_t i = 0; next_input_token(parser, &cursor, &tokens.items[i]); i++) {
+        if (tokens.items[i].type == IDENT) {
+            names[name_count++] = tokens.items[i].value;
+        }
+    }
+    if (name_count == 0 || tokens.count < 2) {
+        fprintf(stderr, "Error: %s has too few tokens to edit\n", file);
+        exit(1);
+    }
+    Atom fresh_name = intern_atom(&parser->atoms, "zz", 2);
+    Atom one = intern_atom(&parser->atoms, "1", 1);
+    program(parser);
+
+    rng_state = (uint64_t)seed * 2654435761u + 7;
+    bool ok = true;
+    for (int e = 0; e < edits && ok; e++) {
+        size_t first = 1 + rng((unsigned)tokens.count - 1);
+        if (parser->edit.valid && parser->proc_count > 0 && rng(5) > 0) {
+            // somewhere in a body; stored token indexes leave out the EOLNs
+            ProcedureEntry* proc = procedure_at(parser, rng((unsigned)parser->proc_count));
+            size_t start = proc->body_start + (size_t)token_line(parser, proc->body_start) - 1;
+            size_t end = proc->body_end + (size_t)token_line(parser, proc->body_end) - 1;
+            if (end > tokens.count) {
+                end = tokens.count;
+            }
+            if (end > start + 2) {
+                first = start + 2 + rng((unsigned)(end - start - 2));
+            }
+        }
+        size_t line = first;
+        while (line > 0 && tokens.items[line - 1].type != EOLN) {
+            line--;
+        }
+        if (line == 0) {
+            line = first;
+        }
+        Atom name = names[rng((unsigned)name_count)];
+        Atom other = names[rng((unsigned)name_count)];
+        Token inserted[MAX_INSERT];
+        size_t removed = 0;
+        size_t count = 0;
+        switch (rng(12)) {
+        case 0:
+        case 1: { // declaration line
+            Token line_tokens[] = { { INTEGER, ATOM_NONE }, { IDENT, rng(3) ? name : fresh_name },
+                                    { SEMICOLON, ATOM_NONE }, { EOLN, ATOM_NONE } };
+            memcpy(inserted, line_tokens, sizeof(line_tokens));
+            count = 4;
+            first = line;
+            break;
+        }
+        case 2:
+        case 3: { // assignment line
+            Token line_tokens[] = { { IDENT, name }, { ASSIGN, ATOM_NONE }, { IDENT, other }, { SEMICOLON, ATOM_NONE },
+                                    { EOLN, ATOM_NONE } };
+            memcpy(inserted, line_tokens, sizeof(line_tokens));
+            count = 5;
+            first = line;
+            break;
+        }
+        case 4:
+        case 5: { // delete a line
+            size_t end = line;
+            while (end < tokens.count && tokens.items[end].type != EOLN) {
+                end++;
+            }
+            if (end < tokens.count) {
+                end++;
+            }
+            first = line;
+            removed = end - line;
+            break;
+        }
+        case 6: // replace a name
+            if (tokens.items[first].type == IDENT) {
+                inserted[0] = (Token){ IDENT, name };
+                removed = 1;
+                count = 1;
+            }
+            break;
+        case 7: // delete a token
+            removed = 1;
+            break;
+        case 8: { // insert any token
+            TokenType type = (TokenType)rng(_EOF);
+            inserted[0] = (Token){ type, type == IDENT ? name : type == CONST ? one : ATOM_NONE };
+            count = 1;
+            break;
+        }
+        case 9: { // write line
+            Token line_tokens[] = { { WRITE, ATOM_NONE }, { OPENPAREN, ATOM_NONE }, { IDENT, name },
+                                    { CLOSEPAREN, ATOM_NONE }, { SEMICOLON, ATOM_NONE }, { EOLN, ATOM_NONE } };
+            memcpy(inserted, line_tokens, sizeof(line_tokens));
+            count = 6;
+            first = line;
+            break;
+        }
+        default: { // call line, of a function the file declares if one is found
+            Atom callee = other;
+            for (int tries = 0; tries < 20 && parser->proc_count > 0; tries++) {
+                callee = names[rng((unsigned)name_count)];
+                if (find_procedure(parser, callee)) {
+                    break;
+                }
+            }
+            Token line_tokens[] = { { IDENT, name }, { ASSIGN, ATOM_NONE }, { IDENT, callee }, { OPENPAREN, ATOM_NONE },
+                                    { CONST, one }, { CLOSEPAREN, ATOM_NONE }, { SEMICOLON, ATOM_NONE },
+                                    { EOLN, ATOM_NONE } };
+            memcpy(inserted, line_tokens, sizeof(line_tokens));
+            count = 8;
+            first = line;
+            break;
+        }
+        }
+        if (first + removed > tokens.count) {
+            removed = tokens.count - first;
+        }
+        Token* saved = (Token*)malloc((removed + 1) * sizeof(Token));
+        if (!saved) {
+            perror("Failed to allocate tokens");
+            exit(1);
+        }
+        memcpy(saved, tokens.items + first, removed * sizeof(Token));
+        bool result;
+        ok = check_edit(parser, &tokens, mode, &edited, &fresh, first, removed, inserted, count, &result);
+        if (ok && !result && rng(10) < 8) {
+            ok = check_edit(parser, &tokens, mode, &edited, &fresh, first, count, saved, removed, &result);
+        }
+        free(saved);
+    }
+    if (!ok) {
+        printf("  in %s, seed %u\n", file, seed);
+    }
+    free(tokens.items);
+    free(names);
+    free(edited.tables.data);
+    free(edited.diagnostics.data);
+    free(fresh.tables.data);
+    free(fresh.diagnostics.data);
+    destroy_parser(parser);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int threads = 4;
+    unsigned seeds = 10;
+    int edits = 40;
+    int i = 1;
+    for (; i + 1 < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+        if (strcmp(argv[i], "--threads") == 0) {
+            threads = (int)strtol(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--seeds") == 0) {
+            seeds = (unsigned)strtoul(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--edits") == 0) {
+            edits = (int)strtol(argv[i + 1], NULL, 10);
+        }
+        else {
+            break;
+        }
+    }
+    if (i >= argc) {
+        fprintf(stderr, "Usage: %s [--threads THREADS] [--seeds N] [--edits N] FILE...\n", argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for (; i < argc; i++) {
+        for (int m = 0; m < 8; m++) {
+            Mode mode = { m & 1 ? ENGINE_TABLE : ENGINE_RECURSIVE, (m & 2) != 0, m & 4 ? threads : 0 };
+            for (unsigned seed = 1; seed <= seeds; seed++) {
+                ok = edit_file(argv[i], seed, edits, &mode) && ok;
+            }
+        }
+    }
+    if (ok) {
+        printf("edit_diff: every edit matches a new parse\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+// engine_diff: differential check of the parser engines (ParserEngine). The
+// table and recursive engines must return the same result and deliver the
+// same tables and diagnostics when stopping at the first error, when
+// collecting errors, and when collecting at most two, and must build the same
+// syntax tree, with and without collecting errors. The inputs are the
+// given files, a program nested deeper than RECURSIVE_MAX_DEPTH, where the
+// recursive engine hands the inner parts to the table one, and COUNT
+// mutations of their tokens: a few tokens deleted, inserted or replaced by
+// tokens taken from any of the files.
+//
+//   engine_diff [--count N] FILE...
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "parser.h"
+
+#define DEEP_NESTING (RECURSIVE_MAX_DEPTH + 500) // levels of ifs, blocks and parentheses
+
+typedef struct {
+    TokenType type;
+    const char* value; // in the atoms of the parser the file was loaded into, NULL for none
+} Item;
+
+typedef struct {
+    Item* items;
+    size_t count;
+    size_t capacity;
+} TokenList;
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+typedef struct {
+    const char* name;
+    bool collect_errors;
+    size_t max_errors;
+    bool ast;
+} Mode;
+
+static const Mode modes[] = {
+    { "first error", false, DEFAULT_MAX_ERRORS, false },
+    { "--collect-errors", true, DEFAULT_MAX_ERRORS, false },
+    { "--max-errors 2", true, 2, false },
+    { "--ast", false, DEFAULT_MAX_ERRORS, true },
+    { "--ast --collect-errors", true, DEFAULT_MAX_ERRORS, true },
+};
+
+static uint64_t rng_state;
+
+static unsigned rng(unsigned n) {
+    rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)((rng_state >> 33) % n);
+}
+
+static void append(Text* t, const char* bytes, size_t length) {
+    if (t->length + length > t->capacity) {
+        t->capacity = (t->length + length) * 2;
+        t->data = (char*)realloc(t->data, t->capacity);
+        if (!t->data) {
+            perror("Failed to allocate text");
+            exit(1);
+        }
+    }
+    memcpy(t->data + t->length, bytes, length);
+    t->length += length;
+}
+
+static void add(Text* t, const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        append(t, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
+}
+
+static void push_item(TokenList* list, Item item) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->items = (Item*)realloc(list->items, list->capacity * sizeof(Item));
+        if (!list->items) {
+            perror("Failed to allocate tokens");
+            exit(1);
+        }
+    }
+    list->items[list->count++] = item;
+}
+
+static void on_procedure(void* context, const ProcedureEntry* entry, const char* name) {
+    add((Text*)context, "pro %s %d %d %d %d\n", name, (int)entry->ptype, entry->plev, entry->faddr, entry->laddr);
+}
+
+static void on_variable(void* context, const VariableEntry* entry, const char* name, const char* proc) {
+    add((Text*)context, "var %s %s %d %d %d %d\n", name, proc, entry->vkind, (int)entry->vtype, entry->vlev, entry->vaddr);
+}
+
+static void on_diagnostic(void* context, int line, const char* message) {
+    add((Text*)context, "err %d %s\n", line, message);
+}
+
+static void push_items(TokenList* list, const Item* items, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        push_item(list, items[i]);
+    }
+}
+
+// begin integer k; then DEEP_NESTING ifs, each around a block, around an
+// assignment of a constant in DEEP_NESTING parentheses.
+static void deep_program(TokenList* list) {
+    static const Item head[] = { { BEGIN, NULL }, { EOLN, NULL }, { INTEGER, NULL }, { IDENT, "k" },
+                                 { SEMICOLON, NULL }, { EOLN, NULL } };
+    static const Item level[] = { { IF, NULL }, { IDENT, "k" }, { EQU, NULL }, { CONST, "1" }, { THEN, NULL },
+                                  { EOLN, NULL }, { BEGIN, NULL }, { EOLN, NULL } };
+    static const Item assign[] = { { IDENT, "k" }, { ASSIGN, NULL } };
+    static const Item close[] = { { END, NULL }, { EOLN, NULL } };
+    Item open_paren = { OPENPAREN, NULL };
+    Item close_paren = { CLOSEPAREN, NULL };
+    Item one = { CONST, "1" };
+    static const Item semicolon[] = { { SEMICOLON, NULL }, { EOLN, NULL } };
+    push_items(list, head, sizeof(head) / sizeof(head[0]));
+    for (int d = 0; d < DEEP_NESTING; d++) {
+        push_items(list, level, sizeof(level) / sizeof(level[0]));
+    }
+    push_items(list, assign, sizeof(assign) / sizeof(assign[0]));
+    for (int d = 0; d < DEEP_NESTING; d++) {
+        push_item(list, open_paren);
+    }
+    push_item(list, one);
+    for (int d = 0; d < DEEP_NESTING; d++) {
+        push_item(list, close_paren);
+    }
+    push_items(list, semicolon, 2);
+    for (int d = 0; d <= DEEP_NESTING; d++) {
+        push_items(list, close, sizeof(close) / sizeof(close[0]));
+    }
+}
+
+// Parses tokens with engine in mode; out receives everything the parse delivered.
+static void parse(const TokenList* tokens, ParserEngine engine, const Mode* mode, Text* out) {
+    out->length = 0;
+    ParserSinks sinks = { out, on_procedure, on_variable, on_diagnostic };
+    Parser* parser = create_buffer_parser("", 0, &sinks);
+    if (!parser || !reserve_tokens(parser, tokens->count + 1, 0)) {
+        fprintf(stderr, "Error: failed to set up a parser\n");
+        exit(1);
+    }
+    parser->engine = engine;
+    parser->collect_errors = mode->collect_errors;
+    parser->max_errors = mode->max_errors;
+    parser->ast.enabled = mode->ast;
+    for (size_t i = 0; i < tokens->count; i++) {
+        const Item* item = &tokens->items[i];
+        Atom value = item->value ? intern_atom(&parser->atoms, item->value, strlen(item->value)) : ATOM_NONE;
+        if ((item->value && value == ATOM_NONE) || !append_token(parser, item->type, value)) {
+            fprintf(stderr, "Error: failed to store tokens\n");
+            exit(1);
+        }
+    }
+    bool result = program(parser);
+    add(out, "result %d\n", result);
+    if (result && mode->ast) {
+        char* tree = NULL;
+        size_t length = 0;
+        FILE* f = open_memstream(&tree, &length);
+        if (!f || !print_ast(parser, f)) {
+            fprintf(stderr, "Error: failed to print the syntax tree\n");
+            exit(1);
+        }
+        fclose(f);
+        append(out, tree, length);
+        free(tree);
+    }
+    destroy_parser(parser);
+}
+
+// Parses tokens with both engines in every mode; false, after reporting it,
+// if they differ.
+static bool check(const char* name, const TokenList* tokens, Text* table, Text* recursive) {
+    bool same = true;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        parse(tokens, ENGINE_TABLE, &modes[m], table);
+        parse(tokens, ENGINE_RECURSIVE, &modes[m], recursive);
+        if (table->length != recursive->length || memcmp(table->data, recursive->data, table->length) != 0) {
+            printf("MISMATCH %s, %s: the engines differ\n", name, modes[m].name);
+            same = false;
+        }
+    }
+    return same;
+}
+
+int main(int argc, char* argv[]) {
+    long count = 500;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "--count") == 0) {
+        count = strtol(argv[i + 1], NULL, 10);
+        i += 2;
+    }
+    int file_count = argc - i;
+    if (file_count <= 0) {
+        fprintf(stderr, "Usage: %s [--count N] FILE...\n", argv[0]);
+        return 1;
+    }
+    // the files' parsers stay alive: their atoms name the tokens
+    Parser** loaded = (Parser**)calloc((size_t)file_count, sizeof(Parser*));
+    TokenList* files = (TokenList*)calloc((size_t)file_count + 1, sizeof(TokenList)); // and the deep program
+    TokenList pool = { NULL, 0, 0 };
+    if (!loaded || !files) {
+        perror("Failed to allocate files");
+        return 1;
+    }
+    for (int f = 0; f < file_count; f++) {
+        loaded[f] = create_buffer_parser("", 0, NULL);
+        if (!loaded[f] || !parser_load_tokens(loaded[f], argv[i + f])) {
+            return 1;
+        }
+        TokenCursor cursor = { 0, 0 };
+        Token token;
+        while (next_input_token(loaded[f], &cursor, &token)) {
+            const char* value = token.value != ATOM_NONE ? atom_name(&loaded[f]->atoms, token.value) : NULL;
+            Item item = { token.type, value };
+            push_item(&files[f], item);
+            push_item(&pool, item);
+        }
+    }
+    deep_program(&files[file_count]);
+
+    bool ok = true;
+    char name[512];
+    Text table = { NULL, 0, 0 };
+    Text recursive = { NULL, 0, 0 };
+    for (int f = 0; f <= file_count; f++) {
+        ok = check(f < file_count ? argv[i + f] : "deep program", &files[f], &table, &recursive) && ok;
+    }
+    TokenList mutant = { NULL, 0, 0 };
+    for (long n = 0; n < count; n++) {
+        rng_state = (uint64_t)n * 2654435761u + 5;
+        int f = (int)rng((unsigned)file_count + 1);
+        mutant.count = 0;
+        for (size_t t = 0; t < files[f].count; t++) {
+            push_item(&mutant, files[f].items[t]);
+        }
+        for (unsigned edits = 1 + rng(6); edits > 0; edits--) {
+            size_t at = rng((unsigned)mutant.count + 1);
+            unsigned op = rng(3);
+            if (op == 0 && at < mutant.count) {
+                memmove(mutant.items + at, mutant.items + at + 1, (mutant.count - at - 1) * sizeof(Item));
+                mutant.count--;
+            }
+            else if (op == 1 || at == mutant.count) {
+                push_item(&mutant, pool.items[0]); // room for one more
+                memmove(mutant.items + at + 1, mutant.items + at, (mutant.count - at - 1) * sizeof(Item));
+                mutant.items[at] = pool.items[rng((unsigned)pool.count)];
+            }
+            else {
+                mutant.items[at] = pool.items[rng((unsigned)pool.count)];
+            }
+        }
+        snprintf(name, sizeof(name), "%s mutation %ld", f < file_count ? argv[i + f] : "deep program", n);
+        ok = check(name, &mutant, &table, &recursive) && ok;
+    }
+
+    free(mutant.items);
+    free(table.data);
+    free(recursive.data);
+    free(pool.items);
+    for (int f = 0; f < file_count; f++) {
+        free(files[f].items);
+        destroy_parser(loaded[f]);
+    }
+    free(files[file_count].items);
+    free(files);
+    free(loaded);
+    if (ok) {
+        printf("engine_diff: the engines agree\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#!/bin/sh
+# Output check of the .var, .pro and .err files. The samples must give the
+# files in tests/ in every mode, or with errors in every mode that stops at
+# the first one and, where tests/collect/ has them, those files with
+# --collect-errors. Generated programs, and broken copies of them
+# with one line deleted, must give the same files in every mode as in the
+# default one with the same error handling, and print the same unless run as
+# a batch. The modes are --engine table, --stream, batch mode, and --threads 4
+# with either engine; each runs as it is and with --collect-errors.
+#
+#   output_diff.sh MINIPARSER MKPROG WORKDIR [COUNT]
+set -u
+MINIPARSER=$1
+MKPROG=$2
+WORK=$3
+COUNT=${4:-20}
+TESTS=$(cd "$(dirname "$0")" && pwd)
+
+rm -rf "$WORK"
+mkdir -p "$WORK/inputs"
+cp "$TESTS"/*.dyd "$WORK/inputs"/
+seed=1
+while [ $seed -le $COUNT ]; do
+    "$MKPROG" --functions 6 --statements 4 --nest $((seed % 3)) --seed $seed -o "$WORK/gen$seed.mini" || exit 1
+    sed "$((seed * 7 % 60 + 2))d" "$WORK/gen$seed.mini" > "$WORK/broken$seed.mini"
+    for name in gen$seed broken$seed; do
+        "$MINIPARSER" --convert "$WORK/$name.mini" "$WORK/inputs/$name.dyd" > /dev/null || exit 1
+    done
+    seed=$((seed + 1))
+done
+
+# run DIR BATCH OPTIONS...: parses a copy of every input in DIR, in one batch
+# if BATCH is yes, else one at a time with what it prints in NAME.out
+run() {
+    dir=$1
+    batch=$2
+    shift 2
+    rm -rf "$dir"
+    mkdir -p "$dir"
+    cp "$WORK"/inputs/*.dyd "$dir"/
+    if [ "$batch" = yes ]; then
+        "$MINIPARSER" --jobs 2 "$@" "$dir"/*.dyd > /dev/null 2>&1
+        return
+    fi
+    for input in "$dir"/*.dyd; do
+        "$MINIPARSER" "$@" "$input" > "${input%.dyd}.out" 2>&1
+    done
+}
+
+# same FILE EXPECTED LABEL
+same() {
+    if ! cmp -s "$1" "$2"; then
+        echo "MISMATCH $3"
+        failed=1
+    fi
+}
+
+failed=0
+for collect in "" --collect-errors; do
+    run "$WORK/default" no $collect
+    for sample in "$TESTS"/*.dyd; do
+        name=$(basename "$sample" .dyd)
+        # the files in tests/ are those of the first error; collecting
+        # errors writes the tables too, as in tests/collect/
+        expected=$TESTS
+        if [ -n "$collect" ] && [ -f "$TESTS/collect/$name.err" ]; then
+            expected=$TESTS/collect
+        elif [ -n "$collect" ] && [ -s "$TESTS/$name.err" ]; then
+            continue
+        fi
+        for ext in var pro err; do
+            same "$WORK/default/$name.$ext" "$expected/$name.$ext" "$name.$ext: default $collect"
+        done
+    done
+    for mode in table stream batch threads table-threads; do
+        batch=no
+        options=
+        case $mode in
+        table) options="--engine table" ;;
+        stream) options=--stream ;;
+        batch) batch=yes ;;
+        threads) options="--threads 4" ;;
+        table-threads) options="--engine table --threads 4" ;;
+        esac
+        run "$WORK/$mode" $batch $options $collect
+        for input in "$WORK"/inputs/*.dyd; do
+            name=$(basename "$input" .dyd)
+            for ext in var pro err out; do
+                if [ "$ext" != out ] || [ $batch = no ]; then
+                    same "$WORK/$mode/$name.$ext" "$WORK/default/$name.$ext" "$name.$ext: $mode $collect"
+                fi
+            done
+        done
+    done
+done
+[ $failed = 0 ] && echo "output_diff: all modes agree"
+exit $failed
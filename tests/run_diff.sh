@@ -0,0 +1,78 @@
+#!/bin/sh
+# Differential check of the compilers. Each program must print the same, and
+# exit the same way, when run from the syntax tree and through the optimized
+# IR with each pass turned off in turn, and with "native" also as executables
+# built by --native, with all passes and without inlining. The programs are
+# those in tests/ that parse, and COUNT programs from mkprog with nested
+# functions.
+#
+#   run_diff.sh MINIPARSER MKPROG WORKDIR [COUNT [native]]
+set -u
+MINIPARSER=$1
+MKPROG=$2
+WORK=$3
+COUNT=${4:-40}
+NATIVE=${5:-}
+TESTS=$(cd "$(dirname "$0")" && pwd)
+
+rm -rf "$WORK"
+mkdir -p "$WORK"
+seq 1 200 > "$WORK/input"
+for program in "$TESTS"/*.mini; do
+    # those that do not parse cannot run
+    [ -s "${program%.mini}.err" ] || cp "$program" "$WORK"/
+done
+seed=1
+while [ $seed -le $COUNT ]; do
+    "$MKPROG" --functions 4 --vars 2 --statements 4 --expr 4 --depth 2 --nest $((seed % 4)) --seed $seed \
+        -o "$WORK/gen$seed.mini" || exit 1
+    seed=$((seed + 1))
+done
+
+# run OUTPUT PROGRAM OPTIONS...: the program's output and exit status
+run() {
+    out=$1
+    program=$2
+    shift 2
+    "$MINIPARSER" --run "$@" "$program" < "$WORK/input" > "$out" 2>&1
+    echo "exit $?" >> "$out"
+}
+
+# native OUTPUT PROGRAM OPTIONS...: the same for the program built by --native
+native() {
+    out=$1
+    program=$2
+    shift 2
+    if ! "$MINIPARSER" --native "$WORK/program" "$@" "$program" > /dev/null 2> "$out"; then
+        echo "build failed" >> "$out"
+        return
+    fi
+    "$WORK/program" < "$WORK/input" > "$out" 2>&1
+    echo "exit $?" >> "$out"
+}
+
+failed=0
+for program in "$WORK"/*.mini; do
+    run "$WORK/expected" "$program"
+    for options in "--optimize" "--optimize --no-pass inline" "--optimize --no-pass fold" \
+                   "--optimize --no-pass strength" "--optimize --no-pass dce"; do
+        # options is split into words on purpose
+        run "$WORK/actual" "$program" $options
+        if ! cmp -s "$WORK/expected" "$WORK/actual"; then
+            echo "MISMATCH $(basename "$program") $options"
+            diff "$WORK/expected" "$WORK/actual" | head -5
+            failed=1
+        fi
+    done
+    [ -n "$NATIVE" ] || continue
+    for options in "" "--no-pass inline"; do
+        native "$WORK/actual" "$program" $options
+        if ! cmp -s "$WORK/expected" "$WORK/actual"; then
+            echo "MISMATCH $(basename "$program") --native $options"
+            diff "$WORK/expected" "$WORK/actual" | head -5
+            failed=1
+        fi
+    done
+done
+[ $failed = 0 ] && echo "run_diff: all programs agree"
+exit $failed
@@ -0,0 +1,191 @@
+// scan_diff: differential check of the .dyd scanners (dydscan.h). On each
+// input, every scanner the CPU supports must load the same tokens and line
+// breaks as the scalar one, or fail with the same error. The inputs are the
+// given .dyd files, copies of them cut short or with a byte changed, and COUNT
+// generated texts mixing well-formed lines with malformed ones.
+//
+//   scan_diff [--count N] FILE.dyd...
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+#define LONG_NAME 300 // bytes of the longest generated identifier
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+static uint64_t rng_state;
+
+static unsigned rng(unsigned n) {
+    rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)((rng_state >> 33) % n);
+}
+
+static void append(Text* t, const char* bytes, size_t length) {
+    if (t->length + length > t->capacity) {
+        t->capacity = (t->length + length) * 2;
+        t->data = (char*)realloc(t->data, t->capacity);
+        if (!t->data) {
+            perror("Failed to allocate text");
+            exit(1);
+        }
+    }
+    memcpy(t->data + t->length, bytes, length);
+    t->length += length;
+}
+
+// What loading data with scanner gave: the error, or every input token with
+// the line breaks as EOLN.
+static char* load(DydScanner scanner, const char* data, size_t size) {
+    char* out = NULL;
+    size_t out_length = 0;
+    FILE* f = open_memstream(&out, &out_length);
+    Parser* parser = create_buffer_parser("", 0, NULL);
+    if (!f || !parser) {
+        fprintf(stderr, "Error: failed to set up a parser\n");
+        exit(1);
+    }
+    parser->scanner = scanner;
+    char error[128];
+    if (!load_dyd(parser, data, size, error, sizeof(error))) {
+        fprintf(f, "%s\n", error);
+    }
+    else {
+        TokenCursor cursor = { 0, 0 };
+        Token token;
+        while (next_input_token(parser, &cursor, &token)) {
+            const char* value = token.value != ATOM_NONE ? atom_name(&parser->atoms, token.value) : "";
+            fprintf(f, "%d %s\n", (int)token.type, value);
+        }
+    }
+    destroy_parser(parser);
+    fclose(f);
+    return out;
+}
+
+// Loads data with every scanner; false, after reporting it, if one differs.
+static bool check(const char* name, const char* data, size_t size) {
+    char* expected = load(DYD_SCAN_SCALAR, data, size);
+    bool same = true;
+    for (int s = DYD_SCAN_SCALAR + 1; s <= DYD_SCAN_AVX2 && dyd_scanner_supported((DydScanner)s); s++) {
+        char* got = load((DydScanner)s, data, size);
+        if (strcmp(got, expected) != 0) {
+            printf("MISMATCH %s: %s and scalar differ\n", name, dyd_scanner_name((DydScanner)s));
+            same = false;
+        }
+        free(got);
+    }
+    free(expected);
+    return same;
+}
+
+static void append_line(Text* t, const char* value, const char* type) {
+    append(t, value, strlen(value));
+    append(t, " ", 1);
+    append(t, type, strlen(type));
+    append(t, "\n", 1);
+}
+
+// A line of .dyd text, malformed one time in four when bad is set.
+static void generate_line(Text* t, bool bad) {
+    static const char* const values[] = { "begin", "end", "integer", "function", "read", "write", "if", "then",
+                                          "else", "x", "k1", "abc_def", "42", "007", ";", ":=", "(", ")", "-", "*",
+                                          "<=", "<>" };
+    const char* value = values[rng(sizeof(values) / sizeof(values[0]))];
+    char type[16];
+    snprintf(type, sizeof(type), "%u", rng(30));
+    if (rng(8) == 0) {
+        append_line(t, "EOLN", "24");
+        return;
+    }
+    if (rng(40) == 0) {
+        char name[LONG_NAME + 1];
+        size_t length = 1 + rng(LONG_NAME);
+        memset(name, 'q', length);
+        name[length] = '\0';
+        append_line(t, name, "10");
+        return;
+    }
+    if (!bad || rng(4) != 0) {
+        append_line(t, value, type);
+        return;
+    }
+    switch (rng(11)) {
+    case 0: append(t, "\n", 1); break; // empty line
+    case 1: append(t, value, strlen(value)); append(t, "\n", 1); break; // no type
+    case 2: append_line(t, value, ""); break; // nothing after the space
+    case 3: append(t, value, strlen(value)); append(t, "  ", 2); append(t, type, strlen(type)); append(t, "\n", 1); break;
+    case 4: append(t, value, strlen(value)); append(t, " ", 1); append(t, type, strlen(type)); append(t, "\r\n", 2); break;
+    case 5: append(t, value, strlen(value)); append(t, "\t", 1); append(t, type, strlen(type)); append(t, "\n", 1); break;
+    case 6: append_line(t, value, "07"); break;
+    case 7: append_line(t, value, "-3"); break;
+    case 8: append_line(t, value, "12x"); break;
+    case 9: append_line(t, value, "99999999999"); break;
+    default: append_line(t, "a b", type); break; // a space in the value
+    }
+}
+
+int main(int argc, char* argv[]) {
+    long count = 2000;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "--count") == 0) {
+        count = strtol(argv[i + 1], NULL, 10);
+        i += 2;
+    }
+    bool ok = true;
+    char name[64];
+    Text text = { NULL, 0, 0 };
+    for (; i < argc; i++) {
+        FILE* f = fopen(argv[i], "rb");
+        if (!f) {
+            fprintf(stderr, "Error opening file %s\n", argv[i]);
+            return 1;
+        }
+        text.length = 0;
+        char chunk[4096];
+        for (size_t n; (n = fread(chunk, 1, sizeof(chunk), f)) > 0;) {
+            append(&text, chunk, n);
+        }
+        fclose(f);
+        ok = check(argv[i], text.data, text.length) && ok;
+        rng_state = (uint64_t)i;
+        for (int cut = 0; cut < 50 && text.length > 0; cut++) {
+            snprintf(name, sizeof(name), "%s cut %d", argv[i], cut);
+            ok = check(name, text.data, rng((unsigned)text.length)) && ok;
+        }
+        for (int change = 0; change < 50 && text.length > 0; change++) {
+            size_t at = rng((unsigned)text.length);
+            char saved = text.data[at];
+            static const char bytes[] = " \n\r\t0x-";
+            text.data[at] = bytes[rng(sizeof(bytes) - 1)];
+            snprintf(name, sizeof(name), "%s change %d", argv[i], change);
+            ok = check(name, text.data, text.length) && ok;
+            text.data[at] = saved;
+        }
+    }
+    for (long n = 0; n < count; n++) {
+        rng_state = (uint64_t)n * 2654435761u + 17;
+        text.length = 0;
+        // mostly short texts, some spanning many 64-byte blocks
+        size_t size = 1 + rng(n % 10 == 0 ? 20000 : 400);
+        bool bad = rng(4) == 0;
+        while (text.length < size) {
+            generate_line(&text, bad);
+        }
+        if (rng(3) == 0) {
+            text.length--; // no final newline
+        }
+        snprintf(name, sizeof(name), "generated %ld", n);
+        ok = check(name, text.data, text.length) && ok;
+    }
+    free(text.data);
+    if (ok) {
+        printf("scan_diff: all scanners agree\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+// minibench: times the phases of parsing each input file and reports the
+// distribution over repetitions, as a table and optionally as JSON for
+// comparing builds.
+//
+//   minibench [--repeat N] [--warmup N] [--engine table|recursive]
+//             [--label TEXT] [--json output.json] <input_file>...
+//
+// The phases are load (create_parser: reading and tokenizing the input),
+// parse (program() with the output files detached) and emit (output_to_file()
+// writing the .var and .pro tables).
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "parser.h"
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE ""
+#endif
+
+#define PHASE_COUNT 4 // the last one is the sum of the others
+
+static const char* const phase_names[PHASE_COUNT] = { "load", "parse", "emit", "total" };
+
+typedef struct {
+    int repeat;
+    int warmup;
+    ParserEngine engine;
+    const char* label;
+    const char* json;
+} BenchOptions;
+
+typedef struct {
+    double min;
+    double median;
+    double mean;
+    double stddev;
+    double max;
+} Stats;
+
+typedef struct {
+    const char* file;
+    long long bytes;
+    size_t tokens;
+    Stats phases[PHASE_COUNT]; // milliseconds
+} BenchResult;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts the samples.
+static Stats summarize(double* samples, int count) {
+    Stats stats;
+    qsort(samples, count, sizeof(double), compare_doubles);
+    stats.min = samples[0];
+    stats.max = samples[count - 1];
+    stats.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    stats.mean = sum / count;
+    double squares = 0;
+    for (int i = 0; i < count; i++) {
+        squares += (samples[i] - stats.mean) * (samples[i] - stats.mean);
+    }
+    stats.stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+    return stats;
+}
+
+// One load, parse and emit of file; times[] receives the phases in ms.
+static bool run_once(const char* file, const BenchOptions* options, double times[PHASE_COUNT], size_t* tokens) {
+    double start = now_ms();
+    Parser* parser = create_parser(file);
+    double loaded = now_ms();
+    if (!parser) {
+        return false;
+    }
+    parser->engine = options->engine;
+
+    // program() writes the tables when it finishes; detaching the files
+    // leaves that to the emit phase
+    FILE* pro = parser->pro;
+    FILE* var = parser->var;
+    parser->pro = parser->var = NULL;
+    bool ok = program(parser);
+    double parsed = now_ms();
+    parser->pro = pro;
+    parser->var = var;
+    output_to_file(parser);
+    double emitted = now_ms();
+
+    *tokens = input_token_count(parser);
+    destroy_parser(parser);
+    if (!ok) {
+        fprintf(stderr, "Error: %s does not parse; benchmark inputs must be valid programs\n", file);
+        return false;
+    }
+    times[0] = loaded - start;
+    times[1] = parsed - loaded;
+    times[2] = emitted - parsed;
+    times[3] = emitted - start;
+    return true;
+}
+
+static bool bench_file(const char* file, const BenchOptions* options, BenchResult* result) {
+    double* samples = (double*)malloc(sizeof(double) * PHASE_COUNT * options->repeat);
+    if (!samples) {
+        perror("Failed to allocate samples");
+        return false;
+    }
+    double times[PHASE_COUNT];
+    bool ok = true;
+    for (int i = 0; ok && i < options->warmup; i++) {
+        ok = run_once(file, options, times, &result->tokens);
+    }
+    for (int i = 0; ok && i < options->repeat; i++) {
+        ok = run_once(file, options, times, &result->tokens);
+        for (int phase = 0; ok && phase < PHASE_COUNT; phase++) {
+            samples[phase * options->repeat + i] = times[phase];
+        }
+    }
+    if (ok) {
+        struct stat st;
+        result->file = file;
+        result->bytes = stat(file, &st) == 0 ? (long long)st.st_size : -1;
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            result->phases[phase] = summarize(samples + phase * options->repeat, options->repeat);
+        }
+    }
+    free(samples);
+    return ok;
+}
+
+// Throughput figures use the median, which one slow repetition cannot move.
+static double ns_per_token(const BenchResult* result, int phase) {
+    return result->tokens ? result->phases[phase].median * 1e6 / (double)result->tokens : 0;
+}
+
+static double tokens_per_sec(const BenchResult* result, int phase) {
+    double median = result->phases[phase].median;
+    return median > 0 ? (double)result->tokens / (median / 1e3) : 0;
+}
+
+static void print_result(const BenchResult* result) {
+    printf("%s: %zu tokens, %lld bytes\n", result->file, result->tokens, result->bytes);
+    printf("  %-6s %10s %10s %10s %10s %10s %10s %14s\n", "phase", "median ms", "min ms", "mean ms", "stddev ms",
+           "max ms", "ns/token", "tokens/s");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const Stats* s = &result->phases[phase];
+        printf("  %-6s %10.3f %10.3f %10.3f %10.3f %10.3f %10.2f %14.0f\n", phase_names[phase], s->median, s->min,
+               s->mean, s->stddev, s->max, ns_per_token(result, phase), tokens_per_sec(result, phase));
+    }
+}
+
+static void json_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const char* p = text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        }
+        else if ((unsigned char)*p < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned char)*p);
+        }
+        else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static bool write_json(const char* filename, const BenchOptions* options, const BenchResult* results, int count) {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        return false;
+    }
+    fprintf(out, "{\n  \"label\": ");
+    json_string(out, options->label);
+    fprintf(out, ",\n  \"build_type\": ");
+    json_string(out, BENCH_BUILD_TYPE);
+    fprintf(out, ",\n  \"engine\": \"%s\",\n", options->engine == ENGINE_TABLE ? "table" : "recursive");
+    fprintf(out, "  \"repeat\": %d,\n  \"warmup\": %d,\n  \"timestamp\": %lld,\n  \"inputs\": [", options->repeat,
+            options->warmup, (long long)time(NULL));
+    for (int i = 0; i < count; i++) {
+        const BenchResult* result = &results[i];
+        fprintf(out, "%s\n    {\n      \"file\": ", i > 0 ? "," : "");
+        json_string(out, result->file);
+        fprintf(out, ",\n      \"bytes\": %lld,\n      \"tokens\": %zu,\n      \"phases\": {", result->bytes,
+                result->tokens);
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            const Stats* s = &result->phases[phase];
+            fprintf(out,
+                    "%s\n        \"%s\": { \"median_ms\": %.6f, \"min_ms\": %.6f, \"mean_ms\": %.6f, "
+                    "\"stddev_ms\": %.6f, \"max_ms\": %.6f, \"ns_per_token\": %.3f, \"tokens_per_sec\": %.0f }",
+                    phase > 0 ? "," : "", phase_names[phase], s->median, s->min, s->mean, s->stddev, s->max,
+                    ns_per_token(result, phase), tokens_per_sec(result, phase));
+        }
+        fprintf(out, "\n      }\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--repeat N] [--warmup N] [--engine table|recursive] [--label TEXT] [--json output.json] <input_file>...\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options = { 10, 1, ENGINE_RECURSIVE, "", NULL };
+    int i = 1;
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            options.repeat = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            options.warmup = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "table") == 0) {
+                options.engine = ENGINE_TABLE;
+            }
+            else if (strcmp(argv[i], "recursive") == 0) {
+                options.engine = ENGINE_RECURSIVE;
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+            options.label = argv[++i];
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            options.json = argv[++i];
+        }
+        else {
+            break;
+        }
+    }
+    if (i >= argc || options.repeat <= 0 || options.warmup < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int count = argc - i;
+    BenchResult* results = (BenchResult*)calloc(count, sizeof(BenchResult));
+    if (!results) {
+        perror("Failed to allocate results");
+        return 1;
+    }
+    bool ok = true;
+    for (int k = 0; ok && k < count; k++) {
+        ok = bench_file(argv[i + k], &options, &results[k]);
+        if (ok) {
+            print_result(&results[k]);
+        }
+    }
+    if (ok && options.json && !write_json(options.json, &options, results, count)) {
+        fprintf(stderr, "Error writing %s\n", options.json);
+        ok = false;
+    }
+    free(results);
+    return ok ? 0 : 1;
+}
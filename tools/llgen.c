@@ -0,0 +1,760 @@
+// llgen: builds the LL(1) predict table of the table-driven parser from a
+// grammar description (see src/mini.ll for the format) and writes it as a C
+// header.
+//
+//   llgen <grammar.ll> <output.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#define MAX_SYMBOLS 256
+#define MAX_PRODUCTIONS 250 // production numbers are stored in a byte next to 0 and RESOLVE
+#define RESOLVE 0xff // LL_RESOLVE of the generated header
+#define MAX_RHS 32 // well below the 7 bits of LL_SKIP
+#define MAX_TERMINALS 63 // column 0 is the unknown token, terminals take bits 1..63
+
+typedef enum { SYM_TERMINAL, SYM_NONTERMINAL, SYM_ACTION } SymbolKind;
+
+typedef struct {
+    char* name;
+    SymbolKind kind;
+    int index; // column of a terminal, number of a nonterminal or action
+    int line; // first use, for error messages
+    bool defined; // a nonterminal with at least one production
+
+    // actions only
+    bool tree; // listed in %tree, left out of the productions used without a syntax tree
+
+    // nonterminals only
+    bool resolve;
+    int abort_action; // symbol of the %abort action, -1 if none
+    char* error;
+    bool nullable;
+    uint64_t first;
+} Symbol;
+
+typedef struct {
+    int symbol;
+    bool must; // trailing '!'
+} RhsItem;
+
+typedef struct {
+    int lhs;
+    RhsItem rhs[MAX_RHS];
+    int length;
+    bool has_guard;
+    bool guard_star;
+    uint64_t guard;
+    int line;
+} Production;
+
+typedef enum { T_NAME, T_ACTION, T_DIRECTIVE, T_STRING, T_PUNCT, T_END } LexKind;
+
+typedef struct {
+    LexKind kind;
+    char* text;
+    int line;
+} Lexeme;
+
+static Symbol symbols[MAX_SYMBOLS];
+static int symbol_count;
+static Production productions[MAX_PRODUCTIONS];
+static int production_count;
+static int terminal_count; // columns 1..terminal_count
+static int nonterminal_count;
+static int action_count;
+static const char* grammar_path;
+
+static Lexeme* lexemes;
+static size_t lexeme_count;
+static size_t pos;
+
+static void fail(int line, const char* msg, const char* detail) {
+    fprintf(stderr, "%s:%d: %s%s%s\n", grammar_path, line, msg, detail ? " " : "", detail ? detail : "");
+    exit(1);
+}
+
+static char* copy_range(const char* begin, size_t len) {
+    char* s = (char*)malloc(len + 1);
+    if (!s) {
+        perror("llgen");
+        exit(1);
+    }
+    memcpy(s, begin, len);
+    s[len] = '\0';
+    return s;
+}
+
+static void add_lexeme(LexKind kind, char* text, int line) {
+    static size_t capacity;
+    if (lexeme_count == capacity) {
+        capacity = capacity ? capacity * 2 : 256;
+        lexemes = (Lexeme*)realloc(lexemes, capacity * sizeof(Lexeme));
+        if (!lexemes) {
+            perror("llgen");
+            exit(1);
+        }
+    }
+    lexemes[lexeme_count].kind = kind;
+    lexemes[lexeme_count].text = text;
+    lexemes[lexeme_count].line = line;
+    lexeme_count++;
+}
+
+static bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static void lex(const char* text) {
+    int line = 1;
+    const char* p = text;
+    while (*p) {
+        if (*p == '\n') {
+            line++;
+            p++;
+        }
+        else if (isspace((unsigned char)*p)) {
+            p++;
+        }
+        else if (*p == '#') {
+            while (*p && *p != '\n') p++;
+        }
+        else if (*p == '"') {
+            const char* start = ++p;
+            while (*p && *p != '"' && *p != '\n') p++;
+            if (*p != '"') fail(line, "unterminated string", NULL);
+            add_lexeme(T_STRING, copy_range(start, p - start), line);
+            p++;
+        }
+        else if (*p == '@' || *p == '%' || is_name_char(*p)) {
+            LexKind kind = *p == '@' ? T_ACTION : *p == '%' ? T_DIRECTIVE : T_NAME;
+            const char* start = kind == T_NAME ? p : ++p;
+            while (is_name_char(*p)) p++;
+            if (p == start) fail(line, "expected a name", NULL);
+            add_lexeme(kind, copy_range(start, p - start), line);
+        }
+        else if (strchr(":|;[]*!", *p)) {
+            add_lexeme(T_PUNCT, copy_range(p, 1), line);
+            p++;
+        }
+        else {
+            char c[2] = { *p, '\0' };
+            fail(line, "unexpected character", c);
+        }
+    }
+    add_lexeme(T_END, copy_range("", 0), line);
+}
+
+static Lexeme* peek(void) {
+    return &lexemes[pos];
+}
+
+static bool peek_punct(char c) {
+    return lexemes[pos].kind == T_PUNCT && lexemes[pos].text[0] == c;
+}
+
+static void expect_punct(char c) {
+    if (!peek_punct(c)) {
+        char expected[2] = { c, '\0' };
+        fail(peek()->line, "expected", expected);
+    }
+    pos++;
+}
+
+static int find_symbol(const char* name, SymbolKind kind) {
+    for (int i = 0; i < symbol_count; i++) {
+        if (strcmp(symbols[i].name, name) == 0 && (symbols[i].kind == SYM_ACTION) == (kind == SYM_ACTION)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the symbol called name, creating a nonterminal or action on first use.
+static int intern_symbol(const char* name, SymbolKind kind, int line) {
+    int i = find_symbol(name, kind);
+    if (i >= 0) {
+        return i;
+    }
+    if (symbol_count == MAX_SYMBOLS) fail(line, "too many symbols", NULL);
+    Symbol* s = &symbols[symbol_count];
+    memset(s, 0, sizeof(Symbol));
+    s->name = copy_range(name, strlen(name));
+    s->kind = kind;
+    s->line = line;
+    s->abort_action = -1;
+    if (kind == SYM_NONTERMINAL) s->index = nonterminal_count++;
+    if (kind == SYM_ACTION) s->index = action_count++;
+    return symbol_count++;
+}
+
+static int nonterminal(const char* name, int line) {
+    int i = find_symbol(name, SYM_NONTERMINAL);
+    if (i >= 0 && symbols[i].kind == SYM_TERMINAL) fail(line, "expected a nonterminal, found terminal", name);
+    return intern_symbol(name, SYM_NONTERMINAL, line);
+}
+
+static void parse_directive(void) {
+    Lexeme* d = &lexemes[pos++];
+    int line = d->line;
+    if (strcmp(d->text, "token") == 0) {
+        if (nonterminal_count > 0) fail(line, "%token must come before the productions", NULL);
+        while (peek()->kind == T_NAME && peek()->line == line) {
+            if (find_symbol(peek()->text, SYM_TERMINAL) >= 0) fail(line, "duplicate token", peek()->text);
+            if (terminal_count == MAX_TERMINALS) fail(line, "too many tokens", NULL);
+            int i = intern_symbol(peek()->text, SYM_TERMINAL, line);
+            symbols[i].index = ++terminal_count;
+            pos++;
+        }
+    }
+    else if (strcmp(d->text, "tree") == 0 && peek()->kind == T_ACTION) {
+        while (peek()->kind == T_ACTION && peek()->line == line) {
+            symbols[intern_symbol(peek()->text, SYM_ACTION, line)].tree = true;
+            pos++;
+        }
+    }
+    else if (strcmp(d->text, "resolve") == 0 && peek()->kind == T_NAME) {
+        symbols[nonterminal(lexemes[pos++].text, line)].resolve = true;
+    }
+    else if (strcmp(d->text, "abort") == 0 && peek()->kind == T_NAME && lexemes[pos + 1].kind == T_ACTION) {
+        int nt = nonterminal(lexemes[pos].text, line);
+        symbols[nt].abort_action = intern_symbol(lexemes[pos + 1].text, SYM_ACTION, line);
+        pos += 2;
+    }
+    else if (strcmp(d->text, "error") == 0 && peek()->kind == T_NAME && lexemes[pos + 1].kind == T_STRING) {
+        int nt = nonterminal(lexemes[pos].text, line);
+        symbols[nt].error = lexemes[pos + 1].text;
+        pos += 2;
+    }
+    else {
+        fail(line, "malformed directive", d->text);
+    }
+    if (peek()->line == line && peek()->kind != T_END) fail(line, "unexpected text after directive", peek()->text);
+}
+
+// terminal set of a [T U] or [*] guard
+static void parse_guard(Production* prod) {
+    expect_punct('[');
+    prod->has_guard = true;
+    while (!peek_punct(']')) {
+        if (peek_punct('*')) {
+            prod->guard_star = true;
+        }
+        else {
+            int t = peek()->kind == T_NAME ? find_symbol(peek()->text, SYM_TERMINAL) : -1;
+            if (t < 0 || symbols[t].kind != SYM_TERMINAL) fail(peek()->line, "expected a token in lookahead, found", peek()->text);
+            prod->guard |= 1ull << symbols[t].index;
+        }
+        pos++;
+    }
+    pos++;
+}
+
+static void parse_rule(void) {
+    Lexeme* name = &lexemes[pos++];
+    int lhs = nonterminal(name->text, name->line);
+    symbols[lhs].defined = true;
+    expect_punct(':');
+    for (;;) {
+        if (production_count == MAX_PRODUCTIONS) fail(peek()->line, "too many productions", NULL);
+        Production* prod = &productions[production_count++];
+        memset(prod, 0, sizeof(Production));
+        prod->lhs = lhs;
+        prod->line = peek()->line;
+        if (peek_punct('[')) {
+            parse_guard(prod);
+        }
+        while (peek()->kind == T_NAME || peek()->kind == T_ACTION) {
+            Lexeme* l = &lexemes[pos++];
+            if (prod->length == MAX_RHS) fail(l->line, "production too long", NULL);
+            RhsItem* item = &prod->rhs[prod->length++];
+            if (l->kind == T_ACTION) {
+                item->symbol = intern_symbol(l->text, SYM_ACTION, l->line);
+            }
+            else {
+                int t = find_symbol(l->text, SYM_TERMINAL);
+                item->symbol = (t >= 0 && symbols[t].kind == SYM_TERMINAL) ? t : nonterminal(l->text, l->line);
+            }
+            if (peek_punct('!')) {
+                if (symbols[item->symbol].kind == SYM_NONTERMINAL) fail(l->line, "'!' after nonterminal", l->text);
+                item->must = true;
+                pos++;
+            }
+        }
+        if (peek_punct(';')) {
+            pos++;
+            return;
+        }
+        expect_punct('|');
+    }
+}
+
+static void parse_grammar(void) {
+    while (peek()->kind != T_END) {
+        if (peek()->kind == T_DIRECTIVE) {
+            parse_directive();
+        }
+        else if (peek()->kind == T_NAME) {
+            parse_rule();
+        }
+        else {
+            fail(peek()->line, "expected a production or directive, found", peek()->text);
+        }
+    }
+    if (terminal_count == 0) fail(1, "no %token declaration", NULL);
+    if (production_count == 0) fail(1, "no productions", NULL);
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].kind == SYM_NONTERMINAL && !symbols[i].defined) {
+            fail(symbols[i].line, "nonterminal without productions:", symbols[i].name);
+        }
+    }
+
+    // number nonterminals and actions in the order the productions use them,
+    // rather than the order the directives mention them
+    for (int i = 0; i < symbol_count; i++) {
+        symbols[i].index = symbols[i].kind == SYM_TERMINAL ? symbols[i].index : -1;
+    }
+    int next_nonterminal = 0;
+    int next_action = 0;
+    for (int i = 0; i < production_count; i++) {
+        Symbol* lhs = &symbols[productions[i].lhs];
+        if (lhs->index < 0) lhs->index = next_nonterminal++;
+        for (int k = 0; k < productions[i].length; k++) {
+            Symbol* s = &symbols[productions[i].rhs[k].symbol];
+            if (s->kind == SYM_ACTION && s->index < 0) s->index = next_action++;
+        }
+    }
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].kind == SYM_ACTION && symbols[i].index < 0) symbols[i].index = next_action++;
+    }
+}
+
+// Replaces each use of a nonterminal that has a single production without '!'
+// marks (term, arithmetic_expression, ...) with that production, saving the
+// engine an expansion. Abandoning the enclosing production skips the inlined
+// symbols as it would have skipped the nonterminal.
+static const Production* inlinable(int symbol) {
+    const Symbol* s = &symbols[symbol];
+    if (s->kind != SYM_NONTERMINAL || s->resolve || s->abort_action >= 0 || s->error || symbol == productions[0].lhs) {
+        return NULL;
+    }
+    const Production* only = NULL;
+    for (int i = 0; i < production_count; i++) {
+        if (productions[i].lhs != symbol) continue;
+        if (only) return NULL;
+        only = &productions[i];
+    }
+    if (only->has_guard) return NULL;
+    for (int k = 0; k < only->length; k++) {
+        if (only->rhs[k].must || only->rhs[k].symbol == symbol) return NULL;
+    }
+    return only;
+}
+
+static void inline_productions(void) {
+    for (int pass = 0; pass < nonterminal_count; pass++) {
+        bool changed = false;
+        for (int i = 0; i < production_count; i++) {
+            Production* prod = &productions[i];
+            for (int k = 0; k < prod->length; k++) {
+                const Production* inner = inlinable(prod->rhs[k].symbol);
+                if (!inner || inner == prod || prod->length - 1 + inner->length > MAX_RHS) continue;
+                memmove(&prod->rhs[k + inner->length], &prod->rhs[k + 1], (size_t)(prod->length - k - 1) * sizeof(RhsItem));
+                memcpy(&prod->rhs[k], inner->rhs, (size_t)inner->length * sizeof(RhsItem));
+                prod->length += inner->length - 1;
+                changed = true;
+            }
+        }
+        if (!changed) break;
+    }
+}
+
+// FIRST set and nullability of rhs[from..length), actions being transparent.
+static uint64_t first_of(const Production* prod, int from, bool* nullable) {
+    uint64_t first = 0;
+    for (int i = from; i < prod->length; i++) {
+        const Symbol* s = &symbols[prod->rhs[i].symbol];
+        if (s->kind == SYM_ACTION) {
+            continue;
+        }
+        if (s->kind == SYM_TERMINAL) {
+            *nullable = false;
+            return first | 1ull << s->index;
+        }
+        first |= s->first;
+        if (!s->nullable) {
+            *nullable = false;
+            return first;
+        }
+    }
+    *nullable = true;
+    return first;
+}
+
+static void compute_first_sets(void) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < production_count; i++) {
+            Symbol* lhs = &symbols[productions[i].lhs];
+            bool nullable;
+            uint64_t first = first_of(&productions[i], 0, &nullable);
+            if ((lhs->first | first) != lhs->first || (nullable && !lhs->nullable)) {
+                lhs->first |= first;
+                lhs->nullable |= nullable;
+                changed = true;
+            }
+        }
+    }
+}
+
+static const char* column_name(int column) {
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].kind == SYM_TERMINAL && symbols[i].index == column) {
+            return symbols[i].name;
+        }
+    }
+    return "0";
+}
+
+// A column predicting a production that is a single nonterminal predicts
+// that nonterminal's production for the column instead, saving the engine an
+// expansion. Errors and resolvers of the inner nonterminal are left to it.
+static void collapse_unit_productions(uint8_t* predict) {
+    int columns = terminal_count + 1;
+    for (int pass = 0; pass < nonterminal_count; pass++) {
+        bool changed = false;
+        for (int cell = 0; cell < nonterminal_count * columns; cell++) {
+            int entry = predict[cell];
+            if (entry == 0 || entry == RESOLVE) continue;
+            const Production* prod = &productions[entry - 1];
+            const Symbol* inner = &symbols[prod->rhs[0].symbol];
+            if (prod->length != 1 || inner->kind != SYM_NONTERMINAL || symbols[prod->lhs].abort_action >= 0) continue;
+            int target = predict[inner->index * columns + cell % columns];
+            if (target != 0 && target != RESOLVE) {
+                predict[cell] = (uint8_t)target;
+                changed = true;
+            }
+        }
+        if (!changed) break;
+    }
+}
+
+// predict[nonterminal][column] = production + 1, 0 for an error, RESOLVE where
+// the alternatives of a %resolve nonterminal overlap
+static void build_table(uint8_t* predict) {
+    int columns = terminal_count + 1;
+    for (int i = 0; i < production_count; i++) {
+        const Production* prod = &productions[i];
+        const Symbol* lhs = &symbols[prod->lhs];
+        uint8_t* row = &predict[lhs->index * columns];
+        bool nullable;
+        uint64_t set = prod->has_guard ? prod->guard : first_of(prod, 0, &nullable);
+        for (int c = 0; c < columns; c++) {
+            if (!(set >> c & 1)) continue;
+            if (row[c] != 0 && lhs->resolve) {
+                row[c] = RESOLVE;
+                continue;
+            }
+            if (row[c] != 0) {
+                fprintf(stderr, "%s:%d: LL(1) conflict in %s on %s with the production on line %d\n",
+                        grammar_path, prod->line, lhs->name, column_name(c), productions[row[c] - 1].line);
+                exit(1);
+            }
+            row[c] = (uint8_t)(i + 1);
+        }
+    }
+
+    // defaults: [*], the empty-deriving alternative without a guard, or the
+    // only alternative, which then reports a mismatch itself like a function
+    // that does not branch; the resolver of a %resolve nonterminal without an
+    // %error message
+    for (int n = 0; n < symbol_count; n++) {
+        const Symbol* nt = &symbols[n];
+        if (nt->kind != SYM_NONTERMINAL) continue;
+        uint8_t* row = &predict[nt->index * columns];
+        if (nt->resolve) {
+            for (int c = 0; c < columns; c++) {
+                if (row[c] == 0 && !nt->error) row[c] = RESOLVE;
+            }
+            continue;
+        }
+        int fallback = -1;
+        int alternatives = 0;
+        for (int i = 0; i < production_count; i++) {
+            alternatives += productions[i].lhs == n;
+        }
+        for (int i = 0; i < production_count; i++) {
+            const Production* prod = &productions[i];
+            if (prod->lhs != n) continue;
+            bool nullable = false;
+            if (!prod->has_guard) first_of(prod, 0, &nullable);
+            if (prod->guard_star || nullable || alternatives == 1) {
+                if (fallback >= 0) {
+                    fprintf(stderr, "%s:%d: %s has two default alternatives (lines %d and %d)\n",
+                            grammar_path, prod->line, nt->name, productions[fallback].line, prod->line);
+                    exit(1);
+                }
+                fallback = i;
+            }
+        }
+        for (int c = 0; c < columns; c++) {
+            if (row[c] != 0) continue;
+            if (fallback < 0 && !nt->error) {
+                fprintf(stderr, "%s:%d: %s cannot predict every token and needs an %%error message\n",
+                        grammar_path, nt->line, nt->name);
+                exit(1);
+            }
+            if (fallback >= 0) row[c] = (uint8_t)(fallback + 1);
+        }
+    }
+
+    collapse_unit_productions(predict);
+}
+
+// A symbol marked '!' carries how many stack entries to pop when it fails:
+// the rest of its production, plus the frame marker of an %abort nonterminal.
+static void write_symbol(FILE* out, const Production* prod, int k) {
+    const RhsItem* item = &prod->rhs[k];
+    const Symbol* s = &symbols[item->symbol];
+    const char* prefix = s->kind == SYM_NONTERMINAL ? "NT_" : s->kind == SYM_ACTION ? "ACT_" : "";
+    fprintf(out, "%s%s", prefix, s->name);
+    if (item->must) {
+        int skip = prod->length - k - 1 + (symbols[prod->lhs].abort_action >= 0);
+        if (skip > 0) fprintf(out, " | %d << LL_SKIP_SHIFT", skip);
+    }
+    fprintf(out, ", ");
+}
+
+static void write_header(FILE* out, const uint8_t* predict) {
+    int columns = terminal_count + 1;
+    const char* last_token = column_name(terminal_count);
+
+    const char* base = strrchr(grammar_path, '/');
+    fprintf(out, "// Generated by llgen from %s, do not edit.\n", base ? base + 1 : grammar_path);
+    fprintf(out, "#ifndef GRAMMAR_TABLE_H\n#define GRAMMAR_TABLE_H\n\n");
+    fprintf(out, "#include <stdint.h>\n#include <stdbool.h>\n#include <stddef.h>\n#include \"token.h\"\n\n");
+    fprintf(out, "struct Parser;\nstruct LLState;\n\n");
+    fprintf(out, "#define LL_COLUMNS (%s + 1) // column 0 takes token types outside the grammar\n", last_token);
+    fprintf(out, "#define LL_SYMBOL(entry) ((entry) & 0xff)\n");
+    fprintf(out, "#define LL_SKIP_SHIFT 8\n");
+    fprintf(out, "#define LL_SKIP(entry) ((entry) >> LL_SKIP_SHIFT) // entries abandoned if this symbol fails\n");
+    fprintf(out, "#define LL_RESOLVE 0xff // predict entry: ask the nonterminal's resolver\n\n");
+
+    // symbol numbers: tokens, then nonterminals, actions and frame markers
+    fprintf(out, "enum {\n    LL_FIRST_NONTERMINAL = LL_COLUMNS,\n");
+    for (int n = 0; n < nonterminal_count; n++) {
+        for (int i = 0; i < symbol_count; i++) {
+            if (symbols[i].kind == SYM_NONTERMINAL && symbols[i].index == n) {
+                fprintf(out, "    NT_%s%s,\n", symbols[i].name, n == 0 ? " = LL_FIRST_NONTERMINAL" : "");
+            }
+        }
+    }
+    fprintf(out, "    LL_FIRST_ACTION,\n");
+    for (int a = 0; a < action_count; a++) {
+        for (int i = 0; i < symbol_count; i++) {
+            if (symbols[i].kind == SYM_ACTION && symbols[i].index == a) {
+                fprintf(out, "    ACT_%s%s,\n", symbols[i].name, a == 0 ? " = LL_FIRST_ACTION" : "");
+            }
+        }
+    }
+    fprintf(out, "    LL_FRAME, // frame marker, LL_FRAME + action runs that action when abandoned\n};\n\n");
+    fprintf(out, "#define LL_START NT_%s\n", symbols[productions[0].lhs].name);
+    fprintf(out, "#define LL_NONTERMINALS %d\n\n", nonterminal_count);
+
+    // right-hand sides in push order: frame marker first, then the symbols
+    // reversed; once without the %tree actions and once with them
+    fprintf(out, "typedef struct {\n    uint16_t start;\n    uint16_t length;\n} LLProduction;\n\n");
+    fprintf(out, "static const uint16_t ll_rhs[] = {\n");
+    int* starts = (int*)malloc(2 * production_count * sizeof(int));
+    int* lengths = (int*)malloc(2 * production_count * sizeof(int));
+    if (!starts || !lengths) {
+        perror("llgen");
+        exit(1);
+    }
+    int offset = 0;
+    for (int tree = 0; tree < 2; tree++) {
+        for (int i = 0; i < production_count; i++) {
+            Production prod = productions[i];
+            if (!tree) {
+                prod.length = 0;
+                for (int k = 0; k < productions[i].length; k++) {
+                    const RhsItem* item = &productions[i].rhs[k];
+                    if (!(symbols[item->symbol].kind == SYM_ACTION && symbols[item->symbol].tree)) {
+                        prod.rhs[prod.length++] = *item;
+                    }
+                }
+            }
+            int slot = tree * production_count + i;
+            starts[slot] = offset;
+            fprintf(out, "    /* %d%s: %s */ ", i, tree ? " tree" : "", symbols[prod.lhs].name);
+            int abort_action = symbols[prod.lhs].abort_action;
+            if (abort_action >= 0) {
+                fprintf(out, "LL_FRAME + ACT_%s - LL_FIRST_ACTION, ", symbols[abort_action].name);
+                offset++;
+            }
+            for (int k = prod.length - 1; k >= 0; k--) {
+                write_symbol(out, &prod, k);
+                offset++;
+            }
+            lengths[slot] = offset - starts[slot];
+            fprintf(out, "\n");
+        }
+    }
+    fprintf(out, "    0 // keeps the array non-empty\n};\n\n");
+
+    for (int tree = 0; tree < 2; tree++) {
+        fprintf(out, "static const LLProduction %s[] = {\n", tree ? "ll_tree_productions" : "ll_productions");
+        for (int i = 0; i < production_count; i++) {
+            fprintf(out, "    { %d, %d },\n", starts[tree * production_count + i], lengths[tree * production_count + i]);
+        }
+        fprintf(out, "};\n\n");
+    }
+    free(starts);
+    free(lengths);
+
+    // production + 1, 0 for an error, LL_RESOLVE for a resolver
+    fprintf(out, "static const uint8_t ll_predict[LL_NONTERMINALS][LL_COLUMNS] = {\n");
+    for (int n = 0; n < nonterminal_count; n++) {
+        for (int i = 0; i < symbol_count; i++) {
+            const Symbol* nt = &symbols[i];
+            if (nt->kind != SYM_NONTERMINAL || nt->index != n) continue;
+            fprintf(out, "    [NT_%s - LL_FIRST_NONTERMINAL] = {", nt->name);
+            for (int c = 0; c < columns; c++) {
+                if (predict[n * columns + c] == RESOLVE) {
+                    fprintf(out, " [%s] = LL_RESOLVE,", column_name(c));
+                }
+                else if (predict[n * columns + c] != 0) {
+                    fprintf(out, " [%s] = %d,", column_name(c), predict[n * columns + c]);
+                }
+            }
+            fprintf(out, " },\n");
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    // first production of each nonterminal, resolvers return an offset from it
+    fprintf(out, "static const uint8_t ll_first_production[LL_NONTERMINALS] = {\n");
+    for (int n = 0; n < nonterminal_count; n++) {
+        for (int i = 0; i < production_count; i++) {
+            if (symbols[productions[i].lhs].index == n) {
+                fprintf(out, "    [NT_%s - LL_FIRST_NONTERMINAL] = %d,\n", symbols[productions[i].lhs].name, i);
+                break;
+            }
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const char* const ll_errors[LL_NONTERMINALS] = {\n");
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].kind == SYM_NONTERMINAL && symbols[i].error) {
+            fprintf(out, "    [NT_%s - LL_FIRST_NONTERMINAL] = \"%s\",\n", symbols[i].name, symbols[i].error);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    // actions and resolvers are implemented by the engine
+    for (int a = 0; a < action_count; a++) {
+        for (int i = 0; i < symbol_count; i++) {
+            if (symbols[i].kind == SYM_ACTION && symbols[i].index == a) {
+                fprintf(out, "static bool act_%s(struct Parser*, struct LLState*);\n", symbols[i].name);
+            }
+        }
+    }
+    // a switch rather than a table of pointers, so the actions can be inlined
+    fprintf(out, "\n// Runs an action, false if the rest of its production is abandoned.\n");
+    fprintf(out, "static bool ll_action(struct Parser* parser, struct LLState* state, int action) {\n    switch (action) {\n");
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].kind == SYM_ACTION) {
+            fprintf(out, "    case ACT_%s: return act_%s(parser, state);\n", symbols[i].name, symbols[i].name);
+        }
+    }
+    fprintf(out, "    default: return true;\n    }\n}\n\n");
+
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].kind == SYM_NONTERMINAL && symbols[i].resolve) {
+            fprintf(out, "static int resolve_%s(struct Parser*);\n", symbols[i].name);
+        }
+    }
+    fprintf(out, "\n// Alternative of a %%resolve nonterminal, or -1 after reporting an error.\n");
+    fprintf(out, "static int ll_resolve(struct Parser* parser, int nonterminal) {\n    switch (nonterminal) {\n");
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].kind == SYM_NONTERMINAL && symbols[i].resolve) {
+            fprintf(out, "    case NT_%s: return resolve_%s(parser);\n", symbols[i].name, symbols[i].name);
+        }
+    }
+    fprintf(out, "    default: return -1;\n    }\n}\n\n#endif\n");
+}
+
+static char* read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = (char*)malloc((size_t)size + 1);
+    if (!text || fread(text, 1, (size_t)size, file) != (size_t)size) {
+        perror(path);
+        exit(1);
+    }
+    text[size] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Frees the lexemes and symbol names; %error texts are lexemes.
+static void free_grammar(void) {
+    for (size_t i = 0; i < lexeme_count; i++) {
+        free(lexemes[i].text);
+    }
+    free(lexemes);
+    for (int i = 0; i < symbol_count; i++) {
+        free(symbols[i].name);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <grammar.ll> <output.h>\n", argv[0]);
+        return 1;
+    }
+    grammar_path = argv[1];
+    char* text = read_file(grammar_path);
+    lex(text);
+    free(text);
+    parse_grammar();
+    inline_productions();
+    compute_first_sets();
+    // symbols and frame markers must fit the low byte of a stack entry
+    if (terminal_count + 1 + nonterminal_count + 2 * action_count > 255) {
+        fail(1, "too many symbols for one-byte stack entries", NULL);
+    }
+
+    uint8_t* predict = (uint8_t*)calloc((size_t)nonterminal_count * (terminal_count + 1), 1);
+    if (!predict) {
+        perror("llgen");
+        free_grammar();
+        return 1;
+    }
+    build_table(predict);
+
+    // freed before exiting so sanitizer builds of the tree run it cleanly
+    bool ok = false;
+    FILE* out = fopen(argv[2], "w");
+    if (out) {
+        write_header(out, predict);
+        ok = fclose(out) == 0;
+    }
+    if (!ok) {
+        perror(argv[2]);
+    }
+    free(predict);
+    free_grammar();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,275 @@
+// miniquery: sends one query to a "miniparser --daemon" and prints the answer
+// with the fields in the order of the .var, .pro and .err files.
+//
+//   miniquery [--repeat N] SOCKET files
+//   miniquery [--repeat N] SOCKET variable FILE NAME PROC
+//   miniquery [--repeat N] SOCKET variables FILE PROC
+//   miniquery [--repeat N] SOCKET procedures FILE
+//   miniquery [--repeat N] SOCKET diagnostics FILE
+//
+// FILE is a position in the daemon's file list, as "files" numbers them. With
+// --repeat the query is sent N times over one connection and the mean round
+// trip is reported on stderr.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+// The answer being printed, read front to back.
+typedef struct {
+    const unsigned char* p;
+    size_t left;
+} Reply;
+
+static void append(Buffer* b, const void* bytes, size_t length) {
+    if (b->length + length > b->capacity) {
+        b->capacity = (b->length + length) * 2;
+        b->data = (unsigned char*)realloc(b->data, b->capacity);
+        if (!b->data) {
+            perror("Failed to allocate buffer");
+            exit(1);
+        }
+    }
+    memcpy(b->data + b->length, bytes, length);
+    b->length += length;
+}
+
+static void append_u32(Buffer* b, uint32_t v) {
+    unsigned char bytes[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+    append(b, bytes, sizeof(bytes));
+}
+
+static void append_str(Buffer* b, const char* s) {
+    size_t length = strlen(s);
+    unsigned char bytes[2] = { (unsigned char)length, (unsigned char)(length >> 8) };
+    append(b, bytes, sizeof(bytes));
+    append(b, s, length);
+}
+
+static uint32_t take_u32(Reply* r) {
+    if (r->left < 4) {
+        fprintf(stderr, "Error: truncated answer\n");
+        exit(1);
+    }
+    uint32_t v = (uint32_t)r->p[0] | (uint32_t)r->p[1] << 8 | (uint32_t)r->p[2] << 16 | (uint32_t)r->p[3] << 24;
+    r->p += 4;
+    r->left -= 4;
+    return v;
+}
+
+static int take_i32(Reply* r) {
+    return (int)take_u32(r);
+}
+
+static unsigned take_u8(Reply* r) {
+    if (r->left < 1) {
+        fprintf(stderr, "Error: truncated answer\n");
+        exit(1);
+    }
+    r->left--;
+    return *r->p++;
+}
+
+// Returns the string's bytes and sets *length; they are not NUL-terminated.
+static const char* take_str(Reply* r, int* length) {
+    if (r->left < 2 || r->left - 2 < (size_t)(r->p[0] | r->p[1] << 8)) {
+        fprintf(stderr, "Error: truncated answer\n");
+        exit(1);
+    }
+    *length = r->p[0] | r->p[1] << 8;
+    const char* s = (const char*)r->p + 2;
+    r->p += 2 + *length;
+    r->left -= 2 + (size_t)*length;
+    return s;
+}
+
+static bool read_all(int fd, unsigned char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, data, length);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Sends the request frame and reads the answer frame into reply.
+static bool round_trip(int fd, const Buffer* request, Buffer* reply) {
+    if (write(fd, request->data, request->length) != (ssize_t)request->length) {
+        return false;
+    }
+    unsigned char header[4];
+    if (!read_all(fd, header, sizeof(header))) {
+        return false;
+    }
+    size_t length = (size_t)header[0] | (size_t)header[1] << 8 | (size_t)header[2] << 16 | (size_t)header[3] << 24;
+    if (length > reply->capacity) {
+        unsigned char* data = (unsigned char*)realloc(reply->data, length);
+        if (!data) {
+            return false;
+        }
+        reply->data = data;
+        reply->capacity = length;
+    }
+    reply->length = length;
+    return read_all(fd, reply->data, length);
+}
+
+static void print_variable(Reply* r, const char* name, int name_length, const char* proc) {
+    int vkind = take_i32(r);
+    int vtype = take_i32(r);
+    int vlev = take_i32(r);
+    int vaddr = take_i32(r);
+    printf("%.*s %s %d %s %d %d\n", name_length, name, proc, vkind, var_type_to_string((VarType)vtype), vlev, vaddr);
+}
+
+static void print_answer(const char* query, char** args, Reply* r) {
+    int length;
+    if (strcmp(query, "files") == 0) {
+        for (uint32_t i = 0, count = take_u32(r); i < count; i++) {
+            const char* path = take_str(r, &length);
+            unsigned result = take_u8(r);
+            uint32_t generation = take_u32(r);
+            printf("%u %.*s %s %u\n", i, length, path, result ? "successful" : "failed", generation);
+        }
+    }
+    else if (strcmp(query, "variable") == 0) {
+        print_variable(r, args[1], (int)strlen(args[1]), args[2]);
+    }
+    else if (strcmp(query, "variables") == 0) {
+        for (uint32_t i = 0, count = take_u32(r); i < count; i++) {
+            const char* name = take_str(r, &length);
+            print_variable(r, name, length, args[1]);
+        }
+    }
+    else if (strcmp(query, "procedures") == 0) {
+        for (uint32_t i = 0, count = take_u32(r); i < count; i++) {
+            const char* name = take_str(r, &length);
+            int ptype = take_i32(r);
+            int plev = take_i32(r);
+            int faddr = take_i32(r);
+            int laddr = take_i32(r);
+            int first = take_i32(r);
+            int last = take_i32(r);
+            printf("%.*s %s %d %d %d lines %d-%d\n", length, name, var_type_to_string((VarType)ptype), plev, faddr,
+                   laddr, first, last);
+        }
+    }
+    else {
+        unsigned result = take_u8(r);
+        for (uint32_t i = 0, count = take_u32(r); i < count; i++) {
+            int line = take_i32(r);
+            const char* message = take_str(r, &length);
+            printf("LINE:%d %.*s\n", line, length, message);
+        }
+        printf("Parsing %s\n", result ? "successful" : "failed");
+    }
+}
+
+// Builds the request for query and its arguments; false if they do not match.
+static bool build_request(const char* query, char** args, int count, Buffer* request) {
+    static const struct {
+        const char* name;
+        DaemonOpcode opcode;
+        int args; // after the query, the file included
+    } queries[] = {
+        { "files", DAEMON_FILES, 0 },
+        { "variable", DAEMON_VARIABLE, 3 },
+        { "variables", DAEMON_VARIABLES, 2 },
+        { "procedures", DAEMON_PROCEDURES, 1 },
+        { "diagnostics", DAEMON_DIAGNOSTICS, 1 },
+    };
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+        if (strcmp(query, queries[i].name) != 0) {
+            continue;
+        }
+        if (count != queries[i].args) {
+            return false;
+        }
+        append_u32(request, 0); // the length, filled in below
+        unsigned char opcode = (unsigned char)queries[i].opcode;
+        append(request, &opcode, 1);
+        if (count > 0) {
+            append_u32(request, (uint32_t)strtoul(args[0], NULL, 10));
+        }
+        for (int arg = 1; arg < count; arg++) {
+            append_str(request, args[arg]);
+        }
+        uint32_t length = (uint32_t)(request->length - 4);
+        unsigned char bytes[4] = { (unsigned char)length, (unsigned char)(length >> 8), (unsigned char)(length >> 16), (unsigned char)(length >> 24) };
+        memcpy(request->data, bytes, sizeof(bytes));
+        return true;
+    }
+    return false;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+    long repeat = 1;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "--repeat") == 0) {
+        repeat = strtol(argv[i + 1], NULL, 10);
+        i += 2;
+    }
+    Buffer request = { NULL, 0, 0 };
+    if (repeat <= 0 || argc - i < 2 || !build_request(argv[i + 1], argv + i + 2, argc - i - 2, &request)) {
+        fprintf(stderr, "Usage: %s [--repeat N] SOCKET files | variable FILE NAME PROC | variables FILE PROC | procedures FILE | diagnostics FILE\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[i]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error connecting to %s\n", argv[i]);
+        return 1;
+    }
+
+    Buffer reply = { NULL, 0, 0 };
+    double start = now();
+    for (long n = 0; n < repeat; n++) {
+        if (!round_trip(fd, &request, &reply)) {
+            fprintf(stderr, "Error: the daemon closed the connection\n");
+            return 1;
+        }
+    }
+    double elapsed = now() - start;
+    close(fd);
+    if (repeat > 1) {
+        fprintf(stderr, "%ld queries, %.2f us each\n", repeat, elapsed * 1e6 / (double)repeat);
+    }
+
+    Reply r = { reply.data, reply.length };
+    unsigned status = take_u8(&r);
+    int status_code = 0;
+    if (status == DAEMON_OK) {
+        print_answer(argv[i + 1], argv + i + 2, &r);
+    }
+    else {
+        fprintf(stderr, "%s\n", status == DAEMON_NOT_FOUND ? "Not found" : "Bad request");
+        status_code = status == DAEMON_NOT_FOUND ? 2 : 1;
+    }
+    free(request.data);
+    free(reply.data);
+    return status_code;
+}
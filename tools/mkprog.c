@@ -0,0 +1,291 @@
+// mkprog: writes a random but valid .mini program of a chosen shape, as input
+// for benchmarks. The same options and seed always give the same program;
+// "miniparser --convert" turns it into .dyd or .dydb.
+//
+//   mkprog [--functions N] [--vars N] [--statements N] [--expr N] [--depth N]
+//          [--nest N] [--seed N] [-o output.mini]
+//
+// With --nest, each function declares a chain of N functions nested in one
+// another, whose bodies use the variables of every enclosing function and
+// call the function nested in them, so static links get exercised.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_NEST 16
+
+typedef struct {
+    long functions; // top-level functions
+    long vars; // locals of each function, and globals of main
+    long statements; // per body, not counting the ones nested in ifs
+    long expr; // operands of an expression at the outermost level
+    long depth; // deepest nesting of ifs, and of parentheses in expressions
+    long nest; // functions nested in each top-level function, one in another
+} Shape;
+
+typedef struct {
+    FILE* out;
+    const Shape* shape;
+    uint64_t state;
+    long function; // being written, 0 in main
+    long scopes[MAX_NEST]; // nested functions being written, innermost last
+    long scope_count;
+    long nested; // nested functions written so far, which numbers them
+    long child; // nested function declared in the body being written, or 0
+} Generator;
+
+// xorshift64*, so that programs do not depend on the C library's rand()
+static uint64_t next_random(Generator* g) {
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+    return g->state * 0x2545F4914F6CDD1Dull;
+}
+
+static long pick(Generator* g, long n) {
+    return n > 0 ? (long)(next_random(g) % (uint64_t)n) : 0;
+}
+
+static void indent(Generator* g, long level) {
+    fprintf(g->out, "%*s", (int)(4 * level), "");
+}
+
+// A variable visible in the current body: a global, or the parameter or a
+// local of the function being written, or of the nested functions around it.
+static void variable(Generator* g) {
+    long k = g->function;
+    if (g->scope_count > 0) {
+        long choice = pick(g, 2 * g->shape->vars + 1 + 2 * g->scope_count);
+        if (choice < g->shape->vars) {
+            fprintf(g->out, "g%ld", choice);
+        }
+        else if (choice < 2 * g->shape->vars) {
+            fprintf(g->out, "v%ld_%ld", k, choice - g->shape->vars);
+        }
+        else if (choice == 2 * g->shape->vars) {
+            fprintf(g->out, "p%ld", k);
+        }
+        else {
+            choice -= 2 * g->shape->vars + 1;
+            fprintf(g->out, "%c%ld", choice % 2 ? 'w' : 'q', g->scopes[choice / 2]);
+        }
+        return;
+    }
+    long choice = pick(g, k > 0 ? 2 * g->shape->vars + 1 : g->shape->vars);
+    if (k == 0 || choice < g->shape->vars) {
+        fprintf(g->out, "g%ld", choice);
+    }
+    else if (choice == 2 * g->shape->vars) {
+        fprintf(g->out, "p%ld", k);
+    }
+    else {
+        fprintf(g->out, "v%ld_%ld", k, choice - g->shape->vars);
+    }
+}
+
+static void expression(Generator* g, long operands, long depth);
+
+static void operand(Generator* g, long depth) {
+    long r = pick(g, 10);
+    // functions only call the ones declared before them, so nothing recurses
+    long callable = g->function > 0 ? g->function - 1 : g->shape->functions;
+    if (r < 4) {
+        variable(g);
+    }
+    else if (r < 8 || (r == 8 && (depth == 0 || callable == 0))) {
+        fprintf(g->out, "%ld", pick(g, 100));
+    }
+    else if (r == 8 && g->child && pick(g, 2) == 0) {
+        fprintf(g->out, "N%ld(", g->child);
+        expression(g, 1 + pick(g, 2), depth - 1);
+        fprintf(g->out, ")");
+    }
+    else if (r == 8) {
+        fprintf(g->out, "F%ld(", 1 + pick(g, callable));
+        expression(g, 1 + pick(g, 2), depth - 1);
+        fprintf(g->out, ")");
+    }
+    else if (depth > 0) {
+        fprintf(g->out, "(");
+        expression(g, 2 + pick(g, 3), depth - 1);
+        fprintf(g->out, ")");
+    }
+    else {
+        fprintf(g->out, "%ld", pick(g, 100));
+    }
+}
+
+static void expression(Generator* g, long operands, long depth) {
+    for (long i = 0; i < operands; i++) {
+        if (i > 0) {
+            fprintf(g->out, pick(g, 3) == 0 ? " * " : " - ");
+        }
+        operand(g, depth);
+    }
+}
+
+static void condition(Generator* g) {
+    static const char* const relations[] = { "=", "<>", "<", ">", ">=", "<=" };
+    expression(g, 1 + pick(g, g->shape->expr), g->shape->depth);
+    fprintf(g->out, " %s ", relations[pick(g, 6)]);
+    expression(g, 1 + pick(g, g->shape->expr), g->shape->depth);
+}
+
+static void statements(Generator* g, long count, long level, long depth);
+
+static void branch(Generator* g, long level, long depth) {
+    indent(g, level);
+    fprintf(g->out, "begin\n");
+    statements(g, 1 + pick(g, 2), level + 1, depth - 1);
+    indent(g, level);
+    fprintf(g->out, "end\n");
+}
+
+static void statement(Generator* g, long level, long depth) {
+    long r = pick(g, 10);
+    if (r < 2 && depth > 0) {
+        indent(g, level);
+        fprintf(g->out, "if ");
+        condition(g);
+        fprintf(g->out, " then\n");
+        branch(g, level, depth);
+        indent(g, level);
+        fprintf(g->out, "else\n");
+        branch(g, level, depth);
+        return;
+    }
+    indent(g, level);
+    if (r < 4) {
+        fprintf(g->out, r < 3 ? "read(" : "write(");
+        variable(g);
+        fprintf(g->out, ");\n");
+        return;
+    }
+    variable(g);
+    fprintf(g->out, " := ");
+    expression(g, 1 + pick(g, g->shape->expr), g->shape->depth);
+    fprintf(g->out, ";\n");
+}
+
+static void statements(Generator* g, long count, long level, long depth) {
+    for (long i = 0; i < count; i++) {
+        statement(g, level, depth);
+    }
+}
+
+// Writes a function nested in the body at level, and the ones nested in it
+// down to shape.nest levels; returns its number.
+static long nested_function(Generator* g, long level) {
+    long id = ++g->nested;
+    g->scopes[g->scope_count++] = id;
+    indent(g, level);
+    fprintf(g->out, "integer function N%ld(q%ld);\n", id, id);
+    indent(g, level + 1);
+    fprintf(g->out, "begin\n");
+    indent(g, level + 2);
+    fprintf(g->out, "integer q%ld;\n", id);
+    indent(g, level + 2);
+    fprintf(g->out, "integer w%ld;\n", id);
+    g->child = g->scope_count < g->shape->nest ? nested_function(g, level + 2) : 0;
+    statements(g, 1 + pick(g, g->shape->statements), level + 2, g->shape->depth);
+    indent(g, level + 2);
+    fprintf(g->out, "N%ld := ", id);
+    expression(g, 1 + pick(g, g->shape->expr), g->shape->depth);
+    fprintf(g->out, ";\n");
+    indent(g, level + 1);
+    fprintf(g->out, "end\n");
+    g->scope_count--;
+    return id;
+}
+
+static void function(Generator* g, long k) {
+    g->function = k;
+    fprintf(g->out, "    integer function F%ld(p%ld);\n", k, k);
+    fprintf(g->out, "        begin\n");
+    fprintf(g->out, "            integer p%ld;\n", k);
+    for (long i = 0; i < g->shape->vars; i++) {
+        fprintf(g->out, "            integer v%ld_%ld;\n", k, i);
+    }
+    g->child = g->shape->nest > 0 ? nested_function(g, 3) : 0;
+    statements(g, g->shape->statements, 3, g->shape->depth);
+    fprintf(g->out, "            if p%ld <= 0 then F%ld := ", k, k);
+    expression(g, 1 + pick(g, g->shape->expr), g->shape->depth);
+    fprintf(g->out, ";\n            else F%ld := ", k);
+    expression(g, 1 + pick(g, g->shape->expr), g->shape->depth);
+    fprintf(g->out, ";\n        end\n");
+    g->child = 0;
+}
+
+static void generate(Generator* g) {
+    fprintf(g->out, "begin\n");
+    for (long i = 0; i < g->shape->vars; i++) {
+        fprintf(g->out, "    integer g%ld;\n", i);
+    }
+    for (long k = 1; k <= g->shape->functions; k++) {
+        function(g, k);
+    }
+    g->function = 0;
+    statements(g, g->shape->statements, 1, g->shape->depth);
+    fprintf(g->out, "end\n");
+}
+
+static bool read_count(const char* text, long* value) {
+    char* end;
+    *value = strtol(text, &end, 10);
+    return *end == '\0' && *value >= 0;
+}
+
+int main(int argc, char* argv[]) {
+    Shape shape = { 100, 4, 8, 6, 2, 0 };
+    long seed = 1;
+    const char* output = NULL;
+    for (int i = 1; i < argc; i++) {
+        long* value = NULL;
+        if (strcmp(argv[i], "--functions") == 0) value = &shape.functions;
+        else if (strcmp(argv[i], "--vars") == 0) value = &shape.vars;
+        else if (strcmp(argv[i], "--statements") == 0) value = &shape.statements;
+        else if (strcmp(argv[i], "--expr") == 0) value = &shape.expr;
+        else if (strcmp(argv[i], "--depth") == 0) value = &shape.depth;
+        else if (strcmp(argv[i], "--nest") == 0) value = &shape.nest;
+        else if (strcmp(argv[i], "--seed") == 0) value = &seed;
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+            continue;
+        }
+        if (!value || i + 1 >= argc || !read_count(argv[++i], value)) {
+            fprintf(stderr, "Usage: %s [--functions N] [--vars N] [--statements N] [--expr N] [--depth N] [--nest N] [--seed N] [-o output.mini]\n", argv[0]);
+            return 1;
+        }
+    }
+    // every body needs a variable to assign and an expression to assign it
+    if (shape.vars == 0) {
+        shape.vars = 1;
+    }
+    if (shape.expr == 0) {
+        shape.expr = 1;
+    }
+    if (shape.nest > MAX_NEST) {
+        shape.nest = MAX_NEST;
+    }
+
+    Generator g;
+    g.out = output ? fopen(output, "w") : stdout;
+    g.shape = &shape;
+    g.state = 0x9E3779B97F4A7C15ull ^ (uint64_t)seed;
+    g.function = 0;
+    g.scope_count = 0;
+    g.nested = 0;
+    g.child = 0;
+    if (!g.out) {
+        fprintf(stderr, "Error opening %s\n", output);
+        return 1;
+    }
+    generate(&g);
+    if (output && fclose(g.out) != 0) {
+        fprintf(stderr, "Error writing %s\n", output);
+        return 1;
+    }
+    return 0;
+}